@@ -4,14 +4,20 @@
 #include "config.h"
 
 #include <algorithm>
+#include <array>
 #include <assert.h>
 #include <cfloat>
+#include <cstddef>
+#include <deque>
+#include <dirent.h>
+#include <errno.h>
 #include <error.h>
 #include <fcntl.h>
 #if HAVE_GVC == 1
 #include <gvc.h>
 #endif
 #include <jansson.h>
+#include <link.h>
 #include <map>
 #include <math.h>
 #include <optional>
@@ -32,6 +38,8 @@
 
 std::string resolver = "/usr/bin/eu-addr2line";
 std::string core_file, exe_file;
+// where copies of the traced binaries (and/or a .build-id tree) are
+std::string symbol_dir;
 
 typedef enum { UG_HTML, UG_TEXT, UG_SQL } ug_output_t;
 
@@ -88,36 +96,87 @@ std::string lock_action_to_name(const lock_action_t la)
 		return "rw_init";
 	else if (la == a_rw_destroy)
 		return "rw_destroy";
+	else if (la == a_cond_wait)
+		return "cond_wait";
+	else if (la == a_cond_woken)
+		return "cond_woken";
+	else if (la == a_cond_signal)
+		return "cond_signal";
+	else if (la == a_cond_broadcast)
+		return "cond_broadcast";
+	else if (la == a_spin_lock)
+		return "spin_lock";
+	else if (la == a_spin_unlock)
+		return "spin_unlock";
+	else if (la == a_sem_wait)
+		return "sem_wait";
+	else if (la == a_sem_post)
+		return "sem_post";
+	else if (la == a_barrier_wait)
+		return "barrier_wait";
+	else if (la == a_timed_lock)
+		return "timed_lock";
+	else if (la == a_timed_r_lock)
+		return "timed_r_lock";
+	else if (la == a_timed_w_lock)
+		return "timed_w_lock";
 
 	return "internal error";
 }
 
-const lock_trace_item_t *load_data(const std::string & filename)
+// mutexes and spinlocks; a condition variable wait unlocks the mutex
+// and locks it again
+bool is_exclusive_lock(const lock_action_t la)
 {
-	int fd = open(filename.c_str(), O_RDONLY);
-	if (fd == -1) {
-		fprintf(stderr, "Failed opening %s: %s\n", filename.c_str(), strerror(errno));
-		return nullptr;
-	}
+	return la == a_lock || la == a_cond_woken || la == a_spin_lock || la == a_timed_lock;
+}
 
-	struct stat st;
-	fstat(fd, &st);
+bool is_exclusive_unlock(const lock_action_t la)
+{
+	return la == a_unlock || la == a_cond_wait || la == a_spin_unlock;
+}
 
-	lock_trace_item_t *data = (lock_trace_item_t *)mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
-	if (data == MAP_FAILED) {
-		fprintf(stderr, "mmap failed: %s\n", strerror(errno));
-		return nullptr;
-	}
+bool is_read_lock(const lock_action_t la)
+{
+	return la == a_r_lock || la == a_timed_r_lock;
+}
 
-	if (posix_madvise(data, st.st_size, POSIX_MADV_SEQUENTIAL) == -1)
-		perror("posix_madvise");
+bool is_write_lock(const lock_action_t la)
+{
+	return la == a_w_lock || la == a_timed_w_lock;
+}
 
-	close(fd);
+bool is_timed_lock(const lock_action_t la)
+{
+	return la == a_timed_lock || la == a_timed_r_lock || la == a_timed_w_lock;
+}
 
-	return data;
+const char *exclusive_lock_kind(const lock_action_t la)
+{
+	return la == a_spin_lock || la == a_spin_unlock ? "spinlock" : "mutex";
+}
+
+const void *get_cond(const lock_trace_item_t & item)
+{
+	return (const void *)uintptr_t(uint64_t(item.cond_innards.cond_hi) << 32 | item.cond_innards.cond_lo);
+}
+
+int64_t get_timeout(const lock_trace_item_t & item)
+{
+	return int64_t(uint64_t(item.timed_innards.timeout_hi) << 32 | item.timed_innards.timeout_lo);
+}
+
+std::string get_json_string(const json_t *const js, const char *const key)
+{
+	return json_string_value(json_object_get(js, key));
+}
+
+int64_t get_json_int(const json_t *const js, const char *const key)
+{
+	return json_integer_value(json_object_get(js, key));
 }
 
-const lock_usage_groups_t *load_ug_data(const std::string & filename)
+const void *map_file(const std::string & filename, size_t *const size = nullptr)
 {
 	int fd = open(filename.c_str(), O_RDONLY);
 	if (fd == -1) {
@@ -128,9 +187,11 @@ const lock_usage_groups_t *load_ug_data(const std::string & filename)
 	struct stat st;
 	fstat(fd, &st);
 
-	lock_usage_groups_t *data = (lock_usage_groups_t *)mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	// private & writable: timestamps may get converted in place
+	void *data = mmap(nullptr, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
 	if (data == MAP_FAILED) {
 		fprintf(stderr, "mmap failed: %s\n", strerror(errno));
+		close(fd);
 		return nullptr;
 	}
 
@@ -139,661 +200,916 @@ const lock_usage_groups_t *load_ug_data(const std::string & filename)
 
 	close(fd);
 
+	if (size)
+		*size = st.st_size;
+
 	return data;
 }
 
-typedef uint64_t hash_t;
+// Record layout as written by the tracer in dump.dat ("layout"). The
+// build variants of the tracer (see config.h.in) leave out fields, their
+// records are converted field by field to the layout of the analyzer.
+typedef struct {
+	size_t record_size;
+	std::map<std::string, std::pair<size_t, size_t> > fields;  // offset, size
+} record_layout_t;
 
-uint64_t MurmurHash64A(const void *const key, const int len, const uint64_t seed)
+template<typename Type, size_t N>
+record_layout_t native_layout(const trace_field_t (&fields)[N])
 {
-	const uint64_t m = 0xc6a4a7935bd1e995LLU;
-	const int r = 47;
+	record_layout_t layout { sizeof(Type), { } };
 
-	uint64_t h = seed ^ (len * m);
+	for(auto & field : fields)
+		layout.fields.insert({ field.name, { field.offset, field.size } });
 
-	const uint64_t *data = (const uint64_t *)key;
-	const uint64_t *end = (len >> 3) + data;
+	return layout;
+}
 
-	while(data != end) {
-		uint64_t k = *data++;
+// dumps of tracers that did not write a layout have the native one
+record_layout_t get_layout(const json_t *const meta, const char *const key, const record_layout_t & native)
+{
+	const json_t *js = json_object_get(meta, key);
+	if (!js)
+		return native;
 
-		k *= m;
-		k ^= k >> r;
-		k *= m;
+	record_layout_t layout { size_t(get_json_int(js, "record_size")), { } };
 
-		h ^= k;
-		h *= m;
-	}
+	const char *name = nullptr;
+	json_t *field = nullptr;
+	json_object_foreach(json_object_get(js, "fields"), name, field)
+		layout.fields.insert({ name, { json_integer_value(json_array_get(field, 0)), json_integer_value(json_array_get(field, 1)) } });
 
-	const uint8_t *data2 = (const uint8_t *)data;
+	return layout;
+}
 
-	switch(len & 7) {
-		case 7: h ^= (uint64_t)(data2[6]) << 48;
-		case 6: h ^= (uint64_t)(data2[5]) << 40;
-		case 5: h ^= (uint64_t)(data2[4]) << 32;
-		case 4: h ^= (uint64_t)(data2[3]) << 24;
-		case 3: h ^= (uint64_t)(data2[2]) << 16;
-		case 2: h ^= (uint64_t)(data2[1]) << 8;
-		case 1: h ^= (uint64_t)(data2[0]);
-			h *= m;
-	};
+bool operator==(const record_layout_t & a, const record_layout_t & b)
+{
+	return a.record_size == b.record_size && a.fields == b.fields;
+}
 
-	h ^= h >> r;
-	h *= m;
-	h ^= h >> r;
+// fields that are not in the file are left 0
+// NON_TEMPORAL_STORES: the records are aligned to 64 bytes, more than
+// what malloc() guarantees
+template<typename Type>
+Type *allocate_records(const uint64_t n)
+{
+	const size_t size = std::max(uint64_t(1), n) * sizeof(Type);
 
-	return h;
+	Type *out = (Type *)aligned_alloc(std::max(alignof(Type), alignof(std::max_align_t)), size);
+	if (out)
+		memset((void *)out, 0x00, size);
+
+	return out;
 }
 
-hash_t calculate_backtrace_hash(const void *const *const pointers, const size_t n_pointers)
+template<typename Type>
+Type *decode_records(const void *const data, const uint64_t n, const record_layout_t & from, const record_layout_t & to)
 {
-	// hash the contents of the pointer-array instead of where they point to
-	return MurmurHash64A((const void *const)pointers, n_pointers * sizeof(void *), 0);
-}
+	Type *out = allocate_records<Type>(n);
+	if (!out) {
+		fprintf(stderr, "Cannot allocate memory for %lu records\n", n);
+		return nullptr;
+	}
 
-// lae_already_locked: already locked by this tid
-// lae_not_locked: unlock without lock
-// lae_not_owner: other thread unlocks mutex
-typedef enum { lae_already_locked = 0, lae_not_locked, lae_not_owner } lock_action_error_t;
-constexpr const char *const lock_action_error_str[] = { "already locked", "not locked", "not owner (or not waiting for (r/w-lock))" };
+	for(auto & field : to.fields) {
+		auto it = from.fields.find(field.first);
+		if (it == from.fields.end())
+			continue;
 
-typedef struct {
-	std::vector<size_t> latest_records;
-	size_t first_record;
-} double_un_lock_t;
+		const size_t size = std::min(field.second.second, it->second.second);
+
+		for(uint64_t i=0; i<n; i++)
+			memcpy((uint8_t *)&out[i] + field.second.first, (const uint8_t *)data + i * from.record_size + it->second.first, size);
+	}
+
+	return out;
+}
 
+// a range of records: start & count
 template<typename Type>
-void put_lock_error(std::map<std::pair<const Type *, lock_action_error_t>, std::map<hash_t, double_un_lock_t> > *const target, const Type *const lock, const lock_action_error_t error_type, const hash_t calltrace_hash, const size_t record_nr)
+using span_t = std::pair<const Type *, uint64_t>;
+
+// When the tracer ran with per-thread segments, the records of each thread
+// are in their own segments. These are then merged (on timestamp) into one
+// array so that the rest of the analyzer sees one ordered stream.
+template<typename Type>
+Type *merge_spans(const std::vector<span_t<Type> > & spans)
 {
-	std::pair<const Type *, lock_action_error_t> key { lock, error_type };
-	auto it = target->find(key);
+	std::vector<const Type *> order;
 
-	if (it == target->end()) {
-		// this kind of error we've not seen earlier with this lock
-		std::map<hash_t, double_un_lock_t> entry;
+	for(auto & span : spans) {
+		for(uint64_t nr=0; nr<span.second; nr++)
+			order.push_back(&span.first[nr]);
+	}
 
-		double_un_lock_t data;
-		data.first_record = record_nr;
-		entry.insert({ calltrace_hash, data });
+#ifdef MEASURE_TIMING
+	// segments are in the order in which they were claimed and the
+	// records in a segment are already in order, stable_sort keeps
+	// that for records with the same timestamp
+	std::stable_sort(order.begin(), order.end(), [](const Type *const a, const Type *const b) { return a->timestamp < b->timestamp; });
+#endif
 
-		target->insert({ key, entry });
+	Type *out = allocate_records<Type>(order.size());
+	if (!out) {
+		fprintf(stderr, "Cannot allocate memory for %zu records\n", order.size());
+		return nullptr;
 	}
-	else {
-		// this error occured earlier with this lock
-		auto hash_map_it = it->second.find(calltrace_hash);
 
-		if (hash_map_it == it->second.end()) {
-			double_un_lock_t data;
-			data.first_record = record_nr;
+	for(size_t i=0; i<order.size(); i++)
+		out[i] = *order[i];
 
-			it->second.insert({ calltrace_hash, data });
-		}
-		else {
-			hash_map_it->second.latest_records.push_back(record_nr);
-		}
-	}
+	return out;
 }
 
-// this may give false positives if for example an other mutex is malloced()/new'd
-// over the location of a previously unlocked mutex
-typedef struct {
-	std::set<pid_t> tids;
-} lock_record_t;
-
-auto do_find_double_un_locks_mutex(const lock_trace_item_t *const data, const size_t n_records)
+template<typename Type>
+Type *merge_segments(const Type *const data, const json_t *const segments)
 {
-	std::map<std::pair<const pthread_mutex_t *, lock_action_error_t>, std::map<hash_t, double_un_lock_t> > out;
+	std::vector<span_t<Type> > spans;
 
-	std::map<const pthread_mutex_t *, lock_record_t> locked;
+	size_t n_segments = json_array_size(segments);
 
-	for(size_t i=0; i<n_records; i++) {
-		const pthread_mutex_t *const mutex = (const pthread_mutex_t *)data[i].lock;
-		const pid_t tid = data[i].tid;
+	for(size_t i=0; i<n_segments; i++) {
+		const json_t *segment = json_array_get(segments, i);
 
-		// ignore calls that failed
-		if (data[i].rc != 0)
-			continue;
+		spans.push_back({ &data[get_json_int(segment, "first")], get_json_int(segment, "n") });
+	}
 
-		if (data[i].la == a_lock) {
-			// see if it is already locked by current 'tid' which is a mistake
-			auto it = locked.find(mutex);
-			if (it != locked.end()) {
-				if (it->second.tids.find(tid) != it->second.tids.end()) {
-					hash_t hash = calculate_backtrace_hash(data[i].caller, CALLER_DEPTH);
+	return merge_spans(spans);
+}
 
-					put_lock_error(&out, mutex, lae_already_locked, hash, i);
-				}
-				else {
-					// new locker of this mutex
-					it->second.tids.insert(tid);
-				}
-			}
-			else {
-				// new mutex
-				locked.insert({ mutex, { { tid } } });
-			}
+// streaming mode: the file is a sequence of trace_chunk_header_t + records
+template<typename Type>
+Type *merge_chunks(const void *const data, const size_t size, const record_layout_t & from, const record_layout_t & to)
+{
+	std::vector<std::pair<uint64_t, span_t<Type> > > chunks;
+	std::vector<Type *> decoded;
+
+	// the chunk headers can leave the records unaligned, they're copied then
+	const bool native = from == to && alignof(Type) <= alignof(trace_chunk_header_t);
+
+	const uint8_t *p = (const uint8_t *)data;
+	const uint8_t *const end = p + size;
+
+	while(p + sizeof(trace_chunk_header_t) <= end) {
+		const trace_chunk_header_t *header = (const trace_chunk_header_t *)p;
+
+		if (header->magic != TRACE_CHUNK_MAGIC || header->record_size != from.record_size) {
+			fprintf(stderr, "Invalid chunk at offset %zu, measurements file is corrupt or from a different tracer build\n", size_t(p - (const uint8_t *)data));
+			break;
 		}
-		else if (data[i].la == a_unlock) {
-			// see if it is not locked (mistake)
-			auto it = locked.find(mutex);
-			if (it == locked.end()) {
-				hash_t hash = calculate_backtrace_hash(data[i].caller, CALLER_DEPTH);
 
-				put_lock_error(&out, mutex, lae_not_locked, hash, i);
-			}
-			// see if it is not locked by current tid (mistake)
-			else {
-				auto tid_it = it->second.tids.find(tid);
-				if (tid_it == it->second.tids.end()) {
-					hash_t hash = calculate_backtrace_hash(data[i].caller, CALLER_DEPTH);
+		p += sizeof(trace_chunk_header_t);
 
-					put_lock_error(&out, mutex, lae_not_owner, hash, i);
-				}
-				else {
-					it->second.tids.erase(tid_it);
-				}
+		uint64_t n = std::min(header->n_records, uint64_t(end - p) / from.record_size);
 
-				if (it->second.tids.empty())
-					locked.erase(it);
-			}
+		if (native)
+			chunks.push_back({ header->seq, { (const Type *)p, n } });
+		else {
+			Type *records = decode_records<Type>(p, n, from, to);
+			if (!records)
+				break;
+
+			decoded.push_back(records);
+
+			chunks.push_back({ header->seq, { records, n } });
 		}
+
+		p += n * from.record_size;
 	}
 
+	// chunks are written in the order in which segments fill up, not in
+	// the order in which they were claimed
+	std::stable_sort(chunks.begin(), chunks.end(), [](const auto & a, const auto & b) { return a.first < b.first; });
+
+	std::vector<span_t<Type> > spans;
+	for(auto & chunk : chunks)
+		spans.push_back(chunk.second);
+
+	Type *out = merge_spans(spans);
+
+	for(auto & records : decoded)
+		free(records);
+
 	return out;
 }
 
-std::map<const void *, std::string> symbol_cache;
+bool is_stream(const json_t *const meta)
+{
+	const json_t *stream = json_object_get(meta, "stream");
 
-std::string lookup_symbol(const void *const p)
+	return stream && json_integer_value(stream);
+}
+
+// *mapped_size is set when the records are the mapped file itself (else
+// they are allocated)
+template<typename Type>
+Type *load_records(const json_t *const meta, const char *const measurements_key, const char *const segments_key, const record_layout_t & from, const record_layout_t & to, size_t *const mapped_size = nullptr)
 {
-	if (p == nullptr)
-		return "(nil)";
+	if (mapped_size)
+		*mapped_size = 0;
 
-	auto it = symbol_cache.find(p);
-	if (it != symbol_cache.end())
-		return it->second;
+	size_t size = 0;
+	const void *raw = map_file(get_json_string(meta, measurements_key), &size);
+	if (!raw)
+		return nullptr;
 
-	std::string command_line;
+	if (is_stream(meta)) {
+		Type *out = merge_chunks<Type>(raw, size, from, to);
 
-	if (core_file.empty() == false)
-		command_line = myformat("%s -x -a -C --core %s %p", resolver.c_str(), core_file.c_str(), p);
-	else
-		command_line = myformat("%s -x -a -C -e %s %p", resolver.c_str(), exe_file.c_str(), p);
+		munmap(const_cast<void *>(raw), size);
 
-	char buffer[4096] { 0x00 };
+		return out;
+	}
 
-	FILE *fh = popen(command_line.c_str(), "r");
-	if (fh) {
-		if (fread(buffer, 1, sizeof buffer - 1, fh) == 0)
-			buffer[0] = 0x00;
+	Type *data = (Type *)raw;
 
-		for(;;) {
-			char *lf = strchr(buffer, '\n');
-			if (!lf)
-				break;
+	if (!(from == to)) {
+		data = decode_records<Type>(raw, size / from.record_size, from, to);
 
-			*lf = '/';
-		}
+		munmap(const_cast<void *>(raw), size);
 
-		pclose(fh);
-	}
-	else {
-		fprintf(stderr, "Cannot resolve symbol (\"%s\"): %s\n", command_line.c_str(), strerror(errno));
+		raw = nullptr;
 	}
 
-	char *lf = strchr(buffer, '\n');
-	if (lf)
-		*lf = 0x00;
+	const json_t *segments = json_object_get(meta, segments_key);
 
-	std::string result = buffer;
+	if (data && segments) {
+		Type *out = merge_segments(data, segments);
 
-	if (result.substr(0, 2) == "??" || result == "")
-		result = myformat("%p", p);
+		if (raw)
+			munmap(const_cast<void *>(raw), size);
+		else
+			free(data);
 
-	symbol_cache.insert({ p, result });
+		return out;
+	}
 
-	return result;
+	if (raw && mapped_size)
+		*mapped_size = size;
+
+	return data;
 }
 
-#if defined(WITH_BACKTRACE)
-void put_call_trace_html(FILE *const fh, const lock_trace_item_t & record, const std::string & table_color)
+// TRACE_COMPACT: the segments are byte streams, see lock_tracer.h
+uint64_t get_varint(const uint8_t **const p, const uint8_t *const end)
 {
-	fprintf(fh, "<table class=\"%s\">\n", table_color.c_str());
+	uint64_t v = 0;
 
-	int d = CALLER_DEPTH - 1;
-	while(d > 0 && record.caller[d] == nullptr)
-		d--;
+	for(int shift=0; *p < end && shift < 64; shift += 7) {
+		uint8_t byte = *(*p)++;
 
-	for(int i=0; i<=d; i++)
-		fprintf(fh, "<tr><th>%p</th><td>%s</td></tr>\n", record.caller[i], lookup_symbol(record.caller[i]).c_str());
+		v |= uint64_t(byte & 0x7f) << shift;
 
-	fprintf(fh, "</table>\n");
+		if ((byte & 0x80) == 0)
+			break;
+	}
+
+	return v;
 }
 
-void put_call_trace_text(FILE *const fh, const lock_trace_item_t & record)
+int64_t unzigzag(const uint64_t v)
 {
-	int d = CALLER_DEPTH - 1;
-	while(d > 0 && record.caller[d] == nullptr)
-		d--;
+	return int64_t(v >> 1) ^ -int64_t(v & 1);
+}
 
-	if (d >= 0) {
-		fprintf(fh, "\t");
+void decode_compact_segment(const uint8_t *p, const uint8_t *const end, const int tid, const json_t *const format, const size_t caller_depth, std::vector<lock_trace_item_t> *const out)
+{
+	const bool timing = get_json_int(format, "timing");
+	const std::string stacks = get_json_string(format, "stacks");
+	const bool has_lock_id = get_json_int(format, "lock_id");
 
-		for(int i=0; i<=d; i++)
-			fprintf(fh, "%p ", record.caller[i]);
+	uint64_t ts = 0;
+	uintptr_t lock = 0;
+	int64_t lock_id = 0;
+	std::vector<uintptr_t> callers(caller_depth);
+	std::string thread_name;
 
-		fprintf(fh, "%s", lookup_symbol(record.caller[d]).c_str());
-	}
-}
-#endif
+	while(p < end) {
+		lock_trace_item_t item { };
 
-constexpr uint64_t billion = 1000000000ll;
+		const uint8_t flags = *p++;
 
-std::string my_ctime(const uint64_t nts)
-{
-	time_t t = nts / billion;
+		item.tid = tid;
+		item.la  = lock_action_t((flags & COMPACT_LA_MASK) | (flags & COMPACT_LA_HIGH ? 0x10 : 0));
 
-	struct tm tm { 0 };
-	localtime_r(&t, &tm);
+		if (timing) {
+			ts += unzigzag(get_varint(&p, end));
+			uint64_t took = get_varint(&p, end);
+#ifdef MEASURE_TIMING
+			item.timestamp = ts;
+			item.lock_took = took;
+#else
+			(void)took;
+#endif
+		}
 
-	return myformat("%04d-%02d-%02d %02d:%02d:%02d.%09d", tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday, tm.tm_hour, tm.tm_min, tm.tm_sec, int(nts % billion));
-}
+		lock += unzigzag(get_varint(&p, end));
+		item.lock = (void *)lock;
 
-void put_record_details_html(FILE *const fh, const lock_trace_item_t & record, const std::string & base_color)
-{
-	fprintf(fh, "<table class=\"%s\">\n", base_color.c_str());
-	fprintf(fh, "<tr><th>tid</th><td>%d</td></tr>\n", record.tid);
-#ifdef STORE_THREAD_NAME
-	fprintf(fh, "<tr><th>thread name</th><td>%s</td></tr>\n", record.thread_name);
+		if (stacks == "id") {
+			uint32_t stack_id = get_varint(&p, end);
+#ifdef INTERN_STACKS
+			item.stack_id = stack_id;
+#else
+			(void)stack_id;
 #endif
-#ifdef MEASURE_TIMING
-	fprintf(fh, "<tr><th>action</th><td>%s</td></tr>\n", lock_action_to_name(record.la).c_str());
-	fprintf(fh, "<tr><th>lock</th><td>%p</td></tr>\n", record.lock);
-	fprintf(fh, "<tr><th>timestamp</th><td>%s</td></tr>\n", my_ctime(record.timestamp).c_str());
-	fprintf(fh, "<tr><th>took</th><td>%.3fus</td></tr>\n", record.lock_took / 1000.0);
+		}
+		else {
+			for(size_t i=0; i<caller_depth && stacks == "callers"; i++)
+				callers[i] += unzigzag(get_varint(&p, end));
+#ifdef INTERN_STACKS
+			item.stack_id = STACK_ID_UNKNOWN;
+#elif defined(WITH_BACKTRACE)
+			for(size_t i=0; i<std::min(caller_depth, size_t(CALLER_DEPTH)); i++)
+				item.caller[i] = (void *)callers[i];
 #endif
+		}
 
-#if defined(WITH_BACKTRACE)
-	fprintf(fh, "<tr><th>call trace</th><td>");
-	put_call_trace_html(fh, record, base_color);
-	fprintf(fh, "</td></tr>\n");
+		if (has_lock_id)
+			lock_id += unzigzag(get_varint(&p, end));
+#ifdef LOCK_REGISTRY
+		item.lock_id = has_lock_id ? uint32_t(lock_id) : LOCK_ID_UNKNOWN;
 #endif
 
-	fprintf(fh, "</table>\n");
-}
+		if (flags & COMPACT_NAME) {
+			size_t len = p < end ? *p++ : 0;
+			len = std::min(len, size_t(end - p));
 
-void put_record_details_text(FILE *const fh, const lock_trace_item_t & record)
-{
-	fprintf(fh, "%d", record.tid);
+			thread_name.assign((const char *)p, len);
+			p += len;
+		}
 #ifdef STORE_THREAD_NAME
-	if (record.thread_name[0])
-		fprintf(fh, "\t%s", record.thread_name);
-	else
-		fprintf(fh, "\t-");
-#endif
-#ifdef MEASURE_TIMING
-	fprintf(fh, "\t%s", lock_action_to_name(record.la).c_str());
-	fprintf(fh, "\t%p", record.lock);
-	fprintf(fh, "\t%s", my_ctime(record.timestamp).c_str());
-	fprintf(fh, "\t%.3fus", record.lock_took / 1000.);
+		strncpy(item.thread_name, thread_name.c_str(), sizeof item.thread_name - 1);
 #endif
 
-#if defined(WITH_BACKTRACE)
-	put_call_trace_text(fh, record);
-#endif
+		if (flags & COMPACT_INNARDS) {
+			int32_t innards[3];
 
-	fprintf(fh, "\n");
-}
+			for(int i=0; i<3; i++)
+				innards[i] = unzigzag(get_varint(&p, end));
 
-void put_record_details_sql(FILE *const fh, const lock_trace_item_t & record, const uint64_t nr)
-{
-	fprintf(fh, "INSERT INTO lock_trace(nr, tid, thread_name, action, lock, timestamp, took) "
-		    "VALUES(%zu, %d, \"%s\", \"%s\", \"%s\", %.9f, %.6f);\n",
-		    nr,
-		    record.tid,
-		    record.thread_name,
-		    lock_action_to_name(record.la).c_str(),
-		    myformat("%p", record.lock).c_str(),
-		    record.timestamp / 1000000000.,
-		    record.lock_took / 1000.);
+			memcpy(&item.mutex_innards, innards, sizeof innards);
+		}
+
+		if (flags & COMPACT_RC)
+			item.rc = unzigzag(get_varint(&p, end));
+
+		out->push_back(item);
+	}
 }
 
-std::map<hash_t, size_t> find_a_record_for_unique_backtrace_hashes(const lock_trace_item_t *const data, const std::vector<size_t> & backtraces)
+// returns the records merged on timestamp, n is set to the number of them
+lock_trace_item_t *load_compact_records(const json_t *const meta, uint64_t *const n)
 {
-	std::map<hash_t, size_t> out;
+	size_t size = 0;
+	const uint8_t *data = (const uint8_t *)map_file(get_json_string(meta, "measurements"), &size);
+	if (!data)
+		return nullptr;
 
-	for(auto i : backtraces) {
-		hash_t hash = calculate_backtrace_hash(data[i].caller, CALLER_DEPTH);
+	const json_t *format = json_object_get(meta, "compact");
+	const size_t caller_depth = get_json_int(meta, "caller_depth");
 
-		auto it = out.find(hash);
-		if (it == out.end())
-			out.insert({ hash, i });
-	}
+	// per segment/chunk, with the order in which they were claimed
+	std::vector<std::pair<uint64_t, std::vector<lock_trace_item_t> > > decoded;
 
-	return out;
-}
+	if (is_stream(meta)) {
+		const uint8_t *p = data;
+		const uint8_t *const end = data + size;
 
-void find_double_un_locks_mutex(FILE *const fh, const lock_trace_item_t *const data, const uint64_t n_records)
-{
-	auto mutex_lock_mistakes = do_find_double_un_locks_mutex(data, n_records);
+		while(p + sizeof(trace_chunk_header_t) <= end) {
+			const trace_chunk_header_t *header = (const trace_chunk_header_t *)p;
 
-	fprintf(fh, "<section>\n");
-	fprintf(fh, "<h2 id=\"doublem\">4. mutex lock/unlock mistakes</h2>\n");
-	fprintf(fh, "<p>Mistakes are: locking a mutex another time by the same thread, unlocking mutexes that are not locked and unlocking of a mutex by some other thread than the one who locked the mutex.</p>\n");
-	fprintf(fh, "<p>This section contains a list of all the seen mutex/error-type combinations and then for each the mistakes made and then one or more backtraces (\"first\" and \"next\") where they occured.</p>\n");
-	fprintf(fh, "<p>Count: %zu</p>\n", mutex_lock_mistakes.size());
+			if (header->magic != TRACE_CHUNK_MAGIC || header->record_size != 1) {
+				fprintf(stderr, "Invalid chunk at offset %zu, measurements file is corrupt or from a different tracer build\n", size_t(p - data));
+				break;
+			}
 
-	for(auto mutex_lock_mistake : mutex_lock_mistakes) {
-		fprintf(fh, "<h3>mutex %p, type \"%s\"</h3>\n", (const void *)mutex_lock_mistake.first.first, lock_action_error_str[mutex_lock_mistake.first.second]);
+			p += sizeof(trace_chunk_header_t);
 
-		for(auto map_entry : mutex_lock_mistake.second) {
-			double_un_lock_t & dul = map_entry.second;
+			uint64_t n_bytes = std::min(header->n_records, uint64_t(end - p));
 
-			// first (correct?)
-			if (dul.latest_records.empty() == false)
-				fprintf(fh, "<h4>first</h4>\n");
-			put_record_details_html(fh, data[dul.first_record], "red");
+			decoded.push_back({ header->seq, { } });
+			decode_compact_segment(p, p + n_bytes, header->tid, format, caller_depth, &decoded.back().second);
 
-			// then list all mistakes for this combination, show only unique backtraces
-			if (dul.latest_records.empty() == false) {
-				fprintf(fh, "<h4>next</h4>\n");
-				fprintf(fh, "<p>Mistake count: %zu (total number of backtraces seen; note that the list below is de-duplicated).</p>\n", dul.latest_records.size());
+			p += n_bytes;
+		}
 
-				auto unique_backtraces = find_a_record_for_unique_backtrace_hashes(data, dul.latest_records);
+		std::stable_sort(decoded.begin(), decoded.end(), [](const auto & a, const auto & b) { return a.first < b.first; });
+	}
+	else {
+		// these are already in order
+		const json_t *segments = json_object_get(meta, "segments");
 
-				for(auto entry : unique_backtraces) 
-					put_record_details_html(fh, data[entry.second], "red");
-			}
+		for(size_t i=0; i<json_array_size(segments); i++) {
+			const json_t *segment = json_array_get(segments, i);
+			const uint64_t first = get_json_int(segment, "first");
+			const uint64_t n_bytes = std::min(uint64_t(get_json_int(segment, "n")), uint64_t(size - std::min(uint64_t(size), first)));
 
-			fprintf(fh, "<br>\n");
+			decoded.push_back({ i, { } });
+			decode_compact_segment(data + first, data + first + n_bytes, get_json_int(segment, "tid"), format, caller_depth, &decoded.back().second);
 		}
 	}
 
-	fprintf(fh, "</section>\n");
+	std::vector<span_t<lock_trace_item_t> > spans;
+	for(auto & segment : decoded)
+		spans.push_back({ segment.second.data(), segment.second.size() });
+
+	munmap(const_cast<uint8_t *>(data), size);
+
+	*n = 0;
+	for(auto & span : spans)
+		*n += span.second;
+
+	return merge_spans(spans);
 }
 
-std::map<int, std::vector<size_t> > do_list_fuction_call_errors(const lock_trace_item_t *const data, const uint64_t n_records)
+// With USE_TSC the tracer stores TSC ticks instead of nanoseconds. The
+// tick rate follows from the two TSC/CLOCK_MONOTONIC samples.
+bool get_tsc_conversion(const json_t *const meta, double *const ns_per_tick, uint64_t *const start_ticks, uint64_t *const start_ns)
 {
-	std::map<int, std::vector<size_t> > errors;
+	const json_t *tsc = json_object_get(meta, "tsc");
+	if (!tsc)
+		return false;
 
-	for(size_t i=0; i<n_records; i++) {
-		if (data[i].rc == 0)
-			continue;
+	*start_ticks = get_json_int(tsc, "start_ticks");
+	*start_ns = get_json_int(tsc, "start_ns");
 
-		auto it = errors.find(data[i].rc);
-		if (it == errors.end())
-			errors.insert({ data[i].rc, { i } });
-		else
-			it->second.push_back(i);
+	uint64_t d_ticks = get_json_int(tsc, "end_ticks") - *start_ticks;
+	uint64_t d_ns = get_json_int(tsc, "end_mono_ns") - get_json_int(tsc, "start_mono_ns");
+
+	if (d_ticks == 0) {
+		fprintf(stderr, "TSC calibration data is invalid\n");
+		return false;
 	}
 
-	return errors;
+	*ns_per_tick = double(d_ns) / d_ticks;
+
+	return true;
 }
 
-void list_fuction_call_errors(FILE *const fh, const lock_trace_item_t *const data, const uint64_t n_records)
+void convert_timestamps(lock_trace_item_t *const data, const uint64_t n, const json_t *const meta)
 {
-	auto error_list = do_list_fuction_call_errors(data, n_records);
-
-	fprintf(fh, "<section>\n");
-	fprintf(fh, "<h2 id=\"errors\">3. function call errors</h2>\n");
-	fprintf(fh, "<p>pthread_-functions can fail, they then return an errno-alike error code. In this section, all that occured (for the ones checked, like mutex errors etc) are listed.</p>\n");
-	fprintf(fh, "<p>Count: %zu</p>\n", error_list.size());
+#ifdef MEASURE_TIMING
+	double ns_per_tick = 1.;
+	uint64_t start_ticks = 0, start_ns = 0;
 
-	for(auto it : error_list) {
-		fprintf(fh, "<h3>%s</h3>\n", strerror(it.first));
+	if (!get_tsc_conversion(meta, &ns_per_tick, &start_ticks, &start_ns))
+		return;
 
-		auto unique_backtraces = find_a_record_for_unique_backtrace_hashes(data, it.second);
+	for(uint64_t i=0; i<n; i++) {
+		data[i].timestamp = start_ns + int64_t(int64_t(data[i].timestamp - start_ticks) * ns_per_tick);
+		data[i].lock_took *= ns_per_tick;
+	}
+#endif
+}
 
-		for(auto entry : unique_backtraces)  {
-			put_record_details_html(fh, data[entry.second], "green");
+void convert_timestamps(lock_usage_groups_t *const data, const uint64_t n, const json_t *const meta)
+{
+#ifdef MEASURE_TIMING
+	double ns_per_tick = 1.;
+	uint64_t start_ticks = 0, start_ns = 0;
 
-			fprintf(fh, "<br>\n");
-		}
-	}
+	if (!get_tsc_conversion(meta, &ns_per_tick, &start_ticks, &start_ns))
+		return;
 
-	fprintf(fh, "</section>\n");
+	for(uint64_t i=0; i<n; i++)
+		data[i].timestamp = start_ns + int64_t(int64_t(data[i].timestamp - start_ticks) * ns_per_tick);
+#endif
 }
 
-std::map<const pthread_mutex_t *, std::vector<size_t> > do_find_still_locked_mutex(const lock_trace_item_t *const data, const uint64_t n_records)
+#ifdef INTERN_STACKS
+// the backtraces are in a table written by the tracer, the records
+// only have an index in it
+const void *const *stacks = nullptr;
+uint64_t n_stacks = 0;
+
+void load_stacks(const json_t *const meta)
 {
-	std::map<const pthread_mutex_t *, int> mutexes_counts;
+	// variants without backtraces have no stack table
+	if (!json_object_get(meta, "stacks"))
+		return;
 
-	std::map<const pthread_mutex_t *, std::vector<size_t> > mutexes_where;
+	size_t size = 0;
+	const void *const *raw = (const void *const *)map_file(get_json_string(meta, "stacks"), &size);
 
-	for(size_t i=0; i<n_records; i++) {
-		// ignore calls that failed
-		if (data[i].rc != 0)
-			continue;
+	// e.g. the shallow variant stores 1 caller per entry
+	const size_t depth = json_object_get(meta, "caller_depth") ? get_json_int(meta, "caller_depth") : CALLER_DEPTH;
 
-		const pthread_mutex_t *const mutex = (const pthread_mutex_t *)data[i].lock;
+	// entries that were not used yet are all nullptr
+	n_stacks = raw && depth ? size / (sizeof(void *) * depth) : 0;
 
-		if (data[i].la == a_lock) {
-			auto it = mutexes_counts.find(mutex);
+	if (depth == CALLER_DEPTH)
+		stacks = raw;
+	else if (raw) {
+		const void **resized = (const void **)calloc(std::max(uint64_t(1), n_stacks), sizeof(void *) * CALLER_DEPTH);
 
-			if (it == mutexes_counts.end()) {
-				mutexes_counts.insert({ mutex, 1 });
-				mutexes_where.insert({ mutex, { i } });
-			}
-			else {
-				it->second++;
-				mutexes_where.find(mutex)->second.push_back(i);
-			}
-		}
-		else if (data[i].la == a_unlock) {
-			auto it = mutexes_counts.find(mutex);
+		for(uint64_t i=0; i<n_stacks; i++)
+			memcpy(&resized[i * CALLER_DEPTH], &raw[i * depth], sizeof(void *) * std::min(depth, size_t(CALLER_DEPTH)));
 
-			if (it != mutexes_counts.end()) {
-				if (it->second > 0)
-					it->second--;
+		munmap(const_cast<void **>(raw), size);
 
-				if (it->second == 0) {
-					mutexes_counts.erase(mutex);
-					mutexes_where.erase(mutex);
-				}
-			}
-		}
+		stacks = resized;
 	}
 
-	return mutexes_where;
+	if (get_json_int(meta, "stacks_full"))
+		fprintf(stderr, "Stack table was full: %ld backtraces are missing\n", get_json_int(meta, "stacks_full"));
 }
+#endif
 
-void find_still_locked_mutex(FILE *const fh, const lock_trace_item_t *const data, const uint64_t n_records)
+#ifdef LOCK_REGISTRY
+// the locks as registered by the tracer, indexed by lock_id
+const lock_registry_entry_t *lock_registry = nullptr;
+uint64_t n_locks = 0;
+
+void load_lock_registry(const json_t *const meta)
 {
-	auto still_locked_list = do_find_still_locked_mutex(data, n_records);
+	if (!json_object_get(meta, "locks"))
+		return;
 
-	fprintf(fh, "<section>\n");
-	fprintf(fh, "<h2 id=\"stillm\">5. still locked mutexes</h2>\n");
-	fprintf(fh, "<p>A list of the mutexes that were still locked when the program terminated.</p>\n");
-	fprintf(fh, "<p>Count: %zu</p>\n", still_locked_list.size());
+	if (get_json_int(meta, "lock_registry_entry_size") != sizeof(lock_registry_entry_t)) {
+		fprintf(stderr, "Lock registry is from a different tracer build, ignored\n");
+		return;
+	}
 
-	for(auto it : still_locked_list) {
-		fprintf(fh, "<h3>mutex %p</h3>\n", (const void *)it.first);
+	size_t size = 0;
+	lock_registry = (const lock_registry_entry_t *)map_file(get_json_string(meta, "locks"), &size);
 
-		auto unique_backtraces = find_a_record_for_unique_backtrace_hashes(data, it.second);
+	n_locks = lock_registry ? std::min(uint64_t(get_json_int(meta, "n_locks")), uint64_t(size / sizeof(lock_registry_entry_t))) : 0;
 
-		if (unique_backtraces.size() == 1)
-			fprintf(fh, "<p>The following location did not unlock:</p>\n");
-		else
-			fprintf(fh, "<p>One of the following locations did not unlock:</p>\n");
+#ifdef MEASURE_TIMING
+	double ns_per_tick = 1.;
+	uint64_t start_ticks = 0, start_ns = 0;
 
-		for(auto entry : unique_backtraces) {
-			put_record_details_html(fh, data[entry.second], "blue");
+	if (get_tsc_conversion(meta, &ns_per_tick, &start_ticks, &start_ns)) {
+		lock_registry_entry_t *const entries = const_cast<lock_registry_entry_t *>(lock_registry);
 
-			fprintf(fh, "<br>\n");
-		}
+		for(uint64_t i=0; i<n_locks; i++)
+			entries[i].created_ts = start_ns + int64_t(int64_t(entries[i].created_ts - start_ticks) * ns_per_tick);
 	}
+#endif
 
-	fprintf(fh, "</section>\n");
+	if (get_json_int(meta, "locks_full"))
+		fprintf(stderr, "Lock registry was full: %ld locks are not in it\n", get_json_int(meta, "locks_full"));
 }
+#endif
 
-std::map<const pthread_rwlock_t *, std::vector<size_t> > do_find_still_locked_rwlock(const lock_trace_item_t *const data, const uint64_t n_records)
+// the records only, see load_records() for mapped_size
+lock_trace_item_t *load_items(json_t *const meta, size_t *const mapped_size)
 {
-	std::map<const pthread_rwlock_t *, int> rwlocks_counts;
+	*mapped_size = 0;
 
-	std::map<const pthread_rwlock_t *, std::vector<size_t> > rwlockes_where;
+	if (json_object_get(meta, "compact")) {
+		uint64_t n_records = 0;
+		lock_trace_item_t *data = load_compact_records(meta, &n_records);
+		if (!data)
+			return nullptr;
 
-	for(size_t i=0; i<n_records; i++) {
-		// ignore calls that failed
-		if (data[i].rc != 0)
-			continue;
+		if (n_records != uint64_t(get_json_int(meta, "n_records")))
+			fprintf(stderr, "Decoded %lu records, %ld were expected\n", n_records, get_json_int(meta, "n_records"));
 
-		const pthread_rwlock_t *const rwlock = (const pthread_rwlock_t *)data[i].lock;
+		// the rest of the analyzer uses this count
+		json_object_set_new(meta, "n_records", json_integer(n_records));
 
-		if (data[i].la == a_r_lock || data[i].la == a_w_lock) {
-			auto it = rwlocks_counts.find(rwlock);
+		convert_timestamps(data, n_records, meta);
 
-			if (it == rwlocks_counts.end()) {
-				rwlocks_counts.insert({ rwlock, 1 });
-				rwlockes_where.insert({ rwlock, { i } });
-			}
-			else {
-				it->second++;
-				rwlockes_where.find(rwlock)->second.push_back(i);
-			}
-		}
-		else if (data[i].la == a_rw_unlock) {
-			// here it is not important if it is the r or
-			// the w lock, as long as the count matches up
-			auto it = rwlocks_counts.find(rwlock);
+		return data;
+	}
 
-			if (it != rwlocks_counts.end()) {
-				if (it->second > 0)
-					it->second--;
+	const record_layout_t native = native_layout<lock_trace_item_t>(trace_item_fields);
+	const record_layout_t layout = get_layout(meta, "layout", native);
 
-				if (it->second == 0) {
-					rwlocks_counts.erase(rwlock);
-					rwlockes_where.erase(rwlock);
-				}
-			}
-		}
+	lock_trace_item_t *data = load_records<lock_trace_item_t>(meta, "measurements", "segments", layout, native, mapped_size);
+	if (!data)
+		return nullptr;
+
+	const uint64_t n_records = get_json_int(meta, "n_records");
+
+#ifdef INTERN_STACKS
+	// 0 is a valid index
+	if (layout.fields.find("stack_id") == layout.fields.end()) {
+		for(uint64_t i=0; i<n_records; i++)
+			data[i].stack_id = STACK_ID_UNKNOWN;
+	}
+#endif
+#ifdef LOCK_REGISTRY
+	if (layout.fields.find("lock_id") == layout.fields.end()) {
+		for(uint64_t i=0; i<n_records; i++)
+			data[i].lock_id = LOCK_ID_UNKNOWN;
 	}
+#endif
+
+	convert_timestamps(data, n_records, meta);
+
+	return data;
+}
 
-	return rwlockes_where;
+void free_items(lock_trace_item_t *const data, const size_t mapped_size)
+{
+	if (mapped_size)
+		munmap(data, mapped_size);
+	else
+		free(data);
 }
 
-void find_still_locked_rwlock(FILE *const fh, const lock_trace_item_t *const data, const uint64_t n_records)
+const lock_trace_item_t *load_data(json_t *const meta)
 {
-	auto still_locked_list = do_find_still_locked_rwlock(data, n_records);
+#ifdef INTERN_STACKS
+	load_stacks(meta);
+#endif
+#ifdef LOCK_REGISTRY
+	load_lock_registry(meta);
+#endif
 
-	fprintf(fh, "<section>\n");
-	fprintf(fh, "<h2 id=\"stillrw\">7. still locked rwlocks</h2>\n");
-	fprintf(fh, "<p>A list of the r/w-locks that were still locked when the program terminated.</p>\n");
-	fprintf(fh, "<p>Count: %zu</p>\n", still_locked_list.size());
+	size_t mapped_size = 0;
 
-	for(auto it : still_locked_list) {
-		fprintf(fh, "<h3>rwlock %p</h3>\n", (const void *)it.first);
+	return load_items(meta, &mapped_size);
+}
 
-		auto unique_backtraces = find_a_record_for_unique_backtrace_hashes(data, it.second);
+const lock_usage_groups_t *load_ug_data(const json_t *const meta)
+{
+	// not in the output of tracer variants without usage groups
+	if (!json_object_get(meta, "ug_measurements"))
+		return nullptr;
 
-		if (unique_backtraces.size() == 1)
-			fprintf(fh, "<p>The following location did not unlock:</p>\n");
-		else
-			fprintf(fh, "<p>One of the following locations did not unlock:</p>\n");
+	const record_layout_t native = native_layout<lock_usage_groups_t>(ug_item_fields);
 
-		for(auto entry : unique_backtraces) {
-			put_record_details_html(fh, data[entry.second], "magenta");
+	lock_usage_groups_t *data = load_records<lock_usage_groups_t>(meta, "ug_measurements", "ug_segments", get_layout(meta, "ug_layout", native), native);
 
-			fprintf(fh, "<br>\n");
-		}
-	}
+	if (data)
+		convert_timestamps(data, get_json_int(meta, "ug_n_records"), meta);
 
-	fprintf(fh, "</section>\n");
+	return data;
 }
 
-// see do_find_double_un_locks_mutex comment about false positives
-auto do_find_double_un_locks_rwlock(const lock_trace_item_t *const data, const size_t n_records)
+typedef uint64_t hash_t;
+
+uint64_t MurmurHash64A(const void *const key, const int len, const uint64_t seed)
 {
-	std::map<std::pair<const pthread_rwlock_t *, lock_action_error_t>, std::map<hash_t, double_un_lock_t> > out;
+	const uint64_t m = 0xc6a4a7935bd1e995LLU;
+	const int r = 47;
 
-	std::map<const pthread_rwlock_t *, std::set<pid_t> > r_locked;
-	std::map<const pthread_rwlock_t *, std::set<pid_t> > w_locked;
+	uint64_t h = seed ^ (len * m);
 
-	for(size_t i=0; i<n_records; i++) {
-		// ignore calls that failed
-		if (data[i].rc != 0)
-			continue;
+	const uint64_t *data = (const uint64_t *)key;
+	const uint64_t *end = (len >> 3) + data;
 
-		const pthread_rwlock_t *const rwlock = (const pthread_rwlock_t *)data[i].lock;
-		const pid_t tid = data[i].tid;
+	while(data != end) {
+		uint64_t k = *data++;
 
-		if (data[i].la == a_r_lock) {
-			// see if it is already locked by current 'tid' which is a mistake
-			auto it = r_locked.find(rwlock);
-			if (it != r_locked.end()) {
-				if (it->second.find(tid) != it->second.end()) {
-					hash_t hash = calculate_backtrace_hash(data[i].caller, CALLER_DEPTH);
+		k *= m;
+		k ^= k >> r;
+		k *= m;
 
-					put_lock_error(&out, rwlock, lae_already_locked, hash, i);
-				}
-				else {
-					// new locker of this rwlock
-					it->second.insert(tid);
-				}
-			}
-			else {
-				// new rwlock
-				r_locked.insert({ rwlock, { tid } });
-			}
-		}
-		else if (data[i].la == a_w_lock) {
-			auto it = w_locked.find(rwlock);
-			if (it != w_locked.end()) {
-				if (it->second.find(tid) != it->second.end()) {
-					hash_t hash = calculate_backtrace_hash(data[i].caller, CALLER_DEPTH);
+		h ^= k;
+		h *= m;
+	}
 
-					put_lock_error(&out, rwlock, lae_already_locked, hash, i);
+	const uint8_t *data2 = (const uint8_t *)data;
+
+	switch(len & 7) {
+		case 7: h ^= (uint64_t)(data2[6]) << 48;
+		case 6: h ^= (uint64_t)(data2[5]) << 40;
+		case 5: h ^= (uint64_t)(data2[4]) << 32;
+		case 4: h ^= (uint64_t)(data2[3]) << 24;
+		case 3: h ^= (uint64_t)(data2[2]) << 16;
+		case 2: h ^= (uint64_t)(data2[1]) << 8;
+		case 1: h ^= (uint64_t)(data2[0]);
+			h *= m;
+	};
+
+	h ^= h >> r;
+	h *= m;
+	h ^= h >> r;
+
+	return h;
+}
+
+hash_t calculate_backtrace_hash(const void *const *const pointers, const size_t n_pointers)
+{
+	// hash the contents of the pointer-array instead of where they point to
+	return MurmurHash64A((const void *const)pointers, n_pointers * sizeof(void *), 0);
+}
+
+#ifdef INTERN_STACKS
+const void *const *get_callers(const lock_trace_item_t & record)
+{
+	static const void *const unknown[CALLER_DEPTH] { nullptr };
+
+	if (record.stack_id < n_stacks)
+		return &stacks[uint64_t(record.stack_id) * CALLER_DEPTH];
+
+	return unknown;
+}
+
+// the tracer stores each distinct backtrace once, so the index is enough
+hash_t calculate_backtrace_hash(const lock_trace_item_t & record)
+{
+	return record.stack_id;
+}
+#elif defined(WITH_BACKTRACE)
+const void *const *get_callers(const lock_trace_item_t & record)
+{
+	return record.caller;
+}
+
+hash_t calculate_backtrace_hash(const lock_trace_item_t & record)
+{
+	return calculate_backtrace_hash(record.caller, CALLER_DEPTH);
+}
+#endif
+
+// Locks are identified by their registry index when there is one, so
+// that a lock created at the address of a destroyed one is seen as an
+// other lock. Otherwise the address is used (with the upper bit set).
+typedef uint64_t lock_key_t;
+
+constexpr lock_key_t lock_key_address = 1ull << 63;
+
+lock_key_t get_lock_key(const lock_trace_item_t & record)
+{
+#ifdef LOCK_REGISTRY
+	if (record.lock_id < n_locks)
+		return record.lock_id;
+#endif
+
+	return uintptr_t(record.lock) | lock_key_address;
+}
+
+const void *get_lock_pointer(const lock_key_t key)
+{
+#ifdef LOCK_REGISTRY
+	if ((key & lock_key_address) == 0)
+		return lock_registry[key].lock;
+#endif
+
+	return (const void *)(key & ~lock_key_address);
+}
+
+std::string lock_name(const lock_key_t key)
+{
+#ifdef LOCK_REGISTRY
+	if ((key & lock_key_address) == 0 && lock_registry[key].generation)
+		return myformat("%p (generation %u)", lock_registry[key].lock, lock_registry[key].generation);
+#endif
+
+	return myformat("%p", get_lock_pointer(key));
+}
+
+// Per-lock state: a dense array for the locks in the registry, a map
+// for the others.
+template<typename Type>
+struct lock_table_t {
+	std::vector<Type> by_id;
+	std::vector<bool> present;
+	std::map<lock_key_t, Type> by_address;
+
+#ifdef LOCK_REGISTRY
+	lock_table_t() : by_id(n_locks), present(n_locks) { }
+#endif
+};
+
+template<typename Type>
+Type *lock_table_find(lock_table_t<Type> *const table, const lock_key_t key)
+{
+	if (key < table->by_id.size())
+		return table->present[key] ? &table->by_id[key] : nullptr;
+
+	auto it = table->by_address.find(key);
+
+	return it == table->by_address.end() ? nullptr : &it->second;
+}
+
+// inserts when not there yet
+template<typename Type>
+Type & lock_table_get(lock_table_t<Type> *const table, const lock_key_t key)
+{
+	if (key < table->by_id.size()) {
+		table->present[key] = true;
+
+		return table->by_id[key];
+	}
+
+	return table->by_address[key];
+}
+
+template<typename Type>
+void lock_table_erase(lock_table_t<Type> *const table, const lock_key_t key)
+{
+	if (key < table->by_id.size()) {
+		table->present[key] = false;
+		table->by_id[key] = Type();
+	}
+	else {
+		table->by_address.erase(key);
+	}
+}
+
+// lae_already_locked: already locked by this tid
+// lae_not_locked: unlock without lock
+// lae_not_owner: other thread unlocks mutex
+typedef enum { lae_already_locked = 0, lae_not_locked, lae_not_owner } lock_action_error_t;
+constexpr const char *const lock_action_error_str[] = { "already locked", "not locked", "not owner (or not waiting for (r/w-lock))" };
+
+typedef struct {
+	std::vector<size_t> latest_records;
+	size_t first_record;
+} double_un_lock_t;
+
+typedef std::map<std::pair<lock_key_t, lock_action_error_t>, std::map<hash_t, double_un_lock_t> > lock_errors_t;
+
+void put_lock_error(lock_errors_t *const target, const lock_key_t lock, const lock_action_error_t error_type, const hash_t calltrace_hash, const size_t record_nr)
+{
+	std::pair<lock_key_t, lock_action_error_t> key { lock, error_type };
+	auto it = target->find(key);
+
+	if (it == target->end()) {
+		// this kind of error we've not seen earlier with this lock
+		std::map<hash_t, double_un_lock_t> entry;
+
+		double_un_lock_t data;
+		data.first_record = record_nr;
+		entry.insert({ calltrace_hash, data });
+
+		target->insert({ key, entry });
+	}
+	else {
+		// this error occured earlier with this lock
+		auto hash_map_it = it->second.find(calltrace_hash);
+
+		if (hash_map_it == it->second.end()) {
+			double_un_lock_t data;
+			data.first_record = record_nr;
+
+			it->second.insert({ calltrace_hash, data });
+		}
+		else {
+			hash_map_it->second.latest_records.push_back(record_nr);
+		}
+	}
+}
+
+// Without the lock registry this may give false positives if for example
+// an other mutex is malloced()/new'd over the location of a previously
+// unlocked mutex.
+typedef struct {
+	std::set<pid_t> tids;
+} lock_record_t;
+
+lock_errors_t do_find_double_un_locks_mutex(const lock_trace_item_t *const data, const size_t n_records)
+{
+	lock_errors_t out;
+
+	lock_table_t<lock_record_t> locked;
+
+	for(size_t i=0; i<n_records; i++) {
+		const lock_key_t mutex = get_lock_key(data[i]);
+		const pid_t tid = data[i].tid;
+
+		// ignore calls that failed
+		if (data[i].rc != 0)
+			continue;
+
+		if (is_exclusive_lock(data[i].la)) {
+			// see if it is already locked by current 'tid' which is a mistake
+			lock_record_t *const entry = lock_table_find(&locked, mutex);
+			if (entry) {
+				if (entry->tids.find(tid) != entry->tids.end()) {
+					hash_t hash = calculate_backtrace_hash(data[i]);
+
+					put_lock_error(&out, mutex, lae_already_locked, hash, i);
 				}
 				else {
-					it->second.insert(tid);
+					// new locker of this mutex
+					entry->tids.insert(tid);
 				}
 			}
 			else {
-				w_locked.insert({ rwlock, { tid } });
+				// new mutex
+				lock_table_get(&locked, mutex).tids.insert(tid);
 			}
 		}
-		else if (data[i].la == a_rw_unlock) {
+		else if (is_exclusive_unlock(data[i].la)) {
 			// see if it is not locked (mistake)
-			auto w_it = w_locked.find(rwlock);
-			if (w_it == w_locked.end()) {
-				// check r_locked
-
-				auto r_it = r_locked.find(rwlock);
-				if (r_it == r_locked.end()) {
-					hash_t hash = calculate_backtrace_hash(data[i].caller, CALLER_DEPTH);
-
-					put_lock_error(&out, rwlock, lae_not_locked, hash, i);
-				}
-				// see if it is not locked by current tid (mistake)
-				else {
-					auto tid_it = r_it->second.find(tid);
-					if (tid_it == r_it->second.end()) {
-						hash_t hash = calculate_backtrace_hash(data[i].caller, CALLER_DEPTH);
-
-						put_lock_error(&out, rwlock, lae_not_owner, hash, i);
-					}
-					else {
-						r_it->second.erase(tid_it);
-					}
+			lock_record_t *const entry = lock_table_find(&locked, mutex);
+			if (!entry) {
+				hash_t hash = calculate_backtrace_hash(data[i]);
 
-					if (r_it->second.empty())
-						r_locked.erase(r_it);
-				}
+				put_lock_error(&out, mutex, lae_not_locked, hash, i);
 			}
 			// see if it is not locked by current tid (mistake)
-			// that is: not locked or waiting to acquire the w-lock
 			else {
-				auto tid_it = w_it->second.find(tid);
-				if (tid_it == w_it->second.end()) {
-					hash_t hash = calculate_backtrace_hash(data[i].caller, CALLER_DEPTH);
+				auto tid_it = entry->tids.find(tid);
+				if (tid_it == entry->tids.end()) {
+					hash_t hash = calculate_backtrace_hash(data[i]);
 
-					put_lock_error(&out, rwlock, lae_not_owner, hash, i);
+					put_lock_error(&out, mutex, lae_not_owner, hash, i);
 				}
 				else {
-					w_it->second.erase(tid_it);
+					entry->tids.erase(tid_it);
 				}
 
-				if (w_it->second.empty())
-					w_locked.erase(w_it);
+				if (entry->tids.empty())
+					lock_table_erase(&locked, mutex);
 			}
 		}
 	}
@@ -801,525 +1117,1981 @@ auto do_find_double_un_locks_rwlock(const lock_trace_item_t *const data, const s
 	return out;
 }
 
-void find_double_un_locks_rwlock(FILE *const fh, const lock_trace_item_t *const data, const uint64_t n_records)
+// the modules that were loaded in the traced process
+typedef struct {
+	std::string name, build_id;
+	uintptr_t base, lo, hi;
+	// what is given to the resolver, empty when not found
+	std::optional<std::string> file;
+} module_t;
+
+std::vector<module_t> modules;
+
+void load_modules(const json_t *const meta)
 {
-	auto rw_lock_mistakes = do_find_double_un_locks_rwlock(data, n_records);
+	// modules that were dlclose()d are only in the events
+	for(const char *key : { "modules", "dl_events" }) {
+		size_t index = 0;
+		json_t *js = nullptr;
+
+		json_array_foreach(json_object_get(meta, key), index, js) {
+			module_t m;
+			m.name     = get_json_string(js, "name");
+			m.build_id = get_json_string(js, "build_id");
+			m.base     = get_json_int(js, "base");
+			m.lo       = get_json_int(js, "lo");
+			m.hi       = get_json_int(js, "hi");
+
+			if (m.lo >= m.hi)
+				continue;
+
+			bool known = false;
+			for(auto & cur : modules)
+				known |= cur.name == m.name && cur.base == m.base;
+
+			if (!known)
+				modules.push_back(m);
+		}
+	}
+}
 
-	fprintf(fh, "<section>\n");
-	fprintf(fh, "<h2 id=\"doublerw\">6. r/w-lock lock/unlock mistakes</h2>\n");
-	fprintf(fh, "<p>Mistakes are: read-locking a r/w-lock another time by the same thread, unlocking r/w-locks that are not locked and unlocking of an r/w-lock by some other thread than the one who locked it.</p>\n");
-	fprintf(fh, "<p>This section contains a list of all the seen r/w-lock/error-type combinations and then for each the mistakes made and then one or more backtraces (\"first\" and \"next\") where they occured.</p>\n");
-	fprintf(fh, "<p>Count: %zu</p>\n", rw_lock_mistakes.size());
+module_t *find_module(const void *const p)
+{
+	for(auto & m : modules) {
+		if (uintptr_t(p) >= m.lo && uintptr_t(p) < m.hi)
+			return &m;
+	}
 
-	// go through all mutexes for which a mistake was made
-	for(auto rwlock_lock_mistake : rw_lock_mistakes) {
-		fprintf(fh, "<h3>r/w-lock %p, type \"%s\"</h3>\n", (const void *)rwlock_lock_mistake.first.first, lock_action_error_str[rwlock_lock_mistake.first.second]);
+	return nullptr;
+}
 
-		// go through every combination (lock + unlocks)
-		for(auto map_entry : rwlock_lock_mistake.second) {
-			double_un_lock_t & dul = map_entry.second;
+std::string read_build_id(const std::string & file)
+{
+	int fd = open(file.c_str(), O_RDONLY);
+	if (fd == -1)
+		return "";
+
+	std::string result;
+
+	// via the sections: in separate debug files the segments are empty
+	ElfW(Ehdr) eh;
+	if (pread(fd, &eh, sizeof eh, 0) == sizeof eh && memcmp(eh.e_ident, ELFMAG, SELFMAG) == 0 && eh.e_shentsize == sizeof(ElfW(Shdr))) {
+		for(int i=0; i<eh.e_shnum && result.empty(); i++) {
+			ElfW(Shdr) sh;
+			if (pread(fd, &sh, sizeof sh, eh.e_shoff + i * sizeof sh) != sizeof sh)
+				break;
 
-			// first (correct?)
-			if (dul.latest_records.empty() == false)
-				fprintf(fh, "<h4>first</h4>\n");
+			if (sh.sh_type != SHT_NOTE || sh.sh_size > 65536)
+				continue;
 
-			put_record_details_html(fh, data[dul.first_record], "yellow");
+			std::vector<char> notes(sh.sh_size);
+			if (pread(fd, notes.data(), sh.sh_size, sh.sh_offset) != ssize_t(sh.sh_size))
+				continue;
 
-			// then list all mistakes for this combination, show only unique backtraces
-			if (dul.latest_records.empty() == false) {
-				fprintf(fh, "<h4>next</h4>\n");
-				fprintf(fh, "<p>Mistake count: %zu (total number of backtraces seen; note that the list below is de-duplicated).</p>\n", dul.latest_records.size());
+			const size_t align = sh.sh_addralign == 8 ? 8 : 4;
+			size_t o = 0;
 
-				auto unique_backtraces = find_a_record_for_unique_backtrace_hashes(data, dul.latest_records);
+			while(o + sizeof(ElfW(Nhdr)) <= notes.size()) {
+				const ElfW(Nhdr) *const nh = (const ElfW(Nhdr) *)&notes[o];
+				const size_t name_o = o + sizeof(ElfW(Nhdr));
+				const size_t desc_o = name_o + ((nh->n_namesz + align - 1) & ~(align - 1));
 
-				for(auto entry : unique_backtraces) 
-					put_record_details_html(fh, data[entry.second], "yellow");
-			}
+				if (desc_o + nh->n_descsz > notes.size())
+					break;
 
-			fprintf(fh, "<br>\n");
+				if (nh->n_type == NT_GNU_BUILD_ID && nh->n_namesz == 4 && memcmp(&notes[name_o], "GNU", 4) == 0) {
+					for(size_t k=0; k<nh->n_descsz; k++)
+						result += myformat("%02x", uint8_t(notes[desc_o + k]));
+
+					break;
+				}
+
+				o = desc_o + ((nh->n_descsz + align - 1) & ~(align - 1));
+			}
 		}
 	}
 
-	fprintf(fh, "</section>\n");
+	close(fd);
+
+	return result;
 }
 
-void put_html_header(FILE *const fh, const bool run_correlate)
+// Prefers a file with the same build-id as the module that was traced:
+// a copy in the symbol directory, the original path, or the separate
+// debug file.
+std::string module_file(module_t *const m)
 {
-	fprintf(fh, "<!DOCTYPE html>\n<html lang=\"en\"><head>\n");
-	fprintf(fh, "<meta charset=\"utf-8\">\n");
-	fprintf(fh, "<style>.svgbox{height:768px;width:1024px;overflow:scroll}thead th{ background: #ffb0b0}table{font-size:16px;border-collapse:collapse;border-spacing:0;}td,th{border:1px solid #ddd;text-align:left;padding:8px}tr:nth-child(even){background-color:#f2f2f2}.green{background-color:#c0ffc0}.red{background-color:#ffc0c0}.blue{background-color:#c0c0ff}.yellow{background-color:#ffffa0}.magenta{background-color:#ffa0ff}th{padding-top:11px;padding-bottom:11px;background-color:#04aa6d;color:#fff}h1,h2,h3{margin-top:2.2em;}</style>\n");
-	fprintf(fh, "<title>lock trace</title></head><body>\n");
-	fprintf(fh, "<h1>LOCK TRACE</h1>\n");
+	if (m->file.has_value())
+		return m->file.value();
 
-	fprintf(fh, "<h2>table of contents</h2>\n");
-	fprintf(fh, "<p>Please note: the colors are only used for easier reading, they don't have a special meaning.</p>\n");
-	fprintf(fh, "<ol>\n");
-	fprintf(fh, "<li><a href=\"#meta\">meta data</a>\n");
-	fprintf(fh, "<li><a href=\"#durations\">durations</a>\n");
-	fprintf(fh, "<li><a class=\"green\" href=\"#errors\">errors</a>\n");
-	fprintf(fh, "<li><a class=\"red\" href=\"#doublem\">double lock/unlock mutexes</a>\n");
-	fprintf(fh, "<li><a class=\"blue\" href=\"#stillm\">still locked mutexes</a>\n");
-	fprintf(fh, "<li><a class=\"yellow\" href=\"#doublerw\">double lock/unlock r/w-locks</a>\n");
-	fprintf(fh, "<li><a class=\"magenta\" href=\"#stillrw\">still locked r/w-locks</a>\n");
-	fprintf(fh, "<li><a class=\"green\" href=\"#whereused\">where are locks used</a>\n");
-	if (run_correlate)
-		fprintf(fh, "<li><a href=\"#corr\">correlations between locks</a>\n");
-	fprintf(fh, "</ol>\n");
+	std::vector<std::string> candidates;
 
-	fprintf(fh, "<p>The \"tid\" is the thread identifier of the thread that triggered a measurement.</p>\n");
-}
+	if (symbol_dir.empty() == false) {
+		candidates.push_back(symbol_dir + "/" + m->name);
+		candidates.push_back(symbol_dir + "/" + m->name.substr(m->name.rfind('/') + 1));
+	}
 
-void put_html_tail(FILE *const fh)
-{
-	const char footer[] = "<p><br><br></p><hr><footer>This <b>locktracer</b> is (C) 2021 by Folkert van Heusden &lt;mail@vanheusden.com&gt;</footer></body></html>\n";
+	candidates.push_back(m->name);
 
-	if (fprintf(fh, "<p><br><br></p><hr><footer>This <b>locktracer</b> is (C) 2021 by Folkert van Heusden &lt;mail@vanheusden.com&gt;</footer></body></html>\n") != sizeof footer - 1)
-		fprintf(stderr, "Problem writing output-file: filesystem full?\n");
-}
+	if (m->build_id.size() > 2) {
+		std::string id_path = "/.build-id/" + m->build_id.substr(0, 2) + "/" + m->build_id.substr(2) + ".debug";
 
-std::string get_json_string(const json_t *const js, const char *const key)
-{
-	return json_string_value(json_object_get(js, key));
+		if (symbol_dir.empty() == false)
+			candidates.push_back(symbol_dir + id_path);
+
+		candidates.push_back("/usr/lib/debug" + id_path);
+	}
+
+	std::string fallback;
+
+	for(auto & candidate : candidates) {
+		if (access(candidate.c_str(), R_OK) != 0)
+			continue;
+
+		if (m->build_id.empty() || read_build_id(candidate) == m->build_id) {
+			m->file = candidate;
+
+			return candidate;
+		}
+
+		if (fallback.empty())
+			fallback = candidate;
+	}
+
+	if (fallback.empty())
+		fprintf(stderr, "%s (build-id %s) not found, its symbols are not resolved\n", m->name.c_str(), m->build_id.c_str());
+	else
+		fprintf(stderr, "%s: build-id differs from the traced one (%s), symbols may be wrong\n", fallback.c_str(), m->build_id.c_str());
+
+	m->file = fallback;
+
+	return fallback;
+}
+
+std::map<const void *, std::string> symbol_cache;
+
+std::string lookup_symbol(const void *const p)
+{
+	if (p == nullptr)
+		return "(nil)";
+
+	auto it = symbol_cache.find(p);
+	if (it != symbol_cache.end())
+		return it->second;
+
+	std::string command_line;
+	module_t *m = core_file.empty() ? find_module(p) : nullptr;
+
+	if (core_file.empty() == false)
+		command_line = myformat("%s -x -a -C --core %s %p", resolver.c_str(), core_file.c_str(), p);
+	else if (m && module_file(m).empty()) {
+		std::string result = myformat("%s+%#lx", m->name.c_str(), uintptr_t(p) - m->base);
+
+		symbol_cache.insert({ p, result });
+
+		return result;
+	}
+	else if (m)  // relative to where it was loaded
+		command_line = myformat("%s -x -a -C -e %s %#lx", resolver.c_str(), module_file(m).c_str(), uintptr_t(p) - m->base);
+	else
+		command_line = myformat("%s -x -a -C -e %s %p", resolver.c_str(), exe_file.c_str(), p);
+
+	char buffer[4096] { 0x00 };
+
+	FILE *fh = popen(command_line.c_str(), "r");
+	if (fh) {
+		if (fread(buffer, 1, sizeof buffer - 1, fh) == 0)
+			buffer[0] = 0x00;
+
+		for(;;) {
+			char *lf = strchr(buffer, '\n');
+			if (!lf)
+				break;
+
+			*lf = '/';
+		}
+
+		pclose(fh);
+	}
+	else {
+		fprintf(stderr, "Cannot resolve symbol (\"%s\"): %s\n", command_line.c_str(), strerror(errno));
+	}
+
+	char *lf = strchr(buffer, '\n');
+	if (lf)
+		*lf = 0x00;
+
+	std::string result = buffer;
+
+	if (result.substr(0, 2) == "??" || result == "")
+		result = myformat("%p", p);
+
+	symbol_cache.insert({ p, result });
+
+	return result;
+}
+
+#if defined(WITH_BACKTRACE)
+void put_call_trace_html(FILE *const fh, const void *const *const caller, const std::string & table_color)
+{
+	fprintf(fh, "<table class=\"%s\">\n", table_color.c_str());
+
+	int d = CALLER_DEPTH - 1;
+	while(d > 0 && caller[d] == nullptr)
+		d--;
+
+	for(int i=0; i<=d; i++)
+		fprintf(fh, "<tr><th>%p</th><td>%s</td></tr>\n", caller[i], lookup_symbol(caller[i]).c_str());
+
+	fprintf(fh, "</table>\n");
+}
+
+void put_call_trace_html(FILE *const fh, const lock_trace_item_t & record, const std::string & table_color)
+{
+	put_call_trace_html(fh, get_callers(record), table_color);
+}
+
+void put_call_trace_text(FILE *const fh, const lock_trace_item_t & record)
+{
+	const void *const *const caller = get_callers(record);
+
+	int d = CALLER_DEPTH - 1;
+	while(d > 0 && caller[d] == nullptr)
+		d--;
+
+	if (d >= 0) {
+		fprintf(fh, "\t");
+
+		for(int i=0; i<=d; i++)
+			fprintf(fh, "%p ", caller[i]);
+
+		fprintf(fh, "%s", lookup_symbol(caller[d]).c_str());
+	}
+}
+#endif
+
+constexpr uint64_t billion = 1000000000ll;
+
+std::string my_ctime(const uint64_t nts)
+{
+	time_t t = nts / billion;
+
+	struct tm tm { 0 };
+	localtime_r(&t, &tm);
+
+	return myformat("%04d-%02d-%02d %02d:%02d:%02d.%09d", tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday, tm.tm_hour, tm.tm_min, tm.tm_sec, int(nts % billion));
+}
+
+void put_record_details_html(FILE *const fh, const lock_trace_item_t & record, const std::string & base_color)
+{
+	fprintf(fh, "<table class=\"%s\">\n", base_color.c_str());
+	fprintf(fh, "<tr><th>tid</th><td>%d</td></tr>\n", record.tid);
+#ifdef STORE_THREAD_NAME
+	fprintf(fh, "<tr><th>thread name</th><td>%s</td></tr>\n", record.thread_name);
+#endif
+#ifdef MEASURE_TIMING
+	fprintf(fh, "<tr><th>action</th><td>%s</td></tr>\n", lock_action_to_name(record.la).c_str());
+	fprintf(fh, "<tr><th>lock</th><td>%p</td></tr>\n", record.lock);
+	fprintf(fh, "<tr><th>timestamp</th><td>%s</td></tr>\n", my_ctime(record.timestamp).c_str());
+	fprintf(fh, "<tr><th>took</th><td>%.3fus</td></tr>\n", record.lock_took / 1000.0);
+#endif
+
+#if defined(WITH_BACKTRACE)
+	fprintf(fh, "<tr><th>call trace</th><td>");
+	put_call_trace_html(fh, record, base_color);
+	fprintf(fh, "</td></tr>\n");
+#endif
+
+	fprintf(fh, "</table>\n");
+}
+
+// where a lock was initialized (or, if that was not seen, first used)
+void put_lock_origin_html(FILE *const fh, const lock_key_t key, const std::string & base_color)
+{
+#ifdef LOCK_REGISTRY
+	if (key & lock_key_address)
+		return;
+
+	const lock_registry_entry_t & entry = lock_registry[key];
+
+	fprintf(fh, "<table class=\"%s\">\n", base_color.c_str());
+#ifdef MEASURE_TIMING
+	fprintf(fh, "<tr><th>%s</th><td>%s</td></tr>\n", entry.initialized ? "created" : "first used", my_ctime(entry.created_ts).c_str());
+#else
+	fprintf(fh, "<tr><th>%s</th><td></td></tr>\n", entry.initialized ? "created" : "first used");
+#endif
+	if (entry.destroyed)
+		fprintf(fh, "<tr><th>destroyed</th><td>yes</td></tr>\n");
+#if defined(INTERN_STACKS)
+	if (entry.created_stack_id < n_stacks) {
+		fprintf(fh, "<tr><th>call trace</th><td>");
+		put_call_trace_html(fh, &stacks[uint64_t(entry.created_stack_id) * CALLER_DEPTH], base_color);
+		fprintf(fh, "</td></tr>\n");
+	}
+#elif defined(WITH_BACKTRACE)
+	fprintf(fh, "<tr><th>call trace</th><td>");
+	put_call_trace_html(fh, entry.created_caller, base_color);
+	fprintf(fh, "</td></tr>\n");
+#endif
+	fprintf(fh, "</table>\n");
+#endif
+}
+
+void put_record_details_text(FILE *const fh, const lock_trace_item_t & record)
+{
+	fprintf(fh, "%d", record.tid);
+#ifdef STORE_THREAD_NAME
+	if (record.thread_name[0])
+		fprintf(fh, "\t%s", record.thread_name);
+	else
+		fprintf(fh, "\t-");
+#endif
+#ifdef MEASURE_TIMING
+	fprintf(fh, "\t%s", lock_action_to_name(record.la).c_str());
+	fprintf(fh, "\t%p", record.lock);
+	fprintf(fh, "\t%s", my_ctime(record.timestamp).c_str());
+	fprintf(fh, "\t%.3fus", record.lock_took / 1000.);
+#endif
+
+#if defined(WITH_BACKTRACE)
+	put_call_trace_text(fh, record);
+#endif
+
+	fprintf(fh, "\n");
+}
+
+void put_record_details_sql(FILE *const fh, const lock_trace_item_t & record, const uint64_t nr)
+{
+	fprintf(fh, "INSERT INTO lock_trace(nr, tid, thread_name, action, lock, timestamp, took) "
+		    "VALUES(%zu, %d, \"%s\", \"%s\", \"%s\", %.9f, %.6f);\n",
+		    nr,
+		    record.tid,
+		    record.thread_name,
+		    lock_action_to_name(record.la).c_str(),
+		    myformat("%p", record.lock).c_str(),
+		    record.timestamp / 1000000000.,
+		    record.lock_took / 1000.);
+}
+
+std::map<hash_t, size_t> find_a_record_for_unique_backtrace_hashes(const lock_trace_item_t *const data, const std::vector<size_t> & backtraces)
+{
+	std::map<hash_t, size_t> out;
+
+	for(auto i : backtraces) {
+		hash_t hash = calculate_backtrace_hash(data[i]);
+
+		auto it = out.find(hash);
+		if (it == out.end())
+			out.insert({ hash, i });
+	}
+
+	return out;
+}
+
+void find_double_un_locks_mutex(FILE *const fh, const lock_trace_item_t *const data, const uint64_t n_records)
+{
+	auto mutex_lock_mistakes = do_find_double_un_locks_mutex(data, n_records);
+
+	fprintf(fh, "<section>\n");
+	fprintf(fh, "<h2 id=\"doublem\">4. mutex lock/unlock mistakes</h2>\n");
+	fprintf(fh, "<p>Mistakes are: locking a mutex another time by the same thread, unlocking mutexes that are not locked and unlocking of a mutex by some other thread than the one who locked the mutex. Spinlocks are checked the same way.</p>\n");
+	fprintf(fh, "<p>This section contains a list of all the seen mutex/error-type combinations and then for each the mistakes made and then one or more backtraces (\"first\" and \"next\") where they occured.</p>\n");
+	fprintf(fh, "<p>Count: %zu</p>\n", mutex_lock_mistakes.size());
+
+	for(auto mutex_lock_mistake : mutex_lock_mistakes) {
+		const lock_action_t la = data[mutex_lock_mistake.second.begin()->second.first_record].la;
+
+		fprintf(fh, "<h3>%s %s, type \"%s\"</h3>\n", exclusive_lock_kind(la), lock_name(mutex_lock_mistake.first.first).c_str(), lock_action_error_str[mutex_lock_mistake.first.second]);
+		put_lock_origin_html(fh, mutex_lock_mistake.first.first, "red");
+
+		for(auto map_entry : mutex_lock_mistake.second) {
+			double_un_lock_t & dul = map_entry.second;
+
+			// first (correct?)
+			if (dul.latest_records.empty() == false)
+				fprintf(fh, "<h4>first</h4>\n");
+			put_record_details_html(fh, data[dul.first_record], "red");
+
+			// then list all mistakes for this combination, show only unique backtraces
+			if (dul.latest_records.empty() == false) {
+				fprintf(fh, "<h4>next</h4>\n");
+				fprintf(fh, "<p>Mistake count: %zu (total number of backtraces seen; note that the list below is de-duplicated).</p>\n", dul.latest_records.size());
+
+				auto unique_backtraces = find_a_record_for_unique_backtrace_hashes(data, dul.latest_records);
+
+				for(auto entry : unique_backtraces) 
+					put_record_details_html(fh, data[entry.second], "red");
+			}
+
+			fprintf(fh, "<br>\n");
+		}
+	}
+
+	fprintf(fh, "</section>\n");
+}
+
+std::map<int, std::vector<size_t> > do_list_fuction_call_errors(const lock_trace_item_t *const data, const uint64_t n_records)
+{
+	std::map<int, std::vector<size_t> > errors;
+
+	for(size_t i=0; i<n_records; i++) {
+		if (data[i].rc == 0)
+			continue;
+
+		auto it = errors.find(data[i].rc);
+		if (it == errors.end())
+			errors.insert({ data[i].rc, { i } });
+		else
+			it->second.push_back(i);
+	}
+
+	return errors;
+}
+
+void list_fuction_call_errors(FILE *const fh, const lock_trace_item_t *const data, const uint64_t n_records)
+{
+	auto error_list = do_list_fuction_call_errors(data, n_records);
+
+	fprintf(fh, "<section>\n");
+	fprintf(fh, "<h2 id=\"errors\">3. function call errors</h2>\n");
+	fprintf(fh, "<p>pthread_-functions can fail, they then return an errno-alike error code. In this section, all that occured (for the ones checked, like mutex errors etc) are listed.</p>\n");
+	fprintf(fh, "<p>Count: %zu</p>\n", error_list.size());
+
+	for(auto it : error_list) {
+		fprintf(fh, "<h3>%s</h3>\n", strerror(it.first));
+
+		auto unique_backtraces = find_a_record_for_unique_backtrace_hashes(data, it.second);
+
+		for(auto entry : unique_backtraces)  {
+			put_record_details_html(fh, data[entry.second], "green");
+
+			fprintf(fh, "<br>\n");
+		}
+	}
+
+	fprintf(fh, "</section>\n");
+}
+
+// lock count & where it was locked
+typedef struct {
+	int count;
+	std::vector<size_t> where;
+} still_locked_t;
+
+std::map<lock_key_t, std::vector<size_t> > still_locked_list(lock_table_t<still_locked_t> *const table, const std::set<lock_key_t> & keys)
+{
+	std::map<lock_key_t, std::vector<size_t> > out;
+
+	for(auto key : keys) {
+		still_locked_t *const entry = lock_table_find(table, key);
+
+		if (entry)
+			out.insert({ key, entry->where });
+	}
+
+	return out;
+}
+
+std::map<lock_key_t, std::vector<size_t> > do_find_still_locked_mutex(const lock_trace_item_t *const data, const uint64_t n_records)
+{
+	lock_table_t<still_locked_t> mutexes;
+	std::set<lock_key_t> seen;
+
+	for(size_t i=0; i<n_records; i++) {
+		// ignore calls that failed
+		if (data[i].rc != 0)
+			continue;
+
+		const lock_key_t mutex = get_lock_key(data[i]);
+
+		if (is_exclusive_lock(data[i].la)) {
+			still_locked_t & entry = lock_table_get(&mutexes, mutex);
+
+			entry.count++;
+			entry.where.push_back(i);
+
+			seen.insert(mutex);
+		}
+		else if (is_exclusive_unlock(data[i].la)) {
+			still_locked_t *const entry = lock_table_find(&mutexes, mutex);
+
+			if (entry) {
+				if (entry->count > 0)
+					entry->count--;
+
+				if (entry->count == 0)
+					lock_table_erase(&mutexes, mutex);
+			}
+		}
+	}
+
+	return still_locked_list(&mutexes, seen);
+}
+
+void find_still_locked_mutex(FILE *const fh, const lock_trace_item_t *const data, const uint64_t n_records)
+{
+	auto still_locked_list = do_find_still_locked_mutex(data, n_records);
+
+	fprintf(fh, "<section>\n");
+	fprintf(fh, "<h2 id=\"stillm\">5. still locked mutexes</h2>\n");
+	fprintf(fh, "<p>A list of the mutexes (and spinlocks) that were still locked when the program terminated.</p>\n");
+	fprintf(fh, "<p>Count: %zu</p>\n", still_locked_list.size());
+
+	for(auto it : still_locked_list) {
+		fprintf(fh, "<h3>%s %s</h3>\n", exclusive_lock_kind(data[it.second.at(0)].la), lock_name(it.first).c_str());
+		put_lock_origin_html(fh, it.first, "blue");
+
+		auto unique_backtraces = find_a_record_for_unique_backtrace_hashes(data, it.second);
+
+		if (unique_backtraces.size() == 1)
+			fprintf(fh, "<p>The following location did not unlock:</p>\n");
+		else
+			fprintf(fh, "<p>One of the following locations did not unlock:</p>\n");
+
+		for(auto entry : unique_backtraces) {
+			put_record_details_html(fh, data[entry.second], "blue");
+
+			fprintf(fh, "<br>\n");
+		}
+	}
+
+	fprintf(fh, "</section>\n");
+}
+
+std::map<lock_key_t, std::vector<size_t> > do_find_still_locked_rwlock(const lock_trace_item_t *const data, const uint64_t n_records)
+{
+	lock_table_t<still_locked_t> rwlocks;
+	std::set<lock_key_t> seen;
+
+	for(size_t i=0; i<n_records; i++) {
+		// ignore calls that failed
+		if (data[i].rc != 0)
+			continue;
+
+		const lock_key_t rwlock = get_lock_key(data[i]);
+
+		if (is_read_lock(data[i].la) || is_write_lock(data[i].la)) {
+			still_locked_t & entry = lock_table_get(&rwlocks, rwlock);
+
+			entry.count++;
+			entry.where.push_back(i);
+
+			seen.insert(rwlock);
+		}
+		else if (data[i].la == a_rw_unlock) {
+			// here it is not important if it is the r or
+			// the w lock, as long as the count matches up
+			still_locked_t *const entry = lock_table_find(&rwlocks, rwlock);
+
+			if (entry) {
+				if (entry->count > 0)
+					entry->count--;
+
+				if (entry->count == 0)
+					lock_table_erase(&rwlocks, rwlock);
+			}
+		}
+	}
+
+	return still_locked_list(&rwlocks, seen);
+}
+
+void find_still_locked_rwlock(FILE *const fh, const lock_trace_item_t *const data, const uint64_t n_records)
+{
+	auto still_locked_list = do_find_still_locked_rwlock(data, n_records);
+
+	fprintf(fh, "<section>\n");
+	fprintf(fh, "<h2 id=\"stillrw\">7. still locked rwlocks</h2>\n");
+	fprintf(fh, "<p>A list of the r/w-locks that were still locked when the program terminated.</p>\n");
+	fprintf(fh, "<p>Count: %zu</p>\n", still_locked_list.size());
+
+	for(auto it : still_locked_list) {
+		fprintf(fh, "<h3>rwlock %s</h3>\n", lock_name(it.first).c_str());
+		put_lock_origin_html(fh, it.first, "magenta");
+
+		auto unique_backtraces = find_a_record_for_unique_backtrace_hashes(data, it.second);
+
+		if (unique_backtraces.size() == 1)
+			fprintf(fh, "<p>The following location did not unlock:</p>\n");
+		else
+			fprintf(fh, "<p>One of the following locations did not unlock:</p>\n");
+
+		for(auto entry : unique_backtraces) {
+			put_record_details_html(fh, data[entry.second], "magenta");
+
+			fprintf(fh, "<br>\n");
+		}
+	}
+
+	fprintf(fh, "</section>\n");
+}
+
+// see do_find_double_un_locks_mutex comment about false positives
+lock_errors_t do_find_double_un_locks_rwlock(const lock_trace_item_t *const data, const size_t n_records)
+{
+	lock_errors_t out;
+
+	std::map<lock_key_t, std::set<pid_t> > r_locked;
+	std::map<lock_key_t, std::set<pid_t> > w_locked;
+
+	for(size_t i=0; i<n_records; i++) {
+		// ignore calls that failed
+		if (data[i].rc != 0)
+			continue;
+
+		const lock_key_t rwlock = get_lock_key(data[i]);
+		const pid_t tid = data[i].tid;
+
+		if (is_read_lock(data[i].la)) {
+			// see if it is already locked by current 'tid' which is a mistake
+			auto it = r_locked.find(rwlock);
+			if (it != r_locked.end()) {
+				if (it->second.find(tid) != it->second.end()) {
+					hash_t hash = calculate_backtrace_hash(data[i]);
+
+					put_lock_error(&out, rwlock, lae_already_locked, hash, i);
+				}
+				else {
+					// new locker of this rwlock
+					it->second.insert(tid);
+				}
+			}
+			else {
+				// new rwlock
+				r_locked.insert({ rwlock, { tid } });
+			}
+		}
+		else if (is_write_lock(data[i].la)) {
+			auto it = w_locked.find(rwlock);
+			if (it != w_locked.end()) {
+				if (it->second.find(tid) != it->second.end()) {
+					hash_t hash = calculate_backtrace_hash(data[i]);
+
+					put_lock_error(&out, rwlock, lae_already_locked, hash, i);
+				}
+				else {
+					it->second.insert(tid);
+				}
+			}
+			else {
+				w_locked.insert({ rwlock, { tid } });
+			}
+		}
+		else if (data[i].la == a_rw_unlock) {
+			// see if it is not locked (mistake)
+			auto w_it = w_locked.find(rwlock);
+			if (w_it == w_locked.end()) {
+				// check r_locked
+
+				auto r_it = r_locked.find(rwlock);
+				if (r_it == r_locked.end()) {
+					hash_t hash = calculate_backtrace_hash(data[i]);
+
+					put_lock_error(&out, rwlock, lae_not_locked, hash, i);
+				}
+				// see if it is not locked by current tid (mistake)
+				else {
+					auto tid_it = r_it->second.find(tid);
+					if (tid_it == r_it->second.end()) {
+						hash_t hash = calculate_backtrace_hash(data[i]);
+
+						put_lock_error(&out, rwlock, lae_not_owner, hash, i);
+					}
+					else {
+						r_it->second.erase(tid_it);
+					}
+
+					if (r_it->second.empty())
+						r_locked.erase(r_it);
+				}
+			}
+			// see if it is not locked by current tid (mistake)
+			// that is: not locked or waiting to acquire the w-lock
+			else {
+				auto tid_it = w_it->second.find(tid);
+				if (tid_it == w_it->second.end()) {
+					hash_t hash = calculate_backtrace_hash(data[i]);
+
+					put_lock_error(&out, rwlock, lae_not_owner, hash, i);
+				}
+				else {
+					w_it->second.erase(tid_it);
+				}
+
+				if (w_it->second.empty())
+					w_locked.erase(w_it);
+			}
+		}
+	}
+
+	return out;
+}
+
+void find_double_un_locks_rwlock(FILE *const fh, const lock_trace_item_t *const data, const uint64_t n_records)
+{
+	auto rw_lock_mistakes = do_find_double_un_locks_rwlock(data, n_records);
+
+	fprintf(fh, "<section>\n");
+	fprintf(fh, "<h2 id=\"doublerw\">6. r/w-lock lock/unlock mistakes</h2>\n");
+	fprintf(fh, "<p>Mistakes are: read-locking a r/w-lock another time by the same thread, unlocking r/w-locks that are not locked and unlocking of an r/w-lock by some other thread than the one who locked it.</p>\n");
+	fprintf(fh, "<p>This section contains a list of all the seen r/w-lock/error-type combinations and then for each the mistakes made and then one or more backtraces (\"first\" and \"next\") where they occured.</p>\n");
+	fprintf(fh, "<p>Count: %zu</p>\n", rw_lock_mistakes.size());
+
+	// go through all mutexes for which a mistake was made
+	for(auto rwlock_lock_mistake : rw_lock_mistakes) {
+		fprintf(fh, "<h3>r/w-lock %s, type \"%s\"</h3>\n", lock_name(rwlock_lock_mistake.first.first).c_str(), lock_action_error_str[rwlock_lock_mistake.first.second]);
+		put_lock_origin_html(fh, rwlock_lock_mistake.first.first, "yellow");
+
+		// go through every combination (lock + unlocks)
+		for(auto map_entry : rwlock_lock_mistake.second) {
+			double_un_lock_t & dul = map_entry.second;
+
+			// first (correct?)
+			if (dul.latest_records.empty() == false)
+				fprintf(fh, "<h4>first</h4>\n");
+
+			put_record_details_html(fh, data[dul.first_record], "yellow");
+
+			// then list all mistakes for this combination, show only unique backtraces
+			if (dul.latest_records.empty() == false) {
+				fprintf(fh, "<h4>next</h4>\n");
+				fprintf(fh, "<p>Mistake count: %zu (total number of backtraces seen; note that the list below is de-duplicated).</p>\n", dul.latest_records.size());
+
+				auto unique_backtraces = find_a_record_for_unique_backtrace_hashes(data, dul.latest_records);
+
+				for(auto entry : unique_backtraces) 
+					put_record_details_html(fh, data[entry.second], "yellow");
+			}
+
+			fprintf(fh, "<br>\n");
+		}
+	}
+
+	fprintf(fh, "</section>\n");
+}
+
+void put_html_head(FILE *const fh)
+{
+	fprintf(fh, "<!DOCTYPE html>\n<html lang=\"en\"><head>\n");
+	fprintf(fh, "<meta charset=\"utf-8\">\n");
+	fprintf(fh, "<style>.svgbox{height:768px;width:1024px;overflow:scroll}thead th{ background: #ffb0b0}table{font-size:16px;border-collapse:collapse;border-spacing:0;}td,th{border:1px solid #ddd;text-align:left;padding:8px}tr:nth-child(even){background-color:#f2f2f2}.green{background-color:#c0ffc0}.red{background-color:#ffc0c0}.blue{background-color:#c0c0ff}.yellow{background-color:#ffffa0}.magenta{background-color:#ffa0ff}th{padding-top:11px;padding-bottom:11px;background-color:#04aa6d;color:#fff}h1,h2,h3{margin-top:2.2em;}</style>\n");
+	fprintf(fh, "<title>lock trace</title></head><body>\n");
+	fprintf(fh, "<h1>LOCK TRACE</h1>\n");
+}
+
+void put_html_header(FILE *const fh, const bool run_correlate, const bool contention)
+{
+	put_html_head(fh);
+
+	fprintf(fh, "<h2>table of contents</h2>\n");
+	fprintf(fh, "<p>Please note: the colors are only used for easier reading, they don't have a special meaning.</p>\n");
+	fprintf(fh, "<ol>\n");
+	fprintf(fh, "<li><a href=\"#meta\">meta data</a>\n");
+	fprintf(fh, "<li><a href=\"#durations\">durations</a>\n");
+	fprintf(fh, "<li><a class=\"green\" href=\"#errors\">errors</a>\n");
+	fprintf(fh, "<li><a class=\"red\" href=\"#doublem\">double lock/unlock mutexes</a>\n");
+	fprintf(fh, "<li><a class=\"blue\" href=\"#stillm\">still locked mutexes</a>\n");
+	fprintf(fh, "<li><a class=\"yellow\" href=\"#doublerw\">double lock/unlock r/w-locks</a>\n");
+	fprintf(fh, "<li><a class=\"magenta\" href=\"#stillrw\">still locked r/w-locks</a>\n");
+	fprintf(fh, "<li><a class=\"green\" href=\"#whereused\">where are locks used</a>\n");
+	fprintf(fh, "<li><a href=\"#condvars\">condition variables</a>\n");
+	fprintf(fh, "<li><a href=\"#sync\">spinlocks, semaphores and barriers</a>\n");
+	fprintf(fh, "<li><a href=\"#timed\">timed locks</a>\n");
+	if (contention)
+		fprintf(fh, "<li><a href=\"#contention\">contention rates</a>\n");
+	if (run_correlate)
+		fprintf(fh, "<li><a href=\"#corr\">correlations between locks</a>\n");
+	fprintf(fh, "</ol>\n");
+
+	fprintf(fh, "<p>The \"tid\" is the thread identifier of the thread that triggered a measurement.</p>\n");
+}
+
+void put_html_tail(FILE *const fh)
+{
+	const char footer[] = "<p><br><br></p><hr><footer>This <b>locktracer</b> is (C) 2021 by Folkert van Heusden &lt;mail@vanheusden.com&gt;</footer></body></html>\n";
+
+	if (fprintf(fh, "<p><br><br></p><hr><footer>This <b>locktracer</b> is (C) 2021 by Folkert van Heusden &lt;mail@vanheusden.com&gt;</footer></body></html>\n") != sizeof footer - 1)
+		fprintf(stderr, "Problem writing output-file: filesystem full?\n");
+}
+
+// with TRACE_SAMPLE_RATE only lock/unlock records are sampled
+bool is_sampled_action(const lock_action_t la)
+{
+	return is_exclusive_lock(la) || is_exclusive_unlock(la) || la == a_r_lock || la == a_w_lock || la == a_rw_unlock || la == a_sem_wait || la == a_sem_post || la == a_barrier_wait || is_timed_lock(la);
+}
+
+// name -> count, sampled
+std::map<std::string, std::pair<uint64_t, bool> > data_stats(const lock_trace_item_t *const data, const uint64_t n_records)
+{
+	uint64_t cnts[_a_max][2] { { 0, 0 } };
+
+	for(uint64_t i=0; i<n_records; i++)
+		cnts[data[i].la][!!data[i].rc]++;
+
+	const std::pair<const char *, lock_action_t> names[] {
+		{ "mutex locks", a_lock },
+		{ "mutex unlocks", a_unlock },
+		{ "pthread_clean", a_thread_clean },
+		{ "rw read lock", a_r_lock },
+		{ "rw write lock", a_w_lock },
+		{ "rw unlock", a_rw_unlock },
+		{ "mutex init", a_init },
+		{ "mutex destroy", a_destroy },
+		{ "rw init", a_rw_init },
+		{ "rw destroy", a_rw_destroy },
+		{ "cond wait", a_cond_wait },
+		{ "cond wakeup", a_cond_woken },
+		{ "cond signal", a_cond_signal },
+		{ "cond broadcast", a_cond_broadcast },
+		{ "spin locks", a_spin_lock },
+		{ "spin unlocks", a_spin_unlock },
+		{ "sem waits", a_sem_wait },
+		{ "sem posts", a_sem_post },
+		{ "barrier waits", a_barrier_wait },
+		{ "mutex timed locks", a_timed_lock },
+		{ "rw timed read lock", a_timed_r_lock },
+		{ "rw timed write lock", a_timed_w_lock } };
+
+	std::map<std::string, std::pair<uint64_t, bool> > out;
+
+	for(auto & name : names) {
+		out.insert({ name.first, { cnts[name.second][0], is_sampled_action(name.second) } });
+		out.insert({ std::string("failed ") + name.first, { cnts[name.second][1], is_sampled_action(name.second) } });
+	}
+
+	return out;
+}
+
+// With sampling, n recorded events estimate n * sample_rate events. The
+// error bound is the 95% interval of that binomial estimate.
+std::string estimate_count(const uint64_t n, const uint64_t sample_rate)
+{
+	if (sample_rate <= 1)
+		return myformat("%lu", n);
+
+	double se = sample_rate * sqrt(n * (1. - 1. / sample_rate));
+
+	return myformat("~%.0f &plusmn; %.0f (%lu recorded)", n * double(sample_rate), 1.96 * se, n);
+}
+
+// streaming mode: the dump has no segment list, the chunk headers have the nodes
+void count_chunk_nodes(const json_t *const meta, std::map<int, std::pair<uint64_t, uint64_t> > *const per_node)
+{
+	size_t size = 0;
+	const uint8_t *data = (const uint8_t *)map_file(get_json_string(meta, "measurements"), &size);
+	if (!data)
+		return;
+
+	const uint8_t *p = data;
+	const uint8_t *const end = data + size;
+
+	while(p + sizeof(trace_chunk_header_t) <= end) {
+		const trace_chunk_header_t *header = (const trace_chunk_header_t *)p;
+
+		if (header->magic != TRACE_CHUNK_MAGIC)
+			break;
+
+		(*per_node)[header->memory_node].first++;
+
+		if (header->node != header->memory_node)
+			(*per_node)[header->memory_node].second++;
+
+		p += sizeof(trace_chunk_header_t) + header->n_records * header->record_size;
+	}
+
+	munmap(const_cast<uint8_t *>(data), size);
+}
+
+void emit_meta_data(FILE *const fh, const json_t *const meta, const std::string & core_file_in, const std::string & trace_file, const lock_trace_item_t *const data, const uint64_t n_records)
+{
+	fprintf(fh, "<h2 id=\"meta\">1. META DATA</h2>\n");
+	fprintf(fh, "<table><tr><th colspan=2>meta data</th></tr>\n");
+	fprintf(fh, "<tr><th>executable</th><td>%s</td></tr>\n", get_json_string(meta, "exe_name").c_str());
+	fprintf(fh, "<tr><th>PID</th><td>%ld</td></tr>\n", get_json_int(meta, "pid"));
+	fprintf(fh, "<tr><th>scheduler</th><td>%s</td></tr>\n", get_json_string(meta, "scheduler").c_str());
+	fprintf(fh, "<tr><th>host name</th><td>%s</td></tr>\n", get_json_string(meta, "hostname").c_str());
+	fprintf(fh, "<tr><th>core file</th><td>%s</td></tr>\n", core_file_in.c_str());
+	if (json_object_get(meta, "modules"))
+		fprintf(fh, "<tr><th>modules</th><td>%zu loaded, %zu dlopen/dlclose events</td></tr>\n", json_array_size(json_object_get(meta, "modules")), json_array_size(json_object_get(meta, "dl_events")));
+	fprintf(fh, "<tr><th>trace file</th><td>%s</td></tr>\n", trace_file.c_str());
+	double took = double(get_json_int(meta, "end_ts") - get_json_int(meta, "start_ts")) / billion;
+	uint64_t _n_records = get_json_int(meta, "n_records");
+	uint64_t _n_records_max = get_json_int(meta, "n_records_max");
+	double n_per_sec = took > 0 ? _n_records / took: 0;
+	// n_records_max is in full-size records
+	if (json_object_get(meta, "aggregate"))
+		fprintf(fh, "<tr><th>mode</th><td>aggregate: no trace records, only histograms</td></tr>\n");
+	else if (json_object_get(meta, "compact"))
+		fprintf(fh, "<tr><th># trace records</th><td>%lu (compact format, %.0f/s)</td></tr>\n", _n_records, n_per_sec);
+	else
+		fprintf(fh, "<tr><th># trace records</th><td>%lu (%.2f%%, %.2f%%/s)</td></tr>\n", _n_records, _n_records * 100.0 / _n_records_max, n_per_sec * 100.0 / _n_records_max);
+	if (json_object_get(meta, "segment_records"))
+		fprintf(fh, "<tr><th>per-thread segment size</th><td>%ld records</td></tr>\n", get_json_int(meta, "segment_records"));
+	const json_t *numa_regions = json_object_get(meta, "numa_regions");
+	if (json_array_size(numa_regions)) {
+		// memory node -> segments, segments written by threads on an other node
+		std::map<int, std::pair<uint64_t, uint64_t> > per_node;
+
+		if (is_stream(meta))
+			count_chunk_nodes(meta, &per_node);
+		else {
+			const json_t *segments = json_object_get(meta, "segments");
+			for(size_t i=0; i<json_array_size(segments); i++) {
+				const json_t *segment = json_array_get(segments, i);
+				const int memory_node = get_json_int(segment, "memory_node");
+
+				per_node[memory_node].first++;
+
+				if (get_json_int(segment, "node") != memory_node)
+					per_node[memory_node].second++;
+			}
+		}
+
+		std::string text;
+		for(size_t i=0; i<json_array_size(numa_regions); i++) {
+			const int node = get_json_int(json_array_get(numa_regions, i), "node");
+
+			text += myformat("%snode %d: %lu segments used, %lu of them by threads on an other node", i ? "<br>" : "", node, per_node[node].first, per_node[node].second);
+		}
+
+		fprintf(fh, "<tr><th>NUMA regions</th><td>%s</td></tr>\n", text.c_str());
+	}
+	if (json_object_get(meta, "snapshot"))
+		fprintf(fh, "<tr><th>snapshot</th><td>%ld (trigger: %s)</td></tr>\n", get_json_int(meta, "snapshot"), get_json_string(meta, "trigger").c_str());
+	if (get_json_int(meta, "ring_buffer"))
+		fprintf(fh, "<tr><th>flight-recorder</th><td>ring buffer: only the most recent records were kept</td></tr>\n");
+	const uint64_t sample_rate = std::max(int64_t(1), get_json_int(meta, "sample_rate"));
+	if (sample_rate > 1)
+		fprintf(fh, "<tr><th>sampling</th><td>1 in %lu lock acquisitions was recorded (with its unlock): counts are estimates, averages are based on the recorded ones</td></tr>\n", sample_rate);
+	if (get_json_int(meta, "sampled_held_full"))
+		fprintf(fh, "<tr><th>not recorded</th><td>%ld acquisitions: the thread held too many recorded locks to keep track of their unlocks</td></tr>\n", get_json_int(meta, "sampled_held_full"));
+	const json_t *filter = json_object_get(meta, "filter");
+	if (filter) {
+		std::string text;
+
+		const json_t *addr = json_object_get(filter, "addr");
+		for(size_t i=0; i<json_array_size(addr); i++) {
+			const json_t *range = json_array_get(addr, i);
+
+			text += myformat("%saddress %lx-%lx", text.empty() ? "" : "<br>", json_integer_value(json_array_get(range, 0)), json_integer_value(json_array_get(range, 1)));
+		}
+
+		for(auto & key : { "caller", "init" }) {
+			const json_t *modules = json_object_get(filter, key);
+
+			for(size_t i=0; i<json_array_size(modules); i++)
+				text += myformat("%s%s %s", text.empty() ? "" : "<br>", key, json_string_value(json_array_get(modules, i)));
+		}
+
+		if (!get_json_string(filter, "name").empty())
+			text += myformat("%sname %s", text.empty() ? "" : "<br>", get_json_string(filter, "name").c_str());
+
+		if (get_json_int(filter, "locks_traced") || get_json_int(filter, "locks_skipped"))
+			text += myformat("<br>%ld locks traced, %ld skipped", get_json_int(filter, "locks_traced"), get_json_int(filter, "locks_skipped"));
+
+		if (get_json_int(filter, "held_full"))
+			text += myformat("<br>%ld acquisitions from selected callers not traced: too many locks held by a thread", get_json_int(filter, "held_full"));
+
+		fprintf(fh, "<tr><th>lock filter</th><td>%s</td></tr>\n", text.c_str());
+	}
+	if (json_object_get(meta, "variant"))
+		fprintf(fh, "<tr><th>tracer variant</th><td>%s</td></tr>\n", get_json_string(meta, "variant").c_str());
+	if (json_object_get(meta, "hugepages") && get_json_string(meta, "hugepages") != "none") {
+		auto pages_name = [](const std::string & name) { return name == "thp" ? "transparent huge pages" : "huge pages (hugetlb)"; };
+
+		std::string text = pages_name(get_json_string(meta, "hugepages"));
+
+		// when the reserved huge pages ran out for the second buffer
+		if (json_object_get(meta, "ug_hugepages") && get_json_string(meta, "ug_hugepages") != get_json_string(meta, "hugepages"))
+			text += myformat(", usage groups: %s", pages_name(get_json_string(meta, "ug_hugepages")));
+
+		fprintf(fh, "<tr><th>trace buffer pages</th><td>%s</td></tr>\n", text.c_str());
+	}
+	if (is_stream(meta))
+		fprintf(fh, "<tr><th>streamed</th><td>%ld records dropped (writer could not keep up)</td></tr>\n", get_json_int(meta, "stream_dropped"));
+	if (json_object_get(meta, "n_locks")) {
+		if (get_json_int(meta, "locks_full"))
+			fprintf(fh, "<tr><th># locks</th><td>%ld (registry was full, %ld uses of other locks were not registered)</td></tr>\n", get_json_int(meta, "n_locks"), get_json_int(meta, "locks_full"));
+		else
+			fprintf(fh, "<tr><th># locks</th><td>%ld</td></tr>\n", get_json_int(meta, "n_locks"));
+	}
+	if (get_json_int(meta, "fork_ts"))
+		fprintf(fh, "<tr><th>forked from</th><td>%ld at %s</td></tr>\n", get_json_int(meta, "parent_pid"), my_ctime(get_json_int(meta, "fork_ts")).c_str());
+	else if (get_json_int(meta, "fork_warning"))
+		fprintf(fh, "<tr><th>fork warning</th><td>the process forked, the trace may be corrupt</td></tr>\n");
+	const json_t *children = json_object_get(meta, "children");
+	if (json_array_size(children)) {
+		std::string list;
+		for(size_t i=0; i<json_array_size(children); i++)
+			list += myformat("%s%lld", i ? ", " : "", json_integer_value(json_array_get(children, i)));
+
+		fprintf(fh, "<tr><th>child processes</th><td>%s (combined report with -P)</td></tr>\n", list.c_str());
+	}
+	fprintf(fh, "<tr><th># cores</th><td>%ld</td></tr>\n", get_json_int(meta, "n_procs"));
+	uint64_t start_ts = get_json_int(meta, "start_ts");
+	uint64_t end_ts = get_json_int(meta, "end_ts");
+	fprintf(fh, "<tr><th>started at</th><td>%.9f (%s)</td></tr>\n", start_ts / double(billion), my_ctime(start_ts).c_str());
+	fprintf(fh, "<tr><th>stopped at</th><td>%.9f (%s)</td></tr>\n", end_ts / double(billion), my_ctime(end_ts).c_str());
+	fprintf(fh, "<tr><th>took</th><td>%fs</td></tr>\n", took);
+	fprintf(fh, "</table>\n");
+
+	fprintf(fh, "<h3>counts</h3>\n");
+	fprintf(fh, "<table>\n");
+	fprintf(fh, "<tr><th># mutex try-locks</th><td>%ld</td></tr>\n", get_json_int(meta, "cnt_mutex_trylock"));
+	fprintf(fh, "<tr><th># mutex timed-locks</th><td>%ld</td></tr>\n", get_json_int(meta, "cnt_mutex_timedlock"));
+	fprintf(fh, "<tr><th># rwlock try-rdlock</th><td>%ld</td></tr>\n", get_json_int(meta, "cnt_rwlock_try_rdlock"));
+	fprintf(fh, "<tr><th># rwlock try-timed-rdlock</th><td>%ld</td></tr>\n", get_json_int(meta, "cnt_rwlock_try_timedrdlock"));
+	fprintf(fh, "<tr><th># rwlock try-wrlock</th><td>%ld</td></tr>\n", get_json_int(meta, "cnt_rwlock_try_wrlock"));
+	fprintf(fh, "<tr><th># rwlock try-timed-rwlock</th><td>%ld</td></tr>\n", get_json_int(meta, "cnt_rwlock_try_timedwrlock"));
+
+	assert(n_records == _n_records);
+	auto ds = data_stats(data, n_records);
+	for(auto ds_entry : ds)
+		fprintf(fh, "<tr><th>%s</th><td>%s</td></tr>\n", ds_entry.first.c_str(), estimate_count(ds_entry.second.first, ds_entry.second.second ? sample_rate : 1).c_str());
+
+	fprintf(fh, "</table>\n");
+}
+
+typedef struct {
+	uint64_t mutex_lock_acquire_durations, n_mutex_acquire_locks, mutex_lock_acquire_sd, mutex_lock_acquire_max;
+} durations_mutex_t;
+
+typedef struct {
+	uint64_t mutex_locked_durations, n_mutex_locked_durations, mutex_locked_durations_sd, mutex_locked_durations_max;
+} locked_durations_mutex_t;
+
+typedef struct {
+	uint64_t rwlock_r_lock_acquire_durations, n_rwlock_r_acquire_locks, rwlock_r_lock_acquire_sd, rwlock_r_lock_acquire_max;
+} durations_rwlock_r_t;
+
+typedef struct {
+	uint64_t rwlock_w_lock_acquire_durations, n_rwlock_w_acquire_locks, rwlock_w_lock_acquire_sd, rwlock_w_lock_acquire_max;
+} durations_rwlock_w_t;
+
+typedef struct {
+	uint64_t rwlock_r_locked_durations, n_rwlock_r_locked, rwlock_r_locked_sd, rwlock_r_locked_max;
+	uint64_t rwlock_w_locked_durations, n_rwlock_w_locked, rwlock_w_locked_sd, rwlock_w_locked_max;
+} locked_durations_rwlock_t;
+
+typedef struct {
+	// acquire
+	durations_mutex_t durations_mutex;
+	std::map<pthread_mutex_t *, durations_mutex_t> per_mutex_durations;
+	// hold
+	locked_durations_mutex_t locked_durations;
+	std::map<pthread_mutex_t *, locked_durations_mutex_t> per_mutex_locked_durations;
+
+	// acquire
+	durations_rwlock_r_t durations_r_rwlock;
+	durations_rwlock_w_t durations_w_rwlock;
+	std::map<pthread_rwlock_t *, durations_rwlock_r_t> per_rwlock_r_acquire_durations;
+	std::map<pthread_rwlock_t *, durations_rwlock_w_t> per_rwlock_w_acquire_durations;
+	// hold
+	std::map<pthread_rwlock_t *, locked_durations_rwlock_t> per_rwlock_locked_durations;
+} durations_t;
+
+typedef struct {
+	uint64_t w_timestamp;
+	int __cur_writer;  // tid of who holds the write lock
+
+	uint64_t r_timestamp;
+} rwlock_holder_t;
+
+durations_t do_determine_durations(const lock_trace_item_t *const data, const uint64_t n_records)
+{
+	durations_t d;
+	d.durations_mutex = { 0 };
+	d.locked_durations = { 0 };
+	d.durations_r_rwlock = { 0 };
+	d.durations_w_rwlock = { 0 };
+
+	std::map<pthread_mutex_t *, uint64_t> mutex_acquire_timestamp;
+
+	std::map<pthread_rwlock_t *, rwlock_holder_t> rwlock_acquire_timestamp;
+
+	for(uint64_t i=0; i<n_records; i++) {
+		if (data[i].rc != 0)  // ignore failed calls
+			continue;
+
+		const uint64_t took = data[i].lock_took;
+
+		if (data[i].la == a_lock || data[i].la == a_timed_lock) {
+			d.durations_mutex.mutex_lock_acquire_durations += took;
+			d.durations_mutex.mutex_lock_acquire_sd += took * took;
+			d.durations_mutex.mutex_lock_acquire_max = std::max(d.durations_mutex.mutex_lock_acquire_max, took);
+			d.durations_mutex.n_mutex_acquire_locks++;
+
+			pthread_mutex_t *mutex_lock = (pthread_mutex_t *)data[i].lock;
+
+			mutex_acquire_timestamp.insert({ mutex_lock, data[i].timestamp });
+
+			auto it = d.per_mutex_durations.find(mutex_lock);
+			if (it == d.per_mutex_durations.end())
+				d.per_mutex_durations.insert({ mutex_lock, { took, 1, took * took, took } });
+			else {
+				it->second.mutex_lock_acquire_durations += took;
+				it->second.n_mutex_acquire_locks++;
+				it->second.mutex_lock_acquire_sd += took * took;
+				it->second.mutex_lock_acquire_max = std::max(it->second.mutex_lock_acquire_max, took);
+			}
+		}
+		else if (data[i].la == a_cond_woken) {
+			// held again, but the wait is not an acquisition duration
+			mutex_acquire_timestamp.insert({ (pthread_mutex_t *)data[i].lock, data[i].timestamp });
+		}
+		else if (data[i].la == a_unlock || data[i].la == a_cond_wait) {
+			auto lock_it = mutex_acquire_timestamp.find((pthread_mutex_t *)data[i].lock);
+
+			if (lock_it != mutex_acquire_timestamp.end()) {
+				uint64_t t_delta_took = data[i].timestamp - lock_it->second;
+
+				mutex_acquire_timestamp.erase(lock_it);
+
+				d.locked_durations.mutex_locked_durations += t_delta_took;
+				d.locked_durations.n_mutex_locked_durations++;
+				d.locked_durations.mutex_locked_durations_sd += t_delta_took * t_delta_took;
+				d.locked_durations.mutex_locked_durations_sd = std::max(d.locked_durations.mutex_locked_durations_max, t_delta_took);
+
+				pthread_mutex_t *mutex_lock = (pthread_mutex_t *)data[i].lock;
+
+				auto it = d.per_mutex_locked_durations.find(mutex_lock);
+				if (it == d.per_mutex_locked_durations.end())
+					d.per_mutex_locked_durations.insert({ mutex_lock, { t_delta_took, 1, t_delta_took * t_delta_took, t_delta_took } });
+				else {
+					it->second.mutex_locked_durations += t_delta_took;
+					it->second.n_mutex_locked_durations++;
+					it->second.mutex_locked_durations_sd += t_delta_took * t_delta_took;
+					it->second.mutex_locked_durations_sd = std::max(it->second.mutex_locked_durations_max, t_delta_took);
+				}
+			}
+		}
+		else if (is_read_lock(data[i].la)) {
+			pthread_rwlock_t *rwlock_lock = (pthread_rwlock_t *)data[i].lock;
+
+			// acquiring
+			d.durations_r_rwlock.rwlock_r_lock_acquire_durations += took;
+			d.durations_r_rwlock.n_rwlock_r_acquire_locks++;
+			d.durations_r_rwlock.rwlock_r_lock_acquire_sd += took * took;
+			d.durations_r_rwlock.rwlock_r_lock_acquire_max = std::max(d.durations_r_rwlock.rwlock_r_lock_acquire_max, took);
+			// per lock 'r_took'
+			auto ar_it = d.per_rwlock_r_acquire_durations.find(rwlock_lock);
+			if (ar_it == d.per_rwlock_r_acquire_durations.end())
+				d.per_rwlock_r_acquire_durations.insert({ rwlock_lock, { took, 1, took * took, took } });
+			else {
+				ar_it->second.rwlock_r_lock_acquire_durations += took;
+				ar_it->second.n_rwlock_r_acquire_locks++;
+				ar_it->second.rwlock_r_lock_acquire_sd += took * took;
+				ar_it->second.rwlock_r_lock_acquire_max = std::max(ar_it->second.rwlock_r_lock_acquire_max, took);
+			}
+
+			// locked durations
+			auto d_it = rwlock_acquire_timestamp.find(rwlock_lock);
+			if (d_it == rwlock_acquire_timestamp.end())
+				rwlock_acquire_timestamp.insert({ rwlock_lock, { 0, 0, data[i].timestamp } });
+			else
+				d_it->second.r_timestamp = data[i].timestamp;
+		}
+		else if (is_write_lock(data[i].la)) {
+			pthread_rwlock_t *rwlock_lock = (pthread_rwlock_t *)data[i].lock;
+
+			// acquiring
+			d.durations_w_rwlock.rwlock_w_lock_acquire_durations += took;
+			d.durations_w_rwlock.rwlock_w_lock_acquire_sd += took * took;
+			d.durations_w_rwlock.rwlock_w_lock_acquire_max = std::max(d.durations_w_rwlock.rwlock_w_lock_acquire_max, took);
+			d.durations_w_rwlock.n_rwlock_w_acquire_locks++;
+			// per lock 'w_took'
+			auto aw_it = d.per_rwlock_w_acquire_durations.find(rwlock_lock);
+			if (aw_it == d.per_rwlock_w_acquire_durations.end())
+				d.per_rwlock_w_acquire_durations.insert({ rwlock_lock, { took, 1, took * took, took } });
+			else {
+				aw_it->second.rwlock_w_lock_acquire_durations += took;
+				aw_it->second.n_rwlock_w_acquire_locks++;
+				aw_it->second.rwlock_w_lock_acquire_sd += took * took;
+				aw_it->second.rwlock_w_lock_acquire_max = std::max(aw_it->second.rwlock_w_lock_acquire_max, took);
+			}
+
+			// locked durations
+			auto it = rwlock_acquire_timestamp.find(rwlock_lock);
+			if (it == rwlock_acquire_timestamp.end())
+				rwlock_acquire_timestamp.insert({ rwlock_lock, { data[i].timestamp, data[i].tid, 0 } });
+			else {
+				it->second.w_timestamp = data[i].timestamp;
+				it->second.__cur_writer = data[i].tid;
+			}
+		}
+		else if (data[i].la == a_rw_unlock) {
+			pthread_rwlock_t *rwlock_lock = (pthread_rwlock_t *)data[i].lock;
+
+			auto lock_it = rwlock_acquire_timestamp.find(rwlock_lock);
+
+			if (lock_it != rwlock_acquire_timestamp.end()) {
+				if (lock_it->second.__cur_writer == data[i].tid && lock_it->second.w_timestamp > 0) {  // write lock
+					uint64_t t_delta_took = data[i].timestamp - lock_it->second.w_timestamp;
+
+					lock_it->second.w_timestamp = 0;
+
+					auto it = d.per_rwlock_locked_durations.find(rwlock_lock);
+
+					if (it != d.per_rwlock_locked_durations.end()) {
+						it->second.rwlock_w_locked_durations += t_delta_took;
+						it->second.n_rwlock_w_locked++;
+						it->second.rwlock_w_locked_sd += t_delta_took * t_delta_took;
+						it->second.rwlock_w_locked_max = std::max(it->second.rwlock_w_locked_max, t_delta_took);
+					}
+					else {
+						d.per_rwlock_locked_durations.insert({ rwlock_lock, { 0, 0, 0, t_delta_took, 1, t_delta_took * t_delta_took, t_delta_took } });
+					}
+				}
+				else if (lock_it->second.r_timestamp > 0) {  // read lock
+					uint64_t t_delta_took = data[i].timestamp - lock_it->second.r_timestamp;
+
+					lock_it->second.r_timestamp = 0;
+
+					auto it = d.per_rwlock_locked_durations.find(rwlock_lock);
+
+					if (it != d.per_rwlock_locked_durations.end()) {
+						it->second.rwlock_r_locked_durations += t_delta_took;
+						it->second.n_rwlock_r_locked++;
+						it->second.rwlock_r_locked_sd += t_delta_took * t_delta_took;
+						it->second.rwlock_r_locked_max = std::max(it->second.rwlock_r_locked_max, t_delta_took);
+					}
+					else {
+						d.per_rwlock_locked_durations.insert({ rwlock_lock, { t_delta_took, 1, t_delta_took * t_delta_took, 0, 0, 0, t_delta_took } });
+					}
+				}
+			}
+		}
+	}
+
+	return d;
 }
 
-int64_t get_json_int(const json_t *const js, const char *const key)
+void determine_durations(FILE *const fh, const lock_trace_item_t *const data, const uint64_t n_records)
 {
-	return json_integer_value(json_object_get(js, key));
+	const auto & d = do_determine_durations(data, n_records);
+
+	fprintf(fh, "<section>\n");
+
+	fprintf(fh, "<h2 id=\"durations\">2. acquisition durations</h2>\n");
+	fprintf(fh, "<p>How long it took before a mutex (or r/w-lock) was acquired. This takes longer if an other thread is already holding it and doesn't immediately return it.</p>\n");
+	fprintf(fh, "<p>Also shown is, how long mutex was held on average. 'sd' is the standard deviation.</p>\n");
+	fprintf(fh, "<table>\n");
+
+	// mutex acquisition durations
+	double avg_mutex_lock_acquire_durations = d.durations_mutex.mutex_lock_acquire_durations / double(d.durations_mutex.n_mutex_acquire_locks);
+	double sd_mutex_lock_acquire_durations = sqrt(d.durations_mutex.mutex_lock_acquire_sd / double(d.durations_mutex.n_mutex_acquire_locks) - pow(avg_mutex_lock_acquire_durations, 2.0));
+	fprintf(fh, "<tr><th>mutex</th><td>avg: %.3fus, sd: %.3fus, max: %.3fus</td></tr>\n", avg_mutex_lock_acquire_durations / 1000.0, sd_mutex_lock_acquire_durations / 1000.0, d.durations_mutex.mutex_lock_acquire_max / 1000.);
+
+	// mutex held durations
+	double avg_mutex_locked_durations = d.locked_durations.mutex_locked_durations / double(d.locked_durations.n_mutex_locked_durations);
+	if (d.locked_durations.n_mutex_locked_durations > 1) {
+		double sd_mutex_locked_durations = sqrt(d.locked_durations.mutex_locked_durations_sd / double(d.locked_durations.n_mutex_locked_durations) - pow(avg_mutex_locked_durations, 2.0));
+		fprintf(fh, "<tr><th>mutex held</th><td>avg: %.3fus, sd: %.3fus, max: %.3fus</td></tr>\n", avg_mutex_locked_durations / 1000.0, sd_mutex_locked_durations / 1000.0, d.locked_durations.mutex_locked_durations_max / 1000.);
+	}
+	else {
+		fprintf(fh, "<tr><th>mutex held</th><td>avg: %.3fus, max: %.3fus</td></tr>\n", avg_mutex_locked_durations / 1000.0, d.locked_durations.mutex_locked_durations_max / 1000.);
+	}
+
+	// read lock of r/w locks
+	double avg_rwlock_r_lock_acquire_durations = d.durations_r_rwlock.rwlock_r_lock_acquire_durations / double(d.durations_r_rwlock.n_rwlock_r_acquire_locks);
+	double sd_rwlock_r_lock_acquire_durations = sqrt(d.durations_r_rwlock.rwlock_r_lock_acquire_sd / double(d.durations_r_rwlock.n_rwlock_r_acquire_locks) - pow(avg_rwlock_r_lock_acquire_durations, 2.0));
+	fprintf(fh, "<tr><th>read lock</th><td>avg: %.3fus, sd: %.3fus, max: %.3fus</td></tr>\n", avg_rwlock_r_lock_acquire_durations / 1000.0, sd_rwlock_r_lock_acquire_durations / 1000.0, d.durations_r_rwlock.rwlock_r_lock_acquire_max / 1000.);
+
+	// write lock of r/w locks
+	double avg_rwlock_w_lock_acquire_durations = d.durations_w_rwlock.rwlock_w_lock_acquire_durations / double(d.durations_w_rwlock.n_rwlock_w_acquire_locks);
+	double sd_rwlock_w_lock_acquire_durations = sqrt(d.durations_w_rwlock.rwlock_w_lock_acquire_sd / double(d.durations_w_rwlock.n_rwlock_w_acquire_locks) - pow(avg_rwlock_w_lock_acquire_durations, 2.0));
+	fprintf(fh, "<tr><th>write lock</th><td>avg: %.3fus, sd: %.3fus, max: %.3fus</td></tr>\n", avg_rwlock_w_lock_acquire_durations / 1000.0, sd_rwlock_w_lock_acquire_durations, d.durations_w_rwlock.rwlock_w_lock_acquire_max / 1000.);
+
+	fprintf(fh, "</table>\n");
+
+	fprintf(fh, "<h3>per mutex durations</h3>\n");
+
+	fprintf(fh, "<h4>acquiration duration</h4>\n");
+	fprintf(fh, "<table>\n");
+	fprintf(fh, "<tr><th>pointer</th><th>average</th><th>standard deviation</th><th>maximum</th></tr>\n");
+	for(auto entry : d.per_mutex_durations) {
+		double avg = entry.second.mutex_lock_acquire_durations / double(entry.second.n_mutex_acquire_locks);
+		double sd = sqrt(entry.second.mutex_lock_acquire_sd / double(entry.second.n_mutex_acquire_locks) - pow(avg, 2.0));
+
+		fprintf(fh, "<tr><th>%s</th><td>%.3fus</td><td>%.3fus</td><td>%.3fus</td></tr>\n", lookup_symbol(entry.first).c_str(), avg, sd, entry.second.mutex_lock_acquire_max * 1.);
+	}
+	fprintf(fh, "</table>\n");
+
+	fprintf(fh, "<h4>mutex held duration</h4>\n");
+	fprintf(fh, "<table>\n");
+	fprintf(fh, "<tr><th>pointer</th><th>average</th><th>standard deviation</th><th>maximum</th></tr>\n");
+	for(auto entry : d.per_mutex_locked_durations) {
+		double avg = entry.second.mutex_locked_durations / double(entry.second.n_mutex_locked_durations);
+		double sd = sqrt(entry.second.mutex_locked_durations_sd / double(entry.second.n_mutex_locked_durations) - pow(avg, 2.0));
+
+		fprintf(fh, "<tr><th>%s</th><td>%.3fus</td><td>%.3fus</td><td>%.3fus</td></tr>\n", lookup_symbol(entry.first).c_str(), avg, sd, entry.second.mutex_locked_durations_max * 1.);
+	}
+	fprintf(fh, "</table>\n");
+
+	fprintf(fh, "<h3>per r/w lock durations</h3>\n");
+
+	fprintf(fh, "<h4>read lock acquiration duration</h4>\n");
+	fprintf(fh, "<table>\n");
+	fprintf(fh, "<tr><th>pointer</th><th>r/w</th><th>average</th><th>standard deviation</th><th>maximum</th></tr>\n");
+	for(auto entry : d.per_rwlock_r_acquire_durations) {
+		double avg = entry.second.rwlock_r_lock_acquire_durations / double(entry.second.n_rwlock_r_acquire_locks);
+		double sd = sqrt(entry.second.rwlock_r_lock_acquire_sd / double(entry.second.n_rwlock_r_acquire_locks) - pow(avg, 2.0));
+
+		fprintf(fh, "<tr><th>%s</th><td>%.3fus</td><td>%.3fus</td><td>%.3fus</td></tr>\n", lookup_symbol(entry.first).c_str(), avg, sd, entry.second.rwlock_r_lock_acquire_max * 1.);
+	}
+	fprintf(fh, "</table>\n");
+
+	fprintf(fh, "<h4>write lock acquiration duration</h4>\n");
+	fprintf(fh, "<table>\n");
+	fprintf(fh, "<tr><th>pointer</th><th>r/w</th><th>average</th><th>standard deviation</th><th>maximum</th></tr>\n");
+	for(auto entry : d.per_rwlock_w_acquire_durations) {
+		double avg = entry.second.rwlock_w_lock_acquire_durations / double(entry.second.n_rwlock_w_acquire_locks);
+		double sd = sqrt(entry.second.rwlock_w_lock_acquire_sd / double(entry.second.n_rwlock_w_acquire_locks) - pow(avg, 2.0));
+
+		fprintf(fh, "<tr><th>%s</th><td>%.3fus</td><td>%.3fus</td><td>%.3fus</td></tr>\n", lookup_symbol(entry.first).c_str(), avg, sd, entry.second.rwlock_w_lock_acquire_max * 1.);
+	}
+	fprintf(fh, "</table>\n");
+
+	fprintf(fh, "<h4>r/w-lock held duration</h4>\n");
+	fprintf(fh, "<table>\n");
+	fprintf(fh, "<tr><th>pointer</th><th>r/w></th><th>average</th><th>standard deviation</th><th>maximum</th></tr>\n");
+	for(auto entry : d.per_rwlock_locked_durations) {
+		double r_avg = entry.second.rwlock_r_locked_durations / double(entry.second.n_rwlock_r_locked);
+		double r_sd = sqrt(entry.second.rwlock_r_locked_sd / double(entry.second.n_rwlock_r_locked) - pow(r_avg, 2.0));
+
+		double w_avg = entry.second.rwlock_w_locked_durations / double(entry.second.n_rwlock_w_locked);
+		double w_sd = sqrt(entry.second.rwlock_w_locked_sd / double(entry.second.n_rwlock_w_locked) - pow(r_avg, 2.0));
+
+		fprintf(fh, "<tr><th>%s</th><td>r</td><td>%.3fus</td><td>%.3fus</td><td>%.3fus</td></tr>\n", lookup_symbol(entry.first).c_str(), r_avg, r_sd, entry.second.rwlock_r_locked_max * 1.);
+		fprintf(fh, "<tr><th></th><td>w</td><td>%.3fus</td><td>%.3fus</td></tr>\n", w_avg, w_sd);
+	}
+	fprintf(fh, "</table>\n");
+
+	fprintf(fh, "</section>\n");
 }
 
-std::map<std::string, uint64_t> data_stats(const lock_trace_item_t *const data, const uint64_t n_records)
+// lock, backtrace
+std::map<const void *, std::map<hash_t, uint64_t> > do_where_are_locks_used(const lock_trace_item_t *const data, const uint64_t n_records)
 {
-	uint64_t cnts[_a_max][2] { { 0, 0 } };
+	std::map<const void *, std::map<hash_t, uint64_t> > out;
 
-	for(uint64_t i=0; i<n_records; i++)
-		cnts[data[i].la][!!data[i].rc]++;
+	for(uint64_t i=0; i<n_records; i++) {
+		if (data[i].rc != 0)  // ignore failed calls
+			continue;
+
+		if (data[i].la == a_lock || data[i].la == a_timed_lock || is_read_lock(data[i].la) || is_write_lock(data[i].la)) {
+			hash_t h = calculate_backtrace_hash(data[i]);
+
+			auto lock_it = out.find(data[i].lock);
+			if (lock_it != out.end())
+				lock_it->second.insert({ h, i });
+			else {
+				std::map<hash_t, uint64_t> d;
+				d.insert({ h, i });
 
-	std::map<std::string, uint64_t> out;
-	out.insert({ "mutex locks", cnts[a_lock][0] });
-	out.insert({ "mutex unlocks", cnts[a_unlock][0] });
-	out.insert({ "pthread_clean", cnts[a_thread_clean][0] });
-	out.insert({ "rw read lock", cnts[a_r_lock][0] });
-	out.insert({ "rw write lock", cnts[a_w_lock][0] });
-	out.insert({ "rw unlock", cnts[a_rw_unlock][0] });
-	out.insert({ "mutex init", cnts[a_init][0] });
-	out.insert({ "mutex destroy", cnts[a_destroy][0] });
-	out.insert({ "rw init", cnts[a_rw_init][0] });
-	out.insert({ "rw destroy", cnts[a_rw_destroy][0] });
-
-	out.insert({ "failed mutex locks", cnts[a_lock][1] });
-	out.insert({ "failed mutex unlocks", cnts[a_unlock][1] });
-	out.insert({ "failed pthread_clean", cnts[a_thread_clean][1] });
-	out.insert({ "failed rw read lock", cnts[a_r_lock][1] });
-	out.insert({ "failed rw write lock", cnts[a_w_lock][1] });
-	out.insert({ "failed rw unlock", cnts[a_rw_unlock][1] });
-	out.insert({ "failed mutex init", cnts[a_init][1] });
-	out.insert({ "failed mutex destroy", cnts[a_destroy][1] });
-	out.insert({ "failed rw init", cnts[a_rw_init][1] });
-	out.insert({ "failed rw destroy", cnts[a_rw_destroy][1] });
+				out.insert({ data[i].lock, d });
+			}
+		}
+	}
 
 	return out;
 }
 
-void emit_meta_data(FILE *const fh, const json_t *const meta, const std::string & core_file_in, const std::string & trace_file, const lock_trace_item_t *const data, const uint64_t n_records)
+void where_are_locks_used(FILE *const fh, const lock_trace_item_t *const data, const uint64_t n_records)
 {
-	fprintf(fh, "<h2 id=\"meta\">1. META DATA</h2>\n");
-	fprintf(fh, "<table><tr><th colspan=2>meta data</th></tr>\n");
-	fprintf(fh, "<tr><th>executable</th><td>%s</td></tr>\n", get_json_string(meta, "exe_name").c_str());
-	fprintf(fh, "<tr><th>PID</th><td>%ld</td></tr>\n", get_json_int(meta, "pid"));
-	fprintf(fh, "<tr><th>scheduler</th><td>%s</td></tr>\n", get_json_string(meta, "scheduler").c_str());
-	fprintf(fh, "<tr><th>host name</th><td>%s</td></tr>\n", get_json_string(meta, "hostname").c_str());
-	fprintf(fh, "<tr><th>core file</th><td>%s</td></tr>\n", core_file_in.c_str());
-	fprintf(fh, "<tr><th>trace file</th><td>%s</td></tr>\n", trace_file.c_str());
-	double took = double(get_json_int(meta, "end_ts") - get_json_int(meta, "start_ts")) / billion;
-	uint64_t _n_records = get_json_int(meta, "n_records");
-	uint64_t _n_records_max = get_json_int(meta, "n_records_max");
-	double n_per_sec = took > 0 ? _n_records / took: 0;
-	fprintf(fh, "<tr><th># trace records</th><td>%lu (%.2f%%, %.2f%%/s)</td></tr>\n", _n_records, _n_records * 100.0 / _n_records_max, n_per_sec * 100.0 / _n_records_max);
-	fprintf(fh, "<tr><th>fork warning</th><td>%s</td></tr>\n", get_json_int(meta, "fork_warning") ? "true" : "false");
-	fprintf(fh, "<tr><th># cores</th><td>%ld</td></tr>\n", get_json_int(meta, "n_procs"));
-	uint64_t start_ts = get_json_int(meta, "start_ts");
-	uint64_t end_ts = get_json_int(meta, "end_ts");
-	fprintf(fh, "<tr><th>started at</th><td>%.9f (%s)</td></tr>\n", start_ts / double(billion), my_ctime(start_ts).c_str());
-	fprintf(fh, "<tr><th>stopped at</th><td>%.9f (%s)</td></tr>\n", end_ts / double(billion), my_ctime(end_ts).c_str());
-	fprintf(fh, "<tr><th>took</th><td>%fs</td></tr>\n", took);
+	auto lock_use_locations = do_where_are_locks_used(data, n_records);
+
+	fprintf(fh, "<section>\n");
+
+	fprintf(fh, "<h2 id=\"whereused\">8. where are locks used</h2>\n");
+	fprintf(fh, "<table class=\"green\">\n");
+	for(auto & entry : lock_use_locations) {
+		fprintf(fh, "<tr><td>%s</td><td>\n", lookup_symbol(entry.first).c_str());
+
+		for(const auto & p : entry.second) {
+			put_call_trace_html(fh, data[p.second], "green");
+
+			fprintf(fh, "<br>\n");
+		}
+
+		fprintf(fh, "</td></tr>\n");
+	}
 	fprintf(fh, "</table>\n");
 
-	fprintf(fh, "<h3>counts</h3>\n");
-	fprintf(fh, "<table>\n");
-	fprintf(fh, "<tr><th># mutex try-locks</th><td>%ld</td></tr>\n", get_json_int(meta, "cnt_mutex_trylock"));
-	fprintf(fh, "<tr><th># rwlock try-rdlock</th><td>%ld</td></tr>\n", get_json_int(meta, "cnt_rwlock_try_rdlock"));
-	fprintf(fh, "<tr><th># rwlock try-timed-rdlock</th><td>%ld</td></tr>\n", get_json_int(meta, "cnt_rwlock_try_timedrdlock"));
-	fprintf(fh, "<tr><th># rwlock try-wrlock</th><td>%ld</td></tr>\n", get_json_int(meta, "cnt_rwlock_try_wrlock"));
-	fprintf(fh, "<tr><th># rwlock try-timed-rwlock</th><td>%ld</td></tr>\n", get_json_int(meta, "cnt_rwlock_try_timedwrlock"));
+	fprintf(fh, "</section>\n");
+}
+
+typedef struct {
+	uint64_t n_waits, n_timeouts, n_spurious, n_errors;
+	uint64_t wait_total, wait_max;
+	uint64_t n_signals, n_broadcasts;
+	uint64_t n_latency, latency_total, latency_max;
+	// signals that did not wake up a thread (yet)
+	std::deque<uint64_t> pending_signals;
+	uint64_t last_broadcast;
+	std::set<const void *> mutexes;
+} cond_stats_t;
+
+// A wakeup is attributed to the oldest signal (or else the most recent
+// broadcast) that was sent while the thread was waiting. When there's
+// none, the wakeup was spurious.
+std::map<const void *, cond_stats_t> do_condition_variables(const lock_trace_item_t *const data, const uint64_t n_records)
+{
+	std::map<const void *, cond_stats_t> out;
+
+	for(uint64_t i=0; i<n_records; i++) {
+		const lock_action_t la = data[i].la;
+
+		if ((la == a_cond_signal || la == a_cond_broadcast) && data[i].rc == 0) {
+			cond_stats_t & c = out[data[i].lock];
+
+			if (la == a_cond_signal) {
+				c.n_signals++;
+
+				c.pending_signals.push_back(data[i].timestamp);
+
+				// nobody was waiting for most of these
+				if (c.pending_signals.size() > 1024)
+					c.pending_signals.pop_front();
+			}
+			else {
+				c.n_broadcasts++;
+
+				c.last_broadcast = data[i].timestamp;
+			}
+		}
+		else if (la == a_cond_woken) {
+			cond_stats_t & c = out[get_cond(data[i])];
+			const uint64_t wait = data[i].lock_took;
+			const uint64_t start = data[i].timestamp - wait;
+
+			c.mutexes.insert(data[i].lock);
+
+			c.n_waits++;
+			c.wait_total += wait;
+			c.wait_max = std::max(c.wait_max, wait);
+
+			const int wait_rc = data[i].cond_innards.wait_rc;
+
+			if (wait_rc == ETIMEDOUT) {
+				c.n_timeouts++;
+				continue;
+			}
+
+			if (wait_rc != 0) {
+				c.n_errors++;
+				continue;
+			}
+
+			auto it = std::find_if(c.pending_signals.begin(), c.pending_signals.end(), [start](const uint64_t ts) { return ts >= start; });
+
+			uint64_t woken_by = 0;
+
+			if (it != c.pending_signals.end()) {
+				woken_by = *it;
+
+				c.pending_signals.erase(it);
+			}
+			else if (c.n_broadcasts && c.last_broadcast >= start) {
+				woken_by = c.last_broadcast;
+			}
+			else {
+				c.n_spurious++;
+				continue;
+			}
+
+			uint64_t latency = data[i].timestamp - woken_by;
 
-	assert(n_records == _n_records);
-	auto ds = data_stats(data, n_records);
-	for(auto ds_entry : ds)
-		fprintf(fh, "<tr><th>%s</th><td>%lu</td></tr>\n", ds_entry.first.c_str(), ds_entry.second);
+			c.n_latency++;
+			c.latency_total += latency;
+			c.latency_max = std::max(c.latency_max, latency);
+		}
+	}
 
-	fprintf(fh, "</table>\n");
+	return out;
 }
 
-typedef struct {
-	uint64_t mutex_lock_acquire_durations, n_mutex_acquire_locks, mutex_lock_acquire_sd, mutex_lock_acquire_max;
-} durations_mutex_t;
+void condition_variables(FILE *const fh, const lock_trace_item_t *const data, const uint64_t n_records)
+{
+	auto conds = do_condition_variables(data, n_records);
 
-typedef struct {
-	uint64_t mutex_locked_durations, n_mutex_locked_durations, mutex_locked_durations_sd, mutex_locked_durations_max;
-} locked_durations_mutex_t;
+	std::vector<std::pair<const void *, const cond_stats_t *> > order;
+	for(auto & c : conds)
+		order.push_back({ c.first, &c.second });
 
-typedef struct {
-	uint64_t rwlock_r_lock_acquire_durations, n_rwlock_r_acquire_locks, rwlock_r_lock_acquire_sd, rwlock_r_lock_acquire_max;
-} durations_rwlock_r_t;
+	std::sort(order.begin(), order.end(), [](const auto & a, const auto & b) { return a.second->wait_total > b.second->wait_total; });
 
-typedef struct {
-	uint64_t rwlock_w_lock_acquire_durations, n_rwlock_w_acquire_locks, rwlock_w_lock_acquire_sd, rwlock_w_lock_acquire_max;
-} durations_rwlock_w_t;
+	fprintf(fh, "<section>\n");
 
-typedef struct {
-	uint64_t rwlock_r_locked_durations, n_rwlock_r_locked, rwlock_r_locked_sd, rwlock_r_locked_max;
-	uint64_t rwlock_w_locked_durations, n_rwlock_w_locked, rwlock_w_locked_sd, rwlock_w_locked_max;
-} locked_durations_rwlock_t;
+	fprintf(fh, "<h2 id=\"condvars\">9. condition variables</h2>\n");
+	fprintf(fh, "<p>While waiting on a condition variable the mutex is not held, these waits are not part of the mutex hold durations. The latency is from the pthread_cond_signal/broadcast until the woken thread returned from the wait (with the mutex locked again). A wakeup without a signal or broadcast during the wait is spurious.</p>\n");
 
-typedef struct {
-	// acquire
-	durations_mutex_t durations_mutex;
-	std::map<pthread_mutex_t *, durations_mutex_t> per_mutex_durations;
-	// hold
-	locked_durations_mutex_t locked_durations;
-	std::map<pthread_mutex_t *, locked_durations_mutex_t> per_mutex_locked_durations;
+	if (order.empty())
+		fprintf(fh, "<p>No condition variables were used.</p>\n");
+	else {
+		fprintf(fh, "<table>\n");
+		fprintf(fh, "<tr><th>condition variable</th><th>mutex(es)</th><th># waits</th><th>wait avg</th><th>wait max</th><th># signals</th><th># broadcasts</th><th>wakeup latency avg</th><th>wakeup latency max</th><th># timeouts</th><th># spurious</th><th># errors</th></tr>\n");
+
+		for(auto & entry : order) {
+			const cond_stats_t & c = *entry.second;
+
+			std::string mutexes;
+			for(auto & m : c.mutexes)
+				mutexes += (mutexes.empty() ? "" : "<br>") + lookup_symbol(m);
+
+			fprintf(fh, "<tr><td>%s</td><td>%s</td><td>%lu</td><td>%.3fus</td><td>%.3fus</td><td>%lu</td><td>%lu</td><td>%.3fus</td><td>%.3fus</td><td>%lu</td><td>%lu</td><td>%lu</td></tr>\n",
+					lookup_symbol(entry.first).c_str(), mutexes.c_str(),
+					c.n_waits, c.n_waits ? c.wait_total / 1000. / c.n_waits : 0., c.wait_max / 1000.,
+					c.n_signals, c.n_broadcasts,
+					c.n_latency ? c.latency_total / 1000. / c.n_latency : 0., c.latency_max / 1000.,
+					c.n_timeouts, c.n_spurious, c.n_errors);
+		}
 
-	// acquire
-	durations_rwlock_r_t durations_r_rwlock;
-	durations_rwlock_w_t durations_w_rwlock;
-	std::map<pthread_rwlock_t *, durations_rwlock_r_t> per_rwlock_r_acquire_durations;
-	std::map<pthread_rwlock_t *, durations_rwlock_w_t> per_rwlock_w_acquire_durations;
-	// hold
-	std::map<pthread_rwlock_t *, locked_durations_rwlock_t> per_rwlock_locked_durations;
-} durations_t;
+		fprintf(fh, "</table>\n");
+	}
+
+	fprintf(fh, "</section>\n");
+}
 
 typedef struct {
-	uint64_t w_timestamp;
-	int __cur_writer;  // tid of who holds the write lock
+	lock_action_t kind;
+	uint64_t n, n_busy, n_errors;
+	uint64_t wait_total, wait_max;
+	uint64_t n_held, held_total, held_max;
+	uint64_t n_posts;
+	// tid -> when the spinlock was taken
+	std::map<pid_t, uint64_t> taken;
+} sync_stats_t;
+
+// kind is a_spin_lock, a_sem_wait or a_barrier_wait
+std::map<const void *, sync_stats_t> do_sync_objects(const lock_trace_item_t *const data, const uint64_t n_records)
+{
+	std::map<const void *, sync_stats_t> out;
 
-	uint64_t r_timestamp;
-} rwlock_holder_t;
+	for(uint64_t i=0; i<n_records; i++) {
+		const lock_action_t la = data[i].la;
 
-durations_t do_determine_durations(const lock_trace_item_t *const data, const uint64_t n_records)
-{
-	durations_t d;
-	d.durations_mutex = { 0 };
-	d.locked_durations = { 0 };
-	d.durations_r_rwlock = { 0 };
-	d.durations_w_rwlock = { 0 };
+		if (la != a_spin_lock && la != a_spin_unlock && la != a_sem_wait && la != a_sem_post && la != a_barrier_wait)
+			continue;
 
-	std::map<pthread_mutex_t *, uint64_t> mutex_acquire_timestamp;
+		sync_stats_t & s = out[data[i].lock];
 
-	std::map<pthread_rwlock_t *, rwlock_holder_t> rwlock_acquire_timestamp;
+		s.kind = la == a_spin_unlock ? a_spin_lock : (la == a_sem_post ? a_sem_wait : la);
 
-	for(uint64_t i=0; i<n_records; i++) {
-		if (data[i].rc != 0)  // ignore failed calls
+		if (data[i].rc == EBUSY || data[i].rc == EAGAIN || data[i].rc == ETIMEDOUT) {
+			s.n_busy++;
 			continue;
+		}
 
-		const uint64_t took = data[i].lock_took;
+		if (data[i].rc != 0) {
+			s.n_errors++;
+			continue;
+		}
 
-		if (data[i].la == a_lock) {
-			d.durations_mutex.mutex_lock_acquire_durations += took;
-			d.durations_mutex.mutex_lock_acquire_sd += took * took;
-			d.durations_mutex.mutex_lock_acquire_max = std::max(d.durations_mutex.mutex_lock_acquire_max, took);
-			d.durations_mutex.n_mutex_acquire_locks++;
+		if (la == a_spin_unlock) {
+			auto it = s.taken.find(data[i].tid);
 
-			pthread_mutex_t *mutex_lock = (pthread_mutex_t *)data[i].lock;
+			if (it != s.taken.end()) {
+				const uint64_t held = data[i].timestamp - it->second;
 
-			mutex_acquire_timestamp.insert({ mutex_lock, data[i].timestamp });
+				s.n_held++;
+				s.held_total += held;
+				s.held_max = std::max(s.held_max, held);
 
-			auto it = d.per_mutex_durations.find(mutex_lock);
-			if (it == d.per_mutex_durations.end())
-				d.per_mutex_durations.insert({ mutex_lock, { took, 1, took * took, took } });
-			else {
-				it->second.mutex_lock_acquire_durations += took;
-				it->second.n_mutex_acquire_locks++;
-				it->second.mutex_lock_acquire_sd += took * took;
-				it->second.mutex_lock_acquire_max = std::max(it->second.mutex_lock_acquire_max, took);
+				s.taken.erase(it);
 			}
 		}
-		else if (data[i].la == a_unlock) {
-			auto lock_it = mutex_acquire_timestamp.find((pthread_mutex_t *)data[i].lock);
+		else if (la == a_sem_post) {
+			s.n_posts++;
+		}
+		else {
+			const uint64_t took = data[i].lock_took;
 
-			if (lock_it != mutex_acquire_timestamp.end()) {
-				uint64_t t_delta_took = data[i].timestamp - lock_it->second;
+			s.n++;
+			s.wait_total += took;
+			s.wait_max = std::max(s.wait_max, took);
 
-				mutex_acquire_timestamp.erase(lock_it);
+			if (la == a_spin_lock)
+				s.taken[data[i].tid] = data[i].timestamp;
+		}
+	}
 
-				d.locked_durations.mutex_locked_durations += t_delta_took;
-				d.locked_durations.n_mutex_locked_durations++;
-				d.locked_durations.mutex_locked_durations_sd += t_delta_took * t_delta_took;
-				d.locked_durations.mutex_locked_durations_sd = std::max(d.locked_durations.mutex_locked_durations_max, t_delta_took);
+	return out;
+}
 
-				pthread_mutex_t *mutex_lock = (pthread_mutex_t *)data[i].lock;
+void sync_objects(FILE *const fh, const lock_trace_item_t *const data, const uint64_t n_records)
+{
+	auto objects = do_sync_objects(data, n_records);
 
-				auto it = d.per_mutex_locked_durations.find(mutex_lock);
-				if (it == d.per_mutex_locked_durations.end())
-					d.per_mutex_locked_durations.insert({ mutex_lock, { t_delta_took, 1, t_delta_took * t_delta_took, t_delta_took } });
-				else {
-					it->second.mutex_locked_durations += t_delta_took;
-					it->second.n_mutex_locked_durations++;
-					it->second.mutex_locked_durations_sd += t_delta_took * t_delta_took;
-					it->second.mutex_locked_durations_sd = std::max(it->second.mutex_locked_durations_max, t_delta_took);
-				}
-			}
-		}
-		else if (data[i].la == a_r_lock) {
-			pthread_rwlock_t *rwlock_lock = (pthread_rwlock_t *)data[i].lock;
+	std::vector<std::pair<const void *, const sync_stats_t *> > order;
+	for(auto & o : objects)
+		order.push_back({ o.first, &o.second });
 
-			// acquiring
-			d.durations_r_rwlock.rwlock_r_lock_acquire_durations += took;
-			d.durations_r_rwlock.n_rwlock_r_acquire_locks++;
-			d.durations_r_rwlock.rwlock_r_lock_acquire_sd += took * took;
-			d.durations_r_rwlock.rwlock_r_lock_acquire_max = std::max(d.durations_r_rwlock.rwlock_r_lock_acquire_max, took);
-			// per lock 'r_took'
-			auto ar_it = d.per_rwlock_r_acquire_durations.find(rwlock_lock);
-			if (ar_it == d.per_rwlock_r_acquire_durations.end())
-				d.per_rwlock_r_acquire_durations.insert({ rwlock_lock, { took, 1, took * took, took } });
-			else {
-				ar_it->second.rwlock_r_lock_acquire_durations += took;
-				ar_it->second.n_rwlock_r_acquire_locks++;
-				ar_it->second.rwlock_r_lock_acquire_sd += took * took;
-				ar_it->second.rwlock_r_lock_acquire_max = std::max(ar_it->second.rwlock_r_lock_acquire_max, took);
-			}
+	std::sort(order.begin(), order.end(), [](const auto & a, const auto & b) { return a.second->wait_total > b.second->wait_total; });
 
-			// locked durations
-			auto d_it = rwlock_acquire_timestamp.find(rwlock_lock);
-			if (d_it == rwlock_acquire_timestamp.end())
-				rwlock_acquire_timestamp.insert({ rwlock_lock, { 0, 0, data[i].timestamp } });
-			else
-				d_it->second.r_timestamp = data[i].timestamp;
-		}
-		else if (data[i].la == a_w_lock) {
-			pthread_rwlock_t *rwlock_lock = (pthread_rwlock_t *)data[i].lock;
+	fprintf(fh, "<section>\n");
 
-			// acquiring
-			d.durations_w_rwlock.rwlock_w_lock_acquire_durations += took;
-			d.durations_w_rwlock.rwlock_w_lock_acquire_sd += took * took;
-			d.durations_w_rwlock.rwlock_w_lock_acquire_max = std::max(d.durations_w_rwlock.rwlock_w_lock_acquire_max, took);
-			d.durations_w_rwlock.n_rwlock_w_acquire_locks++;
-			// per lock 'w_took'
-			auto aw_it = d.per_rwlock_w_acquire_durations.find(rwlock_lock);
-			if (aw_it == d.per_rwlock_w_acquire_durations.end())
-				d.per_rwlock_w_acquire_durations.insert({ rwlock_lock, { took, 1, took * took, took } });
-			else {
-				aw_it->second.rwlock_w_lock_acquire_durations += took;
-				aw_it->second.n_rwlock_w_acquire_locks++;
-				aw_it->second.rwlock_w_lock_acquire_sd += took * took;
-				aw_it->second.rwlock_w_lock_acquire_max = std::max(aw_it->second.rwlock_w_lock_acquire_max, took);
-			}
+	fprintf(fh, "<h2 id=\"sync\">10. spinlocks, semaphores and barriers</h2>\n");
+	fprintf(fh, "<p>The wait time is how long was spun for a spinlock, waited in sem_wait or waited for the other threads in pthread_barrier_wait. Busy are the try-locks, try-waits and timed waits that failed because the object was not available (in time). For semaphores, waits minus posts is the net change of its value.</p>\n");
 
-			// locked durations
-			auto it = rwlock_acquire_timestamp.find(rwlock_lock);
-			if (it == rwlock_acquire_timestamp.end())
-				rwlock_acquire_timestamp.insert({ rwlock_lock, { data[i].timestamp, data[i].tid, 0 } });
-			else {
-				it->second.w_timestamp = data[i].timestamp;
-				it->second.__cur_writer = data[i].tid;
+	if (order.empty())
+		fprintf(fh, "<p>No spinlocks, semaphores or barriers were used.</p>\n");
+	else {
+		fprintf(fh, "<table>\n");
+		fprintf(fh, "<tr><th>object</th><th>kind</th><th># acquired/waits</th><th>wait avg</th><th>wait max</th><th>wait total</th><th>held avg</th><th>held max</th><th># posts</th><th>waits - posts</th><th># busy</th><th># errors</th></tr>\n");
+
+		for(auto & entry : order) {
+			const sync_stats_t & s = *entry.second;
+
+			const char *kind = s.kind == a_spin_lock ? "spinlock" : (s.kind == a_sem_wait ? "semaphore" : "barrier");
+
+			std::string held_avg = "-", held_max = "-", posts = "-", balance = "-";
+
+			if (s.kind == a_spin_lock) {
+				held_avg = myformat("%.3fus", s.n_held ? s.held_total / 1000. / s.n_held : 0.);
+				held_max = myformat("%.3fus", s.held_max / 1000.);
 			}
+			else if (s.kind == a_sem_wait) {
+				posts   = myformat("%lu", s.n_posts);
+				balance = myformat("%ld", int64_t(s.n - s.n_posts));
+			}
+
+			fprintf(fh, "<tr><td>%s</td><td>%s</td><td>%lu</td><td>%.3fus</td><td>%.3fus</td><td>%.3fus</td><td>%s</td><td>%s</td><td>%s</td><td>%s</td><td>%lu</td><td>%lu</td></tr>\n",
+					lookup_symbol(entry.first).c_str(), kind, s.n,
+					s.n ? s.wait_total / 1000. / s.n : 0., s.wait_max / 1000., s.wait_total / 1000.,
+					held_avg.c_str(), held_max.c_str(), posts.c_str(), balance.c_str(),
+					s.n_busy, s.n_errors);
 		}
-		else if (data[i].la == a_rw_unlock) {
-			pthread_rwlock_t *rwlock_lock = (pthread_rwlock_t *)data[i].lock;
 
-			auto lock_it = rwlock_acquire_timestamp.find(rwlock_lock);
+		fprintf(fh, "</table>\n");
+	}
 
-			if (lock_it != rwlock_acquire_timestamp.end()) {
-				if (lock_it->second.__cur_writer == data[i].tid && lock_it->second.w_timestamp > 0) {  // write lock
-					uint64_t t_delta_took = data[i].timestamp - lock_it->second.w_timestamp;
+	fprintf(fh, "</section>\n");
+}
 
-					lock_it->second.w_timestamp = 0;
+typedef struct {
+	uint64_t n, n_timeouts, n_errors;
+	// what the callers allowed
+	int64_t timeout_total;
+	// successful acquisitions: time left until the deadline
+	uint64_t n_acquired, n_close;
+	int64_t slack_total, slack_min;
+	// timeouts: how late after the deadline the call returned
+	int64_t late_total, late_max;
+	uint64_t first_record;
+} timed_stats_t;
+
+void add_timed_stats(timed_stats_t *const t, const lock_trace_item_t & record, const uint64_t i)
+{
+	const int64_t timeout = get_timeout(record);
+	const int64_t took    = record.lock_took;
 
-					auto it = d.per_rwlock_locked_durations.find(rwlock_lock);
+	if (t->n == 0) {
+		t->first_record = i;
+		t->slack_min    = INT64_MAX;
+	}
 
-					if (it != d.per_rwlock_locked_durations.end()) {
-						it->second.rwlock_w_locked_durations += t_delta_took;
-						it->second.n_rwlock_w_locked++;
-						it->second.rwlock_w_locked_sd += t_delta_took * t_delta_took;
-						it->second.rwlock_w_locked_max = std::max(it->second.rwlock_w_locked_max, t_delta_took);
-					}
-					else {
-						d.per_rwlock_locked_durations.insert({ rwlock_lock, { 0, 0, 0, t_delta_took, 1, t_delta_took * t_delta_took, t_delta_took } });
-					}
-				}
-				else if (lock_it->second.r_timestamp > 0) {  // read lock
-					uint64_t t_delta_took = data[i].timestamp - lock_it->second.r_timestamp;
+	t->n++;
+	t->timeout_total += timeout;
 
-					lock_it->second.r_timestamp = 0;
+	if (record.rc == ETIMEDOUT) {
+		t->n_timeouts++;
+		t->late_total += took - timeout;
+		t->late_max    = std::max(t->late_max, took - timeout);
+	}
+	else if (record.rc != 0) {
+		t->n_errors++;
+	}
+	else {
+		const int64_t slack = timeout - took;
 
-					auto it = d.per_rwlock_locked_durations.find(rwlock_lock);
+		t->n_acquired++;
+		t->slack_total += slack;
+		t->slack_min    = std::min(t->slack_min, slack);
 
-					if (it != d.per_rwlock_locked_durations.end()) {
-						it->second.rwlock_r_locked_durations += t_delta_took;
-						it->second.n_rwlock_r_locked++;
-						it->second.rwlock_r_locked_sd += t_delta_took * t_delta_took;
-						it->second.rwlock_r_locked_max = std::max(it->second.rwlock_r_locked_max, t_delta_took);
-					}
-					else {
-						d.per_rwlock_locked_durations.insert({ rwlock_lock, { t_delta_took, 1, t_delta_took * t_delta_took, 0, 0, 0, t_delta_took } });
-					}
-				}
-			}
-		}
+		// less than 10% of the timeout left
+		if (slack * 10 < timeout)
+			t->n_close++;
 	}
+}
 
-	return d;
+// lock -> (totals, backtrace -> stats)
+std::map<const void *, std::pair<timed_stats_t, std::map<hash_t, timed_stats_t> > > do_timed_locks(const lock_trace_item_t *const data, const uint64_t n_records)
+{
+	std::map<const void *, std::pair<timed_stats_t, std::map<hash_t, timed_stats_t> > > out;
+
+	for(uint64_t i=0; i<n_records; i++) {
+		if (!is_timed_lock(data[i].la))
+			continue;
+
+		auto & entry = out[data[i].lock];
+
+		add_timed_stats(&entry.first, data[i], i);
+		add_timed_stats(&entry.second[calculate_backtrace_hash(data[i])], data[i], i);
+	}
+
+	return out;
 }
 
-void determine_durations(FILE *const fh, const lock_trace_item_t *const data, const uint64_t n_records)
+std::string timed_stats_cells(const timed_stats_t & t)
 {
-	const auto & d = do_determine_durations(data, n_records);
+	std::string slack = "<td>-</td><td>-</td>";
+	if (t.n_acquired)
+		slack = myformat("<td>%.3fus</td><td>%.3fus</td>", t.slack_total / 1000. / t.n_acquired, t.slack_min / 1000.);
 
-	fprintf(fh, "<section>\n");
+	std::string late = "<td>-</td><td>-</td>";
+	if (t.n_timeouts)
+		late = myformat("<td>%.3fus</td><td>%.3fus</td>", t.late_total / 1000. / t.n_timeouts, t.late_max / 1000.);
 
-	fprintf(fh, "<h2 id=\"durations\">2. acquisition durations</h2>\n");
-	fprintf(fh, "<p>How long it took before a mutex (or r/w-lock) was acquired. This takes longer if an other thread is already holding it and doesn't immediately return it.</p>\n");
-	fprintf(fh, "<p>Also shown is, how long mutex was held on average. 'sd' is the standard deviation.</p>\n");
-	fprintf(fh, "<table>\n");
+	return myformat("<td>%lu</td><td>%.3fus</td><td>%lu</td><td>%.2f%%</td>%s<td>%lu</td>%s<td>%lu</td>", t.n, t.timeout_total / 1000. / t.n, t.n_timeouts, t.n_timeouts * 100. / t.n, slack.c_str(), t.n_close, late.c_str(), t.n_errors);
+}
 
-	// mutex acquisition durations
-	double avg_mutex_lock_acquire_durations = d.durations_mutex.mutex_lock_acquire_durations / double(d.durations_mutex.n_mutex_acquire_locks);
-	double sd_mutex_lock_acquire_durations = sqrt(d.durations_mutex.mutex_lock_acquire_sd / double(d.durations_mutex.n_mutex_acquire_locks) - pow(avg_mutex_lock_acquire_durations, 2.0));
-	fprintf(fh, "<tr><th>mutex</th><td>avg: %.3fus, sd: %.3fus, max: %.3fus</td></tr>\n", avg_mutex_lock_acquire_durations / 1000.0, sd_mutex_lock_acquire_durations / 1000.0, d.durations_mutex.mutex_lock_acquire_max / 1000.);
+void timed_locks(FILE *const fh, const lock_trace_item_t *const data, const uint64_t n_records)
+{
+	auto locks = do_timed_locks(data, n_records);
 
-	// mutex held durations
-	double avg_mutex_locked_durations = d.locked_durations.mutex_locked_durations / double(d.locked_durations.n_mutex_locked_durations);
-	if (d.locked_durations.n_mutex_locked_durations > 1) {
-		double sd_mutex_locked_durations = sqrt(d.locked_durations.mutex_locked_durations_sd / double(d.locked_durations.n_mutex_locked_durations) - pow(avg_mutex_locked_durations, 2.0));
-		fprintf(fh, "<tr><th>mutex held</th><td>avg: %.3fus, sd: %.3fus, max: %.3fus</td></tr>\n", avg_mutex_locked_durations / 1000.0, sd_mutex_locked_durations / 1000.0, d.locked_durations.mutex_locked_durations_max / 1000.);
-	}
+	std::vector<std::pair<const void *, const timed_stats_t *> > order;
+	for(auto & l : locks)
+		order.push_back({ l.first, &l.second.first });
+
+	std::sort(order.begin(), order.end(), [](const auto & a, const auto & b) { return a.second->n_timeouts * b.second->n > b.second->n_timeouts * a.second->n; });
+
+	fprintf(fh, "<section>\n");
+
+	fprintf(fh, "<h2 id=\"timed\">11. timed locks</h2>\n");
+	fprintf(fh, "<p>pthread_mutex_timedlock/clocklock and pthread_rwlock_timed*/clock*: how often the deadline expired and, for the acquisitions that succeeded, how much time was left (slack). \"Close\" are the acquisitions with less than 10%% of the timeout left. \"Late\" is how long after the deadline a timed out call returned. Locks with the highest timeout rate are listed first, per lock the call sites follow its totals.</p>\n");
+
+	if (order.empty())
+		fprintf(fh, "<p>No timed locks were used.</p>\n");
 	else {
-		fprintf(fh, "<tr><th>mutex held</th><td>avg: %.3fus, max: %.3fus</td></tr>\n", avg_mutex_locked_durations / 1000.0, d.locked_durations.mutex_locked_durations_max / 1000.);
+		fprintf(fh, "<table>\n");
+		fprintf(fh, "<tr><th>lock</th><th>call site</th><th>count</th><th>timeout avg</th><th># timeouts</th><th>timeout rate</th><th>slack avg</th><th>slack min</th><th># close</th><th>late avg</th><th>late max</th><th># errors</th></tr>\n");
+
+		for(auto & entry : order) {
+			fprintf(fh, "<tr class=\"green\"><td>%s</td><td>all</td>%s</tr>\n", lookup_symbol(entry.first).c_str(), timed_stats_cells(*entry.second).c_str());
+
+			for(auto & site : locks[entry.first].second) {
+				fprintf(fh, "<tr><td></td><td>\n");
+				put_call_trace_html(fh, data[site.second.first_record], "green");
+				fprintf(fh, "</td>%s</tr>\n", timed_stats_cells(site.second).c_str());
+			}
+		}
+
+		fprintf(fh, "</table>\n");
 	}
 
-	// read lock of r/w locks
-	double avg_rwlock_r_lock_acquire_durations = d.durations_r_rwlock.rwlock_r_lock_acquire_durations / double(d.durations_r_rwlock.n_rwlock_r_acquire_locks);
-	double sd_rwlock_r_lock_acquire_durations = sqrt(d.durations_r_rwlock.rwlock_r_lock_acquire_sd / double(d.durations_r_rwlock.n_rwlock_r_acquire_locks) - pow(avg_rwlock_r_lock_acquire_durations, 2.0));
-	fprintf(fh, "<tr><th>read lock</th><td>avg: %.3fus, sd: %.3fus, max: %.3fus</td></tr>\n", avg_rwlock_r_lock_acquire_durations / 1000.0, sd_rwlock_r_lock_acquire_durations / 1000.0, d.durations_r_rwlock.rwlock_r_lock_acquire_max / 1000.);
+	fprintf(fh, "</section>\n");
+}
 
-	// write lock of r/w locks
-	double avg_rwlock_w_lock_acquire_durations = d.durations_w_rwlock.rwlock_w_lock_acquire_durations / double(d.durations_w_rwlock.n_rwlock_w_acquire_locks);
-	double sd_rwlock_w_lock_acquire_durations = sqrt(d.durations_w_rwlock.rwlock_w_lock_acquire_sd / double(d.durations_w_rwlock.n_rwlock_w_acquire_locks) - pow(avg_rwlock_w_lock_acquire_durations, 2.0));
-	fprintf(fh, "<tr><th>write lock</th><td>avg: %.3fus, sd: %.3fus, max: %.3fus</td></tr>\n", avg_rwlock_w_lock_acquire_durations / 1000.0, sd_rwlock_w_lock_acquire_durations, d.durations_w_rwlock.rwlock_w_lock_acquire_max / 1000.);
+// With TRACE_CONTENDED_ONLY the tracer counts per lock the acquisitions
+// that got the lock with the trylock (not busy), the ones that had to
+// wait (busy) and the ones that returned an error. Explicit trylocks
+// are recorded too but are not in these counts.
+void contention_rates(FILE *const fh, const json_t *const meta, const lock_trace_item_t *const data, const uint64_t n_records)
+{
+	// lock -> not busy, busy, failed; each for mutex, read, write
+	std::map<const void *, std::array<uint64_t, 9> > counts;
 
-	fprintf(fh, "</table>\n");
+	const char *const kinds[] = { "mutex", "read", "write" };
 
-	fprintf(fh, "<h3>per mutex durations</h3>\n");
+	bool has_busy = false;
 
-	fprintf(fh, "<h4>acquiration duration</h4>\n");
-	fprintf(fh, "<table>\n");
-	fprintf(fh, "<tr><th>pointer</th><th>average</th><th>standard deviation</th><th>maximum</th></tr>\n");
-	for(auto entry : d.per_mutex_durations) {
-		double avg = entry.second.mutex_lock_acquire_durations / double(entry.second.n_mutex_acquire_locks);
-		double sd = sqrt(entry.second.mutex_lock_acquire_sd / double(entry.second.n_mutex_acquire_locks) - pow(avg, 2.0));
+	const json_t *list = json_object_get(meta, "uncontended");
+	for(size_t i=0; i<json_array_size(list); i++) {
+		const json_t *entry = json_array_get(list, i);
+		auto & c = counts[(const void *)get_json_int(entry, "lock")];
 
-		fprintf(fh, "<tr><th>%s</th><td>%.3fus</td><td>%.3fus</td><td>%.3fus</td></tr>\n", lookup_symbol(entry.first).c_str(), avg, sd, entry.second.mutex_lock_acquire_max * 1.);
-	}
-	fprintf(fh, "</table>\n");
+		for(int k=0; k<3; k++) {
+			c[k]     = get_json_int(entry, myformat("n_%s", kinds[k]).c_str());
+			c[k + 3] = get_json_int(entry, myformat("n_%s_busy", kinds[k]).c_str());
+			c[k + 6] = get_json_int(entry, myformat("n_%s_failed", kinds[k]).c_str());
+		}
 
-	fprintf(fh, "<h4>mutex held duration</h4>\n");
-	fprintf(fh, "<table>\n");
-	fprintf(fh, "<tr><th>pointer</th><th>average</th><th>standard deviation</th><th>maximum</th></tr>\n");
-	for(auto entry : d.per_mutex_locked_durations) {
-		double avg = entry.second.mutex_locked_durations / double(entry.second.n_mutex_locked_durations);
-		double sd = sqrt(entry.second.mutex_locked_durations_sd / double(entry.second.n_mutex_locked_durations) - pow(avg, 2.0));
+		has_busy |= json_object_get(entry, "n_mutex_busy") != nullptr;
+	}
 
-		fprintf(fh, "<tr><th>%s</th><td>%.3fus</td><td>%.3fus</td><td>%.3fus</td></tr>\n", lookup_symbol(entry.first).c_str(), avg, sd, entry.second.mutex_locked_durations_max * 1.);
+	// older dumps: every recorded acquisition (including the explicit
+	// trylocks and errors) counts as busy
+	if (!has_busy) {
+		for(uint64_t i=0; i<n_records; i++) {
+			if (data[i].la == a_lock)
+				counts[data[i].lock][3]++;
+			else if (data[i].la == a_r_lock)
+				counts[data[i].lock][4]++;
+			else if (data[i].la == a_w_lock)
+				counts[data[i].lock][5]++;
+		}
 	}
-	fprintf(fh, "</table>\n");
 
-	fprintf(fh, "<h3>per r/w lock durations</h3>\n");
+	fprintf(fh, "<section>\n");
+
+	fprintf(fh, "<h2 id=\"contention\">12. contention rates</h2>\n");
+	fprintf(fh, "<p>How often a lock was busy when it was acquired. Only these acquisitions (and the explicit try-locks) are in the other sections. The rate is over the acquisitions that got the lock.</p>\n");
+	if (get_json_int(meta, "uncontended_not_counted"))
+		fprintf(fh, "<p>%ld acquisitions could not be counted (too many threads or locks).</p>\n", get_json_int(meta, "uncontended_not_counted"));
+	if (get_json_int(meta, "sampled_held_full"))
+		fprintf(fh, "<p>%ld busy acquisitions were counted but not recorded: the thread held too many recorded locks to keep track of their unlocks.</p>\n", get_json_int(meta, "sampled_held_full"));
+	if (!has_busy)
+		fprintf(fh, "<p>This trace does not have the busy counts: all recorded acquisitions are counted as busy, including successful try-locks and errors.</p>\n");
 
-	fprintf(fh, "<h4>read lock acquiration duration</h4>\n");
 	fprintf(fh, "<table>\n");
-	fprintf(fh, "<tr><th>pointer</th><th>r/w</th><th>average</th><th>standard deviation</th><th>maximum</th></tr>\n");
-	for(auto entry : d.per_rwlock_r_acquire_durations) {
-		double avg = entry.second.rwlock_r_lock_acquire_durations / double(entry.second.n_rwlock_r_acquire_locks);
-		double sd = sqrt(entry.second.rwlock_r_lock_acquire_sd / double(entry.second.n_rwlock_r_acquire_locks) - pow(avg, 2.0));
+	fprintf(fh, "<tr><th>lock</th><th>type</th><th>busy</th><th>not busy</th><th>errors</th><th>contention rate</th></tr>\n");
+	for(auto & entry : counts) {
+		const auto & c = entry.second;
 
-		fprintf(fh, "<tr><th>%s</th><td>%.3fus</td><td>%.3fus</td><td>%.3fus</td></tr>\n", lookup_symbol(entry.first).c_str(), avg, sd, entry.second.rwlock_r_lock_acquire_max * 1.);
-	}
-	fprintf(fh, "</table>\n");
+		for(int k=0; k<3; k++) {
+			const uint64_t busy = c[k + 3], not_busy = c[k], failed = c[k + 6];
 
-	fprintf(fh, "<h4>write lock acquiration duration</h4>\n");
-	fprintf(fh, "<table>\n");
-	fprintf(fh, "<tr><th>pointer</th><th>r/w</th><th>average</th><th>standard deviation</th><th>maximum</th></tr>\n");
-	for(auto entry : d.per_rwlock_w_acquire_durations) {
-		double avg = entry.second.rwlock_w_lock_acquire_durations / double(entry.second.n_rwlock_w_acquire_locks);
-		double sd = sqrt(entry.second.rwlock_w_lock_acquire_sd / double(entry.second.n_rwlock_w_acquire_locks) - pow(avg, 2.0));
+			if (busy + not_busy + failed == 0)
+				continue;
 
-		fprintf(fh, "<tr><th>%s</th><td>%.3fus</td><td>%.3fus</td><td>%.3fus</td></tr>\n", lookup_symbol(entry.first).c_str(), avg, sd, entry.second.rwlock_w_lock_acquire_max * 1.);
+			fprintf(fh, "<tr><td>%s</td><td>%s</td><td>%lu</td><td>%lu</td><td>%lu</td><td>%.3f%%</td></tr>\n", lookup_symbol(entry.first).c_str(), kinds[k], busy, not_busy, failed, busy + not_busy ? busy * 100. / (busy + not_busy) : 0.);
+		}
 	}
 	fprintf(fh, "</table>\n");
 
-	fprintf(fh, "<h4>r/w-lock held duration</h4>\n");
-	fprintf(fh, "<table>\n");
-	fprintf(fh, "<tr><th>pointer</th><th>r/w></th><th>average</th><th>standard deviation</th><th>maximum</th></tr>\n");
-	for(auto entry : d.per_rwlock_locked_durations) {
-		double r_avg = entry.second.rwlock_r_locked_durations / double(entry.second.n_rwlock_r_locked);
-		double r_sd = sqrt(entry.second.rwlock_r_locked_sd / double(entry.second.n_rwlock_r_locked) - pow(r_avg, 2.0));
+	fprintf(fh, "</section>\n");
+}
 
-		double w_avg = entry.second.rwlock_w_locked_durations / double(entry.second.n_rwlock_w_locked);
-		double w_sd = sqrt(entry.second.rwlock_w_locked_sd / double(entry.second.n_rwlock_w_locked) - pow(r_avg, 2.0));
+// TRACE_AGGREGATE: instead of records, the dump contains per lock and
+// call site a histogram of the acquisition and of the hold durations
+typedef struct {
+	uint64_t n, sum, max;
+	// largest value in the bucket (in ns) -> count
+	std::map<uint64_t, uint64_t> buckets;
+} histogram_t;
 
-		fprintf(fh, "<tr><th>%s</th><td>r</td><td>%.3fus</td><td>%.3fus</td><td>%.3fus</td></tr>\n", lookup_symbol(entry.first).c_str(), r_avg, r_sd, entry.second.rwlock_r_locked_max * 1.);
-		fprintf(fh, "<tr><th></th><td>w</td><td>%.3fus</td><td>%.3fus</td></tr>\n", w_avg, w_sd);
+typedef struct {
+	const void *caller;
+	lock_action_t la;
+	uint64_t n_errors, n_timeouts;
+	histogram_t took, hold;
+} aggregate_site_t;
+
+histogram_t load_histogram(const json_t *const js, const int sub_bits, const double ns_per_tick)
+{
+	histogram_t h { };
+	h.n   = get_json_int(js, "n");
+	h.sum = get_json_int(js, "sum") * ns_per_tick;
+	h.max = get_json_int(js, "max") * ns_per_tick;
+
+	// the buckets are listed by their smallest value
+	const json_t *buckets = json_object_get(js, "buckets");
+	for(size_t i=0; i<json_array_size(buckets); i++) {
+		const json_t *pair = json_array_get(buckets, i);
+		uint64_t v = json_integer_value(json_array_get(pair, 0));
+		uint64_t width = v < (1ull << sub_bits) ? 1 : 1ull << (63 - __builtin_clzll(v) - sub_bits);
+
+		h.buckets[(v + width - 1) * ns_per_tick] += json_integer_value(json_array_get(pair, 1));
 	}
-	fprintf(fh, "</table>\n");
 
-	fprintf(fh, "</section>\n");
+	return h;
 }
 
-// lock, backtrace
-std::map<const void *, std::map<hash_t, uint64_t> > do_where_are_locks_used(const lock_trace_item_t *const data, const uint64_t n_records)
+void merge_histogram(histogram_t *const tgt, const histogram_t & src)
 {
-	std::map<const void *, std::map<hash_t, uint64_t> > out;
+	tgt->n   += src.n;
+	tgt->sum += src.sum;
+	tgt->max  = std::max(tgt->max, src.max);
 
-	for(uint64_t i=0; i<n_records; i++) {
-		if (data[i].rc != 0)  // ignore failed calls
-			continue;
+	for(auto & b : src.buckets)
+		tgt->buckets[b.first] += b.second;
+}
 
-		if (data[i].la == a_lock || data[i].la == a_r_lock || data[i].la == a_w_lock) {
-			hash_t h = calculate_backtrace_hash(data[i].caller, CALLER_DEPTH);
+// the largest value that is in the same bucket as the percentile
+uint64_t histogram_percentile(const histogram_t & h, const double p)
+{
+	const uint64_t target = std::max(uint64_t(1), uint64_t(ceil(h.n * p)));
+	uint64_t n = 0;
 
-			auto lock_it = out.find(data[i].lock);
-			if (lock_it != out.end())
-				lock_it->second.insert({ h, i });
-			else {
-				std::map<hash_t, uint64_t> d;
-				d.insert({ h, i });
+	for(auto & b : h.buckets) {
+		n += b.second;
 
-				out.insert({ data[i].lock, d });
-			}
-		}
+		if (n >= target)
+			return std::min(b.first, h.max);
 	}
 
-	return out;
+	return h.max;
 }
 
-void where_are_locks_used(FILE *const fh, const lock_trace_item_t *const data, const uint64_t n_records)
+std::string histogram_cells(const histogram_t & h)
 {
-	auto lock_use_locations = do_where_are_locks_used(data, n_records);
+	if (h.n == 0)
+		return "<td colspan=5>-</td>";
 
-	fprintf(fh, "<section>\n");
+	return myformat("<td>%.3f</td><td>%.3f</td><td>%.3f</td><td>%.3f</td><td>%.3f</td>", h.sum / 1000.0 / h.n, histogram_percentile(h, 0.5) / 1000.0, histogram_percentile(h, 0.9) / 1000.0, histogram_percentile(h, 0.99) / 1000.0, h.max / 1000.0);
+}
 
-	fprintf(fh, "<h2 id=\"whereused\">8. where are locks used</h2>\n");
-	fprintf(fh, "<table class=\"green\">\n");
-	for(auto & entry : lock_use_locations) {
-		fprintf(fh, "<tr><td>%s</td><td>\n", lookup_symbol(entry.first).c_str());
+void aggregated_durations(FILE *const fh, const json_t *const meta)
+{
+	const json_t *agg = json_object_get(meta, "aggregate");
+	const int sub_bits = get_json_int(agg, "histogram_sub_bits");
 
-		for(const auto & p : entry.second) {
-			put_call_trace_html(fh, data[p.second], "green");
+	double ns_per_tick = 1.;
+	uint64_t start_ticks = 0, start_ns = 0;
+	get_tsc_conversion(meta, &ns_per_tick, &start_ticks, &start_ns);
 
-			fprintf(fh, "<br>\n");
+	std::map<const void *, std::vector<aggregate_site_t> > locks;
+
+	const json_t *list = json_object_get(agg, "entries");
+	for(size_t i=0; i<json_array_size(list); i++) {
+		const json_t *entry = json_array_get(list, i);
+
+		aggregate_site_t site { };
+		site.caller   = (const void *)get_json_int(entry, "caller");
+		site.la       = lock_action_t(get_json_int(entry, "la"));
+		site.n_errors = get_json_int(entry, "n_errors");
+		site.n_timeouts = get_json_int(entry, "n_timeouts");
+		site.took     = load_histogram(json_object_get(entry, "took"), sub_bits, ns_per_tick);
+		site.hold     = load_histogram(json_object_get(entry, "hold"), sub_bits, ns_per_tick);
+
+		locks[(const void *)get_json_int(entry, "lock")].push_back(site);
+	}
+
+	// all call sites of a lock together, the most waited for first
+	std::vector<std::pair<const void *, aggregate_site_t> > totals;
+
+	for(auto & lock : locks) {
+		aggregate_site_t total { };
+
+		for(auto & site : lock.second) {
+			total.n_errors += site.n_errors;
+			total.n_timeouts += site.n_timeouts;
+			merge_histogram(&total.took, site.took);
+			merge_histogram(&total.hold, site.hold);
 		}
 
-		fprintf(fh, "</td></tr>\n");
+		totals.push_back({ lock.first, total });
+	}
+
+	std::sort(totals.begin(), totals.end(), [](const auto & a, const auto & b) { return a.second.took.sum > b.second.took.sum; });
+
+	fprintf(fh, "<section>\n");
+
+	fprintf(fh, "<h2 id=\"aggregate\">2. lock durations</h2>\n");
+	fprintf(fh, "<p>The tracer ran in aggregate mode: it only kept, per lock and call site, histograms of how long it took to get a lock and of how long it was held. Per lock the call sites are listed below its totals. The hold duration is accounted to the call site that acquired the lock.</p>\n");
+	fprintf(fh, "<p>Durations are in microseconds. Percentiles are the upper bound of their histogram bucket: within %.1f%%.</p>\n", 100. / (1 << sub_bits));
+	if (get_json_int(agg, "full"))
+		fprintf(fh, "<p>%ld acquisitions are missing: more than %ld lock/call site combinations (TRACE_AGGREGATE_ENTRIES).</p>\n", get_json_int(agg, "full"), get_json_int(agg, "max_entries"));
+	if (get_json_int(agg, "hold_untracked"))
+		fprintf(fh, "<p>For %ld acquisitions the hold duration is not known: too many locks were held at the same time.</p>\n", get_json_int(agg, "hold_untracked"));
+
+	fprintf(fh, "<table>\n");
+	fprintf(fh, "<tr><th rowspan=2>lock</th><th rowspan=2>call site</th><th rowspan=2>action</th><th rowspan=2>count</th><th rowspan=2>timeouts</th><th rowspan=2>errors</th><th colspan=5>acquiring</th><th colspan=5>held</th></tr>\n");
+	fprintf(fh, "<tr><th>avg</th><th>50%%</th><th>90%%</th><th>99%%</th><th>max</th><th>avg</th><th>50%%</th><th>90%%</th><th>99%%</th><th>max</th></tr>\n");
+
+	for(auto & total : totals) {
+		const aggregate_site_t & t = total.second;
+
+		fprintf(fh, "<tr class=\"green\"><td>%s</td><td>all</td><td></td><td>%lu</td><td>%lu</td><td>%lu</td>%s%s</tr>\n", lookup_symbol(total.first).c_str(), t.took.n, t.n_timeouts, t.n_errors, histogram_cells(t.took).c_str(), histogram_cells(t.hold).c_str());
+
+		auto & sites = locks[total.first];
+		std::sort(sites.begin(), sites.end(), [](const auto & a, const auto & b) { return a.took.sum > b.took.sum; });
+
+		for(auto & site : sites)
+			fprintf(fh, "<tr><td></td><td>%s</td><td>%s</td><td>%lu</td><td>%lu</td><td>%lu</td>%s%s</tr>\n", lookup_symbol(site.caller).c_str(), lock_action_to_name(site.la).c_str(), site.took.n, site.n_timeouts, site.n_errors, histogram_cells(site.took).c_str(), histogram_cells(site.hold).c_str());
 	}
+
 	fprintf(fh, "</table>\n");
 
 	fprintf(fh, "</section>\n");
@@ -1344,7 +3116,7 @@ std::pair<std::vector<std::pair<std::pair<const void *, const void *>, uint64_t>
 
 		bool do_count = false;
 
-		if (data[i].la == a_r_lock || data[i].la == a_w_lock || data[i].la == a_lock) {
+		if (is_read_lock(data[i].la) || is_write_lock(data[i].la) || is_exclusive_lock(data[i].la)) {
 			auto it = locked.find(data[i].lock);
 
 			if (it == locked.end())
@@ -1360,7 +3132,7 @@ std::pair<std::vector<std::pair<std::pair<const void *, const void *>, uint64_t>
 
 			do_count = true;
 		}
-		else if (data[i].la == a_rw_unlock || data[i].la == a_unlock) {
+		else if (data[i].la == a_rw_unlock || is_exclusive_unlock(data[i].la)) {
 			auto it = locked.find(data[i].lock);
 
 			if (it == locked.end())
@@ -1486,7 +3258,7 @@ void correlate(FILE *const fh, const lock_trace_item_t *const data, const uint64
 	free(dot_script);
 
 	fprintf(fh, "<section>\n");
-	fprintf(fh, "<h2 id=\"corr\">9. which locks might be correlated</h2>\n");
+	fprintf(fh, "<h2 id=\"corr\">13. which locks might be correlated</h2>\n");
 	fprintf(fh, "<div class=\"svgbox\">\n");
 	fwrite(svg_script, 1, svg_script_len, fh);
 	fprintf(fh, "</div>\n");
@@ -1548,7 +3320,7 @@ void emit_locks(FILE *const fh, const lock_usage_groups_t *const data, const uin
 
 		void *caller = data[i].caller;
 
-		if (data[i].la == a_lock || data[i].la == a_r_lock || data[i].la == a_w_lock) {
+		if (is_exclusive_lock(data[i].la) || data[i].la == a_r_lock || data[i].la == a_w_lock) {
 			auto it = locks.find(data[i].lock);
 
 			if (it == locks.end())
@@ -1556,7 +3328,7 @@ void emit_locks(FILE *const fh, const lock_usage_groups_t *const data, const uin
 			else
 				it->second.insert({ caller, i });
 		}
-		else if (data[i].la == a_unlock || data[i].la == a_rw_unlock) {
+		else if (is_exclusive_unlock(data[i].la) || data[i].la == a_rw_unlock) {
 			auto it = locks.find(data[i].lock);
 
 			if (it != locks.end()) {
@@ -1647,14 +3419,266 @@ void emit_locks(FILE *const fh, const lock_usage_groups_t *const data, const uin
 	}
 }
 
+typedef struct {
+	pid_t pid, parent;
+	std::string exe, trace_file;
+	bool aggregated;
+	uint64_t n_records, start_ts, end_ts;
+	std::vector<pid_t> children;
+} process_t;
+
+typedef struct {
+	uint64_t n, n_failed;
+	uint64_t wait_total, wait_max;
+} tree_contention_t;
+
+bool is_acquisition(const lock_action_t la)
+{
+	return la == a_lock || la == a_timed_lock || la == a_spin_lock || is_read_lock(la) || is_write_lock(la);
+}
+
+void add_contention(tree_contention_t *const c, const uint64_t n, const uint64_t n_failed, const uint64_t wait_total, const uint64_t wait_max)
+{
+	c->n          += n;
+	c->n_failed   += n_failed;
+	c->wait_total += wait_total;
+	c->wait_max    = std::max(c->wait_max, wait_max);
+}
+
+// a dump in the directory of the trace: pid, start_ts
+typedef std::map<pid_t, std::vector<std::pair<pid_t, uint64_t> > > dumps_by_parent_t;
+
+// Children that did not go through the fork() wrapper (e.g. vfork,
+// clone or posix_spawn of a traced program) are not in the list of the
+// parent, their dump does have the PID of the parent.
+dumps_by_parent_t find_dumps_by_parent(const std::string & dir)
+{
+	dumps_by_parent_t out;
+
+	DIR *d = opendir(dir.empty() ? "." : dir.c_str());
+	if (!d)
+		return out;
+
+	while(struct dirent *de = readdir(d)) {
+		// not the snapshots (dump.dat.PID.n)
+		const char *const pid_str = de->d_name + 9;
+
+		if (strncmp(de->d_name, "dump.dat.", 9) || *pid_str == 0 || strspn(pid_str, "0123456789") != strlen(pid_str))
+			continue;
+
+		json_t *const meta = load_json(dir + de->d_name);
+		if (!meta)
+			continue;
+
+		out[get_json_int(meta, "parent_pid")].push_back({ get_json_int(meta, "pid"), get_json_int(meta, "start_ts") });
+
+		json_decref(meta);
+	}
+
+	closedir(d);
+
+	return out;
+}
+
+// Loads the trace of a process and then those of its children. They are
+// expected in the same directory as the trace of the parent.
+void load_process_tree(const std::string & trace_file, json_t *const meta_in, const dumps_by_parent_t & dumps, std::vector<process_t> *const processes, std::map<const void *, std::map<pid_t, tree_contention_t> > *const locks)
+{
+	json_t *const meta = meta_in ? meta_in : load_json(trace_file);
+	if (!meta)
+		return;
+
+	process_t p { };
+	p.pid        = get_json_int(meta, "pid");
+	p.parent     = get_json_int(meta, "parent_pid");
+	p.exe        = get_json_string(meta, "exe_name");
+	p.trace_file = trace_file;
+	p.aggregated = json_object_get(meta, "aggregate") != nullptr;
+	p.start_ts   = get_json_int(meta, "start_ts");
+	p.end_ts     = get_json_int(meta, "end_ts");
+
+	for(auto & other : *processes) {
+		if (other.pid == p.pid) {
+			fprintf(stderr, "%s: process %d is already loaded\n", trace_file.c_str(), p.pid);
+
+			if (!meta_in)
+				json_decref(meta);
+
+			return;
+		}
+	}
+
+	if (p.aggregated) {
+		const json_t *agg = json_object_get(meta, "aggregate");
+
+		double ns_per_tick = 1.;
+		uint64_t start_ticks = 0, start_ns = 0;
+		get_tsc_conversion(meta, &ns_per_tick, &start_ticks, &start_ns);
+
+		const json_t *list = json_object_get(agg, "entries");
+		for(size_t i=0; i<json_array_size(list); i++) {
+			const json_t *entry = json_array_get(list, i);
+
+			if (!is_acquisition(lock_action_t(get_json_int(entry, "la"))))
+				continue;
+
+			const json_t *took = json_object_get(entry, "took");
+
+			add_contention(&(*locks)[(const void *)get_json_int(entry, "lock")][p.pid],
+					get_json_int(took, "n") + get_json_int(entry, "n_errors") + get_json_int(entry, "n_timeouts"),
+					get_json_int(entry, "n_errors") + get_json_int(entry, "n_timeouts"),
+					get_json_int(took, "sum") * ns_per_tick, get_json_int(took, "max") * ns_per_tick);
+		}
+	}
+	else {
+		// only the records: the stack table and lock registry of the
+		// process are not needed for this
+		size_t mapped_size = 0;
+		lock_trace_item_t *const data = load_items(meta, &mapped_size);
+
+		p.n_records = data ? get_json_int(meta, "n_records") : 0;
+
+		for(uint64_t i=0; i<p.n_records; i++) {
+			if (!is_acquisition(data[i].la))
+				continue;
+
+			tree_contention_t & c = (*locks)[data[i].lock][p.pid];
+
+			if (data[i].rc)
+				add_contention(&c, 1, 1, 0, 0);
+			else
+				add_contention(&c, 1, 0, data[i].lock_took, data[i].lock_took);
+		}
+
+		if (data)
+			free_items(data, mapped_size);
+	}
+
+	const json_t *children = json_object_get(meta, "children");
+	for(size_t i=0; i<json_array_size(children); i++)
+		p.children.push_back(json_integer_value(json_array_get(children, i)));
+
+	// started while this process ran: not an older process with a re-used PID
+	auto it = dumps.find(p.pid);
+	if (it != dumps.end()) {
+		for(auto & child : it->second) {
+			if (child.second >= p.start_ts && child.second <= p.end_ts && std::find(p.children.begin(), p.children.end(), child.first) == p.children.end())
+				p.children.push_back(child.first);
+		}
+	}
+
+	if (!meta_in)
+		json_decref(meta);
+
+	processes->push_back(p);
+
+	const size_t slash = trace_file.rfind('/');
+	const std::string dir = slash == std::string::npos ? "" : trace_file.substr(0, slash + 1);
+
+	for(pid_t child : p.children) {
+		const std::string child_file = myformat("%sdump.dat.%d", dir.c_str(), child);
+
+		if (access(child_file.c_str(), R_OK) == -1) {
+			fprintf(stderr, "No trace of child process %d (%s): it may have ended with _exit() or a signal\n", child, child_file.c_str());
+			continue;
+		}
+
+		load_process_tree(child_file, nullptr, dumps, processes, locks);
+	}
+}
+
+std::string tree_contention_cells(const tree_contention_t & c)
+{
+	const uint64_t n_ok = c.n - c.n_failed;
+
+	return myformat("<td>%lu</td><td>%lu</td><td>%.3fus</td><td>%.3fus</td><td>%.3fus</td>", c.n, c.n_failed, n_ok ? c.wait_total / 1000. / n_ok : 0., c.wait_max / 1000., c.wait_total / 1000.);
+}
+
+// -P: the process and all its (forked) children in one report
+void process_tree(FILE *const fh, const std::string & trace_file, json_t *const meta)
+{
+	std::vector<process_t> processes;
+	std::map<const void *, std::map<pid_t, tree_contention_t> > locks;
+
+	const size_t slash = trace_file.rfind('/');
+	const dumps_by_parent_t dumps = find_dumps_by_parent(slash == std::string::npos ? "" : trace_file.substr(0, slash + 1));
+
+	load_process_tree(trace_file, meta, dumps, &processes, &locks);
+
+	put_html_head(fh);
+
+	fprintf(fh, "<h2>table of contents</h2>\n");
+	fprintf(fh, "<ol>\n");
+	fprintf(fh, "<li><a href=\"#processes\">processes</a>\n");
+	fprintf(fh, "<li><a href=\"#treecontention\">contention over all processes</a>\n");
+	fprintf(fh, "</ol>\n");
+
+	fprintf(fh, "<section>\n");
+	fprintf(fh, "<h2 id=\"processes\">1. processes</h2>\n");
+	fprintf(fh, "<table>\n");
+	fprintf(fh, "<tr><th>pid</th><th>parent</th><th>program</th><th>started at</th><th>took</th><th># records</th><th>children</th><th>trace file</th></tr>\n");
+
+	for(auto & p : processes) {
+		std::string children;
+		for(pid_t child : p.children)
+			children += myformat("%s%d", children.empty() ? "" : ", ", child);
+
+		fprintf(fh, "<tr><td>%d</td><td>%d</td><td>%s</td><td>%s</td><td>%.3fs</td><td>%s</td><td>%s</td><td>%s</td></tr>\n",
+				p.pid, p.parent, p.exe.c_str(), my_ctime(p.start_ts).c_str(), (p.end_ts - p.start_ts) / double(billion),
+				p.aggregated ? "aggregated" : myformat("%lu", p.n_records).c_str(), children.c_str(), p.trace_file.c_str());
+	}
+
+	fprintf(fh, "</table>\n");
+	fprintf(fh, "</section>\n");
+
+	std::vector<std::pair<const void *, tree_contention_t> > totals;
+
+	for(auto & lock : locks) {
+		tree_contention_t total { };
+
+		for(auto & p : lock.second)
+			add_contention(&total, p.second.n, p.second.n_failed, p.second.wait_total, p.second.wait_max);
+
+		totals.push_back({ lock.first, total });
+	}
+
+	std::sort(totals.begin(), totals.end(), [](const auto & a, const auto & b) { return a.second.wait_total > b.second.wait_total; });
+
+	fprintf(fh, "<section>\n");
+	fprintf(fh, "<h2 id=\"treecontention\">2. contention over all processes</h2>\n");
+	fprintf(fh, "<p>Per lock the time it took to acquire it, in all processes together and then per process. A forked child has the same address space layout as its parent, so a lock at the same address is the same lock (variable) in the program; unless it is in shared memory, each process has its own copy of it. Failed are the try- and timed locks that found the lock busy or timed out (and other errors), the wait times are of the successful acquisitions. The symbols are looked up in the first process.</p>\n");
+	fprintf(fh, "<table>\n");
+	fprintf(fh, "<tr><th>lock</th><th>process</th><th># acquisitions</th><th># failed</th><th>wait avg</th><th>wait max</th><th>wait total</th></tr>\n");
+
+	for(auto & total : totals) {
+		fprintf(fh, "<tr class=\"green\"><td>%s</td><td>all (%zu)</td>%s</tr>\n", lookup_symbol(total.first).c_str(), locks[total.first].size(), tree_contention_cells(total.second).c_str());
+
+		std::vector<std::pair<pid_t, const tree_contention_t *> > per_process;
+		for(auto & p : locks[total.first])
+			per_process.push_back({ p.first, &p.second });
+
+		std::sort(per_process.begin(), per_process.end(), [](const auto & a, const auto & b) { return a.second->wait_total > b.second->wait_total; });
+
+		for(auto & p : per_process)
+			fprintf(fh, "<tr><td></td><td>%d</td>%s</tr>\n", p.first, tree_contention_cells(*p.second).c_str());
+	}
+
+	fprintf(fh, "</table>\n");
+	fprintf(fh, "</section>\n");
+
+	put_html_tail(fh);
+}
+
 void help()
 {
 	printf("-t file    file name of data.dump.xxx\n");
 	printf("-c file    core file\n");
 	printf("-r file    path to \"eu-addr2line\"\n");
+	printf("-S dir     directory with copies of the traced binaries (when no core file is used)\n");
 	printf("-f file    html file to write to\n");
 	printf("-T x       print a trace to the file instead of statistics (x = html or ascii)\n");
 	printf("-Q x       show which other instances are trying to lock on a lock (x = html or ascii)\n");
+	printf("-P         process tree: also load the traces of the child processes, for a combined contention report\n");
 #if HAVE_GVC == 1
 	printf("-C         toggle \"correlation graph\" (very slow!)\n");
 #endif
@@ -1683,15 +3707,18 @@ int main(int argc, char *argv[])
 	bool print_trace = false;
 	ug_output_t output_mode = UG_TEXT;
 	bool print_locking = false;
+	bool run_process_tree = false;
 
 	int c = 0;
-	while((c = getopt(argc, argv, "t:c:r:f:T:Q:hC")) != -1) {
+	while((c = getopt(argc, argv, "t:c:r:S:f:T:Q:PhC")) != -1) {
 		if (c == 't')
 			trace_file = optarg;
 		else if (c == 'c')
 			core_file = optarg;
 		else if (c == 'r')
 			resolver = optarg;
+		else if (c == 'S')
+			symbol_dir = optarg;
 		else if (c == 'f')
 			output_file = optarg;
 #if HAVE_GVC == 1
@@ -1708,6 +3735,9 @@ int main(int argc, char *argv[])
 
 			output_mode = text_to_mode(optarg);
 		}
+		else if (c == 'P') {
+			run_process_tree = true;
+		}
 		else if (c == 'h') {
 			help();
 			return 0;
@@ -1734,9 +3764,32 @@ int main(int argc, char *argv[])
 
 	exe_file = get_json_string(meta, "exe_name");
 
-	const lock_trace_item_t *const data = load_data(get_json_string(meta, "measurements"));
+	load_modules(meta);
+
+	if (run_process_tree) {
+		FILE *fh = fopen(output_file.c_str(), "w");
+		if (!fh) {
+			fprintf(stderr, "Failed to create %s: %s\n", output_file.c_str(), strerror(errno));
+			return 1;
+		}
+
+		process_tree(fh, trace_file, meta);
+
+		fclose(fh);
+
+		json_decref(meta);
+
+		fprintf(stderr, "Finished\n");
 
-	const lock_usage_groups_t *const ug_data = load_ug_data(get_json_string(meta, "ug_measurements"));
+		return 0;
+	}
+
+	// TRACE_AGGREGATE: no records
+	const bool aggregated = json_object_get(meta, "aggregate") != nullptr;
+
+	const lock_trace_item_t *const data = aggregated ? nullptr : load_data(meta);
+
+	const lock_usage_groups_t *const ug_data = aggregated ? nullptr : load_ug_data(meta);
 
 	FILE *fh = fopen(output_file.c_str(), "w");
 	if (!fh) {
@@ -1752,8 +3805,25 @@ int main(int argc, char *argv[])
 		emit_locks(fh, ug_data, ug_n_records, output_mode);
 	else if (print_trace)
 		emit_trace(fh, data, n_records, output_mode);
+	else if (aggregated) {
+		put_html_head(fh);
+
+		fprintf(fh, "<h2>table of contents</h2>\n");
+		fprintf(fh, "<ol>\n");
+		fprintf(fh, "<li><a href=\"#meta\">meta data</a>\n");
+		fprintf(fh, "<li><a href=\"#aggregate\">lock durations</a>\n");
+		fprintf(fh, "</ol>\n");
+
+		emit_meta_data(fh, meta, core_file, trace_file, data, n_records);
+
+		aggregated_durations(fh, meta);
+
+		put_html_tail(fh);
+	}
 	else {
-		put_html_header(fh, run_correlate);
+		bool contention = get_json_int(meta, "contended_only");
+
+		put_html_header(fh, run_correlate, contention);
 
 		emit_meta_data(fh, meta, core_file, trace_file, data, n_records);
 
@@ -1771,6 +3841,15 @@ int main(int argc, char *argv[])
 
 		where_are_locks_used(fh, data, n_records);
 
+		condition_variables(fh, data, n_records);
+
+		sync_objects(fh, data, n_records);
+
+		timed_locks(fh, data, n_records);
+
+		if (contention)
+			contention_rates(fh, meta, data, n_records);
+
 #if HAVE_GVC == 1
 		if (run_correlate)
 			correlate(fh, data, n_records);
@@ -0,0 +1,163 @@
+// (C) 2021 by folkert@vanheusden.com
+// released under GPL v3.0
+
+// Measures how much the tracer disturbs a program: threads do short
+// critical sections and, in between, walk over a working set of their
+// own. Run it without and with the tracer (LD_PRELOAD) and compare the
+// time per pass over the working set and the cache misses; that
+// difference is what the trace records cost the program's caches.
+//
+// usage: bench [threads] [iterations per thread] [working set per thread in kB]
+
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+
+pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+volatile uint64_t shared_counter = 0;
+
+int iterations = 100000;
+size_t working_set = 64 * 1024;
+
+uint64_t get_ns()
+{
+	struct timespec tp = { 0, 0 };
+
+	if (clock_gettime(CLOCK_MONOTONIC, &tp) == -1) {
+		perror("clock_gettime");
+		return 0;
+	}
+
+	return tp.tv_sec * 1000000000ull + tp.tv_nsec;
+}
+
+// counts for this process and the threads it starts afterwards, -1
+// when not permitted (see /proc/sys/kernel/perf_event_paranoid)
+int open_counter(const uint32_t type, const uint64_t config)
+{
+	struct perf_event_attr attr;
+	memset(&attr, 0x00, sizeof attr);
+
+	attr.size           = sizeof attr;
+	attr.type           = type;
+	attr.config         = config;
+	attr.disabled       = 1;
+	attr.inherit        = 1;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv     = 1;
+
+	return syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+void print_counter(const char *const name, const int fd)
+{
+	uint64_t value = 0;
+
+	if (fd == -1 || read(fd, &value, sizeof value) != sizeof value)
+		printf("%-24s n/a\n", name);
+	else
+		printf("%-24s %lu\n", name, value);
+}
+
+typedef struct {
+	uint64_t took_ns;
+	uint64_t sum;
+} result_t;
+
+void *thread(void *p)
+{
+	result_t *const result = (result_t *)p;
+
+	const size_t n = working_set / sizeof(uint64_t);
+	uint64_t *data = (uint64_t *)malloc(working_set);
+
+	for(size_t i=0; i<n; i++)
+		data[i] = i;
+
+	uint64_t sum = 0;
+	uint64_t start = get_ns();
+
+	for(int it=0; it<iterations; it++) {
+		pthread_mutex_lock(&mutex);
+		shared_counter++;
+		pthread_mutex_unlock(&mutex);
+
+		// one cache line per step: what matters is which lines are
+		// still in the cache
+		for(size_t i=(it & 7); i<n; i += 8)
+			sum += data[i];
+	}
+
+	result->took_ns = get_ns() - start;
+	result->sum = sum;
+
+	free(data);
+
+	return NULL;
+}
+
+int main(int argc, char *argv[])
+{
+	int n_threads = 4;
+
+	if (argc >= 2)
+		n_threads = atoi(argv[1]);
+	if (argc >= 3)
+		iterations = atoi(argv[2]);
+	if (argc >= 4)
+		working_set = atol(argv[3]) * 1024;
+
+	int fd_cache_misses = open_counter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES);
+	int fd_l1d_misses   = open_counter(PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16));
+
+	if (fd_cache_misses != -1)
+		ioctl(fd_cache_misses, PERF_EVENT_IOC_ENABLE, 0);
+	if (fd_l1d_misses != -1)
+		ioctl(fd_l1d_misses, PERF_EVENT_IOC_ENABLE, 0);
+
+	pthread_t *threads = (pthread_t *)calloc(n_threads, sizeof(pthread_t));
+	result_t *results = (result_t *)calloc(n_threads, sizeof(result_t));
+
+	uint64_t start = get_ns();
+
+	for(int i=0; i<n_threads; i++)
+		pthread_create(&threads[i], NULL, thread, &results[i]);
+
+	uint64_t took_ns = 0;
+
+	for(int i=0; i<n_threads; i++) {
+		pthread_join(threads[i], NULL);
+
+		took_ns += results[i].took_ns;
+	}
+
+	uint64_t total_ns = get_ns() - start;
+
+	if (fd_cache_misses != -1)
+		ioctl(fd_cache_misses, PERF_EVENT_IOC_DISABLE, 0);
+	if (fd_l1d_misses != -1)
+		ioctl(fd_l1d_misses, PERF_EVENT_IOC_DISABLE, 0);
+
+	const uint64_t n_passes = (uint64_t)n_threads * iterations;
+
+	printf("threads                  %d\n", n_threads);
+	printf("iterations per thread    %d\n", iterations);
+	printf("working set per thread   %zu kB\n", working_set / 1024);
+	printf("took                     %.3f s\n", total_ns / 1000000000.);
+	printf("ns per iteration         %.1f\n", took_ns / (double)n_passes);
+	print_counter("cache misses", fd_cache_misses);
+	print_counter("L1d read misses", fd_l1d_misses);
+
+	free(results);
+	free(threads);
+
+	return 0;
+}
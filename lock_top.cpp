@@ -0,0 +1,439 @@
+// (C) 2021-2023 by folkert@vanheusden.com
+// released under Apache license v2.0
+
+// Shows the live statistics (TRACE_LIVE) of a program that runs with
+// the lock tracer: the locks with the most contention first.
+
+#include "config.h"
+
+#include <algorithm>
+#include <errno.h>
+#include <fcntl.h>
+#include <map>
+#include <poll.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+#include <vector>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "lock_tracer.h"
+
+typedef struct {
+	uintptr_t lock;
+	uint64_t n_acquired, n_contended, n_errors;
+	uint64_t wait_total, wait_max, hold_total, hold_max, n_held;
+} lock_counters_t;
+
+typedef struct {
+	lock_counters_t now;
+	// during the last interval
+	lock_counters_t delta;
+} lock_row_t;
+
+typedef enum { s_contended, s_acquired, s_wait, s_wait_max, s_hold, s_hold_max } sort_t;
+
+const char *const sort_names[] = { "contended/s", "acquisitions/s", "wait/s", "max. wait", "hold/s", "max. hold" };
+
+typedef struct {
+	uintptr_t start, end;
+	// where the file is loaded
+	uintptr_t base;
+	std::string name;
+} mapping_t;
+
+static struct termios org_termios;
+static bool raw_terminal = false;
+
+void restore_terminal()
+{
+	if (raw_terminal)
+		tcsetattr(STDIN_FILENO, TCSANOW, &org_termios);
+}
+
+void set_raw_terminal()
+{
+	if (!isatty(STDIN_FILENO) || tcgetattr(STDIN_FILENO, &org_termios) == -1)
+		return;
+
+	struct termios t = org_termios;
+	t.c_lflag &= ~(ICANON | ECHO);
+	t.c_cc[VMIN]  = 0;
+	t.c_cc[VTIME] = 0;
+
+	if (tcsetattr(STDIN_FILENO, TCSANOW, &t) == 0) {
+		raw_terminal = true;
+
+		atexit(restore_terminal);
+	}
+}
+
+void sigint_handler(int sig)
+{
+	restore_terminal();
+
+	_exit(0);
+}
+
+const live_stats_header_t *attach(const int pid, uint32_t *const n_entries)
+{
+	char name[64];
+	snprintf(name, sizeof name, "/lock_tracer-%d", pid);
+
+	int fd = shm_open(name, O_RDONLY, 0);
+	if (fd == -1) {
+		fprintf(stderr, "Cannot open shared memory segment %s: %s\n", name, strerror(errno));
+		fprintf(stderr, "Is process %d running with the lock tracer and TRACE_LIVE set?\n", pid);
+		return nullptr;
+	}
+
+	struct stat st { };
+	if (fstat(fd, &st) == -1 || size_t(st.st_size) < sizeof(live_stats_header_t)) {
+		fprintf(stderr, "Shared memory segment %s is not (yet) valid\n", name);
+		close(fd);
+		return nullptr;
+	}
+
+	void *p = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+
+	if (p == MAP_FAILED) {
+		fprintf(stderr, "Cannot map %s: %s\n", name, strerror(errno));
+		return nullptr;
+	}
+
+	const live_stats_header_t *header = (const live_stats_header_t *)p;
+
+	if (header->magic != LIVE_STATS_MAGIC || header->entry_size != sizeof(live_stats_entry_t) || sizeof(live_stats_header_t) + uint64_t(header->n_entries) * header->entry_size > uint64_t(st.st_size)) {
+		fprintf(stderr, "Shared memory segment %s is from a different tracer version\n", name);
+		return nullptr;
+	}
+
+	*n_entries = header->n_entries;
+
+	return header;
+}
+
+std::map<uintptr_t, lock_counters_t> read_counters(const live_stats_header_t *const header, const uint32_t n_entries)
+{
+	std::map<uintptr_t, lock_counters_t> out;
+
+	const live_stats_entry_t *const entries = (const live_stats_entry_t *)(header + 1);
+
+	for(uint32_t i=0; i<n_entries; i++) {
+		const live_stats_entry_t *const e = &entries[i];
+
+		lock_counters_t c { };
+		c.lock = e->lock.load(std::memory_order_relaxed);
+		if (c.lock == 0)
+			continue;
+
+		c.n_acquired  = e->n_acquired.load(std::memory_order_relaxed);
+		c.n_contended = e->n_contended.load(std::memory_order_relaxed);
+		c.n_errors    = e->n_errors.load(std::memory_order_relaxed);
+		c.wait_total  = e->wait_total.load(std::memory_order_relaxed);
+		c.wait_max    = e->wait_max.load(std::memory_order_relaxed);
+		c.hold_total  = e->hold_total.load(std::memory_order_relaxed);
+		c.hold_max    = e->hold_max.load(std::memory_order_relaxed);
+		c.n_held      = e->n_held.load(std::memory_order_relaxed);
+
+		out.insert({ c.lock, c });
+	}
+
+	return out;
+}
+
+// To show e.g. "test+0x4010" for locks in global variables (the
+// address as in the executable or library). The .bss is an anonymous
+// mapping right after the file.
+std::vector<mapping_t> load_mappings(const int pid)
+{
+	std::vector<mapping_t> out;
+
+	char name[64];
+	snprintf(name, sizeof name, "/proc/%d/maps", pid);
+
+	FILE *fh = fopen(name, "r");
+	if (!fh)
+		return out;
+
+	char line[4096];
+	while(fgets(line, sizeof line, fh)) {
+		mapping_t m { };
+		uintptr_t offset = 0;
+		char path[4096] { 0 };
+
+		if (sscanf(line, "%lx-%lx %*s %lx %*s %*s %4095s", &m.start, &m.end, &offset, path) < 3)
+			continue;
+
+		const char *slash = strrchr(path, '/');
+		m.name = slash ? slash + 1 : path;
+		m.base = m.start - offset;
+
+		if (out.empty() == false) {
+			const mapping_t & prev = out.back();
+
+			if (m.name == prev.name && m.name[0] != '[')
+				m.base = prev.base;
+			else if (m.name.empty() && m.start == prev.end && prev.name.empty() == false && prev.name[0] != '[') {
+				m.name = prev.name;
+				m.base = prev.base;
+			}
+		}
+
+		out.push_back(m);
+	}
+
+	fclose(fh);
+
+	return out;
+}
+
+std::string describe_lock(const std::vector<mapping_t> & mappings, const uintptr_t lock)
+{
+	char buffer[128];
+
+	for(auto & m : mappings) {
+		if (lock < m.start || lock >= m.end)
+			continue;
+
+		if (m.name.empty())
+			break;
+
+		if (m.name[0] == '[')
+			snprintf(buffer, sizeof buffer, "%#lx %s", lock, m.name.c_str());
+		else
+			snprintf(buffer, sizeof buffer, "%s+%#lx", m.name.c_str(), lock - m.base);
+
+		return buffer;
+	}
+
+	snprintf(buffer, sizeof buffer, "%#lx", lock);
+
+	return buffer;
+}
+
+uint64_t sort_value(const lock_row_t & row, const sort_t sort)
+{
+	switch(sort) {
+		case s_contended:
+			return row.delta.n_contended;
+		case s_acquired:
+			return row.delta.n_acquired;
+		case s_wait:
+			return row.delta.wait_total;
+		case s_wait_max:
+			return row.now.wait_max;
+		case s_hold:
+			return row.delta.hold_total;
+		case s_hold_max:
+			return row.now.hold_max;
+	}
+
+	return 0;
+}
+
+double get_ts()
+{
+	struct timespec ts { };
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec + ts.tv_nsec / 1000000000.;
+}
+
+int terminal_rows()
+{
+	struct winsize ws { };
+
+	if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) == -1 || ws.ws_row == 0)
+		return 25;
+
+	return ws.ws_row;
+}
+
+void show(const live_stats_header_t *const header, const std::vector<lock_row_t> & rows, const std::vector<mapping_t> & mappings, const sort_t sort, const double interval, const size_t n_lines, const bool batch)
+{
+	const double us_per_tick = header->ns_per_tick / 1000.;
+
+	if (!batch)
+		printf("\033[H\033[2J");
+
+	time_t now = time(nullptr);
+	printf("lock_top - PID %d - %s", header->pid, ctime(&now));
+	printf("%zu locks, sorted by %s%s, contended: wait > %.3fus", rows.size(), sort_names[sort], batch ? "" : " (keys: c a w W h H, q = quit)", header->contended_ticks * us_per_tick);
+	if (header->n_full.load(std::memory_order_relaxed))
+		printf(", %lu events of locks that did not fit (TRACE_LIVE_LOCKS)", header->n_full.load(std::memory_order_relaxed));
+	printf("\n\n");
+
+	printf("%-32s %10s %10s %7s %12s %12s %12s %12s %8s\n", "lock", "acq/s", "cont/s", "cont%", "avg wait us", "max wait us", "avg hold us", "max hold us", "errors");
+
+	for(size_t i=0; i<std::min(n_lines, rows.size()); i++) {
+		const lock_counters_t & n = rows[i].now;
+		const lock_counters_t & d = rows[i].delta;
+
+		printf("%-32s %10.0f %10.0f %6.2f%% %12.3f %12.3f %12.3f %12.3f %8lu\n",
+				describe_lock(mappings, n.lock).c_str(),
+				d.n_acquired / interval,
+				d.n_contended / interval,
+				n.n_acquired ? n.n_contended * 100. / n.n_acquired : 0.,
+				n.n_acquired ? n.wait_total * us_per_tick / n.n_acquired : 0.,
+				n.wait_max * us_per_tick,
+				n.n_held ? n.hold_total * us_per_tick / n.n_held : 0.,
+				n.hold_max * us_per_tick,
+				n.n_errors);
+	}
+
+	fflush(stdout);
+}
+
+// returns false when 'q' was pressed
+bool wait_for_key(const double interval, sort_t *const sort)
+{
+	int ms = interval * 1000;
+
+	struct pollfd fds[] { { STDIN_FILENO, POLLIN, 0 } };
+
+	if (!raw_terminal) {
+		usleep(ms * 1000);
+		return true;
+	}
+
+	if (poll(fds, 1, ms) == 1) {
+		char c = 0;
+
+		if (read(STDIN_FILENO, &c, 1) == 1) {
+			if (c == 'q')
+				return false;
+
+			const char keys[] = "cawWhH";
+			const char *p = strchr(keys, c);
+			if (p && c)
+				*sort = sort_t(p - keys);
+		}
+	}
+
+	return true;
+}
+
+void help()
+{
+	printf("-p pid     process to show the lock statistics of (it must run with TRACE_LIVE set)\n");
+	printf("-s x       sort by: c(ontended), a(cquisitions), w(ait), W (max. wait), h(old) or H (max. hold)\n");
+	printf("-i x       refresh interval in seconds (default: 1)\n");
+	printf("-n x       number of locks to show (default: what fits on the screen)\n");
+	printf("-b         batch mode: print the statistics once (after one interval) and stop\n");
+}
+
+int main(int argc, char *argv[])
+{
+	int pid = -1;
+	sort_t sort = s_contended;
+	double interval = 1.;
+	size_t n_lines = 0;
+	bool batch = false;
+
+	int c = 0;
+	while((c = getopt(argc, argv, "p:s:i:n:bh")) != -1) {
+		if (c == 'p')
+			pid = atoi(optarg);
+		else if (c == 's') {
+			const char keys[] = "cawWhH";
+			const char *p = strchr(keys, optarg[0]);
+
+			if (!p || !optarg[0]) {
+				help();
+				return 1;
+			}
+
+			sort = sort_t(p - keys);
+		}
+		else if (c == 'i')
+			interval = std::max(0.1, atof(optarg));
+		else if (c == 'n')
+			n_lines = atoi(optarg);
+		else if (c == 'b')
+			batch = true;
+		else if (c == 'h') {
+			help();
+			return 0;
+		}
+		else {
+			help();
+			return 1;
+		}
+	}
+
+	if (pid <= 0) {
+		fprintf(stderr, "Please select a process (-p)\n");
+		return 1;
+	}
+
+	uint32_t n_entries = 0;
+	const live_stats_header_t *const header = attach(pid, &n_entries);
+	if (!header)
+		return 1;
+
+	if (!batch) {
+		set_raw_terminal();
+
+		signal(SIGINT, sigint_handler);
+	}
+
+	auto previous = read_counters(header, n_entries);
+	double previous_ts = get_ts();
+
+	for(;;) {
+		if (!wait_for_key(interval, &sort))
+			break;
+
+		if (kill(pid, 0) == -1 && errno == ESRCH) {
+			printf("Process %d has stopped\n", pid);
+			break;
+		}
+
+		auto current = read_counters(header, n_entries);
+		double current_ts = get_ts();
+
+		std::vector<lock_row_t> rows;
+
+		for(auto & entry : current) {
+			lock_row_t row { entry.second, entry.second };
+
+			auto it = previous.find(entry.first);
+			if (it != previous.end()) {
+				row.delta.n_acquired  -= it->second.n_acquired;
+				row.delta.n_contended -= it->second.n_contended;
+				row.delta.n_errors    -= it->second.n_errors;
+				row.delta.wait_total  -= it->second.wait_total;
+				row.delta.hold_total  -= it->second.hold_total;
+				row.delta.n_held      -= it->second.n_held;
+			}
+
+			rows.push_back(row);
+		}
+
+		std::sort(rows.begin(), rows.end(), [sort](const lock_row_t & a, const lock_row_t & b) { return sort_value(a, sort) > sort_value(b, sort); });
+
+		// batch: all locks unless -n is given
+		size_t n_show = n_lines ? n_lines : batch ? rows.size() : std::max(1, terminal_rows() - 5);
+
+		// a key-press ends the interval early
+		show(header, rows, load_mappings(pid), sort, current_ts - previous_ts, n_show, batch);
+
+		if (batch)
+			break;
+
+		previous = current;
+		previous_ts = current_ts;
+	}
+
+	return 0;
+}
@@ -9,13 +9,19 @@
 #include <dlfcn.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <fnmatch.h>
 #include <jansson.h>
 #define UNW_LOCAL_ONLY
 #include <libunwind.h>
 #include <limits.h>
 #include <map>
+#include <algorithm>
+#include <array>
+#include <ctype.h>
+#include <vector>
 #include <pthread.h>
 #include <sched.h>
+#include <semaphore.h>
 #include <signal.h>
 #include <stdio.h>
 #include <stdint.h>
@@ -31,6 +37,9 @@
 #include <sys/sysinfo.h>
 #include <sys/time.h>
 #include <sys/types.h>
+#include <sys/uio.h>
+#include <link.h>
+#include <linux/mempolicy.h>
 
 
 #if JSON_INTEGER_IS_LONG_LONG
@@ -45,6 +54,32 @@
 #warning This program may only work correctly on Linux.
 #endif
 
+#if defined(BACKTRACE_CACHE) && (!defined(WITH_BACKTRACE) || defined(SHALLOW_BACKTRACE) || defined(PREVENT_RECURSION))
+#undef BACKTRACE_CACHE
+#endif
+
+#if defined(WITH_AGGREGATE) && !defined(MEASURE_TIMING)
+#undef WITH_AGGREGATE
+#endif
+
+#if defined(WITH_LIVE_STATS) && !defined(MEASURE_TIMING)
+#undef WITH_LIVE_STATS
+#endif
+
+#if defined(USE_TSC) && !defined(__x86_64__) && !defined(__i386__)
+#warning USE_TSC is only supported on x86, using clock_gettime instead
+#undef USE_TSC
+#endif
+
+#ifdef USE_TSC
+#include <cpuid.h>
+#include <x86intrin.h>
+#endif
+
+#ifdef NON_TEMPORAL_STORES
+#include <emmintrin.h>
+#endif
+
 #define likely(x)       __builtin_expect((x), 1)
 #define unlikely(x)     __builtin_expect((x), 0)
 
@@ -55,14 +90,111 @@ static char *data_filename = nullptr;
 
 static bool verbose = false;
 
+// flight-recorder: keep the last records instead of stopping when the
+// buffer is full
+static bool ring_buffer = false;
+
+// full segments are written to disk by a background thread and then
+// re-used
+static bool stream_writer = false;
+static std::atomic<bool> stream_writer_stop { false };
+static std::atomic<bool> stream_writer_stopped { false };
+#ifdef PER_THREAD_BUFFERS
+// streaming and flight-recorder mode: hands back the segments of a
+// thread when it terminates
+static pthread_key_t segment_owner_key;
+#endif
+
+// TRACE_HUGEPAGES: the trace buffers are anonymous memory on huge pages
+// (instead of a mapping of the measurements files) and are written to
+// those files at exit
+typedef enum { hp_none, hp_thp, hp_hugetlb } hugepages_t;
+static hugepages_t hugepages = hp_none;
+static size_t huge_page_size = 2 * 1024 * 1024;
+
+static const char *hugepages_name(const hugepages_t hp)
+{
+	if (hp == hp_thp)
+		return "thp";
+
+	if (hp == hp_hugetlb)
+		return "hugetlb";
+
+	return "none";
+}
+
+// name or number of the signal that triggers a snapshot
 static std::string signal_trigger_dump;
+// same, but for snapshots on request: taken right away and not
+// limited by max_snapshots
+static std::string signal_snapshot_dump;
+// converted to get_ts() units at start-up
+static uint64_t trigger_took_ns = 0, trigger_hold_ns = 0;
+
+// record only 1 in sample_rate lock acquisitions (and their unlocks)
+static uint32_t sample_rate = 1;
+
+#ifdef PER_THREAD_BUFFERS
+// varint encoded records, see lock_tracer.h
+static bool compact = false;
+#endif
+
+// only record acquisitions for which the lock was busy, the others
+// are only counted (per thread, per lock)
+static bool contended_only = false;
+
+#define UNCONTENDED_TABLE_SIZE 1024  // power of 2
+
+typedef struct {
+	const void *lock;
+	// mutex lock, read lock, write lock
+	uint64_t n[3];
+	// the ones for which the trylock failed: got the lock after waiting
+	// and returned an error (e.g. EDEADLK)
+	uint64_t n_busy[3], n_failed[3];
+} uncontended_entry_t;
+
+typedef struct {
+	int tid;
+	// locks that did not fit
+	uint64_t n_overflow;
+	uncontended_entry_t entries[UNCONTENDED_TABLE_SIZE];
+} uncontended_table_t;
+
+// Each thread gets its own table from this pool. Tables are never given
+// back so that the counts of threads that stopped are still there at exit.
+static uncontended_table_t *uncontended_tables = nullptr;
+static uint32_t max_uncontended_tables = 1024;
+static std::atomic<uint32_t> n_uncontended_tables { 0 };
+static std::atomic<uint64_t> uncontended_no_table { 0 };
+static uint64_t trigger_post_ms = 100;
+static int max_snapshots = 10;
+static int trigger_pipe[2] { -1, -1 };
+static std::atomic<bool> snapshot_pending { false };
+static std::atomic<bool> on_demand_pending { false };
+static const char *volatile snapshot_reason = nullptr;
+// no new segments are handed out while a snapshot is written
+static std::atomic<bool> frozen { false };
+
+// process tree: the parent is set in all processes (so that the
+// analyzer can also link a child that called exec()), fork_ts only in
+// forked children
+static pid_t parent_pid = 0;
+static uint64_t fork_ts = 0;
+#define MAX_CHILDREN 1024
+static pid_t children[MAX_CHILDREN];
+static std::atomic<uint32_t> n_children { 0 };
 
-static bool fork_warning = false;
 static bool exited = false;
+// TRACE_NO_CORE: let the process exit normally instead of abort()ing
+// for a core file; the analyzer then uses the module list
+static bool no_core = false;
 
 static bool capture_sigterm = false;
 
+#if defined(WITH_BACKTRACE) && !defined(PREVENT_RECURSION) && !defined(SHALLOW_BACKTRACE)
 static thread_local bool prevent_backtrace = false;
+#endif
 
 static void color(const char *str)
 {
@@ -90,11 +222,149 @@ static uint64_t get_ns()
 
 static uint64_t global_start_ts = get_ns();
 
-static std::atomic<std::uint64_t> items_idx { 0 };
+#ifdef USE_TSC
+// only when the TSC is invariant (constant rate, not stopped in deep
+// C-states), else get_ts() falls back to get_ns()
+static bool tsc_usable = false;
+
+// TSC and CLOCK_MONOTONIC sampled together at start-up; the analyzer
+// derives the tick rate from this and a second sample at the end
+static uint64_t tsc_start_ticks = 0, tsc_start_mono = 0, tsc_start_ns = 0;
+
+static uint64_t get_mono_ns()
+{
+	struct timespec tp { 0 };
+
+	clock_gettime(CLOCK_MONOTONIC, &tp);
+
+	return tp.tv_sec * 1000ll * 1000ll * 1000ll + tp.tv_nsec;
+}
+
+static bool tsc_is_invariant()
+{
+	unsigned int eax = 0, ebx = 0, ecx = 0, edx = 0;
+
+	if (!__get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx))
+		return false;
+
+	return edx & (1 << 8);
+}
+#endif
+
+// Timestamp as stored in the trace records. With USE_TSC these are TSC
+// ticks which the analyzer converts to nanoseconds.
+static inline uint64_t get_ts()
+{
+#if defined(USE_TSC) && defined(MEASURE_TIMING)
+	if (likely(tsc_usable)) {
+		unsigned int aux = 0;
+
+		return __rdtscp(&aux);
+	}
+#endif
+
+	return get_ns();
+}
+
+#if defined(USE_TSC) && defined(MEASURE_TIMING)
+// a short calibration, for converting thresholds to ticks
+static double measure_ticks_per_ns()
+{
+	uint64_t start_mono = get_mono_ns();
+	uint64_t start_ticks = get_ts();
+
+	usleep(10000);
+
+	return double(get_ts() - start_ticks) / (get_mono_ns() - start_mono);
+}
+#endif
+
+#ifdef PER_THREAD_BUFFERS
+// Per segment bookkeeping. Only the thread that claimed the segment
+// writes to it, hence the padding to a cache line.
+typedef enum { SEGMENT_FREE = 0, SEGMENT_OWNED, SEGMENT_FULL, SEGMENT_WRITING } segment_state_t;
+
+typedef struct {
+	uint64_t n_used;
+	// compact mode: n_used is in bytes, this is the number of records
+	uint64_t n_events;
+	// how many segments were claimed before this one
+	uint64_t seq;
+	int tid;
+	// NUMA node the thread ran on when it claimed the segment
+	int node;
+	// streaming and flight-recorder mode
+	std::atomic<int> state;
+} __attribute__((aligned(64))) segment_t;
+
+// TRACE_NUMA: the segments are divided in a region per NUMA node,
+// threads take segments from the region of the node they run on
+typedef struct {
+	uint64_t first, n_segments;
+	int node;
+	// index in the region of the next segment to hand out
+	std::atomic<std::uint64_t> next;
+} __attribute__((aligned(64))) buffer_region_t;
+
+#define MAX_NUMA_NODES 64
+
+static bool numa = false;
+static int numa_nodes[MAX_NUMA_NODES] { 0 };
+static int n_numa_nodes = 1;
+// node id to region index
+static int numa_node_region[MAX_NUMA_NODES] { 0 };
+#endif
+
+typedef struct {
+	char *data;
+	// what the buffer got, hugetlb can fall back to thp
+	hugepages_t hugepages;
+	size_t record_size;
+	uint64_t n_records;
+#ifdef PER_THREAD_BUFFERS
+	// record_size is 1 then, the segments contain varint encoded records
+	bool compact;
+	uint64_t segment_records, n_segments;
+	// number of segments handed out so far (the seq of the next one)
+	std::atomic<std::uint64_t> next { 0 };
+	segment_t *segments;
+	buffer_region_t *regions;
+	int n_regions;
+	// streaming mode: where the segments go and how many made it
+	int stream_fd;
+	uint64_t n_streamed;
+	std::atomic<std::uint64_t> n_dropped { 0 };
+	// segments the writer emptied so far
+	std::atomic<std::uint64_t> n_freed { 0 };
+#else
+	// index of the next record to hand out
+	std::atomic<std::uint64_t> next { 0 };
+#endif
+} trace_buffer_t;
+
+#ifdef PER_THREAD_BUFFERS
+// where a thread is in its current segment of a trace_buffer_t
+typedef struct {
+	uint64_t segment, seq, idx, end;
+	// streaming mode: no free segment was found; n_freed at that time
+	bool starved;
+	uint64_t freed_seen;
+	// streaming mode: records dropped that are not in the n_dropped of
+	// the buffer yet
+	uint64_t n_dropped;
+} buffer_cursor_t;
+
+// the drops of a thread are added to the buffer at most this far apart
+#define DROPPED_FLUSH_INTERVAL 1024
+
+static uint64_t segment_records = 4096;
+#endif
+
+static trace_buffer_t items_buffer;
 static lock_trace_item_t *items = nullptr;
 
 #ifdef WITH_USAGE_GROUPS
-static std::atomic<std::uint64_t> ug_items_idx { 0 };
+static trace_buffer_t ug_items_buffer;
 static lock_usage_groups_t *ug_items = nullptr;
 static size_t ug_length = 0;
 static int ug_mmap_fd = -1;
@@ -102,6 +372,7 @@ static char *ug_data_filename = nullptr;
 #endif
 
 static std::atomic<std::uint64_t> cnt_mutex_trylock { 0 };
+static std::atomic<std::uint64_t> cnt_mutex_timedlock { 0 };
 static std::atomic<std::uint64_t> cnt_rwlock_try_rdlock { 0 };
 static std::atomic<std::uint64_t> cnt_rwlock_try_timedrdlock { 0 };
 static std::atomic<std::uint64_t> cnt_rwlock_try_wrlock { 0 };
@@ -114,6 +385,14 @@ static org_pthread_mutex_lock org_pthread_mutex_lock_h = nullptr;
 typedef int (* org_pthread_mutex_trylock)(pthread_mutex_t *mutex);
 static org_pthread_mutex_trylock org_pthread_mutex_trylock_h = nullptr;
 
+typedef int (* org_pthread_mutex_timedlock)(pthread_mutex_t *mutex, const struct timespec *abstime);
+static org_pthread_mutex_timedlock org_pthread_mutex_timedlock_h = nullptr;
+
+#if __GLIBC_PREREQ(2, 30)
+typedef int (* org_pthread_mutex_clocklock)(pthread_mutex_t *mutex, clockid_t clock_id, const struct timespec *abstime);
+static org_pthread_mutex_clocklock org_pthread_mutex_clocklock_h = nullptr;
+#endif
+
 typedef int (* org_pthread_mutex_unlock)(pthread_mutex_t *mutex);
 static org_pthread_mutex_unlock org_pthread_mutex_unlock_h = nullptr;
 
@@ -132,6 +411,9 @@ static org_pthread_setname_np org_pthread_setname_np_h = nullptr;
 typedef pid_t (* org_fork)(void);
 static org_fork org_fork_h = nullptr;
 
+typedef void (* org_exit)(int status);
+static org_exit org_exit_h = nullptr;
+
 typedef int (* org_pthread_rwlock_rdlock)(pthread_rwlock_t *rwlock);
 static org_pthread_rwlock_rdlock org_pthread_rwlock_rdlock_h = nullptr;
 
@@ -150,23 +432,84 @@ static org_pthread_rwlock_trywrlock org_pthread_rwlock_trywrlock_h = nullptr;
 typedef int (* org_pthread_rwlock_timedwrlock)(pthread_rwlock_t *rwlock, const struct timespec *abstime);
 static org_pthread_rwlock_timedwrlock org_pthread_rwlock_timedwrlock_h = nullptr;
 
+#if __GLIBC_PREREQ(2, 30)
+typedef int (* org_pthread_rwlock_clockrdlock)(pthread_rwlock_t *rwlock, clockid_t clock_id, const struct timespec *abstime);
+static org_pthread_rwlock_clockrdlock org_pthread_rwlock_clockrdlock_h = nullptr;
+
+typedef int (* org_pthread_rwlock_clockwrlock)(pthread_rwlock_t *rwlock, clockid_t clock_id, const struct timespec *abstime);
+static org_pthread_rwlock_clockwrlock org_pthread_rwlock_clockwrlock_h = nullptr;
+#endif
+
 typedef int (* org_pthread_rwlock_unlock)(pthread_rwlock_t *rwlock);
 static org_pthread_rwlock_unlock org_pthread_rwlock_unlock_h = nullptr;
 
+typedef int (* org_pthread_cond_wait)(pthread_cond_t *cond, pthread_mutex_t *mutex);
+static org_pthread_cond_wait org_pthread_cond_wait_h = nullptr;
+
+typedef int (* org_pthread_cond_timedwait)(pthread_cond_t *cond, pthread_mutex_t *mutex, const struct timespec *abstime);
+static org_pthread_cond_timedwait org_pthread_cond_timedwait_h = nullptr;
+
+#if __GLIBC_PREREQ(2, 30)
+typedef int (* org_pthread_cond_clockwait)(pthread_cond_t *cond, pthread_mutex_t *mutex, clockid_t clock_id, const struct timespec *abstime);
+static org_pthread_cond_clockwait org_pthread_cond_clockwait_h = nullptr;
+#endif
+
+typedef int (* org_pthread_cond_signal)(pthread_cond_t *cond);
+static org_pthread_cond_signal org_pthread_cond_signal_h = nullptr;
+
+typedef int (* org_pthread_cond_broadcast)(pthread_cond_t *cond);
+static org_pthread_cond_broadcast org_pthread_cond_broadcast_h = nullptr;
+
+typedef int (* org_pthread_spin_lock)(pthread_spinlock_t *lock);
+static org_pthread_spin_lock org_pthread_spin_lock_h = nullptr;
+
+typedef int (* org_pthread_spin_trylock)(pthread_spinlock_t *lock);
+static org_pthread_spin_trylock org_pthread_spin_trylock_h = nullptr;
+
+typedef int (* org_pthread_spin_unlock)(pthread_spinlock_t *lock);
+static org_pthread_spin_unlock org_pthread_spin_unlock_h = nullptr;
+
+typedef int (* org_sem_wait)(sem_t *sem);
+static org_sem_wait org_sem_wait_h = nullptr;
+
+typedef int (* org_sem_trywait)(sem_t *sem);
+static org_sem_trywait org_sem_trywait_h = nullptr;
+
+typedef int (* org_sem_timedwait)(sem_t *sem, const struct timespec *abstime);
+static org_sem_timedwait org_sem_timedwait_h = nullptr;
+
+#if __GLIBC_PREREQ(2, 30)
+typedef int (* org_sem_clockwait)(sem_t *sem, clockid_t clock_id, const struct timespec *abstime);
+static org_sem_clockwait org_sem_clockwait_h = nullptr;
+#endif
+
+typedef int (* org_sem_post)(sem_t *sem);
+static org_sem_post org_sem_post_h = nullptr;
+
+typedef int (* org_pthread_barrier_wait)(pthread_barrier_t *barrier);
+static org_pthread_barrier_wait org_pthread_barrier_wait_h = nullptr;
+
 typedef int (* org_pthread_rwlock_destroy)(pthread_rwlock_t *rwlock);
 static org_pthread_rwlock_destroy org_pthread_rwlock_destroy_h = nullptr;
 
 typedef int (* org_pthread_rwlock_init)(pthread_rwlock_t *rwlock, const pthread_rwlockattr_t *attr);
 static org_pthread_rwlock_init org_pthread_rwlock_init_h = nullptr;
 
-static std::map<int, std::string> *tid_names = nullptr;
+// names set by pthread_setname_np, used by threads that were named by
+// an other thread
+static std::map<pthread_t, std::string> *tid_names = nullptr;
+#ifdef STORE_THREAD_NAME
 static pthread_rwlock_t tid_names_lock = PTHREAD_RWLOCK_INITIALIZER;
+#endif
+// bumped when a thread gets named by an other thread
+static std::atomic<std::uint64_t> tid_names_generation { 0 };
 
 static int _gettid()
 {
 	return syscall(__NR_gettid);
 }
 
+#ifdef STORE_THREAD_NAME
 // check that function pointers that are required for 'tid_names'-
 // map handling are resolved
 static void check_tid_names_lock_functions()
@@ -180,12 +523,14 @@ static void check_tid_names_lock_functions()
 	if (unlikely(!org_pthread_rwlock_unlock_h))
 		org_pthread_rwlock_unlock_h = (org_pthread_rwlock_unlock)dlsym(RTLD_NEXT, "pthread_rwlock_unlock");
 }
+#endif
 
 static void show_items_buffer_not_allocated_error()
 {
 	static bool error_shown = false;
 
-	if (!error_shown) {
+	// after exit() the buffers are gone on purpose
+	if (!error_shown && !exited) {
 		color("\033[0;31m");
 		fprintf(stderr, "Buffer not (yet) allocated?!\n");
 		color("\033[0m");
@@ -210,7 +555,8 @@ static void show_items_buffer_full_error()
 {
 	static bool error_shown = false;
 
-	if (!error_shown) {
+	// in ring-buffer mode records are only dropped while a snapshot is written
+	if (!error_shown && !ring_buffer && !stream_writer) {
 		error_shown = true;
 
 		color("\033[0;31m");
@@ -220,666 +566,5142 @@ static void show_items_buffer_full_error()
 	}
 }
 
-static void show_items_buffer_percent()
+static void show_items_buffer_percent(const uint64_t n_used)
 {
 	color("\033[0;31m");
 	print_timestamp();
-	fprintf(stderr, "Trace buffer %.2f%% full\n", items_idx * 100.0 / n_records);
+	fprintf(stderr, "Trace buffer %.2f%% full\n", n_used * 100.0 / n_records);
 	color("\033[0m");
 }
 
-static void my_backtrace(void **const list, const int max_depth)
-{
-    bool get_backtrace = !prevent_backtrace;
-
-    if (likely(get_backtrace)) {
-        prevent_backtrace = true;
-
-        unw_context_t uc;
-        unw_getcontext(&uc);
-
-        unw_cursor_t cursor;
-        unw_init_local(&cursor, &uc);
+#ifdef WITH_AGGREGATE
+// TRACE_AGGREGATE: no records are stored but, per lock and call site,
+// log-linear (HDR-style) histograms of how long it took to get the lock
+// and how long it was held. Values below 2^HIST_SUB_BITS are exact,
+// above that each power of 2 is split in 2^HIST_SUB_BITS buckets.
+#define HIST_SUB_BITS 3
+// larger values end up in the last bucket
+#define HIST_MAX_BITS 48
+#define HIST_N_BUCKETS ((HIST_MAX_BITS - HIST_SUB_BITS + 1) << HIST_SUB_BITS)
+
+typedef struct {
+	std::atomic<uint64_t> n, sum, max;
+	std::atomic<uint64_t> buckets[HIST_N_BUCKETS];
+} histogram_t;
+
+typedef struct {
+	// hash of lock & caller, 0 = free
+	std::atomic<uint64_t> key;
+	// set when lock & caller are filled in
+	std::atomic<bool> ready;
+	const void *lock;
+	const void *caller;
+	lock_action_t la;
+	std::atomic<uint64_t> n_errors, n_timeouts;
+	histogram_t took, hold;
+} aggregate_entry_t;
+
+static bool aggregate = false;
+// open addressing, power of 2
+static aggregate_entry_t *aggregate_table = nullptr;
+static uint32_t aggregate_size = 4096;
+// lock/call site combinations that did not fit and acquisitions of
+// which the hold duration could not be determined
+static std::atomic<uint64_t> aggregate_full { 0 }, aggregate_hold_untracked { 0 };
+#endif
 
-        memset(list, 0x00, sizeof(void *) * max_depth);
+#ifdef WITH_LIVE_STATS
+static bool live_stats = false;
+static live_stats_header_t *live_header = nullptr;
+static live_stats_entry_t *live_entries = nullptr;
+static uint32_t live_size = 4096;  // power of 2
+static uint64_t live_contended_ns = 1000;
+static char *live_shm_name = nullptr;
+#endif
 
-        for(int i=0; i<max_depth; i++) {
-            if (unw_step(&cursor) <= 0)
-                break;
+#define N_HELD_TRACKED 16
+
+typedef struct {
+	const void *lock;
+	uint64_t ts;
+	// aggregate_entry_t or live_stats_entry_t
+	void *entry;
+} held_lock_t;
+
+// locks held by a thread, to determine the hold durations
+typedef struct {
+	held_lock_t held[N_HELD_TRACKED];
+	int n;
+} held_stack_t;
+
+#ifdef BACKTRACE_CACHE
+// per thread, direct mapped
+#define BT_CACHE_SIZE 32
+
+typedef struct {
+	// return address in the pthread wrapper & stack position
+	const void *caller;
+	uintptr_t sp;
+	uint32_t n_hits;
+#ifdef INTERN_STACKS
+	uint32_t stack_id;
+#else
+	void *list[CALLER_DEPTH];
+#endif
+} bt_cache_entry_t;
+#endif
 
-            unw_word_t ip;
-            unw_get_reg(&cursor, UNW_REG_IP, &ip);
+// Everything a thread needs while storing a record. This is filled in
+// once per thread so that the record functions don't need a gettid()
+// system call and a (locked) lookup of the thread name each time.
+typedef struct {
+	int tid;
+#ifdef STORE_THREAD_NAME
+	char thread_name[16];
+	uint64_t tid_names_generation;
+#endif
+#ifdef PER_THREAD_BUFFERS
+	buffer_cursor_t items_cursor;
+#ifdef WITH_USAGE_GROUPS
+	buffer_cursor_t ug_items_cursor;
+#endif
+#endif
+	held_stack_t held;
+#ifdef WITH_LIVE_STATS
+	held_stack_t live_held;
+#endif
+	// sampling: acquisitions to go before the next one is recorded and
+	// the locks of which the unlock must be recorded as well
+	uint32_t sample_countdown;
+	uint64_t sample_rng;
+	const void *sampled_held[N_HELD_TRACKED];
+	int n_sampled_held;
+	uncontended_table_t *uncontended;
+#ifdef FRAME_POINTER_UNWIND
+	// stack of this thread, frame pointers must point in here
+	uintptr_t stack_lo, stack_hi;
+#endif
+#ifdef BACKTRACE_CACHE
+	bt_cache_entry_t bt_cache[BT_CACHE_SIZE];
+#endif
+	// TRACE_FILTER_CALLER: the locks that were acquired from a selected
+	// module; their unlock is recorded wherever it is done
+	const void *filter_held[N_HELD_TRACKED];
+	int n_filter_held;
+	// the module of the last caller and the addresses that are in it,
+	// valid while module_table is the current table (see caller_module)
+	const void *module_table;
+	uintptr_t caller_lo, caller_n;
+	const void *caller_module;
+	// not in a module: look again from then on
+	uint64_t caller_retry_ts;
+	bool refreshing_modules;
+#ifdef NON_TEMPORAL_STORES
+	// the record is filled in here and then streamed to nt_target
+	lock_trace_item_t nt_item;
+	lock_trace_item_t *nt_target;
+#ifdef WITH_USAGE_GROUPS
+	lock_usage_groups_t nt_ug_item;
+	lock_usage_groups_t *nt_ug_target;
+#endif
+#endif
+#ifdef PER_THREAD_BUFFERS
+	// compact mode: the record is filled in here and then encoded
+	// against the previous one in the same segment
+	lock_trace_item_t compact_item;
+	uint64_t compact_prev_ts;
+	uintptr_t compact_prev_lock;
+#ifdef LOCK_REGISTRY
+	int64_t compact_prev_lock_id;
+#endif
+#if defined(WITH_BACKTRACE) && !defined(INTERN_STACKS)
+	void *compact_prev_caller[CALLER_DEPTH];
+#endif
+#ifdef STORE_THREAD_NAME
+	char compact_prev_name[16];
+	bool compact_name_sent;
+#endif
+#endif
+} tracer_context_t;
 
-            list[i] = (void *)ip;
-        }
+// initial-exec: this library is LD_PRELOADed so there's always room in
+// the static TLS block, which makes access a single %fs-relative load
+static thread_local tracer_context_t context __attribute__((tls_model("initial-exec")));
 
-        prevent_backtrace = false;
-    }
+#ifdef STORE_THREAD_NAME
+static void set_context_thread_name(const char *const name)
+{
+	memset(context.thread_name, 0x00, sizeof context.thread_name);
+	strncpy(context.thread_name, name, sizeof context.thread_name - 1);
 }
 
-static void store_mutex_info(pthread_mutex_t *mutex, lock_action_t la, uint64_t took, const int rc, void *const shallow_backtrace)
+// pick up a name that was set by an other thread
+static void refresh_context_thread_name()
 {
-	if (unlikely(!items)) {
-		// when a constructor of some other library already invokes e.g. pthread_mutex_lock
-		// before this wrapper has been fully initialized
-		show_items_buffer_not_allocated_error();
-		return;
-	}
+	check_tid_names_lock_functions();
 
-	uint64_t cur_idx = items_idx++;
+	context.tid_names_generation = tid_names_generation;
 
-	if (verbose) {
-		if (cur_idx % emit_count_threshold == 0)
-			show_items_buffer_percent();
-	}
+	if (tid_names && (*org_pthread_rwlock_rdlock_h)(&tid_names_lock) == 0) {
+		auto it = tid_names->find(pthread_self());
+		if (it != tid_names->end())
+			set_context_thread_name(it->second.c_str());
 
-	if (likely(cur_idx < n_records)) {
-#ifdef WITH_BACKTRACE
-#if defined(PREVENT_RECURSION) || defined(SHALLOW_BACKTRACE)
-		items[cur_idx].caller[0] = shallow_backtrace;
-#else
-		my_backtrace(items[cur_idx].caller, CALLER_DEPTH);
-#endif
-#endif
-		items[cur_idx].lock = mutex;
-		items[cur_idx].tid = _gettid();
-		items[cur_idx].la = la;
-#ifdef MEASURE_TIMING
-		items[cur_idx].timestamp = get_ns();
-		items[cur_idx].lock_took = took;
+		(*org_pthread_rwlock_unlock_h)(&tid_names_lock);
+	}
+}
 #endif
 
-#ifdef STORE_THREAD_NAME
-		check_tid_names_lock_functions();
-
-		if ((*org_pthread_rwlock_rdlock_h)(&tid_names_lock) == 0) {
-			auto it = tid_names->find(items[cur_idx].tid);
-			if (it != tid_names->end())
-				memcpy(items[cur_idx].thread_name, it->second.c_str(), std::min(size_t(16), it->second.size() + 1));
+static inline tracer_context_t *get_context()
+{
+	if (unlikely(context.tid == 0)) {
+		context.tid = _gettid();
 
-			(*org_pthread_rwlock_unlock_h)(&tid_names_lock);
-		}
+#ifdef STORE_THREAD_NAME
+		refresh_context_thread_name();
 #endif
-
-		items[cur_idx].mutex_innards.__count = mutex->__data.__count;
-		items[cur_idx].mutex_innards.__owner = mutex->__data.__owner;
-		items[cur_idx].mutex_innards.__kind  = mutex->__data.__kind;
-
-		items[cur_idx].rc = rc;
 	}
-	else {
-		show_items_buffer_full_error();
+#ifdef STORE_THREAD_NAME
+	else if (unlikely(context.tid_names_generation != tid_names_generation.load(std::memory_order_relaxed))) {
+		refresh_context_thread_name();
 	}
+#endif
+
+	return &context;
 }
 
-#ifdef WITH_USAGE_GROUPS
-void store_lock(void *lock, void *caller, lock_action_t la)
+#ifdef MEASURE_TIMING
+// returns the entry, nullptr if too many locks are held
+static held_lock_t *push_held(held_stack_t *const s, const void *const lock, const uint64_t ts)
 {
-	if (unlikely(!ug_items)) {
-		show_items_buffer_not_allocated_error();
-		return;
-	}
+	if (s->n >= N_HELD_TRACKED)
+		return nullptr;
 
-	uint64_t cur_idx = ug_items_idx++;
+	held_lock_t *const h = &s->held[s->n++];
+	h->lock  = lock;
+	h->ts    = ts;
+	h->entry = nullptr;
 
-	if (likely(cur_idx < n_records)) {
-		ug_items[cur_idx].lock = lock;
-		ug_items[cur_idx].tid = _gettid();
-		ug_items[cur_idx].la = la;
-#ifdef MEASURE_TIMING
-		ug_items[cur_idx].timestamp = get_ns();
-#endif
-		ug_items[cur_idx].caller = caller;
-#ifdef STORE_THREAD_NAME
-		check_tid_names_lock_functions();
+	return h;
+}
+
+// false if it is not known when the lock was acquired
+static bool pop_held(held_stack_t *const s, const void *const lock, held_lock_t *const out)
+{
+	for(int i=s->n - 1; i>=0; i--) {
+		if (s->held[i].lock == lock) {
+			*out = s->held[i];
 
-		if ((*org_pthread_rwlock_rdlock_h)(&tid_names_lock) == 0) {
-			auto it = tid_names->find(ug_items[cur_idx].tid);
-			if (it != tid_names->end())
-				memcpy(ug_items[cur_idx].thread_name, it->second.c_str(), std::min(size_t(16), it->second.size() + 1));
+			s->n--;
+			memmove(&s->held[i], &s->held[i + 1], (s->n - i) * sizeof(held_lock_t));
 
-			(*org_pthread_rwlock_unlock_h)(&tid_names_lock);
+			return true;
 		}
-#endif
 	}
+
+	return false;
 }
-#endif
 
-#if (defined(PREVENT_RECURSION) || defined(SHALLOW_BACKTRACE)) && defined(WITH_BACKTRACE)
-#define STORE_MUTEX_INFO(a, b, c, d) store_mutex_info(a, b, c, d, __builtin_return_address(0))
-#else
-#define STORE_MUTEX_INFO(a, b, c, d) store_mutex_info(a, b, c, d, nullptr) 
+static inline void atomic_max(std::atomic<uint64_t> *const v, const uint64_t n)
+{
+	uint64_t cur = v->load(std::memory_order_relaxed);
+
+	while(n > cur && !v->compare_exchange_weak(cur, n, std::memory_order_relaxed)) {
+	}
+}
 #endif
 
-pid_t fork(void) throw ()
+static bool is_acquire(const lock_action_t la)
 {
-	if (unlikely(!org_fork_h))
-		org_fork_h = (org_fork)dlsym(RTLD_NEXT, "fork");
-
-	fork_warning = true;
+	return la == a_lock || la == a_r_lock || la == a_w_lock || la == a_cond_woken || la == a_spin_lock || la == a_timed_lock || la == a_timed_r_lock || la == a_timed_w_lock;
+}
 
-	return (*org_fork_h)();
+static bool is_release(const lock_action_t la)
+{
+	return la == a_unlock || la == a_rw_unlock || la == a_cond_wait || la == a_spin_unlock;
 }
 
-#ifdef CAPTURE_PTHREAD_EXIT
-void pthread_exit(void *retval)
+// semaphores and barriers have no owner: only the time it took to get
+// through is known, not how long it was "held"
+static bool is_wait(const lock_action_t la)
 {
-	if (likely(items != nullptr)) {
-		uint64_t cur_idx = items_idx++;
+	return la == a_sem_wait || la == a_barrier_wait;
+}
 
-		if (likely(cur_idx < n_records)) {
-			items[cur_idx].lock = nullptr;
-			items[cur_idx].tid = _gettid();
-			items[cur_idx].la = a_thread_clean;
-#ifdef WITH_TIMESTAMP
-			items[cur_idx].timestamp = get_ns();
-#endif
-		}
-		else {
-			show_items_buffer_full_error();
-		}
-	}
+// uniformly distributed in 1...2*sample_rate-1 so that on average 1 in
+// sample_rate acquisitions is recorded without a fixed pattern that
+// could be in sync with the program
+static uint32_t next_sample_gap(tracer_context_t *const ctx)
+{
+	if (unlikely(ctx->sample_rng == 0))
+		ctx->sample_rng = (uint64_t(ctx->tid) << 32) ^ get_ns() ^ 0x9e3779b97f4a7c15ull;
 
-#ifdef CAPTURE_PTHREAD_EXIT
-	if (unlikely(!org_pthread_exit_h))
-		org_pthread_exit_h = (org_pthread_exit)dlsym(RTLD_NEXT, "pthread_exit");
-#endif
+	// xorshift64
+	ctx->sample_rng ^= ctx->sample_rng << 13;
+	ctx->sample_rng ^= ctx->sample_rng >> 7;
+	ctx->sample_rng ^= ctx->sample_rng << 17;
 
-#ifdef STORE_THREAD_NAME
-	check_tid_names_lock_functions();
+	return 1 + ctx->sample_rng % (2 * sample_rate - 1);
+}
 
-	if ((*org_pthread_rwlock_wrlock_h)(&tid_names_lock) == 0) {
-		tid_names->erase(_gettid());
+// acquisitions that were not recorded because the thread already held
+// N_HELD_TRACKED recorded locks
+static std::atomic<uint64_t> sampled_held_full { 0 };
 
-		(*org_pthread_rwlock_unlock_h)(&tid_names_lock);
+static int find_sampled_held(const tracer_context_t *const ctx, const void *const lock)
+{
+	for(int i=ctx->n_sampled_held - 1; i>=0; i--) {
+		if (ctx->sampled_held[i] == lock)
+			return i;
 	}
-#endif
 
-	(*org_pthread_exit_h)(retval);
+	return -1;
+}
 
-	color("\033[0;31m");
-	fprintf(stderr, "pthread_exit did not stop thread!\n");
-	color("\033[0m");
+#ifdef WITH_USAGE_GROUPS
+// Would the next record for this lock be recorded? Used by the
+// usage-groups records which are stored before the lock-records.
+static bool sample_peek(tracer_context_t *const ctx, const void *const lock, const lock_action_t la)
+{
+	if (is_acquire(la)) {
+		if (ctx->sample_countdown == 0)
+			ctx->sample_countdown = next_sample_gap(ctx);
 
-	for(;;)
-		sleep(86400);
+		return ctx->sample_countdown == 1 && ctx->n_sampled_held < N_HELD_TRACKED;
+	}
+
+	if (is_release(la))
+		return find_sampled_held(ctx, lock) != -1;
+
+	return true;
 }
 #endif
 
-int pthread_mutex_lock(pthread_mutex_t *mutex) throw ()
+// Decides if a record is stored. The unlock that belongs to a recorded
+// lock is always recorded too so that hold durations can be determined.
+static bool sample_take(tracer_context_t *const ctx, const void *const lock, const lock_action_t la, const int rc)
 {
-	if (unlikely(!org_pthread_mutex_lock_h))
-		org_pthread_mutex_lock_h = (org_pthread_mutex_lock)dlsym(RTLD_NEXT, "pthread_mutex_lock");
+	if (is_acquire(la) || is_wait(la) || la == a_sem_post) {
+		if (ctx->sample_countdown == 0)
+			ctx->sample_countdown = next_sample_gap(ctx);
 
-#ifdef MUTEX_SANITY_CHECKS
-	if (mutex->__data.__kind < 0 || mutex->__data.__kind > PTHREAD_MUTEX_ADAPTIVE_NP)
-		fprintf(stderr, "Mutex %p has unknown type %d (caller: %p)\n", (void *)mutex, mutex->__data.__kind, __builtin_return_address(0));
-#endif
+		if (--ctx->sample_countdown)
+			return false;
 
-#ifdef ENFORCE_ERROR_CHECK
-	if (mutex->__data.__kind == PTHREAD_MUTEX_NORMAL || mutex->__data.__kind == PTHREAD_MUTEX_ADAPTIVE_NP || mutex->__data.__kind == PTHREAD_MUTEX_RECURSIVE)
-		mutex->__data.__kind = PTHREAD_MUTEX_ERRORCHECK;
-#endif
+		ctx->sample_countdown = next_sample_gap(ctx);
 
-#ifdef WITH_USAGE_GROUPS
-	store_lock(mutex, __builtin_return_address(0), a_lock);
-#endif
+		if (rc == 0 && is_acquire(la)) {
+			// can't keep track of the unlock
+			if (ctx->n_sampled_held >= N_HELD_TRACKED) {
+				sampled_held_full++;
+				return false;
+			}
 
-	uint64_t start_ts = get_ns();
-	int rc = (*org_pthread_mutex_lock_h)(mutex);
-	uint64_t end_ts = get_ns();
+			ctx->sampled_held[ctx->n_sampled_held++] = lock;
+		}
+
+		return true;
+	}
 
-	STORE_MUTEX_INFO(mutex, a_lock, end_ts - start_ts, rc);
+	if (is_release(la)) {
+		int i = find_sampled_held(ctx, lock);
+		if (i == -1)
+			return false;
 
-	return rc;
+		ctx->n_sampled_held--;
+		memmove(&ctx->sampled_held[i], &ctx->sampled_held[i + 1], (ctx->n_sampled_held - i) * sizeof(const void *));
+
+		return true;
+	}
+
+	// init, destroy, etc. are always recorded
+	return true;
 }
 
-static void mutex_sanity_check(pthread_mutex_t *const mutex, void *const caller)
+#ifdef WITH_LIVE_STATS
+static live_stats_entry_t *get_live_entry(const void *const lock)
 {
-#ifdef MUTEX_SANITY_CHECKS
-	if (mutex->__data.__kind < 0 || mutex->__data.__kind > PTHREAD_MUTEX_ADAPTIVE_NP)
-		fprintf(stderr, "Mutex %p has unknown type %d (caller: %p)\n", (void *)mutex, mutex->__data.__kind, caller);
+	uint64_t h = uintptr_t(lock) >> 3;
+	h ^= h >> 13;
 
-	if (int(mutex->__data.__nusers) < 0)
+	for(uint32_t probe=0; probe<live_size; probe++) {
+		live_stats_entry_t *const e = &live_entries[(h + probe) & (live_size - 1)];
+		uintptr_t cur = e->lock.load(std::memory_order_relaxed);
+
+		// on failure, 'cur' is what an other thread put there
+		if (cur == 0 && e->lock.compare_exchange_strong(cur, uintptr_t(lock)))
+			return e;
+
+		if (likely(cur == uintptr_t(lock)))
+			return e;
+	}
+
+	live_header->n_full.fetch_add(1, std::memory_order_relaxed);
+
+	return nullptr;
+}
+
+// Invoked for every lock event, also for those that are not recorded
+// (sampling, contended-only and aggregate mode).
+static void live_stats_event(const void *const lock, const lock_action_t la, const uint64_t took, const int rc, const uint64_t now)
+{
+	tracer_context_t *const ctx = get_context();
+
+	if (is_acquire(la) || is_wait(la)) {
+		live_stats_entry_t *const e = get_live_entry(lock);
+
+		if (rc == 0) {
+			// the relock after a condition variable wait is not timed: it
+			// only starts the hold time
+			if (e && la != a_cond_woken) {
+				e->n_acquired.fetch_add(1, std::memory_order_relaxed);
+
+				if (took > live_header->contended_ticks)
+					e->n_contended.fetch_add(1, std::memory_order_relaxed);
+
+				e->wait_total.fetch_add(took, std::memory_order_relaxed);
+				atomic_max(&e->wait_max, took);
+			}
+
+			if (is_acquire(la)) {
+				held_lock_t *const h = push_held(&ctx->live_held, lock, now);
+				if (h)
+					h->entry = e;
+			}
+		}
+		else if (e) {
+			// a try- or timed lock that found the lock busy
+			if (rc == EBUSY || rc == ETIMEDOUT || rc == EAGAIN) {
+				e->n_acquired.fetch_add(1, std::memory_order_relaxed);
+				e->n_contended.fetch_add(1, std::memory_order_relaxed);
+			}
+			else
+				e->n_errors.fetch_add(1, std::memory_order_relaxed);
+		}
+	}
+	else if (is_release(la) && rc == 0) {
+		held_lock_t h { };
+
+		if (pop_held(&ctx->live_held, lock, &h) && h.entry) {
+			live_stats_entry_t *const e = (live_stats_entry_t *)h.entry;
+
+			e->n_held.fetch_add(1, std::memory_order_relaxed);
+			e->hold_total.fetch_add(now - h.ts, std::memory_order_relaxed);
+			atomic_max(&e->hold_max, now - h.ts);
+		}
+	}
+}
+#endif
+
+static uncontended_entry_t *get_uncontended_entry(const void *const lock)
+{
+	tracer_context_t *const ctx = get_context();
+
+	if (unlikely(ctx->uncontended == nullptr)) {
+		uint32_t nr = n_uncontended_tables++;
+
+		if (nr >= max_uncontended_tables) {
+			uncontended_no_table++;
+			return nullptr;
+		}
+
+		ctx->uncontended = &uncontended_tables[nr];
+		ctx->uncontended->tid = ctx->tid;
+	}
+
+	uint64_t h = uintptr_t(lock) >> 3;
+	h ^= h >> 13;
+
+	for(uint64_t probe=0; probe<UNCONTENDED_TABLE_SIZE; probe++) {
+		uncontended_entry_t *const e = &ctx->uncontended->entries[(h + probe) & (UNCONTENDED_TABLE_SIZE - 1)];
+
+		if (likely(e->lock == lock))
+			return e;
+
+		if (e->lock == nullptr) {
+			e->lock = lock;
+			return e;
+		}
+	}
+
+	ctx->uncontended->n_overflow++;
+
+	return nullptr;
+}
+
+// see contended_only; which: 0 = mutex, 1 = read lock, 2 = write lock
+static void count_uncontended(const void *const lock, const int which)
+{
+#ifdef WITH_LIVE_STATS
+	if (live_stats)
+		live_stats_event(lock, which == 0 ? a_lock : which == 1 ? a_r_lock : a_w_lock, 0, 0, get_ts());
+#endif
+
+#ifdef MEASURE_TIMING
+	// for the hold trigger when the unlock is seen (see check_triggers)
+	if (unlikely(trigger_hold_ns))
+		push_held(&get_context()->held, lock, get_ts());
+#endif
+
+	uncontended_entry_t *const e = get_uncontended_entry(lock);
+
+	if (likely(e != nullptr))
+		e->n[which]++;
+}
+
+// the trylock of contended_only failed; the records can't tell these
+// apart from explicit trylocks
+static void count_contended(const void *const lock, const int which, const int rc)
+{
+	uncontended_entry_t *const e = get_uncontended_entry(lock);
+
+	if (likely(e != nullptr))
+		(rc == 0 ? e->n_busy : e->n_failed)[which]++;
+}
+
+// This is also invoked from a signal handler so it must stay
+// async-signal-safe. The actual work is done by snapshot_thread.
+static void trigger_snapshot(const char *const reason)
+{
+	if (trigger_pipe[1] != -1 && snapshot_pending.exchange(true) == false) {
+		snapshot_reason = reason;
+
+		char c = 't';
+		if (write(trigger_pipe[1], &c, 1) != 1)
+			snapshot_pending = false;
+	}
+}
+
+// Also async-signal-safe. Requests that arrive while one is still
+// pending are merged.
+static void request_snapshot()
+{
+	if (trigger_pipe[1] != -1 && on_demand_pending.exchange(true) == false) {
+		char c = 's';
+		if (write(trigger_pipe[1], &c, 1) != 1)
+			on_demand_pending = false;
+	}
+}
+
+static inline void check_triggers(tracer_context_t *const ctx, const void *const lock, const lock_action_t la, const uint64_t took, const int rc, const uint64_t ts)
+{
+#ifdef MEASURE_TIMING
+	if (unlikely(trigger_took_ns) && took > trigger_took_ns)
+		trigger_snapshot("acquisition duration above threshold");
+
+	if (unlikely(trigger_hold_ns) && rc == 0) {
+		if (is_acquire(la))
+			push_held(&ctx->held, lock, ts);
+		else if (is_release(la)) {
+			held_lock_t h { };
+
+			if (pop_held(&ctx->held, lock, &h) && ts - h.ts > trigger_hold_ns)
+				trigger_snapshot("hold duration above threshold");
+		}
+	}
+#endif
+}
+
+#ifdef WITH_AGGREGATE
+static inline uint32_t hist_bucket(const uint64_t v)
+{
+	if (v < (1 << HIST_SUB_BITS))
+		return v;
+
+	const int msb = 63 - __builtin_clzll(v);
+	if (msb >= HIST_MAX_BITS)
+		return HIST_N_BUCKETS - 1;
+
+	return ((msb - HIST_SUB_BITS + 1) << HIST_SUB_BITS) | ((v >> (msb - HIST_SUB_BITS)) & ((1 << HIST_SUB_BITS) - 1));
+}
+
+// smallest value that ends up in bucket b
+static uint64_t hist_bucket_value(const uint32_t b)
+{
+	if (b < (1 << HIST_SUB_BITS))
+		return b;
+
+	const int msb = (b >> HIST_SUB_BITS) + HIST_SUB_BITS - 1;
+
+	return (uint64_t(1) << msb) | (uint64_t(b & ((1 << HIST_SUB_BITS) - 1)) << (msb - HIST_SUB_BITS));
+}
+
+static void hist_add(histogram_t *const h, const uint64_t v)
+{
+	h->n.fetch_add(1, std::memory_order_relaxed);
+	h->sum.fetch_add(v, std::memory_order_relaxed);
+	h->buckets[hist_bucket(v)].fetch_add(1, std::memory_order_relaxed);
+
+	atomic_max(&h->max, v);
+}
+
+// Lock-free: a slot is claimed by setting its key, the one who did
+// that then fills in lock & caller.
+static aggregate_entry_t *get_aggregate_entry(const void *const lock, const void *const caller, const lock_action_t la)
+{
+	uint64_t key = uintptr_t(lock) * 0x9e3779b97f4a7c15ull ^ uintptr_t(caller) * 0xc2b2ae3d27d4eb4full;
+	key ^= key >> 29;
+	if (key == 0)
+		key = 1;
+
+	for(uint32_t probe=0; probe<aggregate_size; probe++) {
+		aggregate_entry_t *const e = &aggregate_table[(key + probe) & (aggregate_size - 1)];
+		uint64_t cur = e->key.load(std::memory_order_acquire);
+
+		if (cur == 0 && e->key.compare_exchange_strong(cur, key)) {
+			e->lock   = lock;
+			e->caller = caller;
+			e->la     = la;
+			e->ready.store(true, std::memory_order_release);
+
+			return e;
+		}
+
+		if (cur == key) {
+			while(!e->ready.load(std::memory_order_acquire))
+				sched_yield();
+
+			if (e->lock == lock && e->caller == caller)
+				return e;
+		}
+	}
+
+	aggregate_full++;
+
+	return nullptr;
+}
+
+// Replaces storing a record in TRACE_AGGREGATE mode. The hold duration
+// is accounted to the place where the lock was acquired.
+static void aggregate_event(const void *const lock, const lock_action_t la, const uint64_t took, const int rc, const uint64_t now, const void *const caller)
+{
+	tracer_context_t *const ctx = get_context();
+
+	if (is_acquire(la) || is_wait(la)) {
+		aggregate_entry_t *const e = get_aggregate_entry(lock, caller, la);
+
+		if (rc != 0) {
+			if (e && rc == ETIMEDOUT)
+				e->n_timeouts.fetch_add(1, std::memory_order_relaxed);
+			else if (e)
+				e->n_errors.fetch_add(1, std::memory_order_relaxed);
+
+			return;
+		}
+
+		if (e)
+			hist_add(&e->took, took);
+
+		if (is_wait(la))
+			return;
+
+		held_lock_t *const h = push_held(&ctx->held, lock, now);
+		if (h)
+			h->entry = e;
+		else
+			aggregate_hold_untracked++;
+	}
+	else if (is_release(la) && rc == 0) {
+		held_lock_t h { };
+
+		if (pop_held(&ctx->held, lock, &h) && h.entry)
+			hist_add(&((aggregate_entry_t *)h.entry)->hold, now - h.ts);
+	}
+}
+#endif
+
+// Makes the streamed records visible to other threads (e.g. the stream
+// writer) before a segment is handed over or the buffer is written.
+static inline void flush_records()
+{
+#ifdef NON_TEMPORAL_STORES
+	_mm_sfence();
+#endif
+}
+
+#ifdef PER_THREAD_BUFFERS
+// the region of the NUMA node the calling thread runs on
+static int current_region(const trace_buffer_t *const b, int *const node)
+{
+	*node = 0;
+
+	if (b->n_regions == 1)
+		return 0;
+
+	unsigned cpu = 0, cpu_node = 0;
+#if __GLIBC_PREREQ(2, 29)
+	if (getcpu(&cpu, &cpu_node) == -1 || cpu_node >= MAX_NUMA_NODES)
+#else
+	if (syscall(SYS_getcpu, &cpu, &cpu_node, nullptr) == -1 || cpu_node >= MAX_NUMA_NODES)
+#endif
+		return 0;
+
+	*node = cpu_node;
+
+	return numa_node_region[cpu_node];
+}
+
+static void start_segment(trace_buffer_t *const b, buffer_cursor_t *const c, const uint64_t segment, const int tid, const int node)
+{
+	uint64_t seq = b->next++;
+
+	c->segment = segment;
+	c->seq     = seq;
+	c->idx     = segment * b->segment_records;
+	c->end     = std::min(c->idx + b->segment_records, b->n_records);
+
+	b->segments[segment].n_used   = 0;
+	b->segments[segment].n_events = 0;
+	b->segments[segment].seq      = seq;
+	b->segments[segment].tid      = tid;
+	b->segments[segment].node     = node;
+}
+
+// the records this thread dropped, counted in the buffer
+static void flush_dropped(trace_buffer_t *const b, buffer_cursor_t *const c)
+{
+	if (c->n_dropped) {
+		b->n_dropped.fetch_add(c->n_dropped, std::memory_order_relaxed);
+		c->n_dropped = 0;
+	}
+}
+
+// streaming mode: give the current segment to the writer thread and
+// get a segment that it already emptied
+static bool claim_stream_segment(trace_buffer_t *const b, buffer_cursor_t *const c, const int tid)
+{
+	if (c->end) {
+		flush_records();
+
+		b->segments[c->segment].state = SEGMENT_FULL;
+		c->idx = c->end = 0;
+	}
+	else if (!c->starved) {
+		// first segment of this thread: make sure the last one is handed
+		// over when it terminates
+		pthread_setspecific(segment_owner_key, (void *)1);
+	}
+
+	// read before the scan so that a segment freed during it is not missed
+	const uint64_t freed = b->n_freed.load(std::memory_order_acquire);
+
+	// the writer did not empty a segment since the last scan of this
+	// thread: drop the record without looking again
+	if (c->starved && freed == c->freed_seen) {
+		if (++c->n_dropped >= DROPPED_FLUSH_INTERVAL)
+			flush_dropped(b, c);
+
+		return false;
+	}
+
+	int node = 0;
+	const int first_region = current_region(b, &node);
+
+	// an other node's region only when the own one has no free segment
+	for(int i=0; i<b->n_regions; i++) {
+		buffer_region_t *const r = &b->regions[(first_region + i) % b->n_regions];
+		const uint64_t start = r->next.load(std::memory_order_relaxed);
+
+		for(uint64_t attempt=0; attempt<r->n_segments; attempt++) {
+			const uint64_t idx = (start + attempt) % r->n_segments;
+			segment_t *const s = &b->segments[r->first + idx];
+
+			if (s->state.load(std::memory_order_relaxed) != SEGMENT_FREE)
+				continue;
+
+			int expected = SEGMENT_FREE;
+
+			if (s->state.compare_exchange_strong(expected, SEGMENT_OWNED)) {
+				// only a hint where the next scan starts
+				r->next.store(idx + 1, std::memory_order_relaxed);
+
+				c->starved = false;
+
+				flush_dropped(b, c);
+
+				start_segment(b, c, r->first + idx, tid, node);
+
+				return true;
+			}
+		}
+	}
+
+	// writer thread can't keep up
+	c->starved    = true;
+	c->freed_seen = freed;
+
+	if (++c->n_dropped >= DROPPED_FLUSH_INTERVAL)
+		flush_dropped(b, c);
+
+	return false;
+}
+
+// flight-recorder mode: the oldest segment that no thread is filling
+// is overwritten, after the one of this thread was handed back
+static bool claim_ring_segment(trace_buffer_t *const b, buffer_cursor_t *const c, const int tid)
+{
+	if (c->end) {
+		flush_records();
+
+		b->segments[c->segment].state = SEGMENT_FULL;
+		c->idx = c->end = 0;
+	}
+	else {
+		// first segment of this thread
+		pthread_setspecific(segment_owner_key, (void *)1);
+	}
+
+	int node = 0;
+	const int first_region = current_region(b, &node);
+
+	// an other node's region only when all segments of the own one are
+	// being filled
+	for(int i=0; i<b->n_regions; i++) {
+		buffer_region_t *const r = &b->regions[(first_region + i) % b->n_regions];
+
+		for(uint64_t attempt=0; attempt<r->n_segments; attempt++) {
+			const uint64_t segment = r->first + r->next++ % r->n_segments;
+			segment_t *const s = &b->segments[segment];
+			int state = s->state.load(std::memory_order_relaxed);
+
+			if (state == SEGMENT_OWNED)
+				continue;
+
+			if (s->state.compare_exchange_strong(state, SEGMENT_OWNED)) {
+				start_segment(b, c, segment, tid, node);
+
+				return true;
+			}
+		}
+	}
+
+	// more threads than segments
+	return false;
+}
+
+static bool claim_segment(trace_buffer_t *const b, buffer_cursor_t *const c, const bool show_percent, const int tid)
+{
+	if (unlikely(frozen.load(std::memory_order_relaxed)))
+		return false;
+
+	if (stream_writer)
+		return claim_stream_segment(b, c, tid);
+
+	if (ring_buffer)
+		return claim_ring_segment(b, c, tid);
+
+	int node = 0;
+	const int first_region = current_region(b, &node);
+
+	// when the region of the node is full, continue in that of an other
+	bool claimed = false;
+
+	for(int i=0; i<b->n_regions && !claimed; i++) {
+		buffer_region_t *const r = &b->regions[(first_region + i) % b->n_regions];
+
+		// don't keep bumping the counter once the region is full
+		if (r->next.load(std::memory_order_relaxed) >= r->n_segments)
+			continue;
+
+		uint64_t idx = r->next++;
+
+		if (idx >= r->n_segments)
+			continue;
+
+		start_segment(b, c, r->first + idx, tid, node);
+
+		claimed = true;
+	}
+
+	if (!claimed)
+		return false;
+
+	if (show_percent && verbose) {
+		uint64_t n_used = c->seq * b->segment_records;
+
+		if (n_used / emit_count_threshold != (n_used + b->segment_records) / emit_count_threshold)
+			show_items_buffer_percent(n_used);
+	}
+
+	return true;
+}
+
+// returns nullptr when the buffer is full
+static inline void *claim_record(trace_buffer_t *const b, buffer_cursor_t *const c, const bool show_percent, const int tid)
+{
+	if (unlikely(c->idx >= c->end) && !claim_segment(b, c, show_percent, tid))
+		return nullptr;
+
+	b->segments[c->segment].n_used = c->idx + 1 - c->segment * b->segment_records;
+
+	return b->data + b->record_size * c->idx++;
+}
+
+static uint64_t buffer_n_used(const trace_buffer_t *const b)
+{
+	uint64_t n_used = 0;
+
+	// with TRACE_NUMA the segments in use are not all at the start
+	for(uint64_t i=0; i<b->n_segments; i++)
+		n_used += b->compact ? b->segments[i].n_events : b->segments[i].n_used;
+
+	return n_used;
+}
+#else
+// returns nullptr when the buffer is full
+static inline void *claim_record(trace_buffer_t *const b, const bool show_percent)
+{
+	uint64_t cur_idx = b->next++;
+
+	if (show_percent && verbose) {
+		if (cur_idx % emit_count_threshold == 0)
+			show_items_buffer_percent(cur_idx);
+	}
+
+	if (unlikely(cur_idx >= b->n_records))
+		return nullptr;
+
+	return b->data + b->record_size * cur_idx;
+}
+
+static uint64_t buffer_n_used(const trace_buffer_t *const b)
+{
+	return std::min(b->next.load(), b->n_records);
+}
+#endif
+
+#ifdef PER_THREAD_BUFFERS
+// compact mode: worst case size of an encoded record
+#define COMPACT_MAX_EVENT (1 + 10 + 10 + 10 + 10 * CALLER_DEPTH + 10 + 1 + 16 + 3 * 5 + 5)
+
+static inline uint64_t zigzag(const int64_t v)
+{
+	return (uint64_t(v) << 1) ^ uint64_t(v >> 63);
+}
+
+static inline uint8_t *put_varint(uint8_t *p, uint64_t v)
+{
+	while(v >= 0x80) {
+		*p++ = uint8_t(v) | 0x80;
+		v >>= 7;
+	}
+
+	*p++ = uint8_t(v);
+
+	return p;
+}
+
+// Makes sure there's room for one more record in the segment of this
+// thread. The record is then filled in in the context and encoded by
+// commit_item().
+static lock_trace_item_t *claim_compact_item(tracer_context_t *const ctx)
+{
+	trace_buffer_t *const b = &items_buffer;
+	buffer_cursor_t *const c = &ctx->items_cursor;
+
+	if (unlikely(c->idx + COMPACT_MAX_EVENT > c->end)) {
+		// the last segment can be too small
+		if (!claim_segment(b, c, false, ctx->tid) || c->idx + COMPACT_MAX_EVENT > c->end)
+			return nullptr;
+
+		// each segment can be decoded on its own
+		ctx->compact_prev_ts   = 0;
+		ctx->compact_prev_lock = 0;
+#ifdef LOCK_REGISTRY
+		ctx->compact_prev_lock_id = 0;
+#endif
+#if defined(WITH_BACKTRACE) && !defined(INTERN_STACKS)
+		memset(ctx->compact_prev_caller, 0x00, sizeof ctx->compact_prev_caller);
+#endif
+#ifdef STORE_THREAD_NAME
+		ctx->compact_name_sent = false;
+#endif
+	}
+
+	memset(&ctx->compact_item, 0x00, sizeof ctx->compact_item);
+
+	return &ctx->compact_item;
+}
+
+static void encode_compact_item(tracer_context_t *const ctx)
+{
+	const lock_trace_item_t *const item = &ctx->compact_item;
+	buffer_cursor_t *const c = &ctx->items_cursor;
+
+	uint8_t *const start = (uint8_t *)items_buffer.data + c->idx;
+	uint8_t *p = start + 1;
+	uint8_t flags = (item->la & COMPACT_LA_MASK) | (item->la & 0x10 ? COMPACT_LA_HIGH : 0);
+
+#ifdef MEASURE_TIMING
+	p = put_varint(p, zigzag(int64_t(item->timestamp - ctx->compact_prev_ts)));
+	p = put_varint(p, item->lock_took);
+	ctx->compact_prev_ts = item->timestamp;
+#endif
+
+	p = put_varint(p, zigzag(int64_t(uintptr_t(item->lock) - ctx->compact_prev_lock)));
+	ctx->compact_prev_lock = uintptr_t(item->lock);
+
+#ifdef INTERN_STACKS
+	p = put_varint(p, item->stack_id);
+#elif defined(WITH_BACKTRACE)
+	for(int i=0; i<CALLER_DEPTH; i++) {
+		p = put_varint(p, zigzag(int64_t(uintptr_t(item->caller[i]) - uintptr_t(ctx->compact_prev_caller[i]))));
+		ctx->compact_prev_caller[i] = item->caller[i];
+	}
+#endif
+
+#ifdef LOCK_REGISTRY
+	p = put_varint(p, zigzag(int64_t(item->lock_id) - ctx->compact_prev_lock_id));
+	ctx->compact_prev_lock_id = item->lock_id;
+#endif
+
+#ifdef STORE_THREAD_NAME
+	if (!ctx->compact_name_sent || memcmp(ctx->compact_prev_name, item->thread_name, sizeof item->thread_name) != 0) {
+		uint8_t len = strnlen(item->thread_name, sizeof item->thread_name);
+
+		flags |= COMPACT_NAME;
+		*p++ = len;
+		memcpy(p, item->thread_name, len);
+		p += len;
+
+		memcpy(ctx->compact_prev_name, item->thread_name, sizeof item->thread_name);
+		ctx->compact_name_sent = true;
+	}
+#endif
+
+	// mutex or rwlock, both 3 ints
+	int32_t innards[3];
+	memcpy(innards, &item->mutex_innards, sizeof innards);
+
+	if (innards[0] | innards[1] | innards[2]) {
+		flags |= COMPACT_INNARDS;
+
+		for(int i=0; i<3; i++)
+			p = put_varint(p, zigzag(innards[i]));
+	}
+
+	if (item->rc) {
+		flags |= COMPACT_RC;
+		p = put_varint(p, zigzag(item->rc));
+	}
+
+	*start = flags;
+
+	c->idx += p - start;
+
+	segment_t *const s = &items_buffer.segments[c->segment];
+	s->n_used = c->idx - c->segment * items_buffer.segment_records;
+	s->n_events++;
+}
+#endif
+
+#ifdef NON_TEMPORAL_STORES
+// Copies a record to the trace buffer, bypassing the caches. Both are
+// aligned to and a multiple of 64 bytes.
+static inline void stream_record(void *const target, const void *const record, const size_t size)
+{
+	__m128i *out = (__m128i *)target;
+	const __m128i *in = (const __m128i *)record;
+
+	for(size_t i=0; i<size / sizeof(__m128i); i++)
+		_mm_stream_si128(&out[i], _mm_load_si128(&in[i]));
+}
+#endif
+
+static lock_trace_item_t *claim_item(tracer_context_t *const ctx)
+{
+#ifdef PER_THREAD_BUFFERS
+	if (compact)
+		return claim_compact_item(ctx);
+
+	lock_trace_item_t *const item = (lock_trace_item_t *)claim_record(&items_buffer, &ctx->items_cursor, true, ctx->tid);
+#else
+	lock_trace_item_t *const item = (lock_trace_item_t *)claim_record(&items_buffer, true);
+#endif
+
+#ifdef NON_TEMPORAL_STORES
+	if (unlikely(!item))
+		return nullptr;
+
+	ctx->nt_target = item;
+
+	memset(&ctx->nt_item, 0x00, sizeof ctx->nt_item);
+
+	return &ctx->nt_item;
+#else
+	return item;
+#endif
+}
+
+// to be invoked when the record from claim_item() is filled in
+static inline void commit_item(tracer_context_t *const ctx)
+{
+#ifdef PER_THREAD_BUFFERS
+	if (compact) {
+		encode_compact_item(ctx);
+		return;
+	}
+#endif
+#ifdef NON_TEMPORAL_STORES
+	stream_record(ctx->nt_target, &ctx->nt_item, sizeof ctx->nt_item);
+#endif
+}
+
+#ifdef WITH_USAGE_GROUPS
+static lock_usage_groups_t *claim_ug_item(tracer_context_t *const ctx)
+{
+#ifdef PER_THREAD_BUFFERS
+	lock_usage_groups_t *const ug_item = (lock_usage_groups_t *)claim_record(&ug_items_buffer, &ctx->ug_items_cursor, false, ctx->tid);
+#else
+	lock_usage_groups_t *const ug_item = (lock_usage_groups_t *)claim_record(&ug_items_buffer, false);
+#endif
+
+#ifdef NON_TEMPORAL_STORES
+	if (unlikely(!ug_item))
+		return nullptr;
+
+	ctx->nt_ug_target = ug_item;
+
+	memset(&ctx->nt_ug_item, 0x00, sizeof ctx->nt_ug_item);
+
+	return &ctx->nt_ug_item;
+#else
+	return ug_item;
+#endif
+}
+
+static inline void commit_ug_item(tracer_context_t *const ctx)
+{
+#ifdef NON_TEMPORAL_STORES
+	stream_record(ctx->nt_ug_target, &ctx->nt_ug_item, sizeof ctx->nt_ug_item);
+#endif
+}
+#endif
+
+#ifdef PER_THREAD_BUFFERS
+// Ask the kernel to put the pages of a region on its node. For
+// mappings of a file on disk the page cache ignores this, then the
+// pages end up on the node of the thread that first writes to them,
+// which normally runs on the node of the region.
+static void bind_region(const trace_buffer_t *const b, const buffer_region_t *const r)
+{
+	const size_t page_size = b->hugepages == hp_hugetlb ? huge_page_size : sysconf(_SC_PAGESIZE);
+	const size_t segment_size = b->segment_records * b->record_size;
+
+	// only whole pages
+	uintptr_t start = uintptr_t(b->data) + r->first * segment_size;
+	uintptr_t end = std::min(start + r->n_segments * segment_size, uintptr_t(b->data) + b->n_records * b->record_size);
+
+	start = (start + page_size - 1) / page_size * page_size;
+	end   = end / page_size * page_size;
+
+	if (end <= start)
+		return;
+
+	unsigned long node_mask = 1ul << r->node;
+
+	// "preferred": when the node has no memory left, pages can still be
+	// allocated elsewhere
+	if (syscall(SYS_mbind, start, end - start, MPOL_PREFERRED, &node_mask, sizeof(node_mask) * 8 + 1, 0) == -1)
+		fprintf(stderr, "Cannot bind trace buffer region to NUMA node %d: %s\n", r->node, strerror(errno));
+}
+
+// reads the list of nodes ("0-1", "0,2-3") from sysfs
+static void find_numa_nodes()
+{
+	FILE *fh = fopen("/sys/devices/system/node/online", "r");
+	if (!fh)
+		return;
+
+	char line[256] { 0 };
+	if (!fgets(line, sizeof line, fh))
+		line[0] = 0x00;
+
+	fclose(fh);
+
+	int n = 0;
+	char *saveptr = nullptr;
+
+	for(char *range = strtok_r(line, ",\n", &saveptr); range; range = strtok_r(nullptr, ",\n", &saveptr)) {
+		int first = 0, last = 0;
+
+		int n_fields = sscanf(range, "%d-%d", &first, &last);
+		if (n_fields < 1)
+			continue;
+
+		if (n_fields == 1)
+			last = first;
+
+		for(int node=first; node<=last && node < MAX_NUMA_NODES; node++) {
+			numa_node_region[node] = n;
+			numa_nodes[n++] = node;
+		}
+	}
+
+	n_numa_nodes = std::max(1, n);
+}
+#endif
+
+static void init_trace_buffer(trace_buffer_t *const b, void *const data, const hugepages_t hp, const size_t record_size)
+{
+	b->data        = (char *)data;
+	b->hugepages   = hp;
+	b->record_size = record_size;
+	b->n_records   = n_records;
+	b->next        = 0;
+
+#ifdef PER_THREAD_BUFFERS
+	b->segment_records = segment_records;
+	b->n_segments      = (n_records + segment_records - 1) / segment_records;
+
+	if (posix_memalign((void **)&b->segments, 64, b->n_segments * sizeof(segment_t))) {
+		fprintf(stderr, "ERROR: cannot allocate segment table\n");
+		color("\033[0m");
+		_exit(1);
+	}
+
+	memset((void *)b->segments, 0x00, b->n_segments * sizeof(segment_t));
+
+	// without TRACE_NUMA there's one region with all segments
+	b->n_regions = std::min(uint64_t(numa ? n_numa_nodes : 1), b->n_segments);
+
+	if (posix_memalign((void **)&b->regions, 64, b->n_regions * sizeof(buffer_region_t))) {
+		fprintf(stderr, "ERROR: cannot allocate region table\n");
+		color("\033[0m");
+		_exit(1);
+	}
+
+	memset((void *)b->regions, 0x00, b->n_regions * sizeof(buffer_region_t));
+
+	for(int i=0; i<b->n_regions; i++) {
+		buffer_region_t *const r = &b->regions[i];
+
+		r->first      = b->n_segments * i / b->n_regions;
+		r->n_segments = b->n_segments * (i + 1) / b->n_regions - r->first;
+		r->node       = numa ? numa_nodes[i] : 0;
+
+		if (b->n_regions > 1)
+			bind_region(b, r);
+	}
+
+	b->compact = false;
+	b->stream_fd = -1;
+	b->n_streamed = 0;
+	b->n_dropped = 0;
+	b->n_freed   = 0;
+#endif
+}
+
+#ifdef PER_THREAD_BUFFERS
+// node of the memory of a segment
+static int segment_memory_node(const trace_buffer_t *const b, const uint64_t segment)
+{
+	for(int i=0; i<b->n_regions; i++) {
+		if (segment < b->regions[i].first + b->regions[i].n_segments)
+			return b->regions[i].node;
+	}
+
+	return 0;
+}
+
+// Appends a segment as a chunk to the stream file. The segment is
+// freed for re-use afterwards.
+static void write_stream_segment(trace_buffer_t *const b, const uint64_t segment)
+{
+	segment_t *const s = &b->segments[segment];
+
+	trace_chunk_header_t header { };
+	header.magic       = TRACE_CHUNK_MAGIC;
+	header.seq         = s->seq;
+	header.record_size = b->record_size;
+	header.n_records   = s->n_used;
+	header.tid         = s->tid;
+	header.node        = s->node;
+	header.memory_node = segment_memory_node(b, segment);
+
+	struct iovec iov[2];
+	iov[0].iov_base = &header;
+	iov[0].iov_len  = sizeof header;
+	iov[1].iov_base = b->data + segment * b->segment_records * b->record_size;
+	iov[1].iov_len  = s->n_used * b->record_size;
+
+	if (writev(b->stream_fd, iov, 2) != ssize_t(iov[0].iov_len + iov[1].iov_len))
+		fprintf(stderr, "Problem writing trace chunk: %s\n", strerror(errno));
+	else
+		b->n_streamed += b->compact ? s->n_events : s->n_used;
+
+	s->n_used   = 0;
+	s->n_events = 0;
+	s->state  = SEGMENT_FREE;
+
+	b->n_freed++;
+}
+
+// returns the number of segments written
+static int flush_stream_segments(trace_buffer_t *const b, const bool all)
+{
+	int n_written = 0;
+
+	for(uint64_t i=0; i<b->n_segments; i++) {
+		int expected = SEGMENT_FULL;
+
+		if (b->segments[i].state.compare_exchange_strong(expected, SEGMENT_WRITING) ||
+		    (all && expected == SEGMENT_OWNED && b->segments[i].state.compare_exchange_strong(expected, SEGMENT_WRITING))) {
+			write_stream_segment(b, i);
+			n_written++;
+		}
+	}
+
+	return n_written;
+}
+
+static void *stream_writer_thread(void *)
+{
+	while(!stream_writer_stop) {
+		int n_written = flush_stream_segments(&items_buffer, false);
+#ifdef WITH_USAGE_GROUPS
+		n_written += flush_stream_segments(&ug_items_buffer, false);
+#endif
+
+		if (n_written == 0)
+			usleep(1000);
+	}
+
+	stream_writer_stopped = true;
+
+	return nullptr;
+}
+
+// invoked when a thread terminates: hand over what it has collected (in
+// flight-recorder mode: let an other thread re-use the segment)
+static void segment_owner_exit(void *)
+{
+	flush_records();
+
+	flush_dropped(&items_buffer, &context.items_cursor);
+#ifdef WITH_USAGE_GROUPS
+	flush_dropped(&ug_items_buffer, &context.ug_items_cursor);
+#endif
+
+	if (context.items_cursor.end)
+		items_buffer.segments[context.items_cursor.segment].state = SEGMENT_FULL;
+#ifdef WITH_USAGE_GROUPS
+	if (context.ug_items_cursor.end)
+		ug_items_buffer.segments[context.ug_items_cursor.segment].state = SEGMENT_FULL;
+#endif
+}
+#endif
+
+#ifdef PER_THREAD_BUFFERS
+// segments that are in use, oldest first
+static std::vector<uint64_t> segments_in_order(const trace_buffer_t *const b)
+{
+	std::vector<uint64_t> out;
+
+	for(uint64_t i=0; i<b->n_segments; i++) {
+		if (b->segments[i].n_used)
+			out.push_back(i);
+	}
+
+	std::sort(out.begin(), out.end(), [b](const uint64_t a, const uint64_t c) { return b->segments[a].seq < b->segments[c].seq; });
+
+	return out;
+}
+
+static void emit_segment(json_t *const list, const uint64_t first, const uint64_t n, const trace_buffer_t *const b, const uint64_t segment)
+{
+	json_t *entry = json_object();
+
+	json_object_set_new(entry, "first", json_integer(first));
+	json_object_set_new(entry, "n", json_integer(n));
+	json_object_set_new(entry, "tid", json_integer(b->segments[segment].tid));
+
+	if (numa) {
+		json_object_set_new(entry, "node", json_integer(b->segments[segment].node));
+		json_object_set_new(entry, "memory_node", json_integer(segment_memory_node(b, segment)));
+	}
+
+	json_array_append_new(list, entry);
+}
+
+// the analyzer uses this to put the per-thread segments back in order
+static void emit_segments(json_t *const tgt, const char *const key, const trace_buffer_t *const b)
+{
+	json_t *list = json_array();
+
+	for(auto i : segments_in_order(b))
+		emit_segment(list, i * b->segment_records, b->segments[i].n_used, b, i);
+
+	json_object_set_new(tgt, key, list);
+}
+#endif
+
+// Write the records that are currently in a buffer to a file of their
+// own. Returns the number of records written.
+static uint64_t snapshot_buffer(json_t *const tgt, const char *const segments_key, const trace_buffer_t *const b, const char *const file_name)
+{
+	int fd = open(file_name, O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+	if (fd == -1) {
+		fprintf(stderr, "Failed creating %s: %s\n", file_name, strerror(errno));
+		return 0;
+	}
+
+	uint64_t n_written = 0;
+
+#ifdef PER_THREAD_BUFFERS
+	json_t *list = json_array();
+	// compact mode: n_written is in bytes
+	uint64_t n_events = 0;
+
+	for(auto i : segments_in_order(b)) {
+		uint64_t n_used = b->segments[i].n_used;
+
+		if (write(fd, b->data + i * b->segment_records * b->record_size, n_used * b->record_size) != ssize_t(n_used * b->record_size)) {
+			fprintf(stderr, "Failed writing to %s: %s\n", file_name, strerror(errno));
+			break;
+		}
+
+		emit_segment(list, n_written, n_used, b, i);
+
+		n_written += n_used;
+		n_events  += b->compact ? b->segments[i].n_events : n_used;
+	}
+
+	json_object_set_new(tgt, segments_key, list);
+
+	n_written = n_events;
+#else
+	n_written = buffer_n_used(b);
+
+	if (write(fd, b->data, n_written * b->record_size) != ssize_t(n_written * b->record_size)) {
+		fprintf(stderr, "Failed writing to %s: %s\n", file_name, strerror(errno));
+		n_written = 0;
+	}
+#endif
+
+	close(fd);
+
+	return n_written;
+}
+
+#ifdef FRAME_POINTER_UNWIND
+static std::atomic<uint64_t> cnt_fp_unwind_fallback { 0 };
+
+// address range of this library, see fp_backtrace()
+static uintptr_t own_code_lo = 0, own_code_hi = 0;
+
+static int find_own_code(struct dl_phdr_info *info, size_t size, void *data)
+{
+	if (info->dlpi_addr != uintptr_t(data))
+		return 0;
+
+	for(int i=0; i<info->dlpi_phnum; i++) {
+		if (info->dlpi_phdr[i].p_type == PT_LOAD) {
+			uintptr_t end = info->dlpi_addr + info->dlpi_phdr[i].p_vaddr + info->dlpi_phdr[i].p_memsz;
+
+			if (end > own_code_hi)
+				own_code_hi = end;
+		}
+	}
+
+	own_code_lo = uintptr_t(data);
+
+	return 1;
+}
+
+static void set_stack_bounds()
+{
+	pthread_attr_t attr;
+	void *addr = nullptr;
+	size_t size = 0;
+
+	if (pthread_getattr_np(pthread_self(), &attr) == 0) {
+		pthread_attr_getstack(&attr, &addr, &size);
+		pthread_attr_destroy(&attr);
+	}
+
+	if (addr == nullptr || size == 0) {
+		// unknown: only allow the page(s) around the current frame
+		uintptr_t sp = uintptr_t(__builtin_frame_address(0));
+
+		context.stack_lo = sp & ~uintptr_t(4095);
+		context.stack_hi = context.stack_lo + 65536;
+	}
+	else {
+		context.stack_lo = uintptr_t(addr);
+		context.stack_hi = uintptr_t(addr) + size;
+	}
+}
+
+// Walks the frame-pointer chain. This requires the traced program to be
+// compiled with -fno-omit-frame-pointer. Returns false when the chain
+// is invalid before it reached the code that called the pthread
+// function; when it breaks later on (e.g. in a library without frame
+// pointers) the backtrace is just shorter.
+static bool __attribute__((noinline)) fp_backtrace(void **const list, const int max_depth)
+{
+	bool left_tracer = false;
+
+	if (unlikely(context.stack_hi == 0))
+		set_stack_bounds();
+
+	// skip this function: start at the frame of my_backtrace so that
+	// the result is the same as what libunwind gives
+	uintptr_t fp = *(const uintptr_t *)__builtin_frame_address(0);
+
+	for(int i=0; i<max_depth; i++) {
+		if (fp < context.stack_lo || fp > context.stack_hi - 2 * sizeof(void *) || (fp & (sizeof(void *) - 1)))
+			return left_tracer;
+
+		const uintptr_t *const frame = (const uintptr_t *)fp;
+
+		if (left_tracer == false && (frame[1] < own_code_lo || frame[1] >= own_code_hi)) {
+			left_tracer = true;
+		}
+		else if (left_tracer == false && i == max_depth - 1) {
+			// would not show anything of the program itself
+			return false;
+		}
+
+		list[i] = (void *)frame[1];
+
+		// outermost frame (e.g. _start or clone() has it 0)
+		if (frame[0] == 0 || list[i] == nullptr)
+			break;
+
+		// the stack grows down so callers must be at a higher address
+		if (frame[0] <= fp)
+			return left_tracer;
+
+		fp = frame[0];
+	}
+
+	return true;
+}
+#endif
+
+#if defined(WITH_BACKTRACE) && !defined(PREVENT_RECURSION) && !defined(SHALLOW_BACKTRACE)
+static void my_backtrace(void **const list, const int max_depth)
+{
+    bool get_backtrace = !prevent_backtrace;
+
+    if (likely(get_backtrace)) {
+        prevent_backtrace = true;
+
+#ifdef FRAME_POINTER_UNWIND
+        memset(list, 0x00, sizeof(void *) * max_depth);
+
+        if (likely(fp_backtrace(list, max_depth))) {
+            prevent_backtrace = false;
+            return;
+        }
+
+        cnt_fp_unwind_fallback++;
+#endif
+
+        unw_context_t uc;
+        unw_getcontext(&uc);
+
+        unw_cursor_t cursor;
+        unw_init_local(&cursor, &uc);
+
+        memset(list, 0x00, sizeof(void *) * max_depth);
+
+        for(int i=0; i<max_depth; i++) {
+            if (unw_step(&cursor) <= 0)
+                break;
+
+            unw_word_t ip;
+            unw_get_reg(&cursor, UNW_REG_IP, &ip);
+
+            list[i] = (void *)ip;
+        }
+
+        prevent_backtrace = false;
+    }
+}
+#endif
+
+#ifdef BACKTRACE_CACHE
+// after this many hits the backtrace is determined again, 0 = never
+static uint32_t bt_cache_revalidate = 1024;
+static std::atomic<uint64_t> cnt_bt_cache_stale { 0 };
+
+// The same call site at the same stack depth nearly always has the
+// same backtrace. sp is the frame address of the function that stores
+// the record, which is deterministic for a given call path.
+static bt_cache_entry_t *bt_cache_slot(const void *const caller, const uintptr_t sp)
+{
+	uintptr_t h = uintptr_t(caller) ^ (sp >> 4);
+	h ^= h >> 17;
+
+	return &context.bt_cache[h & (BT_CACHE_SIZE - 1)];
+}
+
+// sets revalidate when the entry matches but is due for a check
+static bool bt_cache_hit(bt_cache_entry_t *const e, const void *const caller, const uintptr_t sp, bool *const revalidate)
+{
+	if (e->caller != caller || e->sp != sp)
+		return false;
+
+	if (bt_cache_revalidate && ++e->n_hits >= bt_cache_revalidate) {
+		*revalidate = true;
+		return false;
+	}
+
+	return true;
+}
+
+static void bt_cache_fill(bt_cache_entry_t *const e, const void *const caller, const uintptr_t sp)
+{
+	e->caller = caller;
+	e->sp     = sp;
+	e->n_hits = 0;
+}
+#endif
+
+#ifdef WITH_BACKTRACE
+static void get_backtrace(void **const list, void *const shallow_backtrace)
+{
+#if defined(PREVENT_RECURSION) || defined(SHALLOW_BACKTRACE)
+	list[0] = shallow_backtrace;
+#elif defined(BACKTRACE_CACHE) && !defined(INTERN_STACKS)
+	const uintptr_t sp = uintptr_t(__builtin_frame_address(0));
+	bt_cache_entry_t *const e = bt_cache_slot(shallow_backtrace, sp);
+	bool revalidate = false;
+
+	if (likely(bt_cache_hit(e, shallow_backtrace, sp, &revalidate))) {
+		memcpy(list, e->list, sizeof e->list);
+		return;
+	}
+
+	my_backtrace(list, CALLER_DEPTH);
+
+	if (revalidate && memcmp(list, e->list, sizeof e->list) != 0)
+		cnt_bt_cache_stale++;
+
+	bt_cache_fill(e, shallow_backtrace, sp);
+	memcpy(e->list, list, sizeof e->list);
+#else
+	my_backtrace(list, CALLER_DEPTH);
+#endif
+}
+#endif
+
+#ifdef INTERN_STACKS
+// Backtraces are stored once in a table (stacks-PID.dat) and the records
+// only contain the index in it. The hash-slots contain the upper 32 bits
+// of the hash of a backtrace and its index + 1 (0 = free slot).
+static void **stacks = nullptr;
+static uint32_t max_stacks = 65536;
+static std::atomic<uint32_t> n_stacks { 0 };
+static std::atomic<uint64_t> *stack_slots = nullptr;
+static uint64_t stack_slots_mask = 0;
+static int stacks_fd = -1;
+static char *stacks_filename = nullptr;
+static std::atomic<uint64_t> stacks_full { 0 };
+
+static uint64_t hash_stack(void *const *const list)
+{
+	uint64_t h = 0;
+
+	for(int i=0; i<CALLER_DEPTH; i++) {
+		h ^= uint64_t(list[i]);
+		h *= 0x9e3779b97f4a7c15ull;
+		h ^= h >> 29;
+	}
+
+	return h;
+}
+
+static uint32_t intern_stack(void *const *const list)
+{
+	const uint64_t h = hash_stack(list);
+	const uint64_t tag = h >> 32 << 32;
+
+	uint32_t reserved = STACK_ID_UNKNOWN;
+
+	for(uint64_t probe=0; probe<=stack_slots_mask; probe++) {
+		std::atomic<uint64_t> *const slot = &stack_slots[(h + probe) & stack_slots_mask];
+		uint64_t v = slot->load(std::memory_order_acquire);
+
+		if (v == 0) {
+			// new backtrace: the entry must be complete before the
+			// slot makes it visible to other threads
+			if (reserved == STACK_ID_UNKNOWN) {
+				reserved = n_stacks++;
+
+				if (reserved >= max_stacks) {
+					stacks_full++;
+					return STACK_ID_UNKNOWN;
+				}
+
+				memcpy(&stacks[uint64_t(reserved) * CALLER_DEPTH], list, sizeof(void *) * CALLER_DEPTH);
+			}
+
+			if (slot->compare_exchange_strong(v, tag | (reserved + 1), std::memory_order_release, std::memory_order_acquire))
+				return reserved;
+
+			// someone else was faster: look at what was put there
+		}
+
+		if ((v >> 32 << 32) == tag) {
+			uint32_t id = uint32_t(v) - 1;
+
+			// a reserved entry that is not used costs a bit of space
+			if (memcmp(&stacks[uint64_t(id) * CALLER_DEPTH], list, sizeof(void *) * CALLER_DEPTH) == 0)
+				return id;
+		}
+	}
+
+	stacks_full++;
+
+	return STACK_ID_UNKNOWN;
+}
+
+static uint32_t get_stack_id(void *const shallow_backtrace)
+{
+#ifdef BACKTRACE_CACHE
+	const uintptr_t sp = uintptr_t(__builtin_frame_address(0));
+	bt_cache_entry_t *const e = bt_cache_slot(shallow_backtrace, sp);
+	bool revalidate = false;
+
+	if (likely(bt_cache_hit(e, shallow_backtrace, sp, &revalidate)))
+		return e->stack_id;
+#endif
+
+	void *list[CALLER_DEPTH] { nullptr };
+
+	get_backtrace(list, shallow_backtrace);
+
+	uint32_t stack_id = intern_stack(list);
+
+#ifdef BACKTRACE_CACHE
+	if (revalidate && stack_id != e->stack_id)
+		cnt_bt_cache_stale++;
+
+	bt_cache_fill(e, shallow_backtrace, sp);
+	e->stack_id = stack_id;
+#endif
+
+	return stack_id;
+}
+#endif
+
+#ifdef LOCK_REGISTRY
+// Lock address -> index in the registry (locks-PID.dat). The index is
+// stored before the address so that a thread that finds the address
+// also finds the index. Registering happens once per lock and is done
+// under a spinlock: a pthread lock can't be used in here.
+static lock_registry_entry_t *lock_registry = nullptr;
+static uint32_t max_locks = 65536;
+static std::atomic<uint32_t> n_locks { 0 };
+static std::atomic<uintptr_t> *lock_slot_keys = nullptr;
+static std::atomic<uint32_t> *lock_slot_ids = nullptr;
+static uint64_t lock_slots_mask = 0;
+static std::atomic_flag lock_registry_busy = ATOMIC_FLAG_INIT;
+static int locks_fd = -1;
+static char *locks_filename = nullptr;
+static std::atomic<uint64_t> locks_full { 0 };
+
+// the lock at this address was destroyed: the next use is a new lock
+#define LOCK_SLOT_DESTROYED 0x80000000
+
+// the slot with this lock or else the free slot where it goes, -1 if
+// the table is full
+static int64_t find_lock_slot(const void *const lock)
+{
+	uint64_t h = uint64_t(lock) * 0x9e3779b97f4a7c15ull;
+	h ^= h >> 29;
+
+	for(uint64_t probe=0; probe<=lock_slots_mask; probe++) {
+		const uint64_t slot = (h + probe) & lock_slots_mask;
+		const uintptr_t key = lock_slot_keys[slot].load(std::memory_order_acquire);
+
+		if (key == uintptr_t(lock) || key == 0)
+			return slot;
+	}
+
+	return -1;
+}
+
+// invoked with lock_registry_busy set
+static uint32_t new_lock_entry(const void *const lock, const uint32_t generation, const lock_kind_t kind, const int type, const bool initialized, const lock_trace_item_t *const item)
+{
+	const uint32_t id = n_locks;
+
+	if (id >= max_locks) {
+		locks_full++;
+		return LOCK_ID_UNKNOWN;
+	}
+
+	lock_registry_entry_t *const e = &lock_registry[id];
+	e->lock        = const_cast<void *>(lock);
+	e->generation  = generation;
+	e->kind        = kind;
+	e->initialized = initialized;
+	e->type        = type;
+#ifdef INTERN_STACKS
+	e->created_stack_id = item->stack_id;
+#elif defined(WITH_BACKTRACE)
+	memcpy(e->created_caller, item->caller, sizeof e->created_caller);
+#endif
+#ifdef MEASURE_TIMING
+	e->created_ts = item->timestamp;
+#endif
+
+	n_locks = id + 1;
+
+	return id;
+}
+
+// item must be filled in (action, backtrace and timestamp)
+static uint32_t get_lock_id(const void *const lock, const lock_kind_t kind, const int type, const lock_trace_item_t *const item)
+{
+	const bool init    = item->la == a_init || item->la == a_rw_init;
+	const bool destroy = item->la == a_destroy || item->la == a_rw_destroy;
+
+	int64_t slot = find_lock_slot(lock);
+
+	// a lock that is already known
+	if (likely(!init && !destroy && slot != -1 && lock_slot_keys[slot].load(std::memory_order_relaxed))) {
+		uint32_t id = lock_slot_ids[slot].load(std::memory_order_relaxed);
+
+		if (likely(id == LOCK_ID_UNKNOWN || (id & LOCK_SLOT_DESTROYED) == 0))
+			return id;
+	}
+
+	while(lock_registry_busy.test_and_set(std::memory_order_acquire))
+		sched_yield();
+
+	// an other thread may have registered it in the mean time
+	slot = find_lock_slot(lock);
+
+	uint32_t id = LOCK_ID_UNKNOWN;
+
+	if (slot == -1)
+		locks_full++;
+	else if (lock_slot_keys[slot].load(std::memory_order_relaxed) == 0) {
+		id = new_lock_entry(lock, 0, kind, type, init, item);
+
+		lock_slot_ids[slot].store(id, std::memory_order_relaxed);
+		lock_slot_keys[slot].store(uintptr_t(lock), std::memory_order_release);
+	}
+	else {
+		id = lock_slot_ids[slot].load(std::memory_order_relaxed);
+
+		// initialized again without a destroy (e.g. freed & allocated
+		// again) or used after a destroy: a new lock at the same address
+		if (init || (id != LOCK_ID_UNKNOWN && (id & LOCK_SLOT_DESTROYED))) {
+			uint32_t generation = id == LOCK_ID_UNKNOWN ? 0 : lock_registry[id & ~LOCK_SLOT_DESTROYED].generation + 1;
+
+			id = new_lock_entry(lock, generation, kind, type, init, item);
+
+			lock_slot_ids[slot].store(id, std::memory_order_relaxed);
+		}
+	}
+
+	if (destroy && id != LOCK_ID_UNKNOWN) {
+		lock_registry[id].destroyed = 1;
+
+		lock_slot_ids[slot].store(id | LOCK_SLOT_DESTROYED, std::memory_order_relaxed);
+	}
+
+	lock_registry_busy.clear(std::memory_order_release);
+
+	return id;
+}
+#endif
+
+// Loaded modules, so that addresses can be resolved without a core
+// file: the analyzer runs the resolver on the module file with the
+// address relative to the load base.
+typedef struct {
+	const char *name;
+	uintptr_t base, lo, hi;
+	char build_id[65];
+} module_info_t;
+
+typedef struct {
+	std::atomic<bool> ready;
+	uint64_t ts;
+	bool open;
+	module_info_t module;
+} dl_event_t;
+
+#define MAX_DL_EVENTS 1024
+static dl_event_t dl_events[MAX_DL_EVENTS];
+static std::atomic<uint32_t> n_dl_events { 0 };
+
+static void get_build_id(const struct dl_phdr_info *const info, char *const out, const size_t out_size)
+{
+	out[0] = 0x00;
+
+	for(int i=0; i<info->dlpi_phnum; i++) {
+		const ElfW(Phdr) *const phdr = &info->dlpi_phdr[i];
+
+		if (phdr->p_type != PT_NOTE)
+			continue;
+
+		const size_t align = phdr->p_align == 8 ? 8 : 4;
+		const char *p = (const char *)(info->dlpi_addr + phdr->p_vaddr);
+		const char *const end = p + phdr->p_memsz;
+
+		while(p + sizeof(ElfW(Nhdr)) <= end) {
+			const ElfW(Nhdr) *const nhdr = (const ElfW(Nhdr) *)p;
+			const char *const name = p + sizeof(ElfW(Nhdr));
+			const uint8_t *const desc = (const uint8_t *)(name + ((nhdr->n_namesz + align - 1) & ~(align - 1)));
+
+			if (nhdr->n_type == NT_GNU_BUILD_ID && nhdr->n_namesz == 4 && memcmp(name, "GNU", 4) == 0) {
+				for(size_t k=0; k<nhdr->n_descsz && k * 2 + 2 < out_size; k++)
+					snprintf(&out[k * 2], 3, "%02x", desc[k]);
+
+				return;
+			}
+
+			p = (const char *)desc + ((nhdr->n_descsz + align - 1) & ~(align - 1));
+		}
+	}
+}
+
+static void describe_module(const struct dl_phdr_info *const info, module_info_t *const m)
+{
+	m->name = info->dlpi_name;
+	m->base = info->dlpi_addr;
+	m->lo   = UINTPTR_MAX;
+	m->hi   = 0;
+
+	for(int i=0; i<info->dlpi_phnum; i++) {
+		if (info->dlpi_phdr[i].p_type == PT_LOAD) {
+			uintptr_t start = info->dlpi_addr + info->dlpi_phdr[i].p_vaddr;
+
+			m->lo = std::min(m->lo, start);
+			m->hi = std::max(m->hi, start + info->dlpi_phdr[i].p_memsz);
+		}
+	}
+
+	get_build_id(info, m->build_id, sizeof m->build_id);
+}
+
+// TRACE_FILTER_*: only the selected locks are traced, the others go to
+// the original function right away (see UNTRACED).
+static bool filtering = false;
+
+typedef struct {
+	// TRACE_FILTER_ADDR: lock address ranges
+	std::vector<std::pair<uintptr_t, uintptr_t> > addr;
+	// TRACE_FILTER_CALLER & TRACE_FILTER_INIT: (parts of) module names,
+	// the ones with a '!' in front are excluded
+	std::vector<std::string> caller, init;
+	// TRACE_FILTER_NAME: fnmatch() pattern for the symbol of the lock
+	std::string name;
+} filter_spec_t;
+
+// a pointer: the constructor runs before the static initializers
+static filter_spec_t *filter = nullptr;
+
+static std::vector<std::string> split_filter(const char *const spec)
+{
+	std::vector<std::string> out;
+	std::string current;
+
+	for(const char *p = spec; ; p++) {
+		if (*p == ',' || *p == 0x00) {
+			if (!current.empty())
+				out.push_back(current);
+
+			current.clear();
+
+			if (*p == 0x00)
+				break;
+		}
+		else {
+			current += *p;
+		}
+	}
+
+	return out;
+}
+
+static bool module_matches(const std::vector<std::string> & filter, const char *const name)
+{
+	bool has_include = false, included = false;
+
+	for(auto & f : filter) {
+		if (f[0] == '!') {
+			if (strstr(name, f.c_str() + 1))
+				return false;
+		}
+		else {
+			has_include = true;
+
+			if (strstr(name, f.c_str()))
+				included = true;
+		}
+	}
+
+	return included || !has_include;
+}
+
+static int find_filter_held(const tracer_context_t *const ctx, const void *const lock)
+{
+	for(int i=ctx->n_filter_held - 1; i>=0; i--) {
+		if (ctx->filter_held[i] == lock)
+			return i;
+	}
+
+	return -1;
+}
+
+static bool forget_filter_held(tracer_context_t *const ctx, const void *const lock)
+{
+	int i = find_filter_held(ctx, lock);
+	if (i == -1)
+		return false;
+
+	ctx->n_filter_held--;
+	memmove(&ctx->filter_held[i], &ctx->filter_held[i + 1], (ctx->n_filter_held - i) * sizeof(const void *));
+
+	return true;
+}
+
+// the lock was added to filter_held before it was known whether it
+// would be acquired; one that failed (EBUSY, ETIMEDOUT, ...) has no
+// unlock
+static inline void filter_acquire_result(tracer_context_t *const ctx, const void *const lock, const lock_action_t la, const int rc)
+{
+	if (unlikely(filtering) && rc != 0 && is_acquire(la))
+		forget_filter_held(ctx, lock);
+}
+
+// glibc decides on the RUNPATH/$ORIGIN and the namespace that dlopen()
+// searches from the address it is called from, so dlopen/dlclose are
+// not wrapped. Instead the list of modules is read again when the
+// load/unload counters of the loader changed; this is checked when the
+// meta data is written and, with a caller or init filter, at most every
+// MODULE_REFRESH_INTERVAL_NS when a lock function is called from outside
+// the known modules.
+typedef struct {
+	module_info_t module;
+	// matches TRACE_FILTER_CALLER & TRACE_FILTER_INIT
+	bool caller, init;
+} known_module_t;
+
+typedef struct {
+	unsigned long long adds, subs;
+	// sorted on lo
+	std::vector<known_module_t> list;
+} module_table_t;
+
+// replaced (not freed: an other thread may still look at it) when
+// modules were loaded or unloaded
+static std::atomic<const module_table_t *> module_table { nullptr };
+static std::atomic_flag module_table_busy = ATOMIC_FLAG_INIT;
+
+static void add_dl_event(const module_info_t *const m, const bool open, const uint64_t ts)
+{
+	uint32_t nr = n_dl_events++;
+	if (nr >= MAX_DL_EVENTS)
+		return;
+
+	dl_event_t *const e = &dl_events[nr];
+	e->ts = ts;
+	e->open = open;
+	e->module = *m;
+
+	e->ready.store(true, std::memory_order_release);
+}
+
+static int read_dl_counters(struct dl_phdr_info *info, size_t size, void *data)
+{
+	unsigned long long *const counters = (unsigned long long *)data;
+
+	counters[0] = info->dlpi_adds;
+	counters[1] = info->dlpi_subs;
+
+	// they're the same for all modules
+	return 1;
+}
+
+static int add_known_module(struct dl_phdr_info *info, size_t size, void *data)
+{
+	module_table_t *const t = (module_table_t *)data;
+
+	t->adds = info->dlpi_adds;
+	t->subs = info->dlpi_subs;
+
+	known_module_t k { };
+	describe_module(info, &k.module);
+
+	if (k.module.lo >= k.module.hi)
+		return 0;
+
+	// the program itself has no name here
+	char exe_name[PATH_MAX] = { 0 };
+	if (k.module.name[0] == 0x00 && readlink("/proc/self/exe", exe_name, sizeof(exe_name) - 1) != -1)
+		k.module.name = exe_name;
+
+	if (filter) {
+		k.caller = module_matches(filter->caller, k.module.name);
+		k.init   = module_matches(filter->init,   k.module.name);
+	}
+
+	// the name is only valid while the module is loaded
+	k.module.name = strdup(k.module.name);
+
+	t->list.push_back(k);
+
+	return 0;
+}
+
+static const known_module_t *find_same_module(const module_table_t *const t, const module_info_t *const m)
+{
+	for(auto & k : t->list) {
+		if (k.module.base == m->base && k.module.lo == m->lo && k.module.hi == m->hi && strcmp(k.module.name, m->name) == 0)
+			return &k;
+	}
+
+	return nullptr;
+}
+
+// force: also when no modules were loaded or unloaded (e.g. the
+// filters changed)
+static void refresh_modules(const bool force)
+{
+	while(module_table_busy.test_and_set(std::memory_order_acquire))
+		sched_yield();
+
+	const module_table_t *const old = module_table.load(std::memory_order_relaxed);
+
+	unsigned long long counters[2] { 0, 0 };
+	dl_iterate_phdr(read_dl_counters, counters);
+
+	if (old && !force && old->adds == counters[0] && old->subs == counters[1]) {
+		module_table_busy.clear(std::memory_order_release);
+		return;
+	}
+
+	module_table_t *const t = new module_table_t;
+	dl_iterate_phdr(add_known_module, t);
+
+	std::sort(t->list.begin(), t->list.end(), [](const known_module_t & a, const known_module_t & b) { return a.module.lo < b.module.lo; });
+
+	// the modules that were there at the start are not events; the time
+	// of the others is when it was noticed
+	if (old) {
+		uint64_t now = get_ns();
+
+		for(auto & k : t->list) {
+			const known_module_t *const prev = find_same_module(old, &k.module);
+
+			if (prev) {
+				free((void *)k.module.name);
+				k.module.name = prev->module.name;
+			}
+			else {
+				add_dl_event(&k.module, true, now);
+			}
+		}
+
+		for(auto & k : old->list) {
+			if (!find_same_module(t, &k.module))
+				add_dl_event(&k.module, false, now);
+		}
+	}
+
+	module_table.store(t, std::memory_order_release);
+
+	module_table_busy.clear(std::memory_order_release);
+}
+
+// the module that address is in; lo-hi is the range for which that is
+// the answer
+static const known_module_t *find_known_module(const module_table_t *const t, const uintptr_t address, uintptr_t *const lo, uintptr_t *const hi)
+{
+	auto it = std::upper_bound(t->list.begin(), t->list.end(), address, [](const uintptr_t a, const known_module_t & k) { return a < k.module.lo; });
+
+	if (it != t->list.begin() && address < (it - 1)->module.hi) {
+		*lo = (it - 1)->module.lo;
+		*hi = (it - 1)->module.hi;
+
+		return &*(it - 1);
+	}
+
+	// e.g. generated code: the gap between the modules around it
+	*lo = it != t->list.begin() ? (it - 1)->module.hi : 0;
+	*hi = it != t->list.end() ? it->module.lo : UINTPTR_MAX;
+
+	return nullptr;
+}
+
+// callers outside of the known modules: the list of modules is not
+// read again more often than this
+#define MODULE_REFRESH_INTERVAL_NS 100000000ull
+
+static std::atomic<uint64_t> modules_refresh_ts { 0 };
+
+static uint64_t get_coarse_ns()
+{
+	struct timespec tp { 0 };
+	clock_gettime(CLOCK_MONOTONIC_COARSE, &tp);
+
+	return tp.tv_sec * 1000ll * 1000ll * 1000ll + tp.tv_nsec;
+}
+
+// The module that a lock function was called from (only used by the
+// TRACE_FILTER_CALLER and TRACE_FILTER_INIT filters). A caller outside
+// of the known modules can mean that modules were loaded since the table
+// was made. Per thread the range of the last lookup is remembered; for
+// a caller outside of the modules only until the next refresh may be
+// done.
+static const known_module_t *caller_module(tracer_context_t *const ctx, const void *const caller)
+{
+	const module_table_t *t = module_table.load(std::memory_order_acquire);
+
+	if (likely(t == ctx->module_table && uintptr_t(caller) - ctx->caller_lo < ctx->caller_n) &&
+	    (ctx->caller_module || get_coarse_ns() < ctx->caller_retry_ts))
+		return (const known_module_t *)ctx->caller_module;
+
+	uintptr_t lo = 0, hi = 0;
+	const known_module_t *m = t ? find_known_module(t, uintptr_t(caller), &lo, &hi) : nullptr;
+
+	uint64_t now = 0;
+
+	if (!m) {
+		now = get_coarse_ns();
+
+		uint64_t last = modules_refresh_ts.load(std::memory_order_relaxed);
+
+		// one thread per interval; refresh_modules() may allocate
+		// memory, which may lock a mutex
+		if (now - last >= MODULE_REFRESH_INTERVAL_NS && !ctx->refreshing_modules &&
+		    modules_refresh_ts.compare_exchange_strong(last, now)) {
+			ctx->refreshing_modules = true;
+			refresh_modules(false);
+			ctx->refreshing_modules = false;
+
+			t = module_table.load(std::memory_order_acquire);
+			m = t ? find_known_module(t, uintptr_t(caller), &lo, &hi) : nullptr;
+		}
+	}
+
+	ctx->module_table    = t;
+	ctx->caller_lo       = lo;
+	ctx->caller_n        = hi - lo;
+	ctx->caller_module   = m;
+	ctx->caller_retry_ts = now + MODULE_REFRESH_INTERVAL_NS;
+
+	return m;
+}
+
+static void store_mutex_info(pthread_mutex_t *mutex, lock_action_t la, uint64_t took, const int rc, const uint64_t now, void *const shallow_backtrace)
+{
+	filter_acquire_result(get_context(), mutex, la, rc);
+
+#ifdef WITH_LIVE_STATS
+	if (live_stats)
+		live_stats_event(mutex, la, took, rc, now);
+#endif
+
+#ifdef WITH_AGGREGATE
+	if (aggregate) {
+		aggregate_event(mutex, la, took, rc, now, shallow_backtrace);
+		return;
+	}
+#endif
+
+	if (unlikely(!items)) {
+		// when a constructor of some other library already invokes e.g. pthread_mutex_lock
+		// before this wrapper has been fully initialized
+		show_items_buffer_not_allocated_error();
+		return;
+	}
+
+	tracer_context_t *const ctx = get_context();
+
+	// also for the events that are not recorded
+	check_triggers(ctx, mutex, la, took, rc, now);
+
+	if (unlikely(sample_rate > 1 || contended_only) && !sample_take(ctx, mutex, la, rc))
+		return;
+
+	lock_trace_item_t *const item = claim_item(ctx);
+
+	if (likely(item != nullptr)) {
+#ifdef INTERN_STACKS
+		item->stack_id = get_stack_id(shallow_backtrace);
+#elif defined(WITH_BACKTRACE)
+		get_backtrace(item->caller, shallow_backtrace);
+#endif
+		item->lock = mutex;
+		item->tid = ctx->tid;
+		item->la = la;
+#ifdef MEASURE_TIMING
+		item->timestamp = now;
+		item->lock_took = took;
+#endif
+
+#ifdef STORE_THREAD_NAME
+		memcpy(item->thread_name, ctx->thread_name, sizeof item->thread_name);
+#endif
+
+		item->mutex_innards.__count = mutex->__data.__count;
+		item->mutex_innards.__owner = mutex->__data.__owner;
+		item->mutex_innards.__kind  = mutex->__data.__kind;
+
+		item->rc = rc;
+
+#ifdef LOCK_REGISTRY
+		item->lock_id = get_lock_id(mutex, lk_mutex, mutex->__data.__kind, item);
+#endif
+
+		commit_item(ctx);
+	}
+	else {
+		show_items_buffer_full_error();
+	}
+}
+
+#ifdef WITH_USAGE_GROUPS
+void store_lock(void *lock, void *caller, lock_action_t la)
+{
+#ifdef WITH_AGGREGATE
+	if (aggregate)
+		return;
+#endif
+
+	if (unlikely(!ug_items)) {
+		show_items_buffer_not_allocated_error();
+		return;
+	}
+
+	tracer_context_t *const ctx = get_context();
+
+	if (unlikely(sample_rate > 1 || contended_only) && !sample_peek(ctx, lock, la))
+		return;
+
+	lock_usage_groups_t *const ug_item = claim_ug_item(ctx);
+
+	if (likely(ug_item != nullptr)) {
+		ug_item->lock = lock;
+		ug_item->tid = ctx->tid;
+		ug_item->la = la;
+#ifdef MEASURE_TIMING
+		ug_item->timestamp = get_ts();
+#endif
+		ug_item->caller = caller;
+#ifdef STORE_THREAD_NAME
+		memcpy(ug_item->thread_name, ctx->thread_name, sizeof ug_item->thread_name);
+#endif
+
+		commit_ug_item(ctx);
+	}
+}
+#endif
+
+// the aggregate mode uses the caller as the call site
+#if ((defined(PREVENT_RECURSION) || defined(SHALLOW_BACKTRACE) || defined(BACKTRACE_CACHE)) && defined(WITH_BACKTRACE)) || defined(WITH_AGGREGATE)
+#define STORE_MUTEX_INFO(a, b, c, d, e) store_mutex_info(a, b, c, d, e, __builtin_return_address(0))
+#else
+#define STORE_MUTEX_INFO(a, b, c, d, e) store_mutex_info(a, b, c, d, e, nullptr)
+#endif
+
+// How long the caller allowed the lock to take: from now until the
+// deadline. Measured on the clock of the deadline, not with get_ts().
+static int64_t get_timeout(const clockid_t clock_id, const struct timespec *const abstime)
+{
+	if (!abstime)
+		return 0;
+
+	struct timespec now { 0, 0 };
+	clock_gettime(clock_id, &now);
+
+	return (abstime->tv_sec - now.tv_sec) * 1000000000ll + abstime->tv_nsec - now.tv_nsec;
+}
+
+// The timed and clock lock variants of mutexes and rwlocks. Instead of
+// the innards of the lock the timeout is stored.
+static void store_timed_info(void *const lock, const lock_kind_t kind, const int type, const lock_action_t la, const uint64_t took, const int rc, const int64_t timeout, const clockid_t clock_id, const uint64_t now, void *const shallow_backtrace)
+{
+	filter_acquire_result(get_context(), lock, la, rc);
+
+#ifdef WITH_LIVE_STATS
+	if (live_stats)
+		live_stats_event(lock, la, took, rc, now);
+#endif
+
+#ifdef WITH_AGGREGATE
+	if (aggregate) {
+		aggregate_event(lock, la, took, rc, now, shallow_backtrace);
+		return;
+	}
+#endif
+
+	if (unlikely(!items)) {
+		show_items_buffer_not_allocated_error();
+		return;
+	}
+
+	tracer_context_t *const ctx = get_context();
+
+	check_triggers(ctx, lock, la, took, rc, now);
+
+	if (unlikely(sample_rate > 1 || contended_only) && !sample_take(ctx, lock, la, rc))
+		return;
+
+	lock_trace_item_t *const item = claim_item(ctx);
+
+	if (likely(item != nullptr)) {
+#ifdef INTERN_STACKS
+		item->stack_id = get_stack_id(shallow_backtrace);
+#elif defined(WITH_BACKTRACE)
+		get_backtrace(item->caller, shallow_backtrace);
+#endif
+		item->lock = lock;
+		item->tid = ctx->tid;
+		item->la = la;
+#ifdef MEASURE_TIMING
+		item->timestamp = now;
+		item->lock_took = took;
+#endif
+
+#ifdef STORE_THREAD_NAME
+		memcpy(item->thread_name, ctx->thread_name, sizeof item->thread_name);
+#endif
+
+		item->timed_innards.timeout_lo = uint64_t(timeout);
+		item->timed_innards.timeout_hi = uint64_t(timeout) >> 32;
+		item->timed_innards.clock      = clock_id;
+
+		item->rc = rc;
+
+#ifdef LOCK_REGISTRY
+		item->lock_id = get_lock_id(lock, kind, type, item);
+#endif
+
+		commit_item(ctx);
+	}
+	else {
+		show_items_buffer_full_error();
+	}
+}
+
+#if ((defined(PREVENT_RECURSION) || defined(SHALLOW_BACKTRACE) || defined(BACKTRACE_CACHE)) && defined(WITH_BACKTRACE)) || defined(WITH_AGGREGATE)
+#define STORE_TIMED_INFO(a, b, c, d, e, f, g, h, i) store_timed_info(a, b, c, d, e, f, g, h, i, __builtin_return_address(0))
+#else
+#define STORE_TIMED_INFO(a, b, c, d, e, f, g, h, i) store_timed_info(a, b, c, d, e, f, g, h, i, nullptr)
+#endif
+
+pid_t fork(void) throw ()
+{
+	if (unlikely(!org_fork_h))
+		org_fork_h = (org_fork)dlsym(RTLD_NEXT, "fork");
+
+	// the child is set up by fork_child()
+	pid_t pid = (*org_fork_h)();
+
+	if (pid > 0) {
+		uint32_t nr = n_children++;
+
+		if (nr < MAX_CHILDREN)
+			children[nr] = pid;
+	}
+
+	return pid;
+}
+
+// per lock the outcome of the filters that only depend on the lock
+typedef enum { fv_unknown = 0, fv_trace, fv_skip } filter_verdict_t;
+
+typedef struct {
+	std::atomic<uintptr_t> lock;
+	std::atomic<uint8_t> verdict;
+	// acquired from a module selected by TRACE_FILTER_CALLER
+	std::atomic<bool> selected;
+} filter_slot_t;
+
+#define FILTER_SLOTS 65536  // power of 2
+#define FILTER_MAX_PROBE 32
+static filter_slot_t *filter_slots = nullptr;
+static std::atomic<uint64_t> filter_locks_traced { 0 }, filter_locks_skipped { 0 }, filter_slots_full { 0 }, filter_held_full { 0 };
+
+// the slot of a lock, claimed when it has none yet (and claim is set);
+// nullptr when the table is full around it
+static filter_slot_t *get_filter_slot(const void *const lock, const bool claim)
+{
+	uint64_t slot = (uintptr_t(lock) >> 3) * 0x9e3779b97f4a7c15ull;
+
+	for(int i=0; i<FILTER_MAX_PROBE; i++) {
+		filter_slot_t *const s = &filter_slots[(slot + i) & (FILTER_SLOTS - 1)];
+
+		uintptr_t key = s->lock.load(std::memory_order_acquire);
+
+		// when the compare_exchange fails, key is what an other thread
+		// put there, possibly this same lock
+		if (key == uintptr_t(lock) || (key == 0 && claim && s->lock.compare_exchange_strong(key, uintptr_t(lock))) || key == uintptr_t(lock))
+			return s;
+
+		if (key == 0)
+			return nullptr;
+	}
+
+	if (claim)
+		filter_slots_full++;
+
+	return nullptr;
+}
+
+// the symbol of a global or static lock (or of the structure it is in);
+// only symbols in the dynamic symbol table, see -rdynamic
+static bool lock_name_matches(const void *const lock)
+{
+	Dl_info info { };
+	const ElfW(Sym) *sym = nullptr;
+
+	if (dladdr1(lock, &info, (void **)&sym, RTLD_DL_SYMENT) == 0 || !info.dli_sname || !sym)
+		return false;
+
+	if (uintptr_t(lock) >= uintptr_t(info.dli_saddr) + std::max(ElfW(Xword)(1), sym->st_size))
+		return false;
+
+	return fnmatch(filter->name.c_str(), info.dli_sname, 0) == 0;
+}
+
+// the init call site is that of pthread_*_init or, for a lock that was
+// not initialized with it, of its first use
+static filter_verdict_t get_filter_verdict(const void *const lock, const void *const caller)
+{
+	if (!filter->name.empty() && !lock_name_matches(lock))
+		return fv_skip;
+
+	if (!filter->init.empty()) {
+		const known_module_t *const m = caller_module(get_context(), caller);
+
+		if (m ? !m->init : !module_matches(filter->init, ""))
+			return fv_skip;
+	}
+
+	return fv_trace;
+}
+
+static bool lock_filter(const void *const lock, const void *const caller, const bool init)
+{
+	if (filter->name.empty() && filter->init.empty())
+		return true;
+
+	filter_slot_t *const s = get_filter_slot(lock, true);
+
+	// slow but correct
+	if (!s)
+		return get_filter_verdict(lock, caller) == fv_trace;
+
+	uint8_t verdict = s->verdict.load(std::memory_order_relaxed);
+
+	// fv_unknown: a new lock or an other thread is still filling it in
+	if (verdict != fv_unknown && !init)
+		return verdict == fv_trace;
+
+	verdict = get_filter_verdict(lock, caller);
+
+	if (s->verdict.exchange(verdict) == fv_unknown)
+		(verdict == fv_trace ? filter_locks_traced : filter_locks_skipped)++;
+
+	return verdict == fv_trace;
+}
+
+// what a wrapper does with the lock, see trace_lock()
+typedef enum { fr_other, fr_init, fr_acquire, fr_release, fr_cond_wait, fr_destroy } filter_role_t;
+
+static bool caller_selected(const void *const caller)
+{
+	const known_module_t *const m = caller_module(get_context(), caller);
+
+	return m ? m->caller : module_matches(filter->caller, "");
+}
+
+// TRACE_FILTER_CALLER decides when a lock is acquired. The unlock, the
+// implicit unlock and lock of a condition variable wait and the destroy
+// of such a lock are then recorded too, from whichever module they are
+// done, so that the analyzer sees complete pairs.
+static bool select_lock(const void *const lock, const void *const caller, const filter_role_t role)
+{
+	if (!filter->addr.empty()) {
+		bool in_range = false;
+
+		for(auto & range : filter->addr) {
+			if (uintptr_t(lock) >= range.first && uintptr_t(lock) < range.second) {
+				in_range = true;
+				break;
+			}
+		}
+
+		if (!in_range)
+			return false;
+	}
+
+	// before the caller filter so that the first use is seen by it
+	if (!lock_filter(lock, caller, role == fr_init))
+		return false;
+
+	if (filter->caller.empty())
+		return true;
+
+	tracer_context_t *const ctx = get_context();
+
+	if (role == fr_acquire) {
+		if (!caller_selected(caller))
+			return false;
+
+		// can't keep track of the unlock
+		if (ctx->n_filter_held >= N_HELD_TRACKED) {
+			filter_held_full++;
+			return false;
+		}
+
+		ctx->filter_held[ctx->n_filter_held++] = lock;
+
+		filter_slot_t *const s = get_filter_slot(lock, true);
+		if (s)
+			s->selected.store(true, std::memory_order_relaxed);
+
+		return true;
+	}
+
+	if (role == fr_release)
+		return forget_filter_held(ctx, lock);
+
+	if (role == fr_cond_wait)
+		return find_filter_held(ctx, lock) != -1;
+
+	if (role == fr_destroy) {
+		filter_slot_t *const s = get_filter_slot(lock, false);
+
+		return s && s->selected.load(std::memory_order_relaxed);
+	}
+
+	return caller_selected(caller);
+}
+
+static bool trace_lock(const void *const lock, const void *const caller, const filter_role_t role)
+{
+	bool trace = select_lock(lock, caller, role);
+
+	// a lock at the same address later on is an other lock, which may
+	// never call pthread_*_init (std::mutex, PTHREAD_MUTEX_INITIALIZER)
+	if (role == fr_destroy && filter_slots) {
+		filter_slot_t *const s = get_filter_slot(lock, false);
+
+		if (s) {
+			s->verdict.store(fv_unknown, std::memory_order_relaxed);
+			s->selected.store(false, std::memory_order_relaxed);
+		}
+	}
+
+	return trace;
+}
+
+// in the wrappers: the caller is that of the wrapper
+#define UNTRACED(lock, role) (unlikely(filtering) && !trace_lock(lock, __builtin_return_address(0), role))
+
+static void setup_filters()
+{
+	filter = new filter_spec_t;
+
+	const char *env_addr = getenv("TRACE_FILTER_ADDR");
+	if (env_addr) {
+		for(auto & range : split_filter(env_addr)) {
+			unsigned long long lo = 0, hi = 0;
+
+			if (sscanf(range.c_str(), "%llx-%llx", &lo, &hi) != 2 || lo >= hi) {
+				fprintf(stderr, "TRACE_FILTER_ADDR: \"%s\" is not a range (\"lo-hi\", hexadecimal), ignored\n", range.c_str());
+				continue;
+			}
+
+			filter->addr.push_back({ lo, hi });
+		}
+	}
+
+	const char *env_caller = getenv("TRACE_FILTER_CALLER");
+	if (env_caller)
+		filter->caller = split_filter(env_caller);
+
+	const char *env_init = getenv("TRACE_FILTER_INIT");
+	if (env_init)
+		filter->init = split_filter(env_init);
+
+	const char *env_name = getenv("TRACE_FILTER_NAME");
+	if (env_name)
+		filter->name = env_name;
+
+	if (filter->addr.empty() && filter->caller.empty() && filter->init.empty() && filter->name.empty())
+		return;
+
+	if (!filter->name.empty() || !filter->init.empty() || !filter->caller.empty()) {
+		filter_slots = (filter_slot_t *)mmap(nullptr, FILTER_SLOTS * sizeof(filter_slot_t), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+		if (filter_slots == MAP_FAILED) {
+			fprintf(stderr, "ERROR: cannot allocate memory for the lock filter: %s\n", strerror(errno));
+			color("\033[0m");
+			_exit(1);
+		}
+	}
+
+	fprintf(stderr, "Only tracing the locks selected by the TRACE_FILTER_* environment variables\n");
+
+	filtering = true;
+}
+
+#ifdef CAPTURE_PTHREAD_EXIT
+void pthread_exit(void *retval)
+{
+	if (likely(items != nullptr)) {
+		tracer_context_t *const ctx = get_context();
+		lock_trace_item_t *const item = claim_item(ctx);
+
+		if (likely(item != nullptr)) {
+			item->lock = nullptr;
+			item->tid = ctx->tid;
+			item->la = a_thread_clean;
+#ifdef LOCK_REGISTRY
+			item->lock_id = LOCK_ID_UNKNOWN;
+#endif
+#ifdef MEASURE_TIMING
+			item->timestamp = get_ts();
+			item->lock_took = 0;
+#endif
+
+			commit_item(ctx);
+		}
+		else {
+			show_items_buffer_full_error();
+		}
+	}
+
+#ifdef CAPTURE_PTHREAD_EXIT
+	if (unlikely(!org_pthread_exit_h))
+		org_pthread_exit_h = (org_pthread_exit)dlsym(RTLD_NEXT, "pthread_exit");
+#endif
+
+#ifdef STORE_THREAD_NAME
+	check_tid_names_lock_functions();
+
+	// pthread_t values get re-used
+	if ((*org_pthread_rwlock_wrlock_h)(&tid_names_lock) == 0) {
+		tid_names->erase(pthread_self());
+
+		(*org_pthread_rwlock_unlock_h)(&tid_names_lock);
+	}
+#endif
+
+	(*org_pthread_exit_h)(retval);
+
+	color("\033[0;31m");
+	fprintf(stderr, "pthread_exit did not stop thread!\n");
+	color("\033[0m");
+
+	for(;;)
+		sleep(86400);
+}
+#endif
+
+int pthread_mutex_lock(pthread_mutex_t *mutex) throw ()
+{
+	if (unlikely(!org_pthread_mutex_lock_h))
+		org_pthread_mutex_lock_h = (org_pthread_mutex_lock)dlsym(RTLD_NEXT, "pthread_mutex_lock");
+
+	if (UNTRACED(mutex, fr_acquire))
+		return (*org_pthread_mutex_lock_h)(mutex);
+
+#ifdef MUTEX_SANITY_CHECKS
+	if (mutex->__data.__kind < 0 || mutex->__data.__kind > PTHREAD_MUTEX_ADAPTIVE_NP)
+		fprintf(stderr, "Mutex %p has unknown type %d (caller: %p)\n", (void *)mutex, mutex->__data.__kind, __builtin_return_address(0));
+#endif
+
+#ifdef ENFORCE_ERROR_CHECK
+	if (mutex->__data.__kind == PTHREAD_MUTEX_NORMAL || mutex->__data.__kind == PTHREAD_MUTEX_ADAPTIVE_NP || mutex->__data.__kind == PTHREAD_MUTEX_RECURSIVE)
+		mutex->__data.__kind = PTHREAD_MUTEX_ERRORCHECK;
+#endif
+
+	if (contended_only) {
+		if (unlikely(!org_pthread_mutex_trylock_h))
+			org_pthread_mutex_trylock_h = (org_pthread_mutex_trylock)dlsym(RTLD_NEXT, "pthread_mutex_trylock");
+
+		if ((*org_pthread_mutex_trylock_h)(mutex) == 0) {
+			count_uncontended(mutex, 0);
+			return 0;
+		}
+	}
+
+#ifdef WITH_USAGE_GROUPS
+	store_lock(mutex, __builtin_return_address(0), a_lock);
+#endif
+
+	uint64_t start_ts = get_ts();
+	int rc = (*org_pthread_mutex_lock_h)(mutex);
+	uint64_t end_ts = get_ts();
+
+	if (contended_only)
+		count_contended(mutex, 0, rc);
+
+	STORE_MUTEX_INFO(mutex, a_lock, end_ts - start_ts, rc, end_ts);
+
+	return rc;
+}
+
+static void mutex_sanity_check(pthread_mutex_t *const mutex, void *const caller)
+{
+#ifdef MUTEX_SANITY_CHECKS
+	if (mutex->__data.__kind < 0 || mutex->__data.__kind > PTHREAD_MUTEX_ADAPTIVE_NP)
+		fprintf(stderr, "Mutex %p has unknown type %d (caller: %p)\n", (void *)mutex, mutex->__data.__kind, caller);
+
+	if (int(mutex->__data.__nusers) < 0)
 		fprintf(stderr, "Mutex %p has suspicious '__nusers': %u (caller: %p)\n", (void *)mutex, mutex->__data.__nusers, caller);
 
-	if (mutex->__data.__lock && mutex->__data.__owner == 0)
-		fprintf(stderr, "Mutex %p has suspicious '__owner': %u with(caller: %p)\n", (void *)mutex, mutex->__data.__owner, caller);
-#endif
+	if (mutex->__data.__lock && mutex->__data.__owner == 0)
+		fprintf(stderr, "Mutex %p has suspicious '__owner': %u with(caller: %p)\n", (void *)mutex, mutex->__data.__owner, caller);
+#endif
+}
+
+static void rwlock_sanity_check(pthread_rwlock_t *const rwlock, void *const caller)
+{
+#ifdef RWLOCK_SANITY_CHECKS
+#if __GLIBC_PREREQ(2, 30)
+	if (int(rwlock->__data.__readers) < 0)
+		fprintf(stderr, "rwlock %p has suspicious '__readers': %u (caller: %p)\n", (void *)rwlock, rwlock->__data.__readers, caller);
+
+	if (int(rwlock->__data.__writers) < 0)
+		fprintf(stderr, "rwlock %p has suspicious '__writers': %u (caller: %p)\n", (void *)rwlock, rwlock->__data.__writers, caller);
+
+	if (rwlock->__data.__writers > 0 && rwlock->__data.__cur_writer == 0)
+		fprintf(stderr, "rwlock %p has suspicious '__cur_writer': %u (caller: %p)\n", (void *)rwlock, rwlock->__data.__cur_writer, caller);
+#endif
+#endif
+}
+
+int pthread_mutex_init(pthread_mutex_t *mutex, const pthread_mutexattr_t *attr) throw ()
+{
+	if (unlikely(!org_pthread_mutex_init_h))
+		org_pthread_mutex_init_h = (org_pthread_mutex_init)dlsym(RTLD_NEXT, "pthread_mutex_init");
+
+	if (UNTRACED(mutex, fr_init))
+		return (*org_pthread_mutex_init_h)(mutex, attr);
+
+	int rc = (*org_pthread_mutex_init_h)(mutex, attr);
+	STORE_MUTEX_INFO(mutex, a_init, 0, rc, get_ts());
+
+	return rc;
+}
+
+int pthread_mutex_destroy(pthread_mutex_t *mutex) throw ()
+{
+	if (unlikely(!org_pthread_mutex_destroy_h))
+		org_pthread_mutex_destroy_h = (org_pthread_mutex_destroy)dlsym(RTLD_NEXT, "pthread_mutex_destroy");
+
+	if (UNTRACED(mutex, fr_destroy))
+		return (*org_pthread_mutex_destroy_h)(mutex);
+
+	int rc = (*org_pthread_mutex_destroy_h)(mutex);
+	STORE_MUTEX_INFO(mutex, a_destroy, 0, rc, get_ts());
+
+	return rc;
+}
+
+int pthread_mutex_trylock(pthread_mutex_t *mutex) throw ()
+{
+	if (unlikely(!org_pthread_mutex_trylock_h))
+		org_pthread_mutex_trylock_h = (org_pthread_mutex_trylock)dlsym(RTLD_NEXT, "pthread_mutex_trylock");
+
+	if (UNTRACED(mutex, fr_acquire))
+		return (*org_pthread_mutex_trylock_h)(mutex);
+
+	cnt_mutex_trylock++;
+
+	mutex_sanity_check(mutex, __builtin_return_address(0));
+
+	int rc = (*org_pthread_mutex_trylock_h)(mutex);
+
+#ifdef WITH_USAGE_GROUPS
+	// after! as only here is known if it would succeed or not
+	if (rc == 0)
+		store_lock(mutex, __builtin_return_address(0), a_lock);
+#endif
+
+	STORE_MUTEX_INFO(mutex, a_lock, 0, rc, get_ts());
+
+	return rc;
+}
+
+int pthread_mutex_timedlock(pthread_mutex_t *mutex, const struct timespec *abstime) throw ()
+{
+	if (unlikely(!org_pthread_mutex_timedlock_h))
+		org_pthread_mutex_timedlock_h = (org_pthread_mutex_timedlock)dlsym(RTLD_NEXT, "pthread_mutex_timedlock");
+
+	if (UNTRACED(mutex, fr_acquire))
+		return (*org_pthread_mutex_timedlock_h)(mutex, abstime);
+
+	cnt_mutex_timedlock++;
+
+	mutex_sanity_check(mutex, __builtin_return_address(0));
+
+	int64_t timeout = get_timeout(CLOCK_REALTIME, abstime);
+
+	uint64_t start_ts = get_ts();
+	int rc = (*org_pthread_mutex_timedlock_h)(mutex, abstime);
+	uint64_t end_ts = get_ts();
+
+#ifdef WITH_USAGE_GROUPS
+	if (rc == 0)
+		store_lock(mutex, __builtin_return_address(0), a_lock);
+#endif
+
+	STORE_TIMED_INFO(mutex, lk_mutex, mutex->__data.__kind, a_timed_lock, end_ts - start_ts, rc, timeout, CLOCK_REALTIME, end_ts);
+
+	return rc;
+}
+
+#if __GLIBC_PREREQ(2, 30)
+int pthread_mutex_clocklock(pthread_mutex_t *mutex, clockid_t clock_id, const struct timespec *abstime) throw ()
+{
+	if (unlikely(!org_pthread_mutex_clocklock_h))
+		org_pthread_mutex_clocklock_h = (org_pthread_mutex_clocklock)dlsym(RTLD_NEXT, "pthread_mutex_clocklock");
+
+	if (UNTRACED(mutex, fr_acquire))
+		return (*org_pthread_mutex_clocklock_h)(mutex, clock_id, abstime);
+
+	cnt_mutex_timedlock++;
+
+	mutex_sanity_check(mutex, __builtin_return_address(0));
+
+	int64_t timeout = get_timeout(clock_id, abstime);
+
+	uint64_t start_ts = get_ts();
+	int rc = (*org_pthread_mutex_clocklock_h)(mutex, clock_id, abstime);
+	uint64_t end_ts = get_ts();
+
+#ifdef WITH_USAGE_GROUPS
+	if (rc == 0)
+		store_lock(mutex, __builtin_return_address(0), a_lock);
+#endif
+
+	STORE_TIMED_INFO(mutex, lk_mutex, mutex->__data.__kind, a_timed_lock, end_ts - start_ts, rc, timeout, clock_id, end_ts);
+
+	return rc;
+}
+#endif
+
+int pthread_mutex_unlock(pthread_mutex_t *mutex) throw ()
+{
+	if (unlikely(!org_pthread_mutex_unlock_h))
+		org_pthread_mutex_unlock_h = (org_pthread_mutex_unlock)dlsym(RTLD_NEXT, "pthread_mutex_unlock");
+
+	if (UNTRACED(mutex, fr_release))
+		return (*org_pthread_mutex_unlock_h)(mutex);
+
+	mutex_sanity_check(mutex, __builtin_return_address(0));
+
+#ifdef WITH_USAGE_GROUPS
+	store_lock(mutex, __builtin_return_address(0), a_unlock);
+#endif
+
+	int rc = (*org_pthread_mutex_unlock_h)(mutex);
+
+	STORE_MUTEX_INFO(mutex, a_unlock, 0, rc, get_ts());
+
+	return rc;
+}
+
+static void store_rwlock_info(pthread_rwlock_t *rwlock, lock_action_t la, uint64_t took, const int rc, const uint64_t now, void *const shallow_backtrace)
+{
+	filter_acquire_result(get_context(), rwlock, la, rc);
+
+#ifdef WITH_LIVE_STATS
+	if (live_stats)
+		live_stats_event(rwlock, la, took, rc, now);
+#endif
+
+#ifdef WITH_AGGREGATE
+	if (aggregate) {
+		aggregate_event(rwlock, la, took, rc, now, shallow_backtrace);
+		return;
+	}
+#endif
+
+	if (unlikely(!items)) {
+		show_items_buffer_not_allocated_error();
+		return;
+	}
+
+	tracer_context_t *const ctx = get_context();
+
+	check_triggers(ctx, rwlock, la, took, rc, now);
+
+	if (unlikely(sample_rate > 1 || contended_only) && !sample_take(ctx, rwlock, la, rc))
+		return;
+
+	lock_trace_item_t *const item = claim_item(ctx);
+
+	if (likely(item != nullptr)) {
+#ifdef INTERN_STACKS
+		item->stack_id = get_stack_id(shallow_backtrace);
+#elif defined(WITH_BACKTRACE)
+		get_backtrace(item->caller, shallow_backtrace);
+#endif
+		item->lock = rwlock;
+		item->tid = ctx->tid;
+		item->la = la;
+#ifdef MEASURE_TIMING
+		item->timestamp = now;
+		item->lock_took = took;
+#endif
+#ifdef STORE_THREAD_NAME
+		memcpy(item->thread_name, ctx->thread_name, sizeof item->thread_name);
+#endif
+
+#if __GLIBC_PREREQ(2, 30)
+		item->rwlock_innards.__readers = rwlock->__data.__readers;
+		item->rwlock_innards.__writers = rwlock->__data.__writers;
+#else
+		item->rwlock_innards.__readers = rwlock->__data.__nr_readers;
+#endif
+#if defined(__x86_64__) && __GLIBC_PREREQ(2, 30)
+		item->rwlock_innards.__cur_writer  = rwlock->__data.__cur_writer;
+#else
+		item->rwlock_innards.__cur_writer  = 0;
+#endif
+
+		item->rc = rc;
+
+#ifdef LOCK_REGISTRY
+		item->lock_id = get_lock_id(rwlock, lk_rwlock, 0, item);
+#endif
+
+		commit_item(ctx);
+	}
+	else {
+		show_items_buffer_full_error();
+	}
+}
+
+#if ((defined(PREVENT_RECURSION) || defined(SHALLOW_BACKTRACE) || defined(BACKTRACE_CACHE)) && defined(WITH_BACKTRACE)) || defined(WITH_AGGREGATE)
+#define STORE_RWLOCK_INFO(a, b, c, d, e) store_rwlock_info(a, b, c, d, e, __builtin_return_address(0))
+#else
+#define STORE_RWLOCK_INFO(a, b, c, d, e) store_rwlock_info(a, b, c, d, e, nullptr)
+#endif
+
+int pthread_rwlock_init(pthread_rwlock_t *rwlock, const pthread_rwlockattr_t *attr) throw ()
+{
+	if (unlikely(!org_pthread_rwlock_init_h))
+		org_pthread_rwlock_init_h = (org_pthread_rwlock_init)dlsym(RTLD_NEXT, "pthread_rwlock_init");
+
+	if (UNTRACED(rwlock, fr_init))
+		return (*org_pthread_rwlock_init_h)(rwlock, attr);
+
+	int rc = (*org_pthread_rwlock_init_h)(rwlock, attr);
+	STORE_RWLOCK_INFO(rwlock, a_rw_init, 0, rc, get_ts());
+
+	return rc;
+}
+
+int pthread_rwlock_destroy(pthread_rwlock_t *rwlock) throw ()
+{
+	if (unlikely(!org_pthread_rwlock_destroy_h))
+		org_pthread_rwlock_destroy_h = (org_pthread_rwlock_destroy)dlsym(RTLD_NEXT, "pthread_rwlock_destroy");
+
+	if (UNTRACED(rwlock, fr_destroy))
+		return (*org_pthread_rwlock_destroy_h)(rwlock);
+
+	int rc = (*org_pthread_rwlock_destroy_h)(rwlock);
+	STORE_RWLOCK_INFO(rwlock, a_rw_destroy, 0, rc, get_ts());
+
+	return rc;
+}
+
+int pthread_rwlock_rdlock(pthread_rwlock_t *rwlock) throw ()
+{
+	if (unlikely(!org_pthread_rwlock_rdlock_h))
+		org_pthread_rwlock_rdlock_h = (org_pthread_rwlock_rdlock)dlsym(RTLD_NEXT, "pthread_rwlock_rdlock");
+
+	if (UNTRACED(rwlock, fr_acquire))
+		return (*org_pthread_rwlock_rdlock_h)(rwlock);
+
+	rwlock_sanity_check(rwlock, __builtin_return_address(0));
+
+	if (contended_only) {
+		if (unlikely(!org_pthread_rwlock_tryrdlock_h))
+			org_pthread_rwlock_tryrdlock_h = (org_pthread_rwlock_tryrdlock)dlsym(RTLD_NEXT, "pthread_rwlock_tryrdlock");
+
+		if ((*org_pthread_rwlock_tryrdlock_h)(rwlock) == 0) {
+			count_uncontended(rwlock, 1);
+			return 0;
+		}
+	}
+
+#ifdef WITH_USAGE_GROUPS
+	store_lock(rwlock, __builtin_return_address(0), a_r_lock);
+#endif
+
+	uint64_t start_ts = get_ts();
+	int rc = (*org_pthread_rwlock_rdlock_h)(rwlock);
+	uint64_t end_ts = get_ts();
+
+	if (contended_only)
+		count_contended(rwlock, 1, rc);
+
+	STORE_RWLOCK_INFO(rwlock, a_r_lock, end_ts - start_ts, rc, end_ts);
+
+	return rc;
+}
+
+int pthread_rwlock_tryrdlock(pthread_rwlock_t *rwlock) throw ()
+{
+	if (unlikely(!org_pthread_rwlock_tryrdlock_h))
+		org_pthread_rwlock_tryrdlock_h = (org_pthread_rwlock_tryrdlock)dlsym(RTLD_NEXT, "pthread_rwlock_tryrdlock");
+
+	if (UNTRACED(rwlock, fr_acquire))
+		return (*org_pthread_rwlock_tryrdlock_h)(rwlock);
+
+	cnt_rwlock_try_rdlock++;
+
+	rwlock_sanity_check(rwlock, __builtin_return_address(0));
+
+	int rc = (*org_pthread_rwlock_tryrdlock_h)(rwlock);
+
+#ifdef WITH_USAGE_GROUPS
+	if (rc == 0)
+		store_lock(rwlock, __builtin_return_address(0), a_r_lock);
+#endif
+
+	STORE_RWLOCK_INFO(rwlock, a_r_lock, 0, rc, get_ts());
+
+	return rc;
+}
+
+int pthread_rwlock_timedrdlock(pthread_rwlock_t *rwlock, const struct timespec *abstime) throw ()
+{
+	if (unlikely(!org_pthread_rwlock_timedrdlock_h))
+		org_pthread_rwlock_timedrdlock_h = (org_pthread_rwlock_timedrdlock)dlsym(RTLD_NEXT, "pthread_rwlock_timedrdlock");
+
+	if (UNTRACED(rwlock, fr_acquire))
+		return (*org_pthread_rwlock_timedrdlock_h)(rwlock, abstime);
+
+	cnt_rwlock_try_timedrdlock++;
+
+	rwlock_sanity_check(rwlock, __builtin_return_address(0));
+
+	int64_t timeout = get_timeout(CLOCK_REALTIME, abstime);
+
+	uint64_t start_ts = get_ts();
+	int rc = (*org_pthread_rwlock_timedrdlock_h)(rwlock, abstime);
+	uint64_t end_ts = get_ts();
+
+#ifdef WITH_USAGE_GROUPS
+	if (rc == 0)
+		store_lock(rwlock, __builtin_return_address(0), a_r_lock);
+#endif
+
+	STORE_TIMED_INFO(rwlock, lk_rwlock, 0, a_timed_r_lock, end_ts - start_ts, rc, timeout, CLOCK_REALTIME, end_ts);
+
+	return rc;
+}
+
+#if __GLIBC_PREREQ(2, 30)
+int pthread_rwlock_clockrdlock(pthread_rwlock_t *rwlock, clockid_t clock_id, const struct timespec *abstime) throw ()
+{
+	if (unlikely(!org_pthread_rwlock_clockrdlock_h))
+		org_pthread_rwlock_clockrdlock_h = (org_pthread_rwlock_clockrdlock)dlsym(RTLD_NEXT, "pthread_rwlock_clockrdlock");
+
+	if (UNTRACED(rwlock, fr_acquire))
+		return (*org_pthread_rwlock_clockrdlock_h)(rwlock, clock_id, abstime);
+
+	cnt_rwlock_try_timedrdlock++;
+
+	rwlock_sanity_check(rwlock, __builtin_return_address(0));
+
+	int64_t timeout = get_timeout(clock_id, abstime);
+
+	uint64_t start_ts = get_ts();
+	int rc = (*org_pthread_rwlock_clockrdlock_h)(rwlock, clock_id, abstime);
+	uint64_t end_ts = get_ts();
+
+#ifdef WITH_USAGE_GROUPS
+	if (rc == 0)
+		store_lock(rwlock, __builtin_return_address(0), a_r_lock);
+#endif
+
+	STORE_TIMED_INFO(rwlock, lk_rwlock, 0, a_timed_r_lock, end_ts - start_ts, rc, timeout, clock_id, end_ts);
+
+	return rc;
+}
+#endif
+
+int pthread_rwlock_wrlock(pthread_rwlock_t *rwlock) throw ()
+{
+	if (unlikely(!org_pthread_rwlock_wrlock_h))
+		org_pthread_rwlock_wrlock_h = (org_pthread_rwlock_wrlock)dlsym(RTLD_NEXT, "pthread_rwlock_wrlock");
+
+	if (UNTRACED(rwlock, fr_acquire))
+		return (*org_pthread_rwlock_wrlock_h)(rwlock);
+
+	rwlock_sanity_check(rwlock, __builtin_return_address(0));
+
+	if (contended_only) {
+		if (unlikely(!org_pthread_rwlock_trywrlock_h))
+			org_pthread_rwlock_trywrlock_h = (org_pthread_rwlock_trywrlock)dlsym(RTLD_NEXT, "pthread_rwlock_trywrlock");
+
+		if ((*org_pthread_rwlock_trywrlock_h)(rwlock) == 0) {
+			count_uncontended(rwlock, 2);
+			return 0;
+		}
+	}
+
+#ifdef WITH_USAGE_GROUPS
+	store_lock(rwlock, __builtin_return_address(0), a_w_lock);
+#endif
+
+	uint64_t start_ts = get_ts();
+	int rc = (*org_pthread_rwlock_wrlock_h)(rwlock);
+	uint64_t end_ts = get_ts();
+
+	if (contended_only)
+		count_contended(rwlock, 2, rc);
+
+	STORE_RWLOCK_INFO(rwlock, a_w_lock, end_ts - start_ts, rc, end_ts);
+
+	return rc;
+}
+
+int pthread_rwlock_trywrlock(pthread_rwlock_t *rwlock) throw ()
+{
+	if (unlikely(!org_pthread_rwlock_trywrlock_h))
+		org_pthread_rwlock_trywrlock_h = (org_pthread_rwlock_trywrlock)dlsym(RTLD_NEXT, "pthread_rwlock_trywrlock");
+
+	if (UNTRACED(rwlock, fr_acquire))
+		return (*org_pthread_rwlock_trywrlock_h)(rwlock);
+
+	cnt_rwlock_try_wrlock++;
+
+	rwlock_sanity_check(rwlock, __builtin_return_address(0));
+
+	int rc = (*org_pthread_rwlock_trywrlock_h)(rwlock);
+
+#ifdef WITH_USAGE_GROUPS
+	if (rc == 0)
+		store_lock(rwlock, __builtin_return_address(0), a_w_lock);
+#endif
+
+	STORE_RWLOCK_INFO(rwlock, a_w_lock, 0, rc, get_ts());
+
+	return rc;
+}
+
+int pthread_rwlock_timedwrlock(pthread_rwlock_t *rwlock, const struct timespec *abstime) throw ()
+{
+	if (unlikely(!org_pthread_rwlock_timedwrlock_h))
+		org_pthread_rwlock_timedwrlock_h = (org_pthread_rwlock_timedwrlock)dlsym(RTLD_NEXT, "pthread_rwlock_timedwrlock");
+
+	if (UNTRACED(rwlock, fr_acquire))
+		return (*org_pthread_rwlock_timedwrlock_h)(rwlock, abstime);
+
+	cnt_rwlock_try_timedwrlock++;
+
+	rwlock_sanity_check(rwlock, __builtin_return_address(0));
+
+	int64_t timeout = get_timeout(CLOCK_REALTIME, abstime);
+
+	uint64_t start_ts = get_ts();
+	int rc = (*org_pthread_rwlock_timedwrlock_h)(rwlock, abstime);
+	uint64_t end_ts = get_ts();
+
+#ifdef WITH_USAGE_GROUPS
+	if (rc == 0)
+		store_lock(rwlock, __builtin_return_address(0), a_w_lock);
+#endif
+
+	STORE_TIMED_INFO(rwlock, lk_rwlock, 0, a_timed_w_lock, end_ts - start_ts, rc, timeout, CLOCK_REALTIME, end_ts);
+
+	return rc;
+}
+
+#if __GLIBC_PREREQ(2, 30)
+int pthread_rwlock_clockwrlock(pthread_rwlock_t *rwlock, clockid_t clock_id, const struct timespec *abstime) throw ()
+{
+	if (unlikely(!org_pthread_rwlock_clockwrlock_h))
+		org_pthread_rwlock_clockwrlock_h = (org_pthread_rwlock_clockwrlock)dlsym(RTLD_NEXT, "pthread_rwlock_clockwrlock");
+
+	if (UNTRACED(rwlock, fr_acquire))
+		return (*org_pthread_rwlock_clockwrlock_h)(rwlock, clock_id, abstime);
+
+	cnt_rwlock_try_timedwrlock++;
+
+	rwlock_sanity_check(rwlock, __builtin_return_address(0));
+
+	int64_t timeout = get_timeout(clock_id, abstime);
+
+	uint64_t start_ts = get_ts();
+	int rc = (*org_pthread_rwlock_clockwrlock_h)(rwlock, clock_id, abstime);
+	uint64_t end_ts = get_ts();
+
+#ifdef WITH_USAGE_GROUPS
+	if (rc == 0)
+		store_lock(rwlock, __builtin_return_address(0), a_w_lock);
+#endif
+
+	STORE_TIMED_INFO(rwlock, lk_rwlock, 0, a_timed_w_lock, end_ts - start_ts, rc, timeout, clock_id, end_ts);
+
+	return rc;
+}
+#endif
+
+int pthread_rwlock_unlock(pthread_rwlock_t *rwlock) throw ()
+{
+	if (unlikely(!org_pthread_rwlock_unlock_h))
+		org_pthread_rwlock_unlock_h = (org_pthread_rwlock_unlock)dlsym(RTLD_NEXT, "pthread_rwlock_unlock");
+
+	if (UNTRACED(rwlock, fr_release))
+		return (*org_pthread_rwlock_unlock_h)(rwlock);
+
+	rwlock_sanity_check(rwlock, __builtin_return_address(0));
+
+#ifdef WITH_USAGE_GROUPS
+	store_lock(rwlock, __builtin_return_address(0), a_rw_unlock);
+#endif
+
+	int rc = (*org_pthread_rwlock_unlock_h)(rwlock);
+
+	STORE_RWLOCK_INFO(rwlock, a_rw_unlock, 0, rc, get_ts());
+
+	return rc;
+}
+
+// The mutex is given for a_cond_wait/a_cond_woken, for a signal or
+// broadcast the record is about the condition variable itself. Acquire
+// durations are not used for the relock: that is part of the wait.
+static void store_cond_info(pthread_cond_t *const cond, pthread_mutex_t *const mutex, const lock_action_t la, const uint64_t took, const int rc, const int wait_rc, const uint64_t now, void *const shallow_backtrace)
+{
+	filter_acquire_result(get_context(), mutex, la, rc);
+
+	void *const lock = mutex ? (void *)mutex : (void *)cond;
+
+#ifdef WITH_LIVE_STATS
+	if (live_stats && mutex)
+		live_stats_event(mutex, la, 0, rc, now);
+#endif
+
+#ifdef WITH_AGGREGATE
+	if (aggregate) {
+		if (mutex)
+			aggregate_event(mutex, la, 0, rc, now, shallow_backtrace);
+
+		return;
+	}
+#endif
+
+	if (unlikely(!items)) {
+		show_items_buffer_not_allocated_error();
+		return;
+	}
+
+	tracer_context_t *const ctx = get_context();
+
+	check_triggers(ctx, lock, la, 0, rc, now);
+
+	if (unlikely(sample_rate > 1 || contended_only) && !sample_take(ctx, lock, la, rc))
+		return;
+
+	lock_trace_item_t *const item = claim_item(ctx);
+
+	if (likely(item != nullptr)) {
+#ifdef INTERN_STACKS
+		item->stack_id = get_stack_id(shallow_backtrace);
+#elif defined(WITH_BACKTRACE)
+		get_backtrace(item->caller, shallow_backtrace);
+#endif
+		item->lock = lock;
+		item->tid = ctx->tid;
+		item->la = la;
+#ifdef MEASURE_TIMING
+		item->timestamp = now;
+		item->lock_took = took;
+#endif
+
+#ifdef STORE_THREAD_NAME
+		memcpy(item->thread_name, ctx->thread_name, sizeof item->thread_name);
+#endif
+
+		if (mutex) {
+			item->cond_innards.cond_lo = uint32_t(uintptr_t(cond));
+			item->cond_innards.cond_hi = uint32_t(uint64_t(uintptr_t(cond)) >> 32);
+			item->cond_innards.wait_rc = wait_rc;
+		}
+		else {
+			item->cond_innards = { 0, 0, 0 };
+		}
+
+		item->rc = rc;
+
+#ifdef LOCK_REGISTRY
+		if (mutex)
+			item->lock_id = get_lock_id(mutex, lk_mutex, mutex->__data.__kind, item);
+		else
+			item->lock_id = get_lock_id(cond, lk_cond, 0, item);
+#endif
+
+		commit_item(ctx);
+	}
+	else {
+		show_items_buffer_full_error();
+	}
+}
+
+#if ((defined(PREVENT_RECURSION) || defined(SHALLOW_BACKTRACE) || defined(BACKTRACE_CACHE)) && defined(WITH_BACKTRACE)) || defined(WITH_AGGREGATE)
+#define STORE_COND_INFO(a, b, c, d, e, f, g) store_cond_info(a, b, c, d, e, f, g, __builtin_return_address(0))
+#else
+#define STORE_COND_INFO(a, b, c, d, e, f, g) store_cond_info(a, b, c, d, e, f, g, nullptr)
+#endif
+
+// After a wait the mutex is locked again, also when it timed out. Only
+// when the wait was not possible at all (e.g. the mutex was not locked
+// by this thread) it didn't unlock it in the first place.
+#define COND_RELOCK_RC(rc) ((rc) == EPERM || (rc) == EINVAL ? (rc) : 0)
+
+// dlsym() can return the version from before glibc 2.3.2 which has a
+// different pthread_cond_t
+static void *get_cond_function(const char *const name)
+{
+	void *f = dlvsym(RTLD_NEXT, name, "GLIBC_2.3.2");
+
+	return f ? f : dlsym(RTLD_NEXT, name);
+}
+
+int pthread_cond_wait(pthread_cond_t *cond, pthread_mutex_t *mutex)
+{
+	if (unlikely(!org_pthread_cond_wait_h))
+		org_pthread_cond_wait_h = (org_pthread_cond_wait)get_cond_function("pthread_cond_wait");
+
+	if (UNTRACED(mutex, fr_cond_wait))
+		return (*org_pthread_cond_wait_h)(cond, mutex);
+
+#ifdef WITH_USAGE_GROUPS
+	store_lock(mutex, __builtin_return_address(0), a_cond_wait);
+#endif
+
+	uint64_t start_ts = get_ts();
+	STORE_COND_INFO(cond, mutex, a_cond_wait, 0, 0, 0, start_ts);
+
+	int rc = (*org_pthread_cond_wait_h)(cond, mutex);
+	uint64_t end_ts = get_ts();
+
+	STORE_COND_INFO(cond, mutex, a_cond_woken, end_ts - start_ts, COND_RELOCK_RC(rc), rc, end_ts);
+
+#ifdef WITH_USAGE_GROUPS
+	store_lock(mutex, __builtin_return_address(0), a_cond_woken);
+#endif
+
+	return rc;
+}
+
+int pthread_cond_timedwait(pthread_cond_t *cond, pthread_mutex_t *mutex, const struct timespec *abstime)
+{
+	if (unlikely(!org_pthread_cond_timedwait_h))
+		org_pthread_cond_timedwait_h = (org_pthread_cond_timedwait)get_cond_function("pthread_cond_timedwait");
+
+	if (UNTRACED(mutex, fr_cond_wait))
+		return (*org_pthread_cond_timedwait_h)(cond, mutex, abstime);
+
+#ifdef WITH_USAGE_GROUPS
+	store_lock(mutex, __builtin_return_address(0), a_cond_wait);
+#endif
+
+	uint64_t start_ts = get_ts();
+	STORE_COND_INFO(cond, mutex, a_cond_wait, 0, 0, 0, start_ts);
+
+	int rc = (*org_pthread_cond_timedwait_h)(cond, mutex, abstime);
+	uint64_t end_ts = get_ts();
+
+	STORE_COND_INFO(cond, mutex, a_cond_woken, end_ts - start_ts, COND_RELOCK_RC(rc), rc, end_ts);
+
+#ifdef WITH_USAGE_GROUPS
+	store_lock(mutex, __builtin_return_address(0), a_cond_woken);
+#endif
+
+	return rc;
+}
+
+#if __GLIBC_PREREQ(2, 30)
+// std::condition_variable::wait_for/wait_until with steady_clock
+int pthread_cond_clockwait(pthread_cond_t *cond, pthread_mutex_t *mutex, clockid_t clock_id, const struct timespec *abstime)
+{
+	if (unlikely(!org_pthread_cond_clockwait_h))
+		org_pthread_cond_clockwait_h = (org_pthread_cond_clockwait)dlsym(RTLD_NEXT, "pthread_cond_clockwait");
+
+	if (UNTRACED(mutex, fr_cond_wait))
+		return (*org_pthread_cond_clockwait_h)(cond, mutex, clock_id, abstime);
+
+#ifdef WITH_USAGE_GROUPS
+	store_lock(mutex, __builtin_return_address(0), a_cond_wait);
+#endif
+
+	uint64_t start_ts = get_ts();
+	STORE_COND_INFO(cond, mutex, a_cond_wait, 0, 0, 0, start_ts);
+
+	int rc = (*org_pthread_cond_clockwait_h)(cond, mutex, clock_id, abstime);
+	uint64_t end_ts = get_ts();
+
+	STORE_COND_INFO(cond, mutex, a_cond_woken, end_ts - start_ts, COND_RELOCK_RC(rc), rc, end_ts);
+
+#ifdef WITH_USAGE_GROUPS
+	store_lock(mutex, __builtin_return_address(0), a_cond_woken);
+#endif
+
+	return rc;
+}
+#endif
+
+int pthread_cond_signal(pthread_cond_t *cond) throw ()
+{
+	if (unlikely(!org_pthread_cond_signal_h))
+		org_pthread_cond_signal_h = (org_pthread_cond_signal)get_cond_function("pthread_cond_signal");
+
+	if (UNTRACED(cond, fr_other))
+		return (*org_pthread_cond_signal_h)(cond);
+
+	// before: the woken thread may already run before this returns
+	uint64_t ts = get_ts();
+	int rc = (*org_pthread_cond_signal_h)(cond);
+	STORE_COND_INFO(cond, nullptr, a_cond_signal, 0, rc, 0, ts);
+
+	return rc;
+}
+
+int pthread_cond_broadcast(pthread_cond_t *cond) throw ()
+{
+	if (unlikely(!org_pthread_cond_broadcast_h))
+		org_pthread_cond_broadcast_h = (org_pthread_cond_broadcast)get_cond_function("pthread_cond_broadcast");
+
+	if (UNTRACED(cond, fr_other))
+		return (*org_pthread_cond_broadcast_h)(cond);
+
+	uint64_t ts = get_ts();
+	int rc = (*org_pthread_cond_broadcast_h)(cond);
+	STORE_COND_INFO(cond, nullptr, a_cond_broadcast, 0, rc, 0, ts);
+
+	return rc;
+}
+
+// Spinlocks, semaphores and barriers: there are no innards worth
+// storing. For a semaphore 'rc' is the errno of a failed call.
+static void store_sync_info(void *const lock, const lock_kind_t kind, const lock_action_t la, const uint64_t took, const int rc, const uint64_t now, void *const shallow_backtrace)
+{
+	filter_acquire_result(get_context(), lock, la, rc);
+
+#ifdef WITH_LIVE_STATS
+	if (live_stats)
+		live_stats_event(lock, la, took, rc, now);
+#endif
+
+#ifdef WITH_AGGREGATE
+	if (aggregate) {
+		aggregate_event(lock, la, took, rc, now, shallow_backtrace);
+		return;
+	}
+#endif
+
+	if (unlikely(!items)) {
+		show_items_buffer_not_allocated_error();
+		return;
+	}
+
+	tracer_context_t *const ctx = get_context();
+
+	// waiting for the others is what a barrier is for
+	check_triggers(ctx, lock, la, la == a_barrier_wait ? 0 : took, rc, now);
+
+	if (unlikely(sample_rate > 1 || contended_only) && !sample_take(ctx, lock, la, rc))
+		return;
+
+	lock_trace_item_t *const item = claim_item(ctx);
+
+	if (likely(item != nullptr)) {
+#ifdef INTERN_STACKS
+		item->stack_id = get_stack_id(shallow_backtrace);
+#elif defined(WITH_BACKTRACE)
+		get_backtrace(item->caller, shallow_backtrace);
+#endif
+		item->lock = lock;
+		item->tid = ctx->tid;
+		item->la = la;
+#ifdef MEASURE_TIMING
+		item->timestamp = now;
+		item->lock_took = took;
+#endif
+
+#ifdef STORE_THREAD_NAME
+		memcpy(item->thread_name, ctx->thread_name, sizeof item->thread_name);
+#endif
+
+		item->mutex_innards = { 0, 0, 0 };
+
+		item->rc = rc;
+
+#ifdef LOCK_REGISTRY
+		item->lock_id = get_lock_id(lock, kind, 0, item);
+#endif
+
+		commit_item(ctx);
+	}
+	else {
+		show_items_buffer_full_error();
+	}
+}
+
+#if ((defined(PREVENT_RECURSION) || defined(SHALLOW_BACKTRACE) || defined(BACKTRACE_CACHE)) && defined(WITH_BACKTRACE)) || defined(WITH_AGGREGATE)
+#define STORE_SYNC_INFO(a, b, c, d, e, f) store_sync_info(a, b, c, d, e, f, __builtin_return_address(0))
+#else
+#define STORE_SYNC_INFO(a, b, c, d, e, f) store_sync_info(a, b, c, d, e, f, nullptr)
+#endif
+
+// lock_took is the time spent spinning
+int pthread_spin_lock(pthread_spinlock_t *lock) throw ()
+{
+	if (unlikely(!org_pthread_spin_lock_h))
+		org_pthread_spin_lock_h = (org_pthread_spin_lock)dlsym(RTLD_NEXT, "pthread_spin_lock");
+
+	if (UNTRACED((void *)lock, fr_acquire))
+		return (*org_pthread_spin_lock_h)(lock);
+
+#ifdef WITH_USAGE_GROUPS
+	store_lock((void *)lock, __builtin_return_address(0), a_spin_lock);
+#endif
+
+	uint64_t start_ts = get_ts();
+	int rc = (*org_pthread_spin_lock_h)(lock);
+	uint64_t end_ts = get_ts();
+
+	STORE_SYNC_INFO((void *)lock, lk_spin, a_spin_lock, end_ts - start_ts, rc, end_ts);
+
+	return rc;
+}
+
+int pthread_spin_trylock(pthread_spinlock_t *lock) throw ()
+{
+	if (unlikely(!org_pthread_spin_trylock_h))
+		org_pthread_spin_trylock_h = (org_pthread_spin_trylock)dlsym(RTLD_NEXT, "pthread_spin_trylock");
+
+	if (UNTRACED((void *)lock, fr_acquire))
+		return (*org_pthread_spin_trylock_h)(lock);
+
+	int rc = (*org_pthread_spin_trylock_h)(lock);
+
+#ifdef WITH_USAGE_GROUPS
+	if (rc == 0)
+		store_lock((void *)lock, __builtin_return_address(0), a_spin_lock);
+#endif
+
+	STORE_SYNC_INFO((void *)lock, lk_spin, a_spin_lock, 0, rc, get_ts());
+
+	return rc;
+}
+
+int pthread_spin_unlock(pthread_spinlock_t *lock) throw ()
+{
+	if (unlikely(!org_pthread_spin_unlock_h))
+		org_pthread_spin_unlock_h = (org_pthread_spin_unlock)dlsym(RTLD_NEXT, "pthread_spin_unlock");
+
+	if (UNTRACED((void *)lock, fr_release))
+		return (*org_pthread_spin_unlock_h)(lock);
+
+#ifdef WITH_USAGE_GROUPS
+	store_lock((void *)lock, __builtin_return_address(0), a_spin_unlock);
+#endif
+
+	int rc = (*org_pthread_spin_unlock_h)(lock);
+
+	STORE_SYNC_INFO((void *)lock, lk_spin, a_spin_unlock, 0, rc, get_ts());
+
+	return rc;
+}
+
+int sem_wait(sem_t *sem)
+{
+	if (unlikely(!org_sem_wait_h))
+		org_sem_wait_h = (org_sem_wait)dlsym(RTLD_NEXT, "sem_wait");
+
+	if (UNTRACED(sem, fr_other))
+		return (*org_sem_wait_h)(sem);
+
+	uint64_t start_ts = get_ts();
+	int rc = (*org_sem_wait_h)(sem);
+	uint64_t end_ts = get_ts();
+
+	// the caller looks at errno
+	int err = errno;
+	STORE_SYNC_INFO(sem, lk_sem, a_sem_wait, end_ts - start_ts, rc == -1 ? err : 0, end_ts);
+	errno = err;
+
+	return rc;
+}
+
+int sem_trywait(sem_t *sem) throw ()
+{
+	if (unlikely(!org_sem_trywait_h))
+		org_sem_trywait_h = (org_sem_trywait)dlsym(RTLD_NEXT, "sem_trywait");
+
+	if (UNTRACED(sem, fr_other))
+		return (*org_sem_trywait_h)(sem);
+
+	int rc = (*org_sem_trywait_h)(sem);
+
+	int err = errno;
+	STORE_SYNC_INFO(sem, lk_sem, a_sem_wait, 0, rc == -1 ? err : 0, get_ts());
+	errno = err;
+
+	return rc;
+}
+
+int sem_timedwait(sem_t *sem, const struct timespec *abstime)
+{
+	if (unlikely(!org_sem_timedwait_h))
+		org_sem_timedwait_h = (org_sem_timedwait)dlsym(RTLD_NEXT, "sem_timedwait");
+
+	if (UNTRACED(sem, fr_other))
+		return (*org_sem_timedwait_h)(sem, abstime);
+
+	uint64_t start_ts = get_ts();
+	int rc = (*org_sem_timedwait_h)(sem, abstime);
+	uint64_t end_ts = get_ts();
+
+	int err = errno;
+	STORE_SYNC_INFO(sem, lk_sem, a_sem_wait, end_ts - start_ts, rc == -1 ? err : 0, end_ts);
+	errno = err;
+
+	return rc;
+}
+
+#if __GLIBC_PREREQ(2, 30)
+int sem_clockwait(sem_t *sem, clockid_t clock_id, const struct timespec *abstime)
+{
+	if (unlikely(!org_sem_clockwait_h))
+		org_sem_clockwait_h = (org_sem_clockwait)dlsym(RTLD_NEXT, "sem_clockwait");
+
+	if (UNTRACED(sem, fr_other))
+		return (*org_sem_clockwait_h)(sem, clock_id, abstime);
+
+	uint64_t start_ts = get_ts();
+	int rc = (*org_sem_clockwait_h)(sem, clock_id, abstime);
+	uint64_t end_ts = get_ts();
+
+	int err = errno;
+	STORE_SYNC_INFO(sem, lk_sem, a_sem_wait, end_ts - start_ts, rc == -1 ? err : 0, end_ts);
+	errno = err;
+
+	return rc;
+}
+#endif
+
+int sem_post(sem_t *sem) throw ()
+{
+	if (unlikely(!org_sem_post_h))
+		org_sem_post_h = (org_sem_post)dlsym(RTLD_NEXT, "sem_post");
+
+	if (UNTRACED(sem, fr_other))
+		return (*org_sem_post_h)(sem);
+
+	// before: the woken thread may already run before this returns
+	uint64_t ts = get_ts();
+	int rc = (*org_sem_post_h)(sem);
+
+	int err = errno;
+	STORE_SYNC_INFO(sem, lk_sem, a_sem_post, 0, rc == -1 ? err : 0, ts);
+	errno = err;
+
+	return rc;
+}
+
+// lock_took is the time waiting for the other threads
+int pthread_barrier_wait(pthread_barrier_t *barrier) throw ()
+{
+	if (unlikely(!org_pthread_barrier_wait_h))
+		org_pthread_barrier_wait_h = (org_pthread_barrier_wait)dlsym(RTLD_NEXT, "pthread_barrier_wait");
+
+	if (UNTRACED(barrier, fr_other))
+		return (*org_pthread_barrier_wait_h)(barrier);
+
+	uint64_t start_ts = get_ts();
+	int rc = (*org_pthread_barrier_wait_h)(barrier);
+	uint64_t end_ts = get_ts();
+
+	// one of the threads gets PTHREAD_BARRIER_SERIAL_THREAD: not an error
+	STORE_SYNC_INFO(barrier, lk_barrier, a_barrier_wait, end_ts - start_ts, rc == PTHREAD_BARRIER_SERIAL_THREAD ? 0 : rc, end_ts);
+
+	return rc;
+}
+
+int pthread_setname_np(pthread_t thread, const char *name) throw ()
+{
+#ifdef STORE_THREAD_NAME
+	if (likely(name != nullptr)) {
+		bool self = pthread_equal(thread, pthread_self());
+
+		if (self)
+			set_context_thread_name(name);
+
+		check_tid_names_lock_functions();
+
+		if (tid_names && (*org_pthread_rwlock_wrlock_h)(&tid_names_lock) == 0) {
+			(*tid_names)[thread] = name;
+
+			(*org_pthread_rwlock_unlock_h)(&tid_names_lock);
+		}
+
+		// let the named thread pick it up
+		if (!self)
+			tid_names_generation++;
+	}
+#endif
+
+	if (unlikely(!org_pthread_setname_np_h))
+		org_pthread_setname_np_h = (org_pthread_setname_np)dlsym(RTLD_NEXT, "pthread_setname_np");
+
+	return (*org_pthread_setname_np_h)(thread, name);
+}
+
+static void emit_key_value(json_t *const tgt, const char *key, const char *value)
+{
+	json_object_set(tgt, key, json_string(value));
+}
+
+static void emit_key_value(json_t *const tgt, const char *key, const uint64_t value)
+{
+	json_object_set(tgt, key, json_integer(value));
+}
+
+static void emit_layout(json_t *const tgt, const char *const key, const size_t record_size, const trace_field_t *const fields, const size_t n_fields)
+{
+	json_t *layout = json_object();
+
+	json_object_set_new(layout, "record_size", json_integer(record_size));
+
+	json_t *list = json_object();
+
+	for(size_t i=0; i<n_fields; i++) {
+		json_t *field = json_array();
+
+		json_array_append_new(field, json_integer(fields[i].offset));
+		json_array_append_new(field, json_integer(fields[i].size));
+
+		json_object_set_new(list, fields[i].name, field);
+	}
+
+	json_object_set_new(layout, "fields", list);
+
+	json_object_set_new(tgt, key, layout);
+}
+
+// the per-thread counters are summed per lock
+static void emit_uncontended(json_t *const tgt)
+{
+	// not busy, busy, failed; each for mutex, read, write
+	std::map<const void *, std::array<uint64_t, 9> > totals;
+	uint64_t n_overflow = uncontended_no_table;
+
+	uint32_t n_tables = std::min(n_uncontended_tables.load(), max_uncontended_tables);
+
+	for(uint32_t t=0; t<n_tables; t++) {
+		const uncontended_table_t *const table = &uncontended_tables[t];
+
+		for(int i=0; i<UNCONTENDED_TABLE_SIZE; i++) {
+			const uncontended_entry_t *const e = &table->entries[i];
+
+			if (e->lock == nullptr)
+				continue;
+
+			auto & total = totals[e->lock];
+
+			for(int k=0; k<3; k++) {
+				total[k]     += e->n[k];
+				total[k + 3] += e->n_busy[k];
+				total[k + 6] += e->n_failed[k];
+			}
+		}
+
+		n_overflow += table->n_overflow;
+	}
+
+	json_t *list = json_array();
+
+	for(auto & entry : totals) {
+		json_t *js = json_object();
+
+		json_object_set_new(js, "lock", json_integer(intptr_t(entry.first)));
+		json_object_set_new(js, "n_mutex", json_integer(entry.second[0]));
+		json_object_set_new(js, "n_read", json_integer(entry.second[1]));
+		json_object_set_new(js, "n_write", json_integer(entry.second[2]));
+		json_object_set_new(js, "n_mutex_busy", json_integer(entry.second[3]));
+		json_object_set_new(js, "n_read_busy", json_integer(entry.second[4]));
+		json_object_set_new(js, "n_write_busy", json_integer(entry.second[5]));
+		json_object_set_new(js, "n_mutex_failed", json_integer(entry.second[6]));
+		json_object_set_new(js, "n_read_failed", json_integer(entry.second[7]));
+		json_object_set_new(js, "n_write_failed", json_integer(entry.second[8]));
+
+		json_array_append_new(list, js);
+	}
+
+	json_object_set_new(tgt, "uncontended", list);
+
+	emit_key_value(tgt, "uncontended_not_counted", n_overflow);
+}
+
+#ifdef WITH_AGGREGATE
+static json_t *emit_histogram(const histogram_t *const h)
+{
+	json_t *js = json_object();
+
+	json_object_set_new(js, "n", json_integer(h->n.load()));
+	json_object_set_new(js, "sum", json_integer(h->sum.load()));
+	json_object_set_new(js, "max", json_integer(h->max.load()));
+
+	// only the buckets that are in use: [smallest value, count]
+	json_t *buckets = json_array();
+
+	for(uint32_t b=0; b<HIST_N_BUCKETS; b++) {
+		uint64_t n = h->buckets[b].load(std::memory_order_relaxed);
+		if (n == 0)
+			continue;
+
+		json_t *pair = json_array();
+		json_array_append_new(pair, json_integer(hist_bucket_value(b)));
+		json_array_append_new(pair, json_integer(n));
+
+		json_array_append_new(buckets, pair);
+	}
+
+	json_object_set_new(js, "buckets", buckets);
+
+	return js;
+}
+
+static void emit_aggregate(json_t *const tgt)
+{
+	json_t *list = json_array();
+
+	for(uint32_t i=0; i<aggregate_size; i++) {
+		const aggregate_entry_t *const e = &aggregate_table[i];
+
+		if (!e->ready)
+			continue;
+
+		json_t *js = json_object();
+
+		json_object_set_new(js, "lock", json_integer(intptr_t(e->lock)));
+		json_object_set_new(js, "caller", json_integer(intptr_t(e->caller)));
+		json_object_set_new(js, "la", json_integer(e->la));
+		json_object_set_new(js, "n_errors", json_integer(e->n_errors.load()));
+		json_object_set_new(js, "n_timeouts", json_integer(e->n_timeouts.load()));
+		json_object_set_new(js, "took", emit_histogram(&e->took));
+		json_object_set_new(js, "hold", emit_histogram(&e->hold));
+
+		json_array_append_new(list, js);
+	}
+
+	json_t *obj = json_object();
+
+	json_object_set_new(obj, "entries", list);
+
+	emit_key_value(obj, "max_entries", aggregate_size);
+	emit_key_value(obj, "full", aggregate_full.load());
+	emit_key_value(obj, "hold_untracked", aggregate_hold_untracked.load());
+	emit_key_value(obj, "histogram_sub_bits", HIST_SUB_BITS);
+
+	json_object_set_new(tgt, "aggregate", obj);
+}
+#endif
+
+// meta data for both the final dump and the snapshots
+static json_t *module_to_json(const module_info_t *const m)
+{
+	json_t *js = json_object();
+
+	json_object_set_new(js, "name", json_string(m->name));
+	json_object_set_new(js, "base", json_integer(intptr_t(m->base)));
+	json_object_set_new(js, "lo", json_integer(intptr_t(m->lo)));
+	json_object_set_new(js, "hi", json_integer(intptr_t(m->hi)));
+	json_object_set_new(js, "build_id", json_string(m->build_id));
+
+	return js;
+}
+
+static int emit_module(struct dl_phdr_info *info, size_t size, void *data)
+{
+	json_t *const list = (json_t *)data;
+
+	module_info_t m;
+	describe_module(info, &m);
+
+	if (m.lo >= m.hi)
+		return 0;
+
+	// the program itself has no name here
+	char exe_name[PATH_MAX] = { 0 };
+	if (m.name[0] == 0x00 && readlink("/proc/self/exe", exe_name, sizeof(exe_name) - 1) != -1)
+		m.name = exe_name;
+
+	json_array_append_new(list, module_to_json(&m));
+
+	return 0;
+}
+
+static void emit_modules(json_t *const tgt)
+{
+	// modules that were unloaded since the last check become events
+	refresh_modules(false);
+
+	json_t *list = json_array();
+	dl_iterate_phdr(emit_module, list);
+	json_object_set_new(tgt, "modules", list);
+
+	// also the ones that were unloaded in the meantime
+	json_t *events = json_array();
+	uint32_t n = std::min(n_dl_events.load(), uint32_t(MAX_DL_EVENTS));
+
+	for(uint32_t i=0; i<n; i++) {
+		const dl_event_t *const e = &dl_events[i];
+
+		if (e->ready.load(std::memory_order_acquire) == false)
+			continue;
+
+		json_t *js = module_to_json(&e->module);
+		json_object_set_new(js, "event", json_string(e->open ? "dlopen" : "dlclose"));
+		json_object_set_new(js, "ts", json_integer(e->ts));
+		json_array_append_new(events, js);
+	}
+
+	json_object_set_new(tgt, "dl_events", events);
+	emit_key_value(tgt, "dl_events_dropped", n_dl_events.load() - n);
+
+	std::string maps;
+	FILE *fh = fopen("/proc/self/maps", "r");
+	if (fh) {
+		char buffer[4096];
+		size_t n_read = 0;
+
+		while((n_read = fread(buffer, 1, sizeof buffer, fh)) > 0)
+			maps.append(buffer, n_read);
+
+		fclose(fh);
+	}
+
+	emit_key_value(tgt, "maps", maps.c_str());
+}
+
+static void emit_filters(json_t *const tgt)
+{
+	json_t *obj = json_object();
+
+	json_t *ranges = json_array();
+	for(auto & range : filter->addr) {
+		json_t *pair = json_array();
+		json_array_append_new(pair, json_integer(intptr_t(range.first)));
+		json_array_append_new(pair, json_integer(intptr_t(range.second)));
+
+		json_array_append_new(ranges, pair);
+	}
+	json_object_set_new(obj, "addr", ranges);
+
+	json_t *caller = json_array();
+	for(auto & f : filter->caller)
+		json_array_append_new(caller, json_string(f.c_str()));
+	json_object_set_new(obj, "caller", caller);
+
+	json_t *init = json_array();
+	for(auto & f : filter->init)
+		json_array_append_new(init, json_string(f.c_str()));
+	json_object_set_new(obj, "init", init);
+
+	emit_key_value(obj, "name", filter->name.c_str());
+
+	emit_key_value(obj, "locks_traced", filter_locks_traced.load());
+	emit_key_value(obj, "locks_skipped", filter_locks_skipped.load());
+	emit_key_value(obj, "slots_full", filter_slots_full.load());
+	emit_key_value(obj, "held_full", filter_held_full.load());
+
+	json_object_set_new(tgt, "filter", obj);
+}
+
+static void emit_process_meta_data(json_t *const obj, const uint64_t end_ts)
+{
+	char hostname[HOST_NAME_MAX + 1];
+	gethostname(hostname, sizeof hostname);
+
+	emit_key_value(obj, "pthread_mutex_lock", (intptr_t)pthread_mutex_lock);
+	emit_key_value(obj, "pthread_rwlock_rdlock", (intptr_t)pthread_rwlock_rdlock);
+	emit_key_value(obj, "pthread_rwlock_wrlock", (intptr_t)pthread_rwlock_wrlock);
+
+	emit_key_value(obj, "hostname", hostname);
+
+	emit_key_value(obj, "start_ts", global_start_ts);
+
+	emit_key_value(obj, "end_ts", end_ts);
+
+#if defined(USE_TSC) && defined(MEASURE_TIMING)
+	// record timestamps are TSC ticks: ns = start_ns + (ticks - start_ticks) * ns-per-tick
+	if (tsc_usable) {
+		unsigned int aux = 0;
+		json_t *tsc = json_object();
+
+		emit_key_value(tsc, "start_ticks", tsc_start_ticks);
+		emit_key_value(tsc, "start_mono_ns", tsc_start_mono);
+		emit_key_value(tsc, "start_ns", tsc_start_ns);
+		emit_key_value(tsc, "end_ticks", __rdtscp(&aux));
+		emit_key_value(tsc, "end_mono_ns", get_mono_ns());
+
+		json_object_set_new(obj, "tsc", tsc);
+	}
+#endif
+
+	emit_key_value(obj, "parent_pid", parent_pid);
+
+	if (fork_ts)
+		emit_key_value(obj, "fork_ts", fork_ts);
+
+	json_t *children_list = json_array();
+	for(uint32_t i=0; i<std::min(n_children.load(), uint32_t(MAX_CHILDREN)); i++)
+		json_array_append_new(children_list, json_integer(children[i]));
+	json_object_set_new(obj, "children", children_list);
+
+	if (n_children > MAX_CHILDREN)
+		emit_key_value(obj, "children_dropped", n_children - MAX_CHILDREN);
+
+	emit_key_value(obj, "n_procs", get_nprocs());
+
+	pid_t pid = getpid();
+	emit_key_value(obj, "pid", pid);
+
+	int s = sched_getscheduler(pid);
+	if (s == SCHED_OTHER)
+		emit_key_value(obj, "scheduler", "sched-other");
+	else if (s == SCHED_BATCH)
+		emit_key_value(obj, "scheduler", "sched-batch");
+	else if (s == SCHED_IDLE)
+		emit_key_value(obj, "scheduler", "sched-idle");
+	else if (s == SCHED_FIFO)
+		emit_key_value(obj, "scheduler", "sched-fifo");
+	else if (s == SCHED_RR)
+		emit_key_value(obj, "scheduler", "sched-rr");
+	else
+		emit_key_value(obj, "scheduler", "unknown");
+
+	emit_key_value(obj, "mutex_type_normal", PTHREAD_MUTEX_NORMAL);
+	emit_key_value(obj, "mutex_type_recursive", PTHREAD_MUTEX_RECURSIVE);
+	emit_key_value(obj, "mutex_type_errorcheck", PTHREAD_MUTEX_ERRORCHECK);
+	emit_key_value(obj, "mutex_type_adaptive", PTHREAD_MUTEX_ADAPTIVE_NP);
+
+	char exe_name[PATH_MAX] = { 0 };
+	if (readlink("/proc/self/exe", exe_name, sizeof(exe_name) - 1) == -1) {
+		color("\033[0;31m");
+		fprintf(stderr, "readlink(/proc/self/exe) failed: %s\n", strerror(errno));
+		color("\033[0m");
+	}
+
+	emit_key_value(obj, "exe_name", exe_name);
+
+	emit_modules(obj);
+
+	emit_key_value(obj, "cnt_mutex_trylock", cnt_mutex_trylock);
+	emit_key_value(obj, "cnt_rwlock_try_rdlock", cnt_rwlock_try_rdlock);
+	emit_key_value(obj, "cnt_mutex_timedlock", cnt_mutex_timedlock);
+	emit_key_value(obj, "cnt_rwlock_try_timedrdlock", cnt_rwlock_try_timedrdlock);
+	emit_key_value(obj, "cnt_rwlock_try_wrlock", cnt_rwlock_try_wrlock);
+	emit_key_value(obj, "cnt_rwlock_try_timedwrlock", cnt_rwlock_try_timedwrlock);
+
+	emit_key_value(obj, "n_records_max", n_records);
+
+#ifdef PER_THREAD_BUFFERS
+	emit_key_value(obj, "segment_records", segment_records);
+
+	if (numa) {
+		json_t *regions = json_array();
+
+		for(int i=0; i<items_buffer.n_regions; i++) {
+			json_t *region = json_object();
+
+			emit_key_value(region, "node", items_buffer.regions[i].node);
+			emit_key_value(region, "first_segment", items_buffer.regions[i].first);
+			emit_key_value(region, "n_segments", items_buffer.regions[i].n_segments);
+
+			json_array_append_new(regions, region);
+		}
+
+		json_object_set_new(obj, "numa_regions", regions);
+	}
+#endif
+
+	emit_key_value(obj, "ring_buffer", ring_buffer);
+	emit_key_value(obj, "stream", stream_writer);
+	emit_key_value(obj, "hugepages", hugepages_name(items_buffer.hugepages));
+#ifdef WITH_USAGE_GROUPS
+	emit_key_value(obj, "ug_hugepages", hugepages_name(ug_items_buffer.hugepages));
+#endif
+
+	if (filtering)
+		emit_filters(obj);
+
+#ifdef PER_THREAD_BUFFERS
+	// the analyzer needs to know which fields are in the encoded records
+	if (compact) {
+		json_t *format = json_object();
+
+#ifdef MEASURE_TIMING
+		emit_key_value(format, "timing", true);
+#else
+		emit_key_value(format, "timing", false);
+#endif
+#if defined(INTERN_STACKS)
+		emit_key_value(format, "stacks", "id");
+#elif defined(WITH_BACKTRACE)
+		emit_key_value(format, "stacks", "callers");
+#else
+		emit_key_value(format, "stacks", "none");
+#endif
+#ifdef LOCK_REGISTRY
+		emit_key_value(format, "lock_id", true);
+#endif
+
+		json_object_set_new(obj, "compact", format);
+	}
+#endif
+
+	emit_key_value(obj, "sample_rate", sample_rate);
+	emit_key_value(obj, "sampled_held_full", sampled_held_full.load());
+
+#if defined(VARIANT_MINIMAL)
+	emit_key_value(obj, "variant", "minimal");
+#elif defined(VARIANT_TIMING)
+	emit_key_value(obj, "variant", "timing");
+#elif defined(VARIANT_SHALLOW)
+	emit_key_value(obj, "variant", "shallow");
+#else
+	emit_key_value(obj, "variant", "full");
+#endif
+
+	emit_key_value(obj, "caller_depth", CALLER_DEPTH);
+
+	emit_layout(obj, "layout", sizeof(lock_trace_item_t), trace_item_fields, sizeof trace_item_fields / sizeof trace_item_fields[0]);
+#ifdef WITH_USAGE_GROUPS
+	emit_layout(obj, "ug_layout", sizeof(lock_usage_groups_t), ug_item_fields, sizeof ug_item_fields / sizeof ug_item_fields[0]);
+#endif
+
+	emit_key_value(obj, "contended_only", contended_only);
+	if (contended_only)
+		emit_uncontended(obj);
+
+#ifdef FRAME_POINTER_UNWIND
+	emit_key_value(obj, "fp_unwind_fallback", cnt_fp_unwind_fallback.load());
+#endif
+
+#ifdef BACKTRACE_CACHE
+	emit_key_value(obj, "bt_cache_revalidate", bt_cache_revalidate);
+	emit_key_value(obj, "bt_cache_stale", cnt_bt_cache_stale.load());
+#endif
+
+#ifdef INTERN_STACKS
+	emit_key_value(obj, "stacks", stacks_filename);
+	emit_key_value(obj, "n_stacks", std::min(n_stacks.load(), max_stacks));
+	emit_key_value(obj, "stacks_full", stacks_full.load());
+#endif
+
+#ifdef LOCK_REGISTRY
+	emit_key_value(obj, "locks", locks_filename);
+	emit_key_value(obj, "n_locks", n_locks.load());
+	emit_key_value(obj, "locks_full", locks_full.load());
+	emit_key_value(obj, "lock_registry_entry_size", sizeof(lock_registry_entry_t));
+#endif
+}
+
+static bool write_dump_file(const json_t *const obj, const char *const file_name)
+{
+	FILE *fh = fopen(file_name, "w");
+	if (!fh) {
+		fprintf(stderr, "Failed creating %s: %s\n", file_name, strerror(errno));
+		return false;
+	}
+
+	char *data = json_dumps(obj, JSON_COMPACT);
+	bool ok = data && fprintf(fh, "%s\n", data) > 0;
+	free(data);
+
+	if (fclose(fh) != 0)
+		ok = false;
+
+	if (!ok)
+		fprintf(stderr, "Failed writing %s: %s\n", file_name, strerror(errno));
+
+	return ok;
+}
+
+static int n_snapshots = 0;
+
+static void write_snapshot(const char *const reason)
+{
+	n_snapshots++;
+
+	pid_t pid = getpid();
+
+	json_t *obj = json_object();
+
+	emit_process_meta_data(obj, get_ns());
+
+	emit_key_value(obj, "snapshot", n_snapshots);
+	emit_key_value(obj, "trigger", reason);
+
+	char *file_name = nullptr;
+
+#ifdef WITH_AGGREGATE
+	// the histograms so far
+	if (aggregate)
+		emit_aggregate(obj);
+	else
+#endif
+	{
+		asprintf(&file_name, "measurements-%d.%d.dat", pid, n_snapshots);
+		emit_key_value(obj, "measurements", file_name);
+		emit_key_value(obj, "n_records", snapshot_buffer(obj, "segments", &items_buffer, file_name));
+		free(file_name);
+
+#ifdef WITH_USAGE_GROUPS
+		asprintf(&file_name, "ug-measurements-%d.%d.dat", pid, n_snapshots);
+		emit_key_value(obj, "ug_measurements", file_name);
+		emit_key_value(obj, "ug_n_records", snapshot_buffer(obj, "ug_segments", &ug_items_buffer, file_name));
+		free(file_name);
+#endif
+	}
+
+	asprintf(&file_name, "dump.dat.%d.%d", pid, n_snapshots);
+
+	if (write_dump_file(obj, file_name)) {
+		color("\033[0;31m");
+		print_timestamp();
+		fprintf(stderr, "Snapshot (%s) written to %s\n", reason, file_name);
+		color("\033[0m");
+	}
+
+	free(file_name);
+
+	json_decref(obj);
+}
+
+static void *snapshot_thread(void *)
+{
+	for(;;) {
+		char c = 0;
+
+		if (read(trigger_pipe[0], &c, 1) != 1) {
+			if (errno == EINTR)
+				continue;
+
+			break;
+		}
+
+		if (c == 's') {
+			on_demand_pending = false;
+
+			frozen = true;
+			write_snapshot("request");
+			frozen = false;
+
+			continue;
+		}
+
+		// also capture what happens right after the trigger
+		usleep(trigger_post_ms * 1000);
+
+		frozen = true;
+		write_snapshot(snapshot_reason);
+		frozen = false;
+
+		// when the maximum is reached, 'snapshot_pending' is left
+		// set so that nothing triggers anymore
+		if (n_snapshots < max_snapshots)
+			snapshot_pending = false;
+	}
+
+	return nullptr;
 }
 
-static void rwlock_sanity_check(pthread_rwlock_t *const rwlock, void *const caller)
+static void signal_trigger_handler(int sig)
 {
-#ifdef RWLOCK_SANITY_CHECKS
-#if __GLIBC_PREREQ(2, 30)
-	if (int(rwlock->__data.__readers) < 0)
-		fprintf(stderr, "rwlock %p has suspicious '__readers': %u (caller: %p)\n", (void *)rwlock, rwlock->__data.__readers, caller);
+	trigger_snapshot("signal");
+}
 
-	if (int(rwlock->__data.__writers) < 0)
-		fprintf(stderr, "rwlock %p has suspicious '__writers': %u (caller: %p)\n", (void *)rwlock, rwlock->__data.__writers, caller);
+static void signal_snapshot_handler(int sig)
+{
+	request_snapshot();
+}
 
-	if (rwlock->__data.__writers > 0 && rwlock->__data.__cur_writer == 0)
-		fprintf(stderr, "rwlock %p has suspicious '__cur_writer': %u (caller: %p)\n", (void *)rwlock, rwlock->__data.__cur_writer, caller);
-#endif
-#endif
+static int signal_by_name(const std::string & name)
+{
+	if (name.empty() == false && isdigit(name[0]))
+		return atoi(name.c_str());
+
+	std::string temp = name.substr(0, 3) == "SIG" ? name.substr(3) : name;
+
+	if (temp == "USR1")
+		return SIGUSR1;
+	if (temp == "USR2")
+		return SIGUSR2;
+	if (temp == "HUP")
+		return SIGHUP;
+	if (temp == "QUIT")
+		return SIGQUIT;
+	if (temp == "INT")
+		return SIGINT;
+
+	return -1;
 }
 
-int pthread_mutex_init(pthread_mutex_t *mutex, const pthread_mutexattr_t *attr) throw ()
+static void start_snapshot_thread()
 {
-	if (unlikely(!org_pthread_mutex_init_h))
-		org_pthread_mutex_init_h = (org_pthread_mutex_init)dlsym(RTLD_NEXT, "pthread_mutex_init");
+	if (pipe(trigger_pipe) == -1) {
+		fprintf(stderr, "ERROR: cannot create trigger pipe: %s\n", strerror(errno));
+		return;
+	}
 
-	int rc = (*org_pthread_mutex_init_h)(mutex, attr);
-	STORE_MUTEX_INFO(mutex, a_init, 0, rc);
+	pthread_t th;
+	int rc = pthread_create(&th, nullptr, snapshot_thread, nullptr);
+	if (rc) {
+		fprintf(stderr, "ERROR: cannot start snapshot thread: %s\n", strerror(rc));
+		return;
+	}
 
-	return rc;
+	pthread_detach(th);
 }
 
-int pthread_mutex_destroy(pthread_mutex_t *mutex) throw ()
+void sigterm_handler(int sig)
 {
-	if (unlikely(!org_pthread_mutex_destroy_h))
-		org_pthread_mutex_destroy_h = (org_pthread_mutex_destroy)dlsym(RTLD_NEXT, "pthread_mutex_destroy");
+	color("\033[0;31m");
 
-	int rc = (*org_pthread_mutex_destroy_h)(mutex);
-	STORE_MUTEX_INFO(mutex, a_destroy, 0, rc);
+	fprintf(stderr, "Caught SIGTERM\n");
 
-	return rc;
+	exit(-1);
 }
 
-int pthread_mutex_trylock(pthread_mutex_t *mutex) throw ()
+static size_t get_huge_page_size()
 {
-	if (unlikely(!org_pthread_mutex_trylock_h))
-		org_pthread_mutex_trylock_h = (org_pthread_mutex_trylock)dlsym(RTLD_NEXT, "pthread_mutex_trylock");
+	FILE *fh = fopen("/proc/meminfo", "r");
+	if (!fh)
+		return huge_page_size;
 
-	cnt_mutex_trylock++;
+	size_t size = huge_page_size;
 
-	mutex_sanity_check(mutex, __builtin_return_address(0));
+	char line[128];
+	while(fgets(line, sizeof line, fh)) {
+		unsigned long kb = 0;
 
-	int rc = (*org_pthread_mutex_trylock_h)(mutex);
+		if (sscanf(line, "Hugepagesize: %lu kB", &kb) == 1 && kb) {
+			size = kb * 1024;
+			break;
+		}
+	}
 
-#ifdef WITH_USAGE_GROUPS
-	// after! as only here is known if it would succeed or not
-	if (rc == 0)
-		store_lock(mutex, __builtin_return_address(0), a_lock);
-#endif
+	fclose(fh);
 
-	STORE_MUTEX_INFO(mutex, a_lock, 0, rc);
+	return size;
+}
 
-	return rc;
+// MAP_HUGETLB mappings must be a multiple of the huge page size
+static size_t buffer_length(const size_t length)
+{
+	if (hugepages != hp_hugetlb)
+		return length;
+
+	return (length + huge_page_size - 1) / huge_page_size * huge_page_size;
 }
 
-int pthread_mutex_unlock(pthread_mutex_t *mutex) throw ()
+// *hp is set to the kind of pages that were used
+static void *allocate_anonymous(const size_t length, hugepages_t *const hp)
 {
-	if (unlikely(!org_pthread_mutex_unlock_h))
-		org_pthread_mutex_unlock_h = (org_pthread_mutex_unlock)dlsym(RTLD_NEXT, "pthread_mutex_unlock");
+	*hp = hugepages;
 
-	mutex_sanity_check(mutex, __builtin_return_address(0));
+	if (*hp == hp_hugetlb) {
+		void *p = mmap(nullptr, length, PROT_WRITE | PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+		if (p != MAP_FAILED)
+			return p;
 
-#ifdef WITH_USAGE_GROUPS
-	store_lock(mutex, __builtin_return_address(0), a_unlock);
-#endif
+		fprintf(stderr, "Cannot allocate %zu bytes of huge pages (see /proc/sys/vm/nr_hugepages): %s, using transparent huge pages instead\n", length, strerror(errno));
 
-	int rc = (*org_pthread_mutex_unlock_h)(mutex);
+		*hp = hp_thp;
+	}
 
-	STORE_MUTEX_INFO(mutex, a_unlock, 0, rc);
+	void *p = mmap(nullptr, length, PROT_WRITE | PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
 
-	return rc;
+	if (p != MAP_FAILED && *hp == hp_thp && madvise(p, length, MADV_HUGEPAGE) == -1)
+		perror("madvise(MADV_HUGEPAGE)");
+
+	return p;
 }
 
-static void store_rwlock_info(pthread_rwlock_t *rwlock, lock_action_t la, uint64_t took, const int rc, void *const shallow_backtrace)
+// In streaming mode the buffer is plain memory (its segments are
+// appended to the file by stream_writer_thread), with TRACE_HUGEPAGES
+// too (copied to the file at exit), else the file is mapped into memory.
+static void *allocate_buffer(const char *const file_name, const size_t length, int *const fd, hugepages_t *const hp, const char *const what)
 {
-	if (unlikely(!items)) {
-		show_items_buffer_not_allocated_error();
-		return;
+	const bool anonymous = stream_writer || hugepages != hp_none;
+
+	*fd = open(file_name, anonymous ? O_WRONLY | O_CREAT | O_TRUNC : O_RDWR | O_CREAT, S_IRUSR | S_IWUSR);
+	if (*fd == -1) {
+		fprintf(stderr, "ERROR: cannot create %s file %s: %s\n", what, file_name, strerror(errno));
+		color("\033[0m");
+		_exit(1);
 	}
 
-	uint64_t cur_idx = items_idx++;
+	void *p = nullptr;
 
-	if (verbose) {
-		if (cur_idx % emit_count_threshold == 0)
-			show_items_buffer_percent();
+	*hp = hp_none;
+
+	if (anonymous) {
+		p = allocate_anonymous(length, hp);
 	}
+	else {
+		if (ftruncate(*fd, length) == -1) {
+			fprintf(stderr, "ERROR: problem reserving space on disk: %s\n", strerror(errno));
+			color("\033[0m");
+			_exit(1);
+		}
 
-	if (likely(cur_idx < n_records)) {
-#ifdef WITH_BACKTRACE
-#if defined(PREVENT_RECURSION) || defined(SHALLOW_BACKTRACE)
-		items[cur_idx].caller[0] = shallow_backtrace;
+#ifdef PREALLOCATE
+		p = mmap(nullptr, length, PROT_WRITE | PROT_READ, MAP_SHARED | MAP_POPULATE, *fd, 0);
 #else
-		my_backtrace(items[cur_idx].caller, CALLER_DEPTH);
-#endif
+		p = mmap(nullptr, length, PROT_WRITE | PROT_READ, MAP_SHARED, *fd, 0);
 #endif
-		items[cur_idx].lock = rwlock;
-		items[cur_idx].tid = _gettid();
-		items[cur_idx].la = la;
-#ifdef MEASURE_TIMING
-		items[cur_idx].timestamp = get_ns();
-		items[cur_idx].lock_took = took;
+	}
+
+	if (p == MAP_FAILED) {
+		fprintf(stderr, "ERROR: cannot allocate %zu bytes of memory (reduce with the \"TRACE_N_RECORDS\" environment variable): %s\n", length, strerror(errno));
+		color("\033[0m");
+		_exit(1);
+	}
+
+	if (posix_madvise(p, length, POSIX_MADV_SEQUENTIAL) == -1)
+		perror("madvise");
+
+	return p;
+}
+
+#ifdef WITH_LIVE_STATS
+static void create_live_stats(const double ns_per_tick)
+{
+	asprintf(&live_shm_name, "/lock_tracer-%d", getpid());
+
+	const size_t live_length = sizeof(live_stats_header_t) + live_size * sizeof(live_stats_entry_t);
+
+	int fd = shm_open(live_shm_name, O_RDWR | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+	if (fd == -1 || ftruncate(fd, live_length) == -1) {
+		fprintf(stderr, "ERROR: cannot create shared memory segment %s: %s\n", live_shm_name, strerror(errno));
+		color("\033[0m");
+		_exit(1);
+	}
+
+	live_header = (live_stats_header_t *)mmap(nullptr, live_length, PROT_WRITE | PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+
+	if (live_header == MAP_FAILED) {
+		fprintf(stderr, "ERROR: cannot map shared memory segment %s: %s\n", live_shm_name, strerror(errno));
+		color("\033[0m");
+		_exit(1);
+	}
+
+	live_entries = (live_stats_entry_t *)(live_header + 1);
+
+	live_header->n_entries   = live_size;
+	live_header->entry_size  = sizeof(live_stats_entry_t);
+	live_header->pid         = getpid();
+	live_header->start_ts    = global_start_ts;
+	live_header->ns_per_tick = ns_per_tick;
+	live_header->contended_ticks = live_contended_ns / live_header->ns_per_tick;
+
+	// lock_top only looks at the segment when this is set
+	std::atomic_thread_fence(std::memory_order_release);
+	live_header->magic = LIVE_STATS_MAGIC;
+}
 #endif
-#ifdef STORE_THREAD_NAME
-		check_tid_names_lock_functions();
 
-		if ((*org_pthread_rwlock_rdlock_h)(&tid_names_lock) == 0) {
-			auto it = tid_names->find(items[cur_idx].tid);
-			if (it != tid_names->end())
-				memcpy(items[cur_idx].thread_name, it->second.c_str(), std::min(size_t(16), it->second.size() + 1));
+static void create_trace_buffers()
+{
+	asprintf(&data_filename, "measurements-%d.dat", getpid());
 
-			(*org_pthread_rwlock_unlock_h)(&tid_names_lock);
-		}
+	length = buffer_length(n_records * sizeof(lock_trace_item_t));
+
+	hugepages_t hp = hp_none;
+
+	items = (lock_trace_item_t *)allocate_buffer(data_filename, length, &mmap_fd, &hp, "data");
+
+	init_trace_buffer(&items_buffer, items, hp, sizeof(lock_trace_item_t));
+#ifdef PER_THREAD_BUFFERS
+	if (stream_writer)
+		items_buffer.stream_fd = mmap_fd;
+
+	// same amount of memory, but in bytes
+	if (compact) {
+		items_buffer.compact          = true;
+		items_buffer.n_records       *= sizeof(lock_trace_item_t);
+		items_buffer.segment_records *= sizeof(lock_trace_item_t);
+		items_buffer.record_size      = 1;
+	}
 #endif
 
-#if __GLIBC_PREREQ(2, 30)
-		items[cur_idx].rwlock_innards.__readers = rwlock->__data.__readers;
-		items[cur_idx].rwlock_innards.__writers = rwlock->__data.__writers;
-#else
-		items[cur_idx].rwlock_innards.__readers = rwlock->__data.__nr_readers;
+#ifdef WITH_USAGE_GROUPS
+	asprintf(&ug_data_filename, "ug-measurements-%d.dat", getpid());
+
+	ug_length = buffer_length(n_records * sizeof(lock_usage_groups_t));
+
+	ug_items = (lock_usage_groups_t *)allocate_buffer(ug_data_filename, ug_length, &ug_mmap_fd, &hp, "usage-groups data");
+
+	init_trace_buffer(&ug_items_buffer, ug_items, hp, sizeof(lock_usage_groups_t));
+#ifdef PER_THREAD_BUFFERS
+	if (stream_writer)
+		ug_items_buffer.stream_fd = ug_mmap_fd;
 #endif
-#if defined(__x86_64__) && __GLIBC_PREREQ(2, 30)
-		items[cur_idx].rwlock_innards.__cur_writer  = rwlock->__data.__cur_writer;
-#else
-		items[cur_idx].rwlock_innards.__cur_writer  = 0;
 #endif
 
-		items[cur_idx].rc = rc;
-	}
-	else {
-		show_items_buffer_full_error();
-	}
-}
+#ifdef PER_THREAD_BUFFERS
+	if (stream_writer) {
+		pthread_t th;
+		int rc = pthread_create(&th, nullptr, stream_writer_thread, nullptr);
+		if (rc) {
+			fprintf(stderr, "ERROR: cannot start stream writer thread: %s\n", strerror(rc));
+			color("\033[0m");
+			_exit(1);
+		}
 
-#if (defined(PREVENT_RECURSION) || defined(SHALLOW_BACKTRACE)) && defined(WITH_BACKTRACE)
-#define STORE_RWLOCK_INFO(a, b, c, d) store_rwlock_info(a, b, c, d, __builtin_return_address(0))
-#else
-#define STORE_RWLOCK_INFO(a, b, c, d) store_rwlock_info(a, b, c, d, nullptr) 
+		pthread_detach(th);
+	}
 #endif
+}
 
-int pthread_rwlock_init(pthread_rwlock_t *rwlock, const pthread_rwlockattr_t *attr) throw ()
+#ifdef INTERN_STACKS
+static void create_stack_table()
 {
-	if (unlikely(!org_pthread_rwlock_init_h))
-		org_pthread_rwlock_init_h = (org_pthread_rwlock_init)dlsym(RTLD_NEXT, "pthread_rwlock_init");
+	asprintf(&stacks_filename, "stacks-%d.dat", getpid());
 
-	int rc = (*org_pthread_rwlock_init_h)(rwlock, attr);
-	STORE_RWLOCK_INFO(rwlock, a_rw_init, 0, rc);
+	stacks_fd = open(stacks_filename, O_RDWR | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+	if (stacks_fd == -1 || ftruncate(stacks_fd, sizeof(void *) * CALLER_DEPTH * max_stacks) == -1) {
+		fprintf(stderr, "ERROR: cannot create stack table %s: %s\n", stacks_filename, strerror(errno));
+		color("\033[0m");
+		_exit(1);
+	}
 
-	return rc;
+	stacks = (void **)mmap(nullptr, sizeof(void *) * CALLER_DEPTH * max_stacks, PROT_WRITE | PROT_READ, MAP_SHARED, stacks_fd, 0);
+
+	if (stacks == MAP_FAILED) {
+		fprintf(stderr, "ERROR: cannot map stack table %s: %s\n", stacks_filename, strerror(errno));
+		color("\033[0m");
+		_exit(1);
+	}
 }
+#endif
 
-int pthread_rwlock_destroy(pthread_rwlock_t *rwlock) throw ()
+#ifdef LOCK_REGISTRY
+static void create_lock_registry()
 {
-	if (unlikely(!org_pthread_rwlock_destroy_h))
-		org_pthread_rwlock_destroy_h = (org_pthread_rwlock_destroy)dlsym(RTLD_NEXT, "pthread_rwlock_destroy");
+	asprintf(&locks_filename, "locks-%d.dat", getpid());
 
-	int rc = (*org_pthread_rwlock_destroy_h)(rwlock);
-	STORE_RWLOCK_INFO(rwlock, a_rw_destroy, 0, rc);
+	locks_fd = open(locks_filename, O_RDWR | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+	if (locks_fd == -1 || ftruncate(locks_fd, sizeof(lock_registry_entry_t) * max_locks) == -1) {
+		fprintf(stderr, "ERROR: cannot create lock registry %s: %s\n", locks_filename, strerror(errno));
+		color("\033[0m");
+		_exit(1);
+	}
 
-	return rc;
+	lock_registry = (lock_registry_entry_t *)mmap(nullptr, sizeof(lock_registry_entry_t) * max_locks, PROT_WRITE | PROT_READ, MAP_SHARED, locks_fd, 0);
+
+	if (lock_registry == MAP_FAILED) {
+		fprintf(stderr, "ERROR: cannot map lock registry %s: %s\n", locks_filename, strerror(errno));
+		color("\033[0m");
+		_exit(1);
+	}
 }
+#endif
 
-int pthread_rwlock_rdlock(pthread_rwlock_t *rwlock) throw ()
+// pthread_atfork() handler. The child inherited the buffers, files and
+// shared memory of the parent: it gets its own so that both traces stay
+// intact. Only the thread that called fork() exists in the child.
+static void fork_child()
 {
-	if (unlikely(!org_pthread_rwlock_rdlock_h))
-		org_pthread_rwlock_rdlock_h = (org_pthread_rwlock_rdlock)dlsym(RTLD_NEXT, "pthread_rwlock_rdlock");
+	if (exited)
+		return;
 
-	rwlock_sanity_check(rwlock, __builtin_return_address(0));
+	parent_pid      = getppid();
+	fork_ts         = get_ns();
+	global_start_ts = fork_ts;
+	n_children      = 0;
 
+	// other threads may have been in these when fork() was called
+#ifdef STORE_THREAD_NAME
+	tid_names_lock = PTHREAD_RWLOCK_INITIALIZER;
+#endif
+#ifdef LOCK_REGISTRY
+	lock_registry_busy.clear();
+#endif
+	module_table_busy.clear();
+
+	cnt_mutex_trylock = cnt_mutex_timedlock = 0;
+	cnt_rwlock_try_rdlock = cnt_rwlock_try_timedrdlock = 0;
+	cnt_rwlock_try_wrlock = cnt_rwlock_try_timedwrlock = 0;
+
+	context.tid = _gettid();
+	context.held.n = 0;
+#ifdef WITH_LIVE_STATS
+	context.live_held.n = 0;
+#endif
+	context.n_sampled_held = 0;
+	sampled_held_full = 0;
+	context.uncontended = nullptr;
+#ifdef PER_THREAD_BUFFERS
+	context.items_cursor = buffer_cursor_t { };
 #ifdef WITH_USAGE_GROUPS
-	store_lock(rwlock, __builtin_return_address(0), a_r_lock);
+	context.ug_items_cursor = buffer_cursor_t { };
+#endif
 #endif
 
-	uint64_t start_ts = get_ns();
-	int rc = (*org_pthread_rwlock_rdlock_h)(rwlock);
-	uint64_t end_ts = get_ns();
+	if (uncontended_tables) {
+		memset((void *)uncontended_tables, 0x00, max_uncontended_tables * sizeof(uncontended_table_t));
+		n_uncontended_tables = 0;
+		uncontended_no_table = 0;
+	}
 
-	STORE_RWLOCK_INFO(rwlock, a_r_lock, end_ts - start_ts, rc);
+#ifdef WITH_LIVE_STATS
+	if (live_stats) {
+		const double ns_per_tick = live_header->ns_per_tick;
 
-	return rc;
-}
+		munmap(live_header, sizeof(live_stats_header_t) + live_size * sizeof(live_stats_entry_t));
+		free(live_shm_name);
 
-int pthread_rwlock_tryrdlock(pthread_rwlock_t *rwlock) throw ()
-{
-	if (unlikely(!org_pthread_rwlock_tryrdlock_h))
-		org_pthread_rwlock_tryrdlock_h = (org_pthread_rwlock_tryrdlock)dlsym(RTLD_NEXT, "pthread_rwlock_tryrdlock");
+		create_live_stats(ns_per_tick);
+	}
+#endif
 
-	cnt_rwlock_try_rdlock++;
+	if (trigger_pipe[0] != -1) {
+		close(trigger_pipe[0]);
+		close(trigger_pipe[1]);
 
-	rwlock_sanity_check(rwlock, __builtin_return_address(0));
+		n_snapshots = 0;
+		snapshot_pending = on_demand_pending = frozen = false;
 
-	int rc = (*org_pthread_rwlock_tryrdlock_h)(rwlock);
+		start_snapshot_thread();
+	}
+
+#ifdef WITH_AGGREGATE
+	if (aggregate) {
+		// a private copy: starts over
+		memset((void *)aggregate_table, 0x00, aggregate_size * sizeof(aggregate_entry_t));
+		aggregate_full = aggregate_hold_untracked = 0;
 
+		return;
+	}
+#endif
+
+	if (!items)
+		return;
+
+	munmap(items, length);
+	close(mmap_fd);
+	free(data_filename);
 #ifdef WITH_USAGE_GROUPS
-	if (rc == 0)
-		store_lock(rwlock, __builtin_return_address(0), a_r_lock);
+	munmap(ug_items, ug_length);
+	close(ug_mmap_fd);
+	free(ug_data_filename);
+#endif
+#ifdef PER_THREAD_BUFFERS
+	free(items_buffer.segments);
+	free(items_buffer.regions);
+#ifdef WITH_USAGE_GROUPS
+	free(ug_items_buffer.segments);
+	free(ug_items_buffer.regions);
+#endif
+	stream_writer_stop = stream_writer_stopped = false;
 #endif
 
-	STORE_RWLOCK_INFO(rwlock, a_r_lock, 0, rc);
+	create_trace_buffers();
 
-	return rc;
+	// the ids in the records refer to these, so the child continues
+	// with a copy
+#ifdef INTERN_STACKS
+	void **const parent_stacks = stacks;
+	close(stacks_fd);
+	free(stacks_filename);
+
+	create_stack_table();
+
+	// only the part in use, the table can be large
+	memcpy(stacks, parent_stacks, sizeof(void *) * CALLER_DEPTH * std::min(n_stacks.load(), max_stacks));
+
+	munmap(parent_stacks, sizeof(void *) * CALLER_DEPTH * max_stacks);
+#endif
+
+#ifdef LOCK_REGISTRY
+	lock_registry_entry_t *const parent_registry = lock_registry;
+	close(locks_fd);
+	free(locks_filename);
+
+	create_lock_registry();
+
+	memcpy((void *)lock_registry, (const void *)parent_registry, sizeof(lock_registry_entry_t) * n_locks);
+
+	munmap(parent_registry, sizeof(lock_registry_entry_t) * max_locks);
+#endif
 }
 
-int pthread_rwlock_timedrdlock(pthread_rwlock_t *rwlock, const struct timespec *abstime) throw ()
+void __attribute__ ((constructor)) start_lock_tracing()
 {
-	if (unlikely(!org_pthread_rwlock_timedrdlock_h))
-		org_pthread_rwlock_timedrdlock_h = (org_pthread_rwlock_timedrdlock)dlsym(RTLD_NEXT, "pthread_rwlock_timedrdlock");
+	color("\033[0;31m");
 
-	cnt_rwlock_try_timedrdlock++;
+	fprintf(stderr, "Lock tracer starting... (structure size: %zu bytes)\n", sizeof(lock_trace_item_t));
 
-	rwlock_sanity_check(rwlock, __builtin_return_address(0));
+	no_core = getenv("TRACE_NO_CORE") != nullptr;
+
+	parent_pid = getppid();
+
+	pthread_atfork(nullptr, nullptr, fork_child);
+
+	struct rlimit rlim { 0, 0 };
+	if (no_core)
+		fprintf(stderr, "Not dumping core at exit\n");
+	else if (getrlimit(RLIMIT_CORE, &rlim) == -1)
+		perror("getrlimit(RLIMIT_CORE) failed");
+	else if (rlim.rlim_max == 0 || rlim.rlim_cur == 0)
+		fprintf(stderr, "NOTE: core-files have been disabled! You may want to re-run after invoking \"ulimit -c unlimited\".\n");
+
+	const char *env_n_records = getenv("TRACE_N_RECORDS");
+	if (env_n_records) {
+		n_records = atoll(env_n_records);
+
+		emit_count_threshold = n_records / 10;
+	}
+
+#ifdef PER_THREAD_BUFFERS
+	const char *env_segment_records = getenv("TRACE_SEGMENT_RECORDS");
+	if (env_segment_records)
+		segment_records = std::max(1ll, atoll(env_segment_records));
+
+	fprintf(stderr, "Per-thread segments of %lu records\n", segment_records);
+#endif
+
+	capture_sigterm = getenv("CAPTURE_SIGTERM") != nullptr;
+	if (capture_sigterm) {
+		fprintf(stderr, "Capture SIGTERM enabled\n");
+
+		signal(SIGTERM, sigterm_handler);
+	}
+
+#ifdef PER_THREAD_BUFFERS
+	stream_writer = getenv("TRACE_STREAM") != nullptr;
+	if (stream_writer)
+		fprintf(stderr, "Streaming mode enabled: the buffer is written to disk while tracing\n");
+
+	ring_buffer = getenv("TRACE_RING") != nullptr && !stream_writer;
+	if (ring_buffer)
+		fprintf(stderr, "Flight-recorder (ring buffer) mode enabled\n");
 
-	uint64_t start_ts = get_ns();
-	int rc = (*org_pthread_rwlock_timedrdlock_h)(rwlock, abstime);
-	uint64_t end_ts = get_ns();
+	compact = getenv("TRACE_COMPACT") != nullptr;
+	if (compact) {
+		fprintf(stderr, "Compact record format enabled\n");
 
-#ifdef WITH_USAGE_GROUPS
-	if (rc == 0)
-		store_lock(rwlock, __builtin_return_address(0), a_r_lock);
+		// a segment must fit at least one record
+		segment_records = std::max(segment_records, uint64_t(COMPACT_MAX_EVENT / sizeof(lock_trace_item_t) + 1));
+	}
+#else
+	if (getenv("TRACE_RING") || getenv("TRACE_STREAM") || getenv("TRACE_COMPACT"))
+		fprintf(stderr, "TRACE_RING, TRACE_STREAM and TRACE_COMPACT require PER_THREAD_BUFFERS, ignored\n");
 #endif
 
-	// TODO seperate a_r_lock for timed locks as they may take quite
-	// a bit longer or add a flag which tells so
-	STORE_RWLOCK_INFO(rwlock, a_r_lock, end_ts - start_ts, rc);
+	setup_filters();
 
-	return rc;
-}
+	// after the filters: their choices per module are in the table
+	refresh_modules(true);
 
-int pthread_rwlock_wrlock(pthread_rwlock_t *rwlock) throw ()
-{
-	if (unlikely(!org_pthread_rwlock_wrlock_h))
-		org_pthread_rwlock_wrlock_h = (org_pthread_rwlock_wrlock)dlsym(RTLD_NEXT, "pthread_rwlock_wrlock");
+#ifdef PER_THREAD_BUFFERS
+	if (getenv("TRACE_NUMA")) {
+		find_numa_nodes();
 
-	rwlock_sanity_check(rwlock, __builtin_return_address(0));
+		numa = n_numa_nodes > 1;
 
-#ifdef WITH_USAGE_GROUPS
-	store_lock(rwlock, __builtin_return_address(0), a_w_lock);
+		if (numa)
+			fprintf(stderr, "Trace buffers divided over %d NUMA nodes\n", n_numa_nodes);
+		else
+			fprintf(stderr, "TRACE_NUMA: only one NUMA node, ignored\n");
+	}
+#else
+	if (getenv("TRACE_NUMA"))
+		fprintf(stderr, "TRACE_NUMA requires PER_THREAD_BUFFERS, ignored\n");
 #endif
 
-	uint64_t start_ts = get_ns();
-	int rc = (*org_pthread_rwlock_wrlock_h)(rwlock);
-	uint64_t end_ts = get_ns();
-
-	STORE_RWLOCK_INFO(rwlock, a_w_lock, end_ts - start_ts, rc);
+	const char *env_hugepages = getenv("TRACE_HUGEPAGES");
+	if (env_hugepages) {
+		if (strcasecmp(env_hugepages, "thp") == 0)
+			hugepages = hp_thp;
+		else if (strcasecmp(env_hugepages, "hugetlb") == 0) {
+			hugepages = hp_hugetlb;
+			huge_page_size = get_huge_page_size();
+		}
+		else if (strcasecmp(env_hugepages, "none") != 0)
+			fprintf(stderr, "TRACE_HUGEPAGES: \"%s\" is not one of none, thp or hugetlb, ignored\n", env_hugepages);
 
-	return rc;
-}
+		if (hugepages != hp_none)
+			fprintf(stderr, "Trace buffers on huge pages (%s)\n", hugepages_name(hugepages));
+	}
 
-int pthread_rwlock_trywrlock(pthread_rwlock_t *rwlock) throw ()
-{
-	if (unlikely(!org_pthread_rwlock_trywrlock_h))
-		org_pthread_rwlock_trywrlock_h = (org_pthread_rwlock_trywrlock)dlsym(RTLD_NEXT, "pthread_rwlock_trywrlock");
+#if defined(USE_TSC) && defined(MEASURE_TIMING)
+	tsc_usable = tsc_is_invariant();
 
-	cnt_rwlock_try_wrlock++;
+	if (tsc_usable) {
+		unsigned int aux = 0;
 
-	rwlock_sanity_check(rwlock, __builtin_return_address(0));
+		tsc_start_ns    = get_ns();
+		tsc_start_mono  = get_mono_ns();
+		tsc_start_ticks = __rdtscp(&aux);
 
-	int rc = (*org_pthread_rwlock_trywrlock_h)(rwlock);
+		fprintf(stderr, "Using the TSC for timestamps\n");
+	}
+	else {
+		fprintf(stderr, "TSC is not invariant, using clock_gettime for timestamps\n");
+	}
+#endif
 
-#ifdef WITH_USAGE_GROUPS
-	if (rc == 0)
-		store_lock(rwlock, __builtin_return_address(0), a_w_lock);
+#ifdef WITH_AGGREGATE
+	aggregate = getenv("TRACE_AGGREGATE") != nullptr;
 #endif
 
-	STORE_RWLOCK_INFO(rwlock, a_w_lock, 0, rc);
+	const char *env_sample_rate = getenv("TRACE_SAMPLE_RATE");
+	if (env_sample_rate) {
+		sample_rate = std::max(1, atoi(env_sample_rate));
 
-	return rc;
-}
+		fprintf(stderr, "Recording 1 in %u lock acquisitions (and their unlocks)\n", sample_rate);
+	}
 
-int pthread_rwlock_timedwrlock(pthread_rwlock_t *rwlock, const struct timespec *abstime) throw ()
-{
-	if (unlikely(!org_pthread_rwlock_timedwrlock_h))
-		org_pthread_rwlock_timedwrlock_h = (org_pthread_rwlock_timedwrlock)dlsym(RTLD_NEXT, "pthread_rwlock_timedwrlock");
+	contended_only = getenv("TRACE_CONTENDED_ONLY") != nullptr;
+	if (contended_only) {
+		const char *env_max_threads = getenv("TRACE_MAX_THREADS");
+		if (env_max_threads)
+			max_uncontended_tables = std::max(1, atoi(env_max_threads));
 
-	cnt_rwlock_try_timedwrlock++;
+		uncontended_tables = (uncontended_table_t *)mmap(nullptr, max_uncontended_tables * sizeof(uncontended_table_t), PROT_WRITE | PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (uncontended_tables == MAP_FAILED) {
+			fprintf(stderr, "ERROR: cannot allocate uncontended-counters for %u threads: %s\n", max_uncontended_tables, strerror(errno));
+			color("\033[0m");
+			_exit(1);
+		}
 
-	rwlock_sanity_check(rwlock, __builtin_return_address(0));
+		fprintf(stderr, "Only recording contended lock acquisitions\n");
+	}
 
-	uint64_t start_ts = get_ns();
-	int rc = (*org_pthread_rwlock_timedwrlock_h)(rwlock, abstime);
-	uint64_t end_ts = get_ns();
+	const char *env_trigger_took = getenv("TRACE_TRIGGER_TOOK_NS");
+	if (env_trigger_took)
+		trigger_took_ns = atoll(env_trigger_took);
 
-#ifdef WITH_USAGE_GROUPS
-	if (rc == 0)
-		store_lock(rwlock, __builtin_return_address(0), a_w_lock);
-#endif
+	const char *env_trigger_hold = getenv("TRACE_TRIGGER_HOLD_NS");
+	if (env_trigger_hold)
+		trigger_hold_ns = atoll(env_trigger_hold);
 
-	STORE_RWLOCK_INFO(rwlock, a_w_lock, end_ts - start_ts, rc);
+	const char *env_trigger_post = getenv("TRACE_TRIGGER_POST_MS");
+	if (env_trigger_post)
+		trigger_post_ms = atoll(env_trigger_post);
 
-	return rc;
-}
+	const char *env_max_snapshots = getenv("TRACE_MAX_SNAPSHOTS");
+	if (env_max_snapshots)
+		max_snapshots = atoi(env_max_snapshots);
 
-int pthread_rwlock_unlock(pthread_rwlock_t *rwlock) throw ()
-{
-	if (unlikely(!org_pthread_rwlock_unlock_h))
-		org_pthread_rwlock_unlock_h = (org_pthread_rwlock_unlock)dlsym(RTLD_NEXT, "pthread_rwlock_unlock");
+	const char *env_trigger_signal = getenv("TRACE_TRIGGER_SIGNAL");
+	if (env_trigger_signal)
+		signal_trigger_dump = env_trigger_signal;
 
-	rwlock_sanity_check(rwlock, __builtin_return_address(0));
+	const char *env_snapshot_signal = getenv("TRACE_SNAPSHOT_SIGNAL");
+	if (env_snapshot_signal)
+		signal_snapshot_dump = env_snapshot_signal;
 
-#ifdef WITH_USAGE_GROUPS
-	store_lock(rwlock, __builtin_return_address(0), a_rw_unlock);
+	if (trigger_took_ns || trigger_hold_ns || signal_trigger_dump.empty() == false) {
+#ifndef MEASURE_TIMING
+		if (trigger_took_ns || trigger_hold_ns)
+			fprintf(stderr, "Duration triggers require MEASURE_TIMING, ignored\n");
 #endif
+		fprintf(stderr, "Snapshot triggers: acquisition > %lu ns, hold > %lu ns, signal \"%s\" (max. %d snapshots)\n", trigger_took_ns, trigger_hold_ns, signal_trigger_dump.c_str(), max_snapshots);
 
-	int rc = (*org_pthread_rwlock_unlock_h)(rwlock);
+#if defined(USE_TSC) && defined(MEASURE_TIMING)
+		// the thresholds are compared against TSC ticks
+		if (tsc_usable && (trigger_took_ns || trigger_hold_ns)) {
+			double ticks_per_ns = measure_ticks_per_ns();
 
-	STORE_RWLOCK_INFO(rwlock, a_rw_unlock, 0, rc);
+			trigger_took_ns *= ticks_per_ns;
+			trigger_hold_ns *= ticks_per_ns;
+		}
+#endif
 
-	return rc;
-}
+		start_snapshot_thread();
 
-int pthread_setname_np(pthread_t thread, const char *name) throw ()
-{
-#ifdef STORE_THREAD_NAME
-	if (likely(name != nullptr)) {
-		check_tid_names_lock_functions();
+		if (signal_trigger_dump.empty() == false) {
+			int sig = signal_by_name(signal_trigger_dump);
 
-		if ((*org_pthread_rwlock_wrlock_h)(&tid_names_lock) == 0) {
-			tid_names->emplace(_gettid(), name);
+			struct sigaction sa { };
+			sa.sa_handler = signal_trigger_handler;
+			sa.sa_flags = SA_RESTART;
 
-			(*org_pthread_rwlock_unlock_h)(&tid_names_lock);
+			if (sig <= 0 || sigaction(sig, &sa, nullptr) == -1)
+				fprintf(stderr, "ERROR: cannot install handler for signal \"%s\"\n", signal_trigger_dump.c_str());
 		}
 	}
-#endif
 
-	if (unlikely(!org_pthread_setname_np_h))
-		org_pthread_setname_np_h = (org_pthread_setname_np)dlsym(RTLD_NEXT, "pthread_setname_np");
+	if (signal_snapshot_dump.empty() == false) {
+		fprintf(stderr, "Snapshot on signal \"%s\"\n", signal_snapshot_dump.c_str());
 
-	return (*org_pthread_setname_np_h)(thread, name);
-}
+		if (trigger_pipe[0] == -1)
+			start_snapshot_thread();
 
-void sigterm_handler(int sig)
-{
-	color("\033[0;31m");
+		int sig = signal_by_name(signal_snapshot_dump);
 
-	fprintf(stderr, "Caught SIGTERM\n");
+		struct sigaction sa { };
+		sa.sa_handler = signal_snapshot_handler;
+		sa.sa_flags = SA_RESTART;
 
-	exit(-1);
-}
+		if (sig <= 0 || sigaction(sig, &sa, nullptr) == -1)
+			fprintf(stderr, "ERROR: cannot install handler for signal \"%s\"\n", signal_snapshot_dump.c_str());
+	}
 
-void __attribute__ ((constructor)) start_lock_tracing()
-{
-	color("\033[0;31m");
+	verbose = getenv("TRACE_VERBOSE") != nullptr;
+	if (verbose)
+		fprintf(stderr, "Verbose tracing enabled\n");
 
-	fprintf(stderr, "Lock tracer starting... (structure size: %zu bytes)\n", sizeof(lock_trace_item_t));
+#ifdef WITH_LIVE_STATS
+	live_stats = getenv("TRACE_LIVE") != nullptr;
+	if (live_stats) {
+		const char *env_live_locks = getenv("TRACE_LIVE_LOCKS");
+		if (env_live_locks) {
+			live_size = 1;
+			while(live_size < uint32_t(std::max(1, atoi(env_live_locks))))
+				live_size <<= 1;
+		}
 
-	struct rlimit rlim { 0, 0 };
-	if (getrlimit(RLIMIT_CORE, &rlim) == -1)
-		perror("getrlimit(RLIMIT_CORE) failed");
-	else if (rlim.rlim_max == 0 || rlim.rlim_cur == 0)
-		fprintf(stderr, "NOTE: core-files have been disabled! You may want to re-run after invoking \"ulimit -c unlimited\".\n");
+		const char *env_live_contended = getenv("TRACE_LIVE_CONTENDED_NS");
+		if (env_live_contended)
+			live_contended_ns = atoll(env_live_contended);
 
-	const char *env_n_records = getenv("TRACE_N_RECORDS");
-	if (env_n_records) {
-		n_records = atoll(env_n_records);
+		double ns_per_tick = 1.;
+#if defined(USE_TSC)
+		if (tsc_usable)
+			ns_per_tick = 1. / measure_ticks_per_ns();
+#endif
 
-		emit_count_threshold = n_records / 10;
+		create_live_stats(ns_per_tick);
+
+		fprintf(stderr, "Live statistics for max. %u locks in shared memory %s (view with \"lock_top -p %d\")\n", live_size, live_shm_name, getpid());
 	}
+#endif
 
-	capture_sigterm = getenv("CAPTURE_SIGTERM") != nullptr;
-	if (capture_sigterm) {
-		fprintf(stderr, "Capture SIGTERM enabled\n");
+#ifdef WITH_AGGREGATE
+	if (aggregate) {
+		const char *env_aggregate_entries = getenv("TRACE_AGGREGATE_ENTRIES");
+		if (env_aggregate_entries) {
+			aggregate_size = 1;
+			while(aggregate_size < uint32_t(std::max(1, atoi(env_aggregate_entries))))
+				aggregate_size <<= 1;
+		}
 
-		signal(SIGTERM, sigterm_handler);
-	}
+		// every acquisition and unlock is needed for the hold durations
+		sample_rate = 1;
+		contended_only = false;
 
-	verbose = getenv("TRACE_VERBOSE") != nullptr;
-	if (verbose)
-		fprintf(stderr, "Verbose tracing enabled\n");
+		aggregate_table = (aggregate_entry_t *)mmap(nullptr, aggregate_size * sizeof(aggregate_entry_t), PROT_WRITE | PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (aggregate_table == MAP_FAILED) {
+			fprintf(stderr, "ERROR: cannot allocate histograms for %u lock/call site combinations (reduce with the \"TRACE_AGGREGATE_ENTRIES\" environment variable): %s\n", aggregate_size, strerror(errno));
+			color("\033[0m");
+			_exit(1);
+		}
 
-	fprintf(stderr, "Tracing max. %lu records\n", n_records);
+		fprintf(stderr, "Aggregating: histograms for max. %u lock/call site combinations, no trace records (TRACE_SAMPLE_RATE and TRACE_CONTENDED_ONLY are ignored)\n", aggregate_size);
 
-	asprintf(&data_filename, "measurements-%d.dat", getpid());
+		tid_names = new std::map<pthread_t, std::string>();
 
-	mmap_fd = open(data_filename, O_RDWR | O_CREAT, S_IRUSR | S_IWUSR);
-	if (mmap_fd == -1) {
-		fprintf(stderr, "ERROR: cannot create data file %s: %s\n", data_filename, strerror(errno));
 		color("\033[0m");
-		_exit(1);
+
+		return;
 	}
+#endif
 
-	length = n_records * sizeof(lock_trace_item_t);
+	fprintf(stderr, "Tracing max. %lu records\n", n_records);
 
-	if (ftruncate(mmap_fd, length) == -1) {
-		fprintf(stderr, "ERROR: problem reserving space on disk: %s\n", strerror(errno));
-		color("\033[0m");
-		_exit(1);
-	}
+#ifdef PER_THREAD_BUFFERS
+	if (stream_writer || ring_buffer)
+		pthread_key_create(&segment_owner_key, segment_owner_exit);
+#endif
 
-#ifdef PREALLOCATE
-	items = (lock_trace_item_t *)mmap(nullptr, length, PROT_WRITE | PROT_READ, MAP_SHARED | MAP_POPULATE, mmap_fd, 0);
-#else
-	items = (lock_trace_item_t *)mmap(nullptr, length, PROT_WRITE | PROT_READ, MAP_SHARED, mmap_fd, 0);
+	create_trace_buffers();
+
+#ifdef BACKTRACE_CACHE
+	const char *env_bt_cache_revalidate = getenv("TRACE_BT_CACHE_REVALIDATE");
+	if (env_bt_cache_revalidate)
+		bt_cache_revalidate = atoi(env_bt_cache_revalidate);
+
+	fprintf(stderr, "Backtrace cache: re-checked every %u hits\n", bt_cache_revalidate);
 #endif
 
-	if (items == MAP_FAILED) {
-		fprintf(stderr, "ERROR: cannot allocate %zu bytes of memory (reduce with the \"TRACE_N_RECORDS\" environment variable): %s\n", length, strerror(errno));
-		color("\033[0m");
-		_exit(1);
-	}
+#ifdef INTERN_STACKS
+	const char *env_max_stacks = getenv("TRACE_MAX_STACKS");
+	if (env_max_stacks)
+		max_stacks = std::min(std::max(1ll, atoll(env_max_stacks)), (long long)STACK_ID_UNKNOWN - 1);
 
-	if (posix_madvise(items, length, POSIX_MADV_SEQUENTIAL) == -1)
-		perror("madvise");
+	create_stack_table();
 
-#ifdef WITH_USAGE_GROUPS
-	asprintf(&ug_data_filename, "ug-measurements-%d.dat", getpid());
+	// at most half full
+	uint64_t n_slots = 1;
+	while(n_slots < uint64_t(max_stacks) * 2)
+		n_slots <<= 1;
+
+	stack_slots_mask = n_slots - 1;
+
+	stack_slots = (std::atomic<uint64_t> *)mmap(nullptr, n_slots * sizeof(uint64_t), PROT_WRITE | PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
 
-	ug_mmap_fd = open(ug_data_filename, O_RDWR | O_CREAT, S_IRUSR | S_IWUSR);
-	if (ug_mmap_fd == -1) {
-		fprintf(stderr, "ERROR: cannot create usage-groups data file %s: %s\n", ug_data_filename, strerror(errno));
+	if (stack_slots == MAP_FAILED) {
+		fprintf(stderr, "ERROR: cannot allocate stack table for %u backtraces (reduce with the \"TRACE_MAX_STACKS\" environment variable): %s\n", max_stacks, strerror(errno));
 		color("\033[0m");
 		_exit(1);
 	}
 
-	ug_length = n_records * sizeof(lock_usage_groups_t);
+	fprintf(stderr, "Stack table for max. %u distinct backtraces\n", max_stacks);
+#endif
+
+#ifdef LOCK_REGISTRY
+	const char *env_max_locks = getenv("TRACE_MAX_LOCKS");
+	if (env_max_locks)
+		max_locks = std::min(std::max(1ll, atoll(env_max_locks)), (long long)LOCK_SLOT_DESTROYED - 1);
+
+	create_lock_registry();
+
+	// at most half full
+	uint64_t n_lock_slots = 1;
+	while(n_lock_slots < uint64_t(max_locks) * 2)
+		n_lock_slots <<= 1;
 
-	if (ftruncate(ug_mmap_fd, ug_length) == -1) {
-		fprintf(stderr, "ERROR: problem reserving space on disk: %s\n", strerror(errno));
+	lock_slots_mask = n_lock_slots - 1;
+
+	lock_slot_keys = (std::atomic<uintptr_t> *)mmap(nullptr, n_lock_slots * sizeof(uintptr_t), PROT_WRITE | PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	lock_slot_ids = (std::atomic<uint32_t> *)mmap(nullptr, n_lock_slots * sizeof(uint32_t), PROT_WRITE | PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+	if (lock_slot_keys == MAP_FAILED || lock_slot_ids == MAP_FAILED) {
+		fprintf(stderr, "ERROR: cannot allocate lock registry for %u locks (reduce with the \"TRACE_MAX_LOCKS\" environment variable): %s\n", max_locks, strerror(errno));
 		color("\033[0m");
 		_exit(1);
 	}
 
-	ug_items = (lock_usage_groups_t *)mmap(nullptr, n_records * sizeof(lock_usage_groups_t), PROT_WRITE | PROT_READ, MAP_SHARED | MAP_POPULATE, ug_mmap_fd, 0);
+	fprintf(stderr, "Lock registry for max. %u locks\n", max_locks);
+#endif
 
-	if (posix_madvise(ug_items, ug_length, POSIX_MADV_SEQUENTIAL) == -1)
-		perror("madvise");
+#ifdef FRAME_POINTER_UNWIND
+	Dl_info own_info { };
+	if (dladdr((void *)fp_backtrace, &own_info))
+		dl_iterate_phdr(find_own_code, own_info.dli_fbase);
+
+	if (own_code_hi == 0)
+		fprintf(stderr, "Cannot determine address range of lock_tracer: frame pointer unwinding may fall back to libunwind\n");
 #endif
 
-	tid_names = new std::map<int, std::string>();
+	tid_names = new std::map<pthread_t, std::string>();
 
 	if (!tid_names) {
 		fprintf(stderr, "ERROR: cannot allocate map for \"TID - thread-name\" mapping\n");
@@ -890,35 +5712,122 @@ void __attribute__ ((constructor)) start_lock_tracing()
 	color("\033[0m");
 }
 
-static void emit_key_value(json_t *const tgt, const char *key, const char *value)
+static void __attribute__((noreturn)) dump_core()
 {
-	json_object_set(tgt, key, json_string(value));
+	delete tid_names;
+
+	color("\033[0;31m");
+	fprintf(stderr, "Dumping core...\n");
+	color("\033[0m");
+
+	fflush(nullptr);
+
+	signal(SIGABRT, SIG_DFL);
+	abort();
 }
 
-static void emit_key_value(json_t *const tgt, const char *key, const uint64_t value)
+#ifdef WITH_AGGREGATE
+static void write_aggregate_dump(const uint64_t end_ts)
 {
-	json_object_set(tgt, key, json_integer(value));
+	char *file_name = nullptr;
+	if (asprintf(&file_name, "dump.dat.%d", getpid()) == -1)
+		file_name = strdup("dump.dat");
+
+	json_t *obj = json_object();
+
+	emit_process_meta_data(obj, end_ts);
+
+	emit_aggregate(obj);
+
+	if (write_dump_file(obj, file_name)) {
+		color("\033[0;31m");
+		fprintf(stderr, "Lock statistics (load with '-t' in analyzer) written to %s\n", file_name);
+		color("\033[0m");
+	}
+
+	free(file_name);
+
+	json_decref(obj);
 }
+#endif
 
-void exit(int status) throw ()
+// Writes everything to disk; the buffers can't be used afterwards.
+static void stop_tracing()
 {
 	exited = true;
+	flush_records();
 	uint64_t end_ts = get_ns();
 
+#ifdef WITH_LIVE_STATS
+	if (live_stats)
+		shm_unlink(live_shm_name);
+#endif
+
+#ifdef WITH_AGGREGATE
+	// there's no trace buffer
+	if (aggregate) {
+		write_aggregate_dump(end_ts);
+
+		return;
+	}
+#endif
+
+	// make sure no entries are added by threads that are still
+	// running: with per-thread segments there's no shared index
+	// to close, so the buffer-pointers are cleared instead
+	lock_trace_item_t *const items_in = items;
+	items = nullptr;
+#ifdef WITH_USAGE_GROUPS
+	ug_items = nullptr;
+#endif
+
 	color("\033[0;31m");
 
-	unsigned long count = items_idx;
+#ifdef PER_THREAD_BUFFERS
+	if (stream_writer) {
+		stream_writer_stop = true;
+
+		while(!stream_writer_stopped)
+			usleep(1000);
+
+		// including the segments that were still being filled
+		flush_stream_segments(&items_buffer, true);
+#ifdef WITH_USAGE_GROUPS
+		flush_stream_segments(&ug_items_buffer, true);
+#endif
+	}
+#endif
+
+#ifdef PER_THREAD_BUFFERS
+	unsigned long count = stream_writer ? items_buffer.n_streamed : buffer_n_used(&items_buffer);
+#else
+	unsigned long count = buffer_n_used(&items_buffer);
+#endif
 	fprintf(stderr, "Lock tracer terminating with %lu records (path: %s, %zu bytes)\n", count, get_current_dir_name(), length);
 
-	if (msync(items, length, MS_SYNC) == -1)
+	if (!stream_writer && hugepages == hp_none && msync(items_in, length, MS_SYNC) == -1)
 		fprintf(stderr, "Problem pushing data to disk: %s\n", strerror(errno));
 
-	if (munmap(items, length) == -1)
+	// without abort() the process continues for a while (atexit
+	// handlers, destructors), so threads may still hold a pointer
+	// into the buffer
+	// (with huge pages it is written to disk further on)
+	if (!no_core && hugepages == hp_none && munmap(items_in, length) == -1)
 		fprintf(stderr, "munmap problem: %s\n", strerror(errno));
 
 	close(mmap_fd);
 
-	if (!items) {
+#ifdef INTERN_STACKS
+	if (msync(stacks, sizeof(void *) * CALLER_DEPTH * max_stacks, MS_SYNC) == -1)
+		fprintf(stderr, "Problem pushing stack table to disk: %s\n", strerror(errno));
+#endif
+
+#ifdef LOCK_REGISTRY
+	if (msync(lock_registry, sizeof(lock_registry_entry_t) * max_locks, MS_SYNC) == -1)
+		fprintf(stderr, "Problem pushing lock registry to disk: %s\n", strerror(errno));
+#endif
+
+	if (!items_in) {
 		fprintf(stderr, "No items recorded yet\n");
 		color("\033[0m");
 	}
@@ -933,118 +5842,97 @@ void exit(int status) throw ()
 
 		color("\033[0m");
 
-		FILE *fh = fopen(file_name, "w");
-		if (!fh) {
-			fprintf(stderr, "Failed creating %s: %s\n", file_name, strerror(errno));
-			fh = stderr;
-		}
-
-		free(file_name);
-
 		json_t *obj = json_object();
 
-		char hostname[HOST_NAME_MAX + 1];
-		gethostname(hostname, sizeof hostname);
-
-		emit_key_value(obj, "pthread_mutex_lock", (intptr_t)pthread_mutex_lock);
-		emit_key_value(obj, "pthread_rwlock_rdlock", (intptr_t)pthread_rwlock_rdlock);
-		emit_key_value(obj, "pthread_rwlock_wrlock", (intptr_t)pthread_rwlock_wrlock);
-
-		emit_key_value(obj, "hostname", hostname);
-
-		emit_key_value(obj, "start_ts", global_start_ts);
+		emit_process_meta_data(obj, end_ts);
 
-		emit_key_value(obj, "end_ts", end_ts);
-
-		emit_key_value(obj, "fork_warning", fork_warning);
+		emit_key_value(obj, "measurements", data_filename);
 
-		emit_key_value(obj, "n_procs", get_nprocs());
+#ifdef WITH_USAGE_GROUPS
+		emit_key_value(obj, "ug_measurements", ug_data_filename);
+#endif
 
-		pid_t pid = getpid();
-		emit_key_value(obj, "pid", pid);
+#ifdef PER_THREAD_BUFFERS
+		if (stream_writer) {
+			// the other threads add theirs when they get a segment again,
+			// terminate or dropped DROPPED_FLUSH_INTERVAL records
+			flush_dropped(&items_buffer, &context.items_cursor);
+#ifdef WITH_USAGE_GROUPS
+			flush_dropped(&ug_items_buffer, &context.ug_items_cursor);
+#endif
 
-		int s = sched_getscheduler(pid);
-		if (s == SCHED_OTHER)
-			emit_key_value(obj, "scheduler", "sched-other");
-		else if (s == SCHED_BATCH)
-			emit_key_value(obj, "scheduler", "sched-batch");
-		else if (s == SCHED_IDLE)
-			emit_key_value(obj, "scheduler", "sched-idle");
-		else if (s == SCHED_FIFO)
-			emit_key_value(obj, "scheduler", "sched-fifo");
-		else if (s == SCHED_RR)
-			emit_key_value(obj, "scheduler", "sched-rr");
+			// the measurement files are a sequence of chunks, each with
+			// a trace_chunk_header_t in front of it
+			emit_key_value(obj, "n_records", items_buffer.n_streamed);
+			emit_key_value(obj, "stream_dropped", items_buffer.n_dropped.load());
+#ifdef WITH_USAGE_GROUPS
+			emit_key_value(obj, "ug_n_records", ug_items_buffer.n_streamed);
+			emit_key_value(obj, "ug_stream_dropped", ug_items_buffer.n_dropped.load());
+#endif
+		}
 		else
-			emit_key_value(obj, "scheduler", "unknown");
-
-		emit_key_value(obj, "mutex_type_normal", PTHREAD_MUTEX_NORMAL);
-		emit_key_value(obj, "mutex_type_recursive", PTHREAD_MUTEX_RECURSIVE);
-		emit_key_value(obj, "mutex_type_errorcheck", PTHREAD_MUTEX_ERRORCHECK);
-		emit_key_value(obj, "mutex_type_adaptive", PTHREAD_MUTEX_ADAPTIVE_NP);
-
-		char exe_name[PATH_MAX] = { 0 };
-		if (readlink("/proc/self/exe", exe_name, sizeof(exe_name) - 1) == -1) {
-			color("\033[0;31m");
-			fprintf(stderr, "readlink(/proc/self/exe) failed: %s\n", strerror(errno));
-			color("\033[0m");
+#endif
+		if (hugepages != hp_none) {
+			// the records are only in memory
+			emit_key_value(obj, "n_records", snapshot_buffer(obj, "segments", &items_buffer, data_filename));
+#ifdef WITH_USAGE_GROUPS
+			emit_key_value(obj, "ug_n_records", snapshot_buffer(obj, "ug_segments", &ug_items_buffer, ug_data_filename));
+#endif
 		}
+		else
+		{
+			// Copy, in case a thread is still running and adding new records: the
+			// segment-list and the record count must match.
+			uint64_t n_rec_inserted = buffer_n_used(&items_buffer);
 
-		emit_key_value(obj, "exe_name", exe_name);
+			emit_key_value(obj, "n_records", n_rec_inserted);
 
-		emit_key_value(obj, "measurements", data_filename);
+#ifdef PER_THREAD_BUFFERS
+			emit_segments(obj, "segments", &items_buffer);
+#endif
 
 #ifdef WITH_USAGE_GROUPS
-		emit_key_value(obj, "ug_measurements", ug_data_filename);
+			emit_key_value(obj, "ug_n_records", buffer_n_used(&ug_items_buffer));
+#ifdef PER_THREAD_BUFFERS
+			emit_segments(obj, "ug_segments", &ug_items_buffer);
 #endif
+#endif
+		}
 
-		emit_key_value(obj, "cnt_mutex_trylock", cnt_mutex_trylock);
-		emit_key_value(obj, "cnt_rwlock_try_rdlock", cnt_rwlock_try_rdlock);
-		emit_key_value(obj, "cnt_rwlock_try_timedrdlock", cnt_rwlock_try_timedrdlock);
-		emit_key_value(obj, "cnt_rwlock_try_wrlock", cnt_rwlock_try_wrlock);
-		emit_key_value(obj, "cnt_rwlock_try_timedwrlock", cnt_rwlock_try_timedwrlock);
-
-		// Copy, in case a thread is still running and adding new records: a for-loop
-		// on 'items_idx' might run longer than intended and even emit garbage.
-		uint64_t n_rec_inserted = items_idx;
-
-		if (n_rec_inserted > n_records)
-			n_rec_inserted = n_records;
-
-		emit_key_value(obj, "n_records", n_rec_inserted);
-		emit_key_value(obj, "n_records_max", n_records);
-
-		emit_key_value(obj, "ug_n_records", std::min(uint64_t(ug_items_idx), n_records));
+		if (write_dump_file(obj, file_name))
+			sync();
+		else
+			fprintf(stderr, "%s\n", json_dumps(obj, JSON_COMPACT));
 
-		fprintf(fh, "%s\n", json_dumps(obj, JSON_COMPACT));
 		json_decref(obj);
 
-		if (fh != stderr) {
-			fclose(fh);
-
-			sync();
-		}
+		free(file_name);
 	}
+}
 
-	// make sure no entries are added by threads that are
-	// still running; next statement unallocates the mmap()ed
-	// memory
-	items_idx = n_records;
-
-	delete tid_names;
+void exit(int status) throw ()
+{
+	if (!exited)
+		stop_tracing();
 
-	// dump core
-	color("\033[0;31m");
-	fprintf(stderr, "Dumping core...\n");
-	color("\033[0m");
+	if (no_core) {
+		if (unlikely(!org_exit_h))
+			org_exit_h = (org_exit)dlsym(RTLD_NEXT, "exit");
 
-	fflush(nullptr);
+		(*org_exit_h)(status);
+	}
 
-	signal(SIGABRT, SIG_DFL);
-	abort();
+	dump_core();
 }
 
 void __attribute__ ((destructor)) stop_lock_tracing()
 {
-	if (!exited)
+	if (exited)
+		return;
+
+	// returned from main(): the process is already exiting
+	if (no_core)
+		stop_tracing();
+	else
 		exit(0);
 }
@@ -1,10 +1,49 @@
+#include <atomic>
+#include <stddef.h>
 #include <stdint.h>
 
-typedef enum { a_lock, a_unlock, a_thread_clean, a_r_lock, a_w_lock, a_rw_unlock, a_init, a_destroy, a_rw_init, a_rw_destroy, _a_max } lock_action_t;
+#if defined(INTERN_STACKS) && !defined(WITH_BACKTRACE)
+#undef INTERN_STACKS
+#endif
+
+#if defined(NON_TEMPORAL_STORES) && !defined(__x86_64__)
+#warning NON_TEMPORAL_STORES is only supported on x86-64
+#undef NON_TEMPORAL_STORES
+#endif
+
+// NON_TEMPORAL_STORES writes whole cache lines
+#ifdef NON_TEMPORAL_STORES
+#define TRACE_RECORD_ALIGN __attribute__((aligned(64)))
+#else
+#define TRACE_RECORD_ALIGN
+#endif
+
+// stack table was full
+#define STACK_ID_UNKNOWN 0xffffffff
+
+// lock registry was full
+#define LOCK_ID_UNKNOWN 0xffffffff
+
+// a_cond_wait: the implicit unlock of the mutex by pthread_cond_*wait()
+// a_cond_woken: the mutex is locked again when the wait returns
+// for these two 'lock' is the mutex, the condition variable is in
+// cond_innards; for a_cond_signal and a_cond_broadcast it is 'lock'
+// a_sem_wait & a_barrier_wait: lock_took is how long it waited
+// a_timed_*: the timed and clock variants of a_lock, a_r_lock and
+// a_w_lock, with the timeout in timed_innards
+typedef enum { a_lock, a_unlock, a_thread_clean, a_r_lock, a_w_lock, a_rw_unlock, a_init, a_destroy, a_rw_init, a_rw_destroy, a_cond_wait, a_cond_woken, a_cond_signal, a_cond_broadcast,
+	a_spin_lock, a_spin_unlock, a_sem_wait, a_sem_post, a_barrier_wait, a_timed_lock, a_timed_r_lock, a_timed_w_lock, _a_max } lock_action_t;
 
 typedef struct {
-#ifdef WITH_BACKTRACE
+#ifdef INTERN_STACKS
+	// index in the stack table (stacks-PID.dat): CALLER_DEPTH pointers each
+	uint32_t stack_id;
+#elif defined(WITH_BACKTRACE)
 	void *caller[CALLER_DEPTH];
+#endif
+#ifdef LOCK_REGISTRY
+	// index in the lock registry (locks-PID.dat)
+	uint32_t lock_id;
 #endif
 	void *lock;
 	int tid;
@@ -28,11 +67,90 @@ typedef struct {
 			unsigned int __writers;
 			int __cur_writer;  // only on __x86_64__
 		} rwlock_innards;
+
+		struct {
+			// in two halves so that the union doesn't get larger
+			uint32_t cond_lo, cond_hi;
+			// a_cond_woken: what the wait returned (e.g. ETIMEDOUT)
+			int wait_rc;
+		} cond_innards;
+
+		struct {
+			// nanoseconds from the call until the deadline, negative
+			// when it had already passed; split like cond_innards
+			uint32_t timeout_lo, timeout_hi;
+			int clock;
+		} timed_innards;
 	};
 
-	// return code of the pthread function called
+	// return code of the pthread function called; for a_cond_woken 0
+	// when the mutex was locked again (also after a timeout), for
+	// a_timed_* ETIMEDOUT when the deadline expired
 	int rc;
-} lock_trace_item_t;
+} TRACE_RECORD_ALIGN lock_trace_item_t;
+
+// Where the fields of a record are. This is written to dump.dat
+// ("layout") so that the analyzer can read the records of all build
+// variants of the tracer (see the end of config.h.in).
+typedef struct {
+	const char *name;
+	size_t offset, size;
+} trace_field_t;
+
+#define TRACE_FIELD(type, name) { #name, offsetof(type, name), sizeof(((type *)nullptr)->name) }
+
+static const trace_field_t trace_item_fields[] = {
+#ifdef INTERN_STACKS
+	TRACE_FIELD(lock_trace_item_t, stack_id),
+#elif defined(WITH_BACKTRACE)
+	TRACE_FIELD(lock_trace_item_t, caller),
+#endif
+#ifdef LOCK_REGISTRY
+	TRACE_FIELD(lock_trace_item_t, lock_id),
+#endif
+	TRACE_FIELD(lock_trace_item_t, lock),
+	TRACE_FIELD(lock_trace_item_t, tid),
+	TRACE_FIELD(lock_trace_item_t, la),
+#ifdef MEASURE_TIMING
+	TRACE_FIELD(lock_trace_item_t, timestamp),
+	TRACE_FIELD(lock_trace_item_t, lock_took),
+#endif
+#ifdef STORE_THREAD_NAME
+	TRACE_FIELD(lock_trace_item_t, thread_name),
+#endif
+	// the union
+	TRACE_FIELD(lock_trace_item_t, mutex_innards),
+	TRACE_FIELD(lock_trace_item_t, rc),
+};
+
+typedef enum { lk_mutex = 0, lk_rwlock, lk_cond, lk_spin, lk_sem, lk_barrier } lock_kind_t;
+
+#ifdef LOCK_REGISTRY
+
+// Each lock that the tracer sees gets an entry in the lock registry. A
+// lock that is initialized at the address of an earlier one (e.g. after
+// free() & malloc()) gets a new entry with a higher generation.
+typedef struct {
+	void *lock;
+	// number of locks that were at this address before this one
+	uint32_t generation;
+	// lock_kind_t
+	uint8_t kind;
+	// 0: first seen in e.g. a lock (PTHREAD_MUTEX_INITIALIZER)
+	uint8_t initialized;
+	uint8_t destroyed;
+	uint8_t pad;
+	// mutex type (__kind, e.g. PTHREAD_MUTEX_RECURSIVE_NP), 0 for r/w-locks
+	int type;
+	// the "created" location is the init or the first use
+#ifdef INTERN_STACKS
+	uint32_t created_stack_id;
+#elif defined(WITH_BACKTRACE)
+	void *created_caller[CALLER_DEPTH];
+#endif
+	uint64_t created_ts;
+} lock_registry_entry_t;
+#endif
 
 #ifdef WITH_USAGE_GROUPS
 typedef struct {
@@ -47,5 +165,85 @@ typedef struct {
 	// the one in linux is said to be max. 16 characters including 0x00 (pthread_setname_np)
 	char thread_name[16];
 #endif
-} lock_usage_groups_t;
+} TRACE_RECORD_ALIGN lock_usage_groups_t;
+
+static const trace_field_t ug_item_fields[] = {
+	TRACE_FIELD(lock_usage_groups_t, caller),
+	TRACE_FIELD(lock_usage_groups_t, lock),
+	TRACE_FIELD(lock_usage_groups_t, tid),
+	TRACE_FIELD(lock_usage_groups_t, la),
+#ifdef MEASURE_TIMING
+	TRACE_FIELD(lock_usage_groups_t, timestamp),
+#endif
+#ifdef STORE_THREAD_NAME
+	TRACE_FIELD(lock_usage_groups_t, thread_name),
+#endif
+};
 #endif
+
+// Live statistics (TRACE_LIVE): per lock counters in a shared memory
+// segment (/lock_tracer-PID) that lock_top shows while the program
+// runs. The table (n_entries, a power of 2) follows the header.
+#define LIVE_STATS_MAGIC 0x5453564c4b434f4cull  // "LOCKLVST"
+
+typedef struct {
+	uint64_t magic;
+	uint32_t n_entries;
+	uint32_t entry_size;
+	int pid;
+	int pad;
+	// ns since the epoch
+	uint64_t start_ts;
+	// wait and hold durations are in ticks of this size
+	double ns_per_tick;
+	// acquisitions that took longer than this are contended
+	uint64_t contended_ticks;
+	// events of locks that did not fit in the table
+	std::atomic<uint64_t> n_full;
+	uint64_t reserved;
+} live_stats_header_t;
+
+typedef struct {
+	// 0 = not in use
+	std::atomic<uintptr_t> lock;
+	// n_acquired includes try- and timed locks that failed because the
+	// lock was busy, these are also counted as contended; not the relock
+	// of the mutex after a condition variable wait
+	std::atomic<uint64_t> n_acquired, n_contended, n_errors;
+	std::atomic<uint64_t> wait_total, wait_max, hold_total, hold_max;
+	// releases that hold_total covers
+	std::atomic<uint64_t> n_held;
+} live_stats_entry_t;
+
+// In streaming mode (TRACE_STREAM) the measurement files consist of
+// chunks: this header followed by n_records records.
+#define TRACE_CHUNK_MAGIC 0x4b4e4843434f4c54ull  // "TLOCCHNK"
+
+typedef struct {
+	uint64_t magic;
+	// order in which the segment was claimed
+	uint64_t seq;
+	uint64_t record_size;
+	uint64_t n_records;
+	int tid;
+	// with TRACE_NUMA: node of the writing thread and of the segment memory
+	int16_t node, memory_node;
+} trace_chunk_header_t;
+
+// Compact format (TRACE_COMPACT): the segments of the measurements file
+// are byte streams instead of arrays of lock_trace_item_t. Per event:
+//   1 byte: lock_action_t (its bit 4 as COMPACT_LA_HIGH) | COMPACT_* flags
+//   varints: timestamp delta (zigzag) and lock_took (MEASURE_TIMING)
+//   varint: lock delta (zigzag)
+//   varint: stack_id (INTERN_STACKS) or per caller its delta (zigzag)
+//   varint: lock_id delta (zigzag, LOCK_REGISTRY)
+//   COMPACT_NAME: 1 byte length + the thread name
+//   COMPACT_INNARDS: 3 varints (zigzag) with the mutex/rwlock innards
+//   COMPACT_RC: varint (zigzag) with the return code
+// Deltas are against the previous event in the same segment (0 for the
+// first one). The tid is in the segment list / chunk header.
+#define COMPACT_LA_MASK 0x0f
+#define COMPACT_RC      0x10
+#define COMPACT_NAME    0x20
+#define COMPACT_INNARDS 0x40
+#define COMPACT_LA_HIGH 0x80